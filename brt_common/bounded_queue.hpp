@@ -0,0 +1,177 @@
+/*
+ * bounded_queue.hpp
+ *
+ *  Created on: Mar 16, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_BOUNDED_QUEUE_HPP_
+#define BRT_COMMON_BOUNDED_QUEUE_HPP_
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+namespace brt
+{
+namespace jupiter
+{
+
+/*
+ * \\class BoundedQueue
+ *
+ * created on: Mar 16, 2020
+ *
+ * Blocking multi producer / multi consumer queue with a fixed capacity.
+ * push() waits while the queue is full, pop() waits while it is empty,
+ * try_push() refuses and push_evict() makes room instead of waiting.
+ * After close() pushes are refused and pop() drains what is left,
+ * then returns false.
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+  BoundedQueue(size_t capacity)
+  : _items()
+  , _capacity((capacity > 0) ? capacity : 1)
+  , _closed(false)
+  {
+  }
+
+  virtual ~BoundedQueue() {}
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  /*
+   * \\fn bool push
+   *
+   * created on: Mar 16, 2020
+   * author: daniel
+   *
+   */
+  bool                            push(T item)
+  {
+    std::unique_lock<std::mutex> l(_mutex);
+    _not_full.wait(l, [this]() { return _closed || (_items.size() < _capacity); });
+    if (_closed)
+      return false;
+
+    _items.push_back(std::move(item));
+    l.unlock();
+
+    _not_empty.notify_one();
+    return true;
+  }
+
+  /*
+   * \\fn bool try_push
+   *
+   * created on: Mar 16, 2020
+   * author: daniel
+   *
+   */
+  bool                            try_push(T item)
+  {
+    std::unique_lock<std::mutex> l(_mutex);
+    if (_closed || (_items.size() >= _capacity))
+      return false;
+
+    _items.push_back(std::move(item));
+    l.unlock();
+
+    _not_empty.notify_one();
+    return true;
+  }
+
+  /*
+   * \\fn bool push_evict
+   *
+   * created on: Apr 15, 2020
+   * author: daniel
+   *
+   * Never waits, a full queue gives up its oldest items to make room.
+   * evicted is the number of items given up.
+   */
+  bool                            push_evict(T item, size_t& evicted)
+  {
+    std::deque<T> old_items;
+
+    std::unique_lock<std::mutex> l(_mutex);
+    evicted = 0;
+    if (_closed)
+      return false;
+
+    while (_items.size() >= _capacity)
+    {
+      old_items.push_back(std::move(_items.front()));
+      _items.pop_front();
+      evicted++;
+    }
+
+    _items.push_back(std::move(item));
+    l.unlock();
+
+    // The evicted items are released here, outside of the lock
+    _not_empty.notify_one();
+    return true;
+  }
+
+  /*
+   * \\fn bool pop
+   *
+   * created on: Mar 16, 2020
+   * author: daniel
+   *
+   */
+  bool                            pop(T& item)
+  {
+    std::unique_lock<std::mutex> l(_mutex);
+    _not_empty.wait(l, [this]() { return _closed || !_items.empty(); });
+    if (_items.empty())
+      return false;
+
+    item = std::move(_items.front());
+    _items.pop_front();
+    l.unlock();
+
+    _not_full.notify_one();
+    return true;
+  }
+
+  /*
+   * \\fn void close
+   *
+   * created on: Mar 16, 2020
+   * author: daniel
+   *
+   */
+  void                            close()
+  {
+    std::unique_lock<std::mutex> l(_mutex);
+    _closed = true;
+    l.unlock();
+
+    _not_full.notify_all();
+    _not_empty.notify_all();
+  }
+
+  size_t                          size() const { std::lock_guard<std::mutex> l(_mutex); return _items.size(); }
+  size_t                          capacity() const { return _capacity; }
+  bool                            closed() const { std::lock_guard<std::mutex> l(_mutex); return _closed; }
+
+private:
+  std::deque<T>                   _items;
+  size_t                          _capacity;
+  bool                            _closed;
+
+  mutable std::mutex              _mutex;
+  std::condition_variable         _not_full;
+  std::condition_variable         _not_empty;
+};
+
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_BOUNDED_QUEUE_HPP_ */
@@ -0,0 +1,285 @@
+/*
+ * dir_enumerator.cpp
+ *
+ *  Created on: Apr 10, 2020
+ *      Author: daniel
+ */
+
+#include "dir_enumerator.hpp"
+#include "thread_pool.hpp"
+
+#include <stdint.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <iostream>
+
+namespace brt
+{
+namespace jupiter
+{
+
+/*
+ * \\struct linux_dirent64
+ *
+ * created on: Apr 10, 2020
+ *
+ * Record layout of getdents64, glibc has no declaration for it
+ */
+struct linux_dirent64
+{
+  uint64_t                        d_ino;
+  int64_t                         d_off;
+  unsigned short                  d_reclen;
+  unsigned char                   d_type;
+  char                            d_name[];
+};
+
+/*
+ * \\fn bool DirEnumerator::enumerate
+ *
+ * created on: Apr 10, 2020
+ * author: daniel
+ *
+ * Returns false if the directory can't be read
+ */
+bool DirEnumerator::enumerate(const std::string& pattern, Callback callback)
+{
+  std::string path = pattern;
+  if ((path.compare(0, 2, "~/") == 0) && (getenv("HOME") != nullptr))
+    path = std::string(getenv("HOME")) + path.substr(1);
+
+  size_t slash = path.find_last_of('/');
+  std::string dir = (slash == std::string::npos) ? std::string() : path.substr(0, slash + 1);
+  std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+
+  if (has_wildcards(dir))
+    return glob_fallback(path, callback);
+
+  // Nothing to match, like glob() the path comes back only if it is there
+  if (!has_wildcards(name))
+  {
+    struct stat st;
+    if (::lstat(path.c_str(), &st) != 0)
+      return false;
+
+    callback(path);
+    return true;
+  }
+
+  int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  std::vector<char> buffer(DIR_ENUM_BUFFER_SIZE);
+  bool proceed = true;
+  long length = 0;
+
+  while (proceed && ((length = ::syscall(SYS_getdents64, fd, buffer.data(), buffer.size())) > 0))
+  {
+    for (long offset = 0; proceed && (offset < length); )
+    {
+      const linux_dirent64* entry = reinterpret_cast<const linux_dirent64*>(buffer.data() + offset);
+      offset += entry->d_reclen;
+
+      if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0))
+        continue;
+
+      if (::fnmatch(name.c_str(), entry->d_name, FNM_PERIOD) == 0)
+        proceed = callback(dir + entry->d_name);
+    }
+  }
+
+  ::close(fd);
+  return (length >= 0) || !proceed;
+}
+
+/*
+ * \\fn std::vector<std::string> DirEnumerator::list
+ *
+ * created on: Apr 10, 2020
+ * author: daniel
+ *
+ */
+std::vector<std::string> DirEnumerator::list(const std::string& pattern, SortOrder order /*= eSortNatural*/,
+                                             size_t jobs /*= 0*/)
+{
+  std::vector<std::string> result;
+  enumerate(pattern, [&result](const std::string& path) { result.push_back(path); return true; });
+
+  sort(result, order, jobs);
+  return result;
+}
+
+/*
+ * \\fn SortOrder DirEnumerator::sort_order
+ *
+ * created on: Apr 10, 2020
+ * author: daniel
+ *
+ */
+SortOrder DirEnumerator::sort_order(const std::string& name)
+{
+  if (name == "none")
+    return eSortNone;
+
+  if (name == "name")
+    return eSortName;
+
+  return eSortNatural;
+}
+
+/*
+ * \\fn bool DirEnumerator::natural_less
+ *
+ * created on: Apr 10, 2020
+ * author: daniel
+ *
+ * Digit runs compare by value, leading zeros aside. Names that only
+ * differ in zero padding fall back to the byte wise order, so the
+ * order stays strict.
+ */
+bool DirEnumerator::natural_less(const std::string& a, const std::string& b)
+{
+  size_t i = 0, j = 0;
+  while ((i < a.size()) && (j < b.size()))
+  {
+    if (isdigit(static_cast<unsigned char>(a[i])) && isdigit(static_cast<unsigned char>(b[j])))
+    {
+      size_t za = i, zb = j;
+      while ((za < a.size()) && (a[za] == '0'))
+        za++;
+      while ((zb < b.size()) && (b[zb] == '0'))
+        zb++;
+
+      size_t ea = za, eb = zb;
+      while ((ea < a.size()) && isdigit(static_cast<unsigned char>(a[ea])))
+        ea++;
+      while ((eb < b.size()) && isdigit(static_cast<unsigned char>(b[eb])))
+        eb++;
+
+      // More significant digits is the larger number
+      if (ea - za != eb - zb)
+        return (ea - za) < (eb - zb);
+
+      int diff = a.compare(za, ea - za, b, zb, eb - zb);
+      if (diff != 0)
+        return diff < 0;
+
+      i = ea;
+      j = eb;
+      continue;
+    }
+
+    if (a[i] != b[j])
+      return static_cast<unsigned char>(a[i]) < static_cast<unsigned char>(b[j]);
+
+    i++;
+    j++;
+  }
+
+  if ((a.size() - i) != (b.size() - j))
+    return (a.size() - i) < (b.size() - j);
+
+  return a < b;
+}
+
+/*
+ * \\fn void DirEnumerator::sort
+ *
+ * created on: Apr 10, 2020
+ * author: daniel
+ *
+ * Slices are sorted on the shared pool, then merged pairwise, every
+ * round of merges in parallel as well
+ */
+void DirEnumerator::sort(std::vector<std::string>& names, SortOrder order, size_t jobs /*= 0*/)
+{
+  if ((order == eSortNone) || (names.size() < 2))
+    return;
+
+  std::function<bool(const std::string&, const std::string&)> less;
+  if (order == eSortNatural)
+    less = natural_less;
+  else
+    less = std::less<std::string>();
+
+  ThreadPool& pool = ThreadPool::shared();
+  if (jobs == 0)
+    jobs = pool.size() + 1;
+
+  // Small lists aren't worth the hand off
+  size_t slices = std::min(jobs, names.size() / 4096 + 1);
+  if (slices < 2)
+  {
+    std::sort(names.begin(), names.end(), less);
+    return;
+  }
+
+  size_t slice = (names.size() + slices - 1) / slices;
+  auto bound = [&names](size_t index) { return names.begin() + std::min(index, names.size()); };
+
+  pool.parallel_for(slices, jobs, [&](size_t index)
+  {
+    std::sort(bound(index * slice), bound((index + 1) * slice), less);
+  });
+
+  for (size_t width = slice; width < names.size(); width *= 2)
+  {
+    size_t pairs = (names.size() + 2 * width - 1) / (2 * width);
+    pool.parallel_for(pairs, jobs, [&](size_t index)
+    {
+      size_t first = index * 2 * width;
+      std::inplace_merge(bound(first), bound(first + width), bound(first + 2 * width), less);
+    });
+  }
+}
+
+/*
+ * \\fn bool DirEnumerator::has_wildcards
+ *
+ * created on: Apr 10, 2020
+ * author: daniel
+ *
+ */
+bool DirEnumerator::has_wildcards(const std::string& pattern)
+{
+  return pattern.find_first_of("*?[") != std::string::npos;
+}
+
+/*
+ * \\fn bool DirEnumerator::glob_fallback
+ *
+ * created on: Apr 10, 2020
+ * author: daniel
+ *
+ */
+bool DirEnumerator::glob_fallback(const std::string& pattern, Callback callback)
+{
+  glob_t glob_result;
+  memset(&glob_result, 0, sizeof(glob_result));
+
+  int result = ::glob(pattern.c_str(), GLOB_TILDE | GLOB_NOSORT, NULL, &glob_result);
+  if (result == 0)
+  {
+    for (size_t index = 0; index < glob_result.gl_pathc; index++)
+    {
+      if (!callback(glob_result.gl_pathv[index]))
+        break;
+    }
+  }
+
+  globfree(&glob_result);
+  return (result == 0) || (result == GLOB_NOMATCH);
+}
+
+} /* namespace jupiter */
+} /* namespace brt */
@@ -0,0 +1,72 @@
+/*
+ * dir_enumerator.hpp
+ *
+ *  Created on: Apr 10, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_DIR_ENUMERATOR_HPP_
+#define BRT_COMMON_DIR_ENUMERATOR_HPP_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#define DIR_ENUM_BUFFER_SIZE                (1024 * 1024)
+
+namespace brt
+{
+namespace jupiter
+{
+
+/*
+ * \\enum SortOrder
+ *
+ * created on: Apr 10, 2020
+ *
+ */
+enum SortOrder
+{
+  eSortNone = 0,      // directory order, as the file system returns it
+  eSortName,          // byte wise, same as glob()
+  eSortNatural,       // digit runs compare as numbers, "img_2" before "img_10"
+
+  eNumSortOrders
+};
+
+/*
+ * \\class DirEnumerator
+ *
+ * created on: Apr 10, 2020
+ *
+ * Pattern matching over a directory read straight with getdents64 in
+ * large chunks. Nothing is stat'ed, and enumerate() hands every match
+ * out as soon as its chunk is read. Only the last path component may
+ * hold wildcards, patterns with wildcards further up go through glob().
+ * Like glob(), names starting with a dot only match an explicit dot.
+ */
+class DirEnumerator
+{
+public:
+  // Return false to stop the enumeration
+  typedef std::function<bool(const std::string&)> Callback;
+
+  static  bool                    enumerate(const std::string& pattern, Callback callback);
+  static  std::vector<std::string>
+                                  list(const std::string& pattern, SortOrder order = eSortNatural, size_t jobs = 0);
+
+  static  SortOrder               sort_order(const std::string& name);
+  static  bool                    natural_less(const std::string& a, const std::string& b);
+  static  void                    sort(std::vector<std::string>& names, SortOrder order, size_t jobs = 0);
+
+private:
+  static  bool                    has_wildcards(const std::string& pattern);
+  static  bool                    glob_fallback(const std::string& pattern, Callback callback);
+};
+
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_DIR_ENUMERATOR_HPP_ */
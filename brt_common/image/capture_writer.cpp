@@ -0,0 +1,230 @@
+/*
+ * capture_writer.cpp
+ *
+ *  Created on: Mar 27, 2020
+ *      Author: daniel
+ */
+
+#include "capture_writer.hpp"
+#include "raw_file.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <iostream>
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\fn Constructor CaptureWriter::CaptureWriter
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ */
+CaptureWriter::CaptureWriter(size_t queue_depth /*= CAPTURE_QUEUE_DEPTH*/)
+: _queue(std::max<size_t>(queue_depth, 1))
+, _pool()
+, _written(0)
+, _dropped(0)
+, _failed(0)
+, _bytes(0)
+, _thread(1, "capture")
+{
+  _thread.post([this]() { loop(); });
+}
+
+/*
+ * \\fn Destructor CaptureWriter::~CaptureWriter
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ * Captures already queued are written before the thread exits
+ */
+CaptureWriter::~CaptureWriter()
+{
+  _queue.close();
+  _thread.stop();
+}
+
+/*
+ * \\fn bool CaptureWriter::submit
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ * Never blocks. The frame is shared, not copied: RawRGB detaches on
+ * write, so the producer can't change what ends up on disk.
+ */
+bool CaptureWriter::submit(const std::string& filename, RawRGBPtr img)
+{
+  if (!img || img->empty())
+    return false;
+
+  Capture capture;
+  capture._filename = filename;
+  capture._image = img->share();
+
+  if (!_queue.try_push(capture))
+  {
+    size_t dropped = ++_dropped;
+    std::cerr << "capture: queue full, dropped " << filename << " (" << dropped << " dropped)" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * \\fn CaptureStats CaptureWriter::stats
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ */
+CaptureStats CaptureWriter::stats() const
+{
+  CaptureStats result;
+  result._queued = _queue.size();
+  result._written = _written.load();
+  result._dropped = _dropped.load();
+  result._failed = _failed.load();
+  result._bytes = _bytes.load();
+  return result;
+}
+
+/*
+ * \\fn void CaptureWriter::loop
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ */
+void CaptureWriter::loop()
+{
+  Capture capture;
+  while (_queue.pop(capture))
+  {
+    int error = 0;
+    if (!write_capture(capture, error))
+    {
+      _failed++;
+      std::cerr << "capture: unable to write " << capture._filename << ": " << strerror(error) << std::endl;
+    }
+    else
+    {
+      CaptureStats current = stats();
+      std::cout << "capture: " << capture._filename << ", " << current._written << " written ("
+                << current._bytes / (1024 * 1024) << " MB), " << current._queued << " queued, "
+                << current._dropped << " dropped" << std::endl;
+    }
+
+    // Let go of the frame before waiting for the next one
+    capture._image.reset();
+  }
+}
+
+/*
+ * \\fn bool CaptureWriter::write_capture
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ * The header and samples are staged together in an aligned buffer, so
+ * the whole file goes out in a few chunk sized writes. The tail padding
+ * of the last chunk is cut off again with ftruncate. The version 2
+ * header is page sized, so the samples stay aligned in the file too.
+ *
+ * errno is taken right where a call fails, recycling the buffer and
+ * closing the file may overwrite it.
+ */
+bool CaptureWriter::write_capture(const Capture& capture, int& error)
+{
+  const RawRGB& img = *capture._image;
+  std::vector<uint8_t> header;
+  if (RawFile::make_header(img, Metadata(), header) == 0)
+  {
+    error = EINVAL;
+    return false;
+  }
+
+  size_t file_size = header.size() + img.size();
+  size_t aligned_size = (file_size + CAPTURE_ALIGNMENT - 1) & ~static_cast<size_t>(CAPTURE_ALIGNMENT - 1);
+
+  PageAllocator::Block block = _pool.acquire(aligned_size + CAPTURE_ALIGNMENT);
+  if (block._ptr == nullptr)
+  {
+    error = ENOMEM;
+    return false;
+  }
+
+  uintptr_t address = reinterpret_cast<uintptr_t>(block._ptr);
+  uint8_t* buffer = reinterpret_cast<uint8_t*>((address + CAPTURE_ALIGNMENT - 1) & ~static_cast<uintptr_t>(CAPTURE_ALIGNMENT - 1));
+
+  memcpy(buffer, header.data(), header.size());
+  memcpy(buffer + header.size(), img.cbytes(), img.size());
+  memset(buffer + file_size, 0, aligned_size - file_size);
+
+  // tmpfs and friends refuse O_DIRECT, buffered writes of the same chunks still work there
+  int fd = ::open(capture._filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+  if ((fd < 0) && (errno == EINVAL))
+    fd = ::open(capture._filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+  bool result = (fd >= 0);
+  if (!result)
+    error = errno;
+  else
+  {
+    // Pre-allocation is only a hint, not every file system has it
+    ::fallocate(fd, 0, 0, static_cast<off_t>(aligned_size));
+
+    size_t offset = 0;
+    while (result && (offset < aligned_size))
+    {
+      size_t chunk = std::min<size_t>(CAPTURE_CHUNK_SIZE, aligned_size - offset);
+      ssize_t written = ::pwrite(fd, buffer + offset, chunk, static_cast<off_t>(offset));
+      if (written < 0)
+      {
+        if (errno != EINTR)
+        {
+          error = errno;
+          result = false;
+        }
+      }
+      else
+        offset += static_cast<size_t>(written);
+    }
+
+    if (result && (::ftruncate(fd, static_cast<off_t>(file_size)) != 0))
+    {
+      error = errno;
+      result = false;
+    }
+
+    if ((::close(fd) != 0) && result)
+    {
+      error = errno;
+      result = false;
+    }
+  }
+
+  _pool.recycle(block);
+  if (!result)
+    return false;
+
+  _written++;
+  _bytes += file_size;
+  return true;
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
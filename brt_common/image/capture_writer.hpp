@@ -0,0 +1,98 @@
+/*
+ * capture_writer.hpp
+ *
+ *  Created on: Mar 27, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_CAPTURE_WRITER_HPP_
+#define BRT_COMMON_IMAGE_CAPTURE_WRITER_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <atomic>
+
+#include "image.hpp"
+#include "bounded_queue.hpp"
+#include "thread_pool.hpp"
+
+#define CAPTURE_QUEUE_DEPTH                 (8)
+#define CAPTURE_ALIGNMENT                   (4096)
+#define CAPTURE_CHUNK_SIZE                  (8 * 1024 * 1024)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\struct CaptureStats
+ *
+ * created on: Mar 27, 2020
+ *
+ */
+struct CaptureStats
+{
+  size_t                          _queued;      // waiting for the writer right now
+  size_t                          _written;
+  size_t                          _dropped;     // queue was full
+  size_t                          _failed;
+  uint64_t                        _bytes;
+};
+
+/*
+ * \\class CaptureWriter
+ *
+ * created on: Mar 27, 2020
+ *
+ * Writes frames as .raw files (RawFile layout) on its own thread.
+ * submit() only queues a shared handle to the frame, so the caller
+ * never waits for the disk; when the queue is full the capture is
+ * dropped and counted. The writer stages every file in a pooled, page
+ * aligned buffer, pre-allocates it with fallocate and writes it in
+ * large O_DIRECT chunks where the file system allows.
+ */
+class CaptureWriter
+{
+public:
+  CaptureWriter(size_t queue_depth = CAPTURE_QUEUE_DEPTH);
+  virtual ~CaptureWriter();
+
+  CaptureWriter(const CaptureWriter&) = delete;
+  CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+          bool                    submit(const std::string& filename, RawRGBPtr img);
+          CaptureStats            stats() const;
+
+private:
+  struct Capture
+  {
+    std::string                   _filename;
+    RawRGBPtr                     _image;
+  };
+
+          void                    loop();
+          // error is the errno of the call that failed
+          bool                    write_capture(const Capture& capture, int& error);
+
+private:
+  BoundedQueue<Capture>           _queue;
+  BlockPool                       _pool;
+
+  std::atomic_size_t              _written;
+  std::atomic_size_t              _dropped;
+  std::atomic_size_t              _failed;
+  std::atomic<uint64_t>           _bytes;
+
+  ThreadPool                      _thread;
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_CAPTURE_WRITER_HPP_ */
@@ -0,0 +1,325 @@
+/*
+ * flight_recorder.cpp
+ *
+ *  Created on: Mar 30, 2020
+ *      Author: daniel
+ */
+
+#include "flight_recorder.hpp"
+#include "raw_codec.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include <utils.hpp>
+
+#define RECORDER_SPARE_BUFFERS              (4)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\fn Constructor FlightRecorder::FlightRecorder
+ *
+ * created on: Mar 30, 2020
+ * author: daniel
+ *
+ */
+FlightRecorder::FlightRecorder(const Metadata& meta /*= Metadata()*/)
+: _window_us(static_cast<uint64_t>(meta.get<double>("seconds",DEFAULT_RECORDER_SECONDS) * 1e6))
+, _memory_limit(static_cast<uint64_t>(meta.get<int>("memory_mb",DEFAULT_RECORDER_MEMORY_MB)) * 1024 * 1024)
+, _compress(meta.get<bool>("compress",false))
+, _compress_threads(std::max(meta.get<int>("compress_threads",1), 1))
+, _out_dir(meta.get<std::string>("out_dir",""))
+, _prefix(meta.get<std::string>("prefix","flight_"))
+, _frames()
+, _pending()
+, _spare()
+, _bytes(0)
+, _triggers(0)
+, _terminate(false)
+, _flushing(0)
+, _compressor(1, "rec_compress")
+, _flusher(1, "rec_flush")
+{
+  if (!_out_dir.empty() && (_out_dir.back() != '/'))
+    _out_dir += '/';
+
+  if (_compress)
+    _compressor.post([this]() { compress_loop(); });
+}
+
+/*
+ * \\fn Destructor FlightRecorder::~FlightRecorder
+ *
+ * created on: Mar 30, 2020
+ * author: daniel
+ *
+ * Triggers already issued are still written out
+ */
+FlightRecorder::~FlightRecorder()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  _terminate = true;
+  l.unlock();
+
+  _cv.notify_all();
+  _compressor.stop();
+  _flusher.stop();
+}
+
+/*
+ * \\fn void FlightRecorder::consume
+ *
+ * created on: Mar 30, 2020
+ * author: daniel
+ *
+ */
+void FlightRecorder::consume(ImageBox box)
+{
+  for (ImagePtr img : box)
+  {
+    if (img)
+      record(img);
+  }
+}
+
+/*
+ * \\fn std::string FlightRecorder::trigger
+ *
+ * created on: Mar 30, 2020
+ * author: daniel
+ *
+ * Returns the name of the sequence file the window goes to. Only the
+ * frame handles are copied here, so this is cheap enough to call from
+ * a capture or UI thread.
+ */
+std::string FlightRecorder::trigger(const std::string& filename /*= ""*/)
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  std::vector<RecordedFramePtr> snapshot(_frames.begin(), _frames.end());
+
+  std::string name = filename;
+  if (name.empty())
+    name = _out_dir + _prefix + Utils::string_format("%04zu.seq", _triggers);
+
+  _triggers++;
+  l.unlock();
+
+  _flushing++;
+  _flusher.post([this, name, snapshot]() { flush(name, snapshot); });
+  return name;
+}
+
+/*
+ * \\fn void FlightRecorder::clear
+ *
+ * created on: Mar 30, 2020
+ * author: daniel
+ *
+ */
+void FlightRecorder::clear()
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  _frames.clear();
+  _pending.clear();
+  _bytes = 0;
+}
+
+/*
+ * \\fn size_t FlightRecorder::size
+ *
+ * created on: Mar 30, 2020
+ * author: daniel
+ *
+ */
+size_t FlightRecorder::size() const
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  return _frames.size();
+}
+
+/*
+ * \\fn uint64_t FlightRecorder::bytes
+ *
+ * created on: Mar 30, 2020
+ * author: daniel
+ *
+ */
+uint64_t FlightRecorder::bytes() const
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  return _bytes;
+}
+
+/*
+ * \\fn void FlightRecorder::record
+ *
+ * created on: Mar 30, 2020
+ * author: daniel
+ *
+ * Producers may stamp frames with "timestamp" (microseconds), otherwise
+ * the arrival time is used. That stamp only goes to the sequence file,
+ * the window always ages frames by their arrival on the steady clock
+ */
+void FlightRecorder::record(ImagePtr img)
+{
+  RawRGBPtr raw = img->get_bits();
+  if (!raw || raw->empty())
+    return;
+
+  uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch()).count());
+
+  RecordedFramePtr frame(new RecordedFrame);
+  memset(&frame->_entry, 0, sizeof(frame->_entry));
+  frame->_entry._size = raw->size();
+  frame->_entry._timestamp = img->get<unsigned long>("timestamp",now);
+  frame->_arrival_us = now;
+  frame->_entry._camera_id = static_cast<uint32_t>(img->get<int>("id",0));
+  frame->_entry._width = static_cast<uint32_t>(raw->width());
+  frame->_entry._height = static_cast<uint32_t>(raw->height());
+  frame->_entry._depth = static_cast<uint16_t>(raw->depth());
+  frame->_entry._type = static_cast<uint8_t>(raw->type());
+  frame->_entry._format = static_cast<uint8_t>(raw->format());
+  frame->_image = raw->share();
+
+  std::unique_lock<std::mutex> l(_mutex);
+  _frames.push_back(frame);
+  _bytes += frame->bytes();
+
+  bool compress = _compress && RawCodec::supported(*raw);
+  if (compress)
+    _pending.push_back(frame);
+
+  trim();
+  l.unlock();
+
+  if (compress)
+    _cv.notify_one();
+}
+
+/*
+ * \\fn void FlightRecorder::trim
+ *
+ * created on: Mar 30, 2020
+ * author: daniel
+ *
+ * Called with the lock held. The newest frame always stays.
+ */
+void FlightRecorder::trim()
+{
+  while (_frames.size() > 1)
+  {
+    const RecordedFramePtr& oldest = _frames.front();
+    uint64_t newest = _frames.back()->_arrival_us;
+    uint64_t age = (newest > oldest->_arrival_us) ? newest - oldest->_arrival_us : 0;
+    if ((age <= _window_us) && (_bytes <= _memory_limit))
+      break;
+
+    _bytes -= oldest->bytes();
+
+    // Pending frames are in window order, so an evicted one is at the front
+    if (!_pending.empty() && (_pending.front() == oldest))
+      _pending.pop_front();
+
+    // Unless a flush still holds it, the compressed buffer goes back to the compressor
+    if ((oldest.use_count() == 1) && (oldest->_packed.capacity() > 0) && (_spare.size() < RECORDER_SPARE_BUFFERS))
+      _spare.push_back(std::move(oldest->_packed));
+
+    _frames.pop_front();
+  }
+}
+
+/*
+ * \\fn void FlightRecorder::compress_loop
+ *
+ * created on: Mar 30, 2020
+ * author: daniel
+ *
+ * Encodes outside of the lock, then swaps the compressed frame in if
+ * the original is still in the window
+ */
+void FlightRecorder::compress_loop()
+{
+  while (true)
+  {
+    std::unique_lock<std::mutex> l(_mutex);
+    _cv.wait(l, [this]() { return _terminate || !_pending.empty(); });
+    if (_terminate)
+      break;
+
+    RecordedFramePtr frame = _pending.front();
+    _pending.pop_front();
+
+    std::vector<uint8_t> buffer;
+    if (!_spare.empty())
+    {
+      buffer = std::move(_spare.back());
+      _spare.pop_back();
+    }
+    l.unlock();
+
+    RecordedFramePtr packed(new RecordedFrame);
+    packed->_entry = frame->_entry;
+    packed->_arrival_us = frame->_arrival_us;
+    if (!RawCodec::encode(*frame->_image, buffer, _compress_threads))
+      continue;
+
+    packed->_packed.swap(buffer);
+    packed->_entry._size = packed->_packed.size();
+    packed->_entry._codec = RAW_CODEC_CFA_RICE;
+
+    l.lock();
+    std::deque<RecordedFramePtr>::iterator iter = std::find(_frames.begin(), _frames.end(), frame);
+    if (iter != _frames.end())
+    {
+      _bytes -= frame->bytes();
+      _bytes += packed->bytes();
+      *iter = packed;
+    }
+  }
+}
+
+/*
+ * \\fn void FlightRecorder::flush
+ *
+ * created on: Mar 30, 2020
+ * author: daniel
+ *
+ */
+void FlightRecorder::flush(std::string filename, std::vector<RecordedFramePtr> frames)
+{
+  SequenceWriter writer;
+  bool result = writer.open(filename.c_str());
+
+  for (size_t index = 0; result && (index < frames.size()); index++)
+  {
+    const RecordedFrame& frame = *frames[index];
+    if (frame._image)
+      result = writer.append(*frame._image, frame._entry._timestamp, frame._entry._camera_id);
+    else
+      result = writer.append(frame._entry, frame._packed.data());
+  }
+
+  if (!writer.close())
+    result = false;
+
+  if (result)
+    std::cout << "recorder: " << frames.size() << " frames to " << filename << std::endl;
+  else
+    std::cerr << "recorder: unable to write " << filename << std::endl;
+
+  _flushing--;
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
@@ -0,0 +1,128 @@
+/*
+ * flight_recorder.hpp
+ *
+ *  Created on: Mar 30, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_FLIGHT_RECORDER_HPP_
+#define BRT_COMMON_IMAGE_FLIGHT_RECORDER_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "image.hpp"
+#include "raw_sequence.hpp"
+#include "thread_pool.hpp"
+
+#define DEFAULT_RECORDER_SECONDS            (5.0)
+#define DEFAULT_RECORDER_MEMORY_MB          (512)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\struct RecordedFrame
+ *
+ * created on: Mar 30, 2020
+ *
+ * One frame of the window, never changed once it is in the window so
+ * snapshots can be read without the lock. The compressor replaces the
+ * frame holding the producer's image with one holding the RawCodec
+ * stream. The window is measured on _arrival_us, the steady clock
+ * time of record(), whatever the producer stamped into the entry.
+ */
+struct RecordedFrame
+{
+  SequenceEntry                   _entry;
+  uint64_t                        _arrival_us;
+  RawRGBPtr                       _image;
+  std::vector<uint8_t>            _packed;
+
+  size_t                          bytes() const { return _image ? _image->size() : _packed.size(); }
+};
+
+typedef std::shared_ptr<RecordedFrame> RecordedFramePtr;
+
+/*
+ * \\class FlightRecorder
+ *
+ * created on: Mar 30, 2020
+ *
+ * Keeps the last few seconds of raw frames in memory, register one per
+ * camera producer. consume() only appends a shared handle, the oldest
+ * frames fall out when they leave the time window or the memory limit
+ * is reached. trigger() takes a snapshot of the window and writes it
+ * to a sequence file on the flush thread, capture goes on meanwhile.
+ *
+ * Options (Metadata):
+ *   seconds          length of the window, DEFAULT_RECORDER_SECONDS
+ *   memory_mb        upper bound for the frames held, DEFAULT_RECORDER_MEMORY_MB
+ *   compress         keep Bayer frames RawCodec compressed
+ *   compress_threads threads per frame for the compressor, 1 by default
+ *   out_dir          directory for the sequence files
+ *   prefix           file name prefix, "flight_" by default
+ */
+class FlightRecorder : public ImageConsumer
+{
+public:
+  FlightRecorder(const Metadata& meta = Metadata());
+  virtual ~FlightRecorder();
+
+  FlightRecorder(const FlightRecorder&) = delete;
+  FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+  virtual void                    consume(ImageBox box);
+
+          std::string             trigger(const std::string& filename = "");
+          void                    clear();
+
+          size_t                  size() const;
+          uint64_t                bytes() const;
+          size_t                  flushing() const { return _flushing.load(); }
+
+private:
+          void                    record(ImagePtr img);
+          void                    trim();
+          void                    compress_loop();
+          void                    flush(std::string filename, std::vector<RecordedFramePtr> frames);
+
+private:
+  uint64_t                        _window_us;
+  uint64_t                        _memory_limit;
+  bool                            _compress;
+  size_t                          _compress_threads;
+  std::string                     _out_dir;
+  std::string                     _prefix;
+
+  std::deque<RecordedFramePtr>    _frames;
+  std::deque<RecordedFramePtr>    _pending;     // waiting for the compressor
+  std::vector<std::vector<uint8_t>>
+                                  _spare;       // buffers of evicted frames, reused
+  uint64_t                        _bytes;
+  size_t                          _triggers;
+  bool                            _terminate;
+  mutable std::mutex              _mutex;
+  std::condition_variable         _cv;
+
+  std::atomic_size_t              _flushing;
+  ThreadPool                      _compressor;
+  ThreadPool                      _flusher;
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_FLIGHT_RECORDER_HPP_ */
@@ -0,0 +1,368 @@
+/*
+ * folder_watcher.cpp
+ *
+ *  Created on: Apr 6, 2020
+ *      Author: daniel
+ */
+
+#include "folder_watcher.hpp"
+#include "raw_file.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <fnmatch.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#include <algorithm>
+#include <future>
+#include <iostream>
+#include <vector>
+
+#include <dir_enumerator.hpp>
+
+#define WATCH_EVENTS                        (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\fn Constructor FolderWatcher::FolderWatcher
+ *
+ * created on: Apr 6, 2020
+ * author: daniel
+ *
+ */
+FolderWatcher::FolderWatcher(const std::string& dir, const Metadata& meta /*= Metadata()*/)
+: _dir(dir)
+, _pattern(meta.get<std::string>("pattern","*.raw"))
+, _prefetch(std::max(meta.get<int>("prefetch",DEFAULT_PREFETCH_DEPTH), 1))
+, _backlog_limit(std::max(meta.get<int>("backlog",DEFAULT_WATCH_BACKLOG), 1))
+, _existing(meta.get<bool>("existing",false))
+, _inotify(-1)
+, _wake(-1)
+, _started(false)
+, _backlog()
+, _terminate(false)
+, _delivered(0)
+, _dropped(0)
+, _failed(0)
+, _watcher(1, "watch")
+, _deliver(1, "watch_deliver")
+, _io(std::max(meta.get<int>("io_threads",DEFAULT_IO_THREADS), 1), "watch_io")
+{
+  if (_dir.empty())
+    _dir = ".";
+
+  if (_dir.back() != '/')
+    _dir += '/';
+}
+
+/*
+ * \\fn Destructor FolderWatcher::~FolderWatcher
+ *
+ * created on: Apr 6, 2020
+ * author: daniel
+ *
+ */
+FolderWatcher::~FolderWatcher()
+{
+  stop();
+}
+
+/*
+ * \\fn bool FolderWatcher::start
+ *
+ * created on: Apr 6, 2020
+ * author: daniel
+ *
+ * The watch is in place before the directory is scanned, a file landing
+ * in between is seen twice rather than missed. The scan runs on the
+ * watch thread with the delivery already going, events arriving
+ * meanwhile wait in the inotify queue.
+ */
+bool FolderWatcher::start()
+{
+  if (_started)
+    return false;
+
+  _inotify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  _wake = ::eventfd(0, EFD_CLOEXEC);
+  if ((_inotify < 0) || (_wake < 0))
+  {
+    std::cerr << "watch: " << strerror(errno) << std::endl;
+    stop();
+    return false;
+  }
+
+  if (::inotify_add_watch(_inotify, _dir.c_str(), WATCH_EVENTS | IN_ONLYDIR) < 0)
+  {
+    std::cerr << "watch: " << _dir << ": " << strerror(errno) << std::endl;
+    stop();
+    return false;
+  }
+
+  _started = true;
+  _deliver.post([this]() { deliver_loop(); });
+  _watcher.post([this]()
+  {
+    if (_existing)
+      scan_existing();
+
+    watch_loop();
+  });
+
+  return true;
+}
+
+/*
+ * \\fn void FolderWatcher::stop
+ *
+ * created on: Apr 6, 2020
+ * author: daniel
+ *
+ * Files still waiting are dropped. The io pool goes last, the delivery
+ * thread may still wait for a load in flight.
+ */
+void FolderWatcher::stop()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  _terminate = true;
+  _backlog.clear();
+  l.unlock();
+  _cv.notify_all();
+
+  if (_wake >= 0)
+  {
+    uint64_t one = 1;
+    if (::write(_wake, &one, sizeof(one)) != sizeof(one))
+      std::cerr << "watch: " << strerror(errno) << std::endl;
+  }
+
+  _watcher.stop();
+  _deliver.stop();
+  _io.stop();
+
+  if (_inotify >= 0)
+    ::close(_inotify);
+
+  if (_wake >= 0)
+    ::close(_wake);
+
+  _inotify = -1;
+  _wake = -1;
+}
+
+/*
+ * \\fn size_t FolderWatcher::backlog
+ *
+ * created on: Apr 6, 2020
+ * author: daniel
+ *
+ */
+size_t FolderWatcher::backlog() const
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  return _backlog.size();
+}
+
+/*
+ * \\fn ImagePtr FolderWatcher::load_frame
+ *
+ * created on: Apr 6, 2020
+ * author: daniel
+ *
+ * The files belong to an external writer, frames get their own copy of
+ * the samples so a rewrite or truncate can't SIGBUS a consumer
+ */
+ImagePtr FolderWatcher::load_frame(const std::string& filename)
+{
+  RawHeader header;
+  RawBufferPtr storage = RawFile::read(filename.c_str(), header);
+
+  // RawCodec files have no RawHeader, the plain read decodes them
+  RawRGBPtr raw;
+  if (storage)
+    raw.reset(new RawRGB(storage, header._width, header._height, header._depth, header._type, header._format));
+  else
+    raw = RawFile::read(filename.c_str());
+
+  if (!raw)
+    return ImagePtr();
+
+  ImagePtr img(raw);
+  *img += header._metadata;
+  img->set("filename", filename.c_str());
+  if (header._timestamp != 0)
+    img->set<unsigned long>("timestamp", header._timestamp);
+
+  return img;
+}
+
+/*
+ * \\fn void FolderWatcher::watch_loop
+ *
+ * created on: Apr 6, 2020
+ * author: daniel
+ *
+ */
+void FolderWatcher::watch_loop()
+{
+  alignas(struct inotify_event) char buffer[16 * 1024];
+
+  while (true)
+  {
+    struct pollfd fds[2] = { { _inotify, POLLIN, 0 }, { _wake, POLLIN, 0 } };
+    if (::poll(fds, 2, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      std::cerr << "watch: " << strerror(errno) << std::endl;
+      break;
+    }
+
+    if (fds[1].revents != 0)
+      break;
+
+    ssize_t length;
+    while ((length = ::read(_inotify, buffer, sizeof(buffer))) > 0)
+    {
+      for (char* ptr = buffer; ptr < buffer + length; )
+      {
+        const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(ptr);
+        ptr += sizeof(struct inotify_event) + event->len;
+
+        if ((event->mask & IN_Q_OVERFLOW) != 0)
+          std::cerr << "watch: " << _dir << ": event queue overflow, files were missed" << std::endl;
+
+        if (((event->mask & WATCH_EVENTS) == 0) || ((event->mask & IN_ISDIR) != 0) || (event->len == 0))
+          continue;
+
+        if (::fnmatch(_pattern.c_str(), event->name, 0) == 0)
+          enqueue(_dir + event->name);
+      }
+    }
+  }
+}
+
+/*
+ * \\fn void FolderWatcher::deliver_loop
+ *
+ * created on: Apr 6, 2020
+ * author: daniel
+ *
+ * Keeps up to _prefetch loads in flight and hands the frames out in
+ * the order the files arrived
+ */
+void FolderWatcher::deliver_loop()
+{
+  struct Pending
+  {
+    std::string                   _filename;
+    std::future<ImagePtr>         _image;
+  };
+
+  std::deque<Pending> loading;
+  while (true)
+  {
+    std::unique_lock<std::mutex> l(_mutex);
+    while (!_terminate && (loading.size() < _prefetch) && !_backlog.empty())
+    {
+      Pending pending;
+      pending._filename = _backlog.front();
+      _backlog.pop_front();
+      _cv.notify_all();
+
+      std::string filename = pending._filename;
+      pending._image = _io.submit([filename]() { return load_frame(filename); });
+      loading.push_back(std::move(pending));
+    }
+
+    if (_terminate)
+      break;
+
+    if (loading.empty())
+    {
+      _cv.wait(l, [this]() { return _terminate || !_backlog.empty(); });
+      continue;
+    }
+    l.unlock();
+
+    Pending pending = std::move(loading.front());
+    loading.pop_front();
+
+    ImagePtr img = pending._image.get();
+    if (!img)
+    {
+      _failed++;
+      std::cerr << "watch: unable to load " << pending._filename << std::endl;
+      continue;
+    }
+
+    ImageBox box;
+    box.push_back(img);
+    ImageProducer::consume(box);
+    _delivered++;
+  }
+}
+
+/*
+ * \\fn bool FolderWatcher::enqueue
+ *
+ * created on: Apr 6, 2020
+ * author: daniel
+ *
+ * A full backlog drops its oldest file, or with wait the caller waits
+ * for room. Returns false once the watcher is stopped.
+ */
+bool FolderWatcher::enqueue(const std::string& filename, bool wait /*= false*/)
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  if (wait)
+    _cv.wait(l, [this]() { return _terminate || (_backlog.size() < _backlog_limit); });
+
+  if (_terminate)
+    return false;
+
+  if (_backlog.size() >= _backlog_limit)
+  {
+    size_t dropped = ++_dropped;
+    std::cerr << "watch: backlog full, dropped " << _backlog.front() << " (" << dropped << " dropped)" << std::endl;
+    _backlog.pop_front();
+  }
+
+  _backlog.push_back(filename);
+  l.unlock();
+
+  // The delivery thread and a scan waiting for room share the one condition
+  _cv.notify_all();
+  return true;
+}
+
+/*
+ * \\fn void FolderWatcher::scan_existing
+ *
+ * created on: Apr 6, 2020
+ * author: daniel
+ *
+ */
+void FolderWatcher::scan_existing()
+{
+  for (const std::string& filename : DirEnumerator::list(_dir + _pattern, eSortNatural))
+  {
+    if (!enqueue(filename, true))
+      break;
+  }
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
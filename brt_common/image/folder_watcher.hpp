@@ -0,0 +1,112 @@
+/*
+ * folder_watcher.hpp
+ *
+ *  Created on: Apr 6, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_FOLDER_WATCHER_HPP_
+#define BRT_COMMON_IMAGE_FOLDER_WATCHER_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "image.hpp"
+#include "image_loader.hpp"
+#include "thread_pool.hpp"
+
+#define DEFAULT_WATCH_BACKLOG               (64)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\class FolderWatcher
+ *
+ * created on: Apr 6, 2020
+ *
+ * Streams the raw files dropped into a directory. inotify reports every
+ * file once it is closed after writing or moved in, the file is loaded
+ * on the io pool and handed to the consumers in arrival order. Nothing
+ * polls, the watch thread sleeps in poll() until the kernel has events.
+ *
+ * Files waiting to be loaded are capped at backlog, when the consumers
+ * can't keep up the oldest ones are dropped and counted. Every image
+ * carries "filename", and "timestamp" plus the metadata block of version
+ * 2 files.
+ *
+ * Options (Metadata):
+ *   pattern          fnmatch pattern for the file names, "*.raw" by default
+ *   prefetch         files loading at the same time, DEFAULT_PREFETCH_DEPTH
+ *   io_threads       loader threads, DEFAULT_IO_THREADS
+ *   backlog          files waiting to load, DEFAULT_WATCH_BACKLOG
+ *   existing         stream the files already in the directory first, in
+ *                    natural order. These wait for room in the backlog
+ *                    rather than being dropped.
+ */
+class FolderWatcher : public ImageProducer
+{
+public:
+  FolderWatcher(const std::string& dir, const Metadata& meta = Metadata());
+  virtual ~FolderWatcher();
+
+  FolderWatcher(const FolderWatcher&) = delete;
+  FolderWatcher& operator=(const FolderWatcher&) = delete;
+
+          // A stopped watcher can't be started again
+          bool                    start();
+          void                    stop();
+
+          size_t                  backlog() const;
+          size_t                  delivered() const { return _delivered.load(); }
+          size_t                  dropped() const { return _dropped.load(); }
+          size_t                  failed() const { return _failed.load(); }
+
+  static  ImagePtr                load_frame(const std::string& filename);
+
+private:
+          void                    watch_loop();
+          void                    deliver_loop();
+          bool                    enqueue(const std::string& filename, bool wait = false);
+          void                    scan_existing();
+
+private:
+  std::string                     _dir;
+  std::string                     _pattern;
+  size_t                          _prefetch;
+  size_t                          _backlog_limit;
+  bool                            _existing;
+
+  int                             _inotify;
+  int                             _wake;        // eventfd, ends the watch thread
+  bool                            _started;
+
+  std::deque<std::string>         _backlog;
+  bool                            _terminate;
+  mutable std::mutex              _mutex;
+  std::condition_variable         _cv;
+
+  std::atomic_size_t              _delivered;
+  std::atomic_size_t              _dropped;
+  std::atomic_size_t              _failed;
+
+  ThreadPool                      _watcher;
+  ThreadPool                      _deliver;
+  ThreadPool                      _io;
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_FOLDER_WATCHER_HPP_ */
@@ -7,10 +7,15 @@
 
 #include <string.h>
 #include <iostream>
-#include <fstream>
+#include <condition_variable>
 
 #include "image.hpp"
+#include "planar.hpp"
+#include "sample_convert.hpp"
+#include "raw_file.hpp"
 #include <utils.hpp>
+#include <bounded_queue.hpp>
+#include <thread_pool.hpp>
 
 namespace brt
 {
@@ -26,20 +31,22 @@ namespace image
  * author: daniel
  *
  */
-RawRGB::RawRGB(size_t w, size_t h, size_t depth, PixelType type /*= eBayer*/)
+RawRGB::RawRGB(size_t w, size_t h, size_t depth, PixelType type /*= eBayer*/, SampleFormat format /*= eUnsigned*/)
 {
   _width = w;
   _height = h;
-  _depth = depth;
+  _depth = format_depth(format, depth);
   _type = type;
+  _format = format;
 
-  uint32_t srcPitch = _width * BYTES_PER_PIXELS(_depth) * type_size(_type);
-  uint32_t srcImageSize = srcPitch * _height;
+  size_t srcImageSize = size();
 
+  _buffer = nullptr;
   if (srcImageSize > 0)
-    _buffer = (uint8_t*)::malloc(srcImageSize);
-  else
-    _buffer = nullptr;
+  {
+    _storage.reset(new RawBuffer(srcImageSize));
+    _buffer = _storage->bytes();
+  }
 }
 
 /*
@@ -49,22 +56,51 @@ RawRGB::RawRGB(size_t w, size_t h, size_t depth, PixelType type /*= eBayer*/)
  * author: daniel
  *
  */
-RawRGB::RawRGB(const uint8_t* buffer, size_t w, size_t h, size_t depth, PixelType type /*= eBayer*/)
+RawRGB::RawRGB(const uint8_t* buffer, size_t w, size_t h, size_t depth, PixelType type /*= eBayer*/, SampleFormat format /*= eUnsigned*/)
 : _buffer(nullptr)
 {
   _width = w;
   _height = h;
-  _depth = depth;
+  _depth = format_depth(format, depth);
   _type = type;
+  _format = format;
 
-  uint32_t srcPitch = _width * BYTES_PER_PIXELS(_depth) * type_size(_type);
-  uint32_t srcImageSize = srcPitch * _height;
+  size_t srcImageSize = size();
 
   if (srcImageSize > 0)
   {
-    _buffer = (uint8_t*)::malloc(srcImageSize);
+    _storage.reset(new RawBuffer(srcImageSize));
+    _buffer = _storage->bytes();
+  }
+
+  if (_buffer != nullptr)
     memcpy(_buffer, buffer, srcImageSize);
+}
+
+/*
+ * \\fn Constructor RawRGB::RawRGB
+ *
+ * created on: Mar 9, 2020
+ * author: daniel
+ *
+ * Adopts existing storage, e.g. a mapped file, without copying
+ */
+RawRGB::RawRGB(RawBufferPtr storage, size_t w, size_t h, size_t depth, PixelType type /*= eBayer*/, SampleFormat format /*= eUnsigned*/)
+: _width(w)
+, _height(h)
+, _depth(format_depth(format, depth))
+, _type(type)
+, _format(format)
+, _storage(storage)
+, _buffer(nullptr)
+{
+  if (!_storage || (_storage->bytes() == nullptr) || (_storage->size() < size()))
+  {
+    _storage.reset();
+    return;
   }
+
+  _buffer = _storage->bytes();
 }
 
 /*
@@ -79,59 +115,65 @@ RawRGB::RawRGB(const char *raw_image_file)
 , _height(0)
 , _depth(0)
 , _type(eBayer)
+, _format(eUnsigned)
 , _buffer(nullptr)
 {
-  std::ifstream image_file(raw_image_file, std::ios::in | std::ios::binary);
-  if (image_file.is_open())
-  {
-    try
-    {
-      uint32_t w,h, depth;
-      if (image_file.read(reinterpret_cast<char*>(&w), sizeof(w)).rdstate() != std::ios_base::goodbit)
-        throw;
-
-      if (image_file.read(reinterpret_cast<char*>(&h), sizeof(h)).rdstate() != std::ios_base::goodbit)
-        throw;
-
-      if (image_file.read(reinterpret_cast<char*>(&depth), sizeof(depth)).rdstate() != std::ios_base::goodbit)
-        throw;
+  RawHeader header;
+  _storage = RawFile::load(raw_image_file, header);
+  if (!_storage)
+    return;
+
+  _width = header._width;
+  _height = header._height;
+  _depth = header._depth;
+  _type = header._type;
+  _format = header._format;
+  _buffer = _storage->bytes();
+}
 
-      /// Backward compatibility
-      if (depth == 2)
-        depth = 16;
+/*
+ * \\fn Destructor RawRGB::~RawRGB
+ *
+ * created on: Jul 2, 2019
+ * author: daniel
+ *
+ */
+RawRGB::~RawRGB()
+{
+}
 
-      _buffer = new uint8_t[w * h * BYTES_PER_PIXELS(depth)];
+/*
+ * \\fn void RawRGB::detach
+ *
+ * created on: Mar 2, 2020
+ * author: daniel
+ *
+ */
+void RawRGB::detach()
+{
+  if (!shared())
+    return;
 
-      if (image_file.read(reinterpret_cast<char*>(_buffer), w * h * BYTES_PER_PIXELS(depth)).rdstate() &
-          ((std::ios_base::badbit | std::ios_base::failbit) != 0))
-        throw;
+  RawBufferPtr storage(new RawBuffer(_storage->size()));
+  if (storage->bytes() == nullptr)
+    return;
 
-      _depth = depth;
-      _width = w;
-      _height = h;
-    }
-    catch(...)
-    {
-      if (_buffer != nullptr)
-      {
-        delete _buffer;
-        _buffer = nullptr;
-      }
-    }
-  }
+  memcpy(storage->bytes(), _buffer, _storage->size());
+  _storage = storage;
+  _buffer = _storage->bytes();
 }
 
 /*
- * \\fn Destructor RawRGB::~RawRGB
+ * \\fn RawRGBPtr RawRGB::share
  *
- * created on: Jul 2, 2019
+ * created on: Mar 2, 2020
  * author: daniel
  *
  */
-RawRGB::~RawRGB()
+RawRGBPtr RawRGB::share() const
 {
-  if (_buffer != nullptr)
-    free(_buffer);
+  RawRGBPtr result(new RawRGB(*this));
+  return result;
 }
 //
 ///*
@@ -153,6 +195,74 @@ RawRGB::~RawRGB()
 //  return Pixel(_buffer + offset,_type, _depth);
 //}
 
+/*
+ * \\fn static void rescale_samples
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ * Unsigned samples from one depth to another. Writing never gets ahead of
+ * reading when the destination is not wider, so src and dst may overlap.
+ */
+static void rescale_samples(const uint8_t* src, size_t src_depth, uint8_t* dst, size_t dst_depth, size_t count)
+{
+  for (size_t sample = 0; sample < count; sample++)
+  {
+    uint32_t pixel = 0;
+    switch (BYTES_PER_PIXELS(src_depth))
+    {
+    case 1:
+      pixel = *src;
+      break;
+
+    case 2:
+      pixel = *reinterpret_cast<const uint16_t*>(src);
+      break;
+
+    case 3:
+      pixel = *reinterpret_cast<const uint32_t*>(src) & 0xFFFFFF;
+      break;
+
+    case 4:
+      pixel = *reinterpret_cast<const uint32_t*>(src);
+      break;
+
+    default:
+      break;
+    }
+
+    if (src_depth > dst_depth)
+      pixel >>= (src_depth - dst_depth);
+    else
+      pixel <<= (dst_depth - src_depth);
+
+    switch (BYTES_PER_PIXELS(dst_depth))
+    {
+    case 1:
+      *dst = static_cast<uint8_t>(pixel & 0xFF);
+      break;
+
+    case 2:
+      *reinterpret_cast<uint16_t*>(dst) = static_cast<uint16_t>(pixel & 0xFFFF);
+      break;
+
+    case 3:
+      *reinterpret_cast<uint32_t*>(dst) = pixel & 0xFFFFFF;
+      break;
+
+    case 4:
+      *reinterpret_cast<uint32_t*>(dst) = pixel;
+      break;
+
+    default:
+      break;
+    }
+
+    src += BYTES_PER_PIXELS(src_depth);
+    dst += BYTES_PER_PIXELS(dst_depth);
+  }
+}
+
 /*
  * \\fn RawRGBPtr RawRGB::clone
  *
@@ -160,79 +270,284 @@ RawRGB::~RawRGB()
  * author: daniel
  *
  */
-RawRGBPtr RawRGB::clone(size_t depth)
+RawRGBPtr RawRGB::clone(size_t depth) const
 {
+  if (packed())
+  {
+    RawRGBPtr unpacked = convert(eUnsigned, _depth);
+    return unpacked ? unpacked->clone(depth) : RawRGBPtr();
+  }
+
   if (depth == _depth)
-    return RawRGBPtr(new RawRGB(_buffer, _width, _height, _depth, _type));
+    return share();
+
+  if (_format != eUnsigned)
+    return convert(eUnsigned, depth);
 
   RawRGB* result = new RawRGB(_width, _height, depth, _type);
 
-  uint8_t*  src = _buffer;
-  uint8_t*  dst = result->_buffer;
+  size_t samples_per_plane = _width * _height * (planar() ? 1 : type_size(_type));
+  for (size_t plane_index = 0; plane_index < planes(); plane_index++)
+    rescale_samples(plane(plane_index), _depth, result->plane(plane_index), depth, samples_per_plane);
+
+  return RawRGBPtr(result);
+}
 
-  for (size_t h = 0; h < _height; h++)
+/*
+ * \\fn bool RawRGB::narrow
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ * Lowers the depth in place, only storage shared with another handle is
+ * converted into a new buffer, the way clone() does
+ */
+bool RawRGB::narrow(size_t depth)
+{
+  if (empty() || (depth == 0) || (depth > _depth))
+    return false;
+
+  if (depth == _depth)
+    return true;
+
+  if (shared() || packed() || (_format != eUnsigned))
   {
-    for (size_t w = 0; w < _width; w++)
+    RawRGBPtr result = clone(depth);
+    if (!result || result->empty())
+      return false;
+
+    _depth = result->_depth;
+    _format = result->_format;
+    _storage = result->_storage;
+    _buffer = result->_buffer;
+    return true;
+  }
+
+  size_t samples_per_plane = _width * _height * (planar() ? 1 : type_size(_type));
+  size_t src_depth = _depth;
+  size_t src_stride = plane_stride();
+
+  _depth = depth;
+  for (size_t plane_index = 0; plane_index < planes(); plane_index++)
+    rescale_samples(_buffer + plane_index * src_stride, src_depth, _buffer + plane_index * plane_stride(), depth, samples_per_plane);
+
+  return true;
+}
+
+/*
+ * \\fn RawRGBPtr RawRGB::convert
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ * depth is the integer depth on the unsigned side of the conversion,
+ * when converting from an unsigned image its own depth is used
+ */
+RawRGBPtr RawRGB::convert(SampleFormat format, size_t depth /*= 16*/) const
+{
+  if (empty())
+    return RawRGBPtr();
+
+  if ((format == eUnsigned) && (_format == eUnsigned))
+    return clone(depth);
+
+  // Integer sides, packed ones included, keep their own depth
+  size_t src_depth = is_float() ? depth : _depth;
+  size_t dst_depth = (format == eUnsigned) ? depth : format_depth(format, _depth);
+
+  RawRGBPtr result(new RawRGB(_width, _height, dst_depth, _type, format));
+  if (result->empty())
+    return RawRGBPtr();
+
+  if ((format == eFloat) || (format == eHalf))
+    dst_depth = src_depth;
+
+  // Packed rows end on a whole group, those go one row at a time
+  size_t samples_per_row = _width * (planar() ? 1 : type_size(_type));
+  size_t rows = (packed() || result->packed()) ? _height : 1;
+  size_t count = (rows == 1) ? samples_per_row * _height : samples_per_row;
+
+  for (size_t plane_index = 0; plane_index < planes(); plane_index++)
+  {
+    const uint8_t* src = plane(plane_index);
+    uint8_t* dst = result->plane(plane_index);
+
+    for (size_t row = 0; row < rows; row++)
     {
-      for (size_t byte = 0; byte < type_size(_type); byte++)
-      {
-        uint32_t pixel = 0;
-        switch (BYTES_PER_PIXELS(_depth))
-        {
-        case 1:
-          pixel = *src;
-          break;
-
-        case 2:
-          pixel = *reinterpret_cast<uint16_t*>(src);
-          break;
-
-        case 3:
-          pixel = *reinterpret_cast<uint32_t*>(src) & 0xFFFFFF;
-          break;
-
-        case 4:
-          pixel = *reinterpret_cast<uint32_t*>(src);
-          break;
-
-        default:
-          break;
-        }
-
-        if (_depth > depth)
-          pixel >>= (_depth - depth);
-        else
-          pixel <<= (depth - _depth);
-
-        switch (BYTES_PER_PIXELS(depth))
-        {
-        case 1:
-          *dst = static_cast<uint8_t>(pixel & 0xFF);
-          break;
-
-        case 2:
-          *reinterpret_cast<uint16_t*>(dst) = static_cast<uint16_t>(pixel & 0xFFFF);
-          break;
-
-        case 3:
-          *reinterpret_cast<uint32_t*>(dst) = pixel & 0xFFFFFF;
-          break;
-
-        case 4:
-          *reinterpret_cast<uint32_t*>(dst) = pixel;
-          break;
-
-        default:
-          break;
-        }
-
-        src += BYTES_PER_PIXELS(_depth);
-        dst += BYTES_PER_PIXELS(depth);
-      }
+      if (!convert_samples(src + row * pitch(), _format, src_depth,
+                           dst + row * result->pitch(), format, dst_depth, count))
+        return RawRGBPtr();
     }
   }
 
-  return RawRGBPtr(result);
+  result->set_histogram(_hist);
+  return result;
+}
+
+/*
+ * \\fn size_t RawRGB::pitch
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+size_t RawRGB::pitch(size_t plane /*= 0*/) const
+{
+  if (plane >= planes())
+    return 0;
+
+  if (packed())
+    return packed_row_bytes(_width * (planar() ? 1 : type_size(_type)), _format);
+
+  return _width * BYTES_PER_PIXELS(_depth) * (planar() ? 1 : type_size(_type));
+}
+
+/*
+ * \\fn size_t RawRGB::plane_stride
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+size_t RawRGB::plane_stride() const
+{
+  size_t plane_size = pitch() * _height;
+  if (!planar())
+    return plane_size;
+
+  // Every plane starts on its own cache line so vectorised per-plane loops
+  // never share a line with the neighbouring channel
+  return (plane_size + PLANE_ALIGNMENT - 1) & ~static_cast<size_t>(PLANE_ALIGNMENT - 1);
+}
+
+/*
+ * \\fn uint8_t* RawRGB::plane
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+uint8_t* RawRGB::plane(size_t index)
+{
+  if ((_buffer == nullptr) || (index >= planes()))
+    return nullptr;
+
+  detach();
+  return _buffer + index * plane_stride();
+}
+
+/*
+ * \\fn const uint8_t* RawRGB::plane
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+const uint8_t* RawRGB::plane(size_t index) const
+{
+  if ((_buffer == nullptr) || (index >= planes()))
+    return nullptr;
+
+  return _buffer + index * plane_stride();
+}
+
+/*
+ * \\fn RawRGBPtr RawRGB::to_planar
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+RawRGBPtr RawRGB::to_planar() const
+{
+  if (empty() || (_type == eBayer) || (_type == eNone))
+    return RawRGBPtr();
+
+  if (planar())
+    return share();
+
+  RawRGBPtr result(new RawRGB(_width, _height, _depth, (type_size(_type) == 4) ? ePlanarRGBA : ePlanarRGB, _format));
+  if (result->empty())
+    return RawRGBPtr();
+
+  uint8_t* planes[4] = { result->plane(0), result->plane(1), result->plane(2), result->plane(3) };
+  if (!deinterleave(_buffer, _type, planes, result->planes(), _width * _height, BYTES_PER_PIXELS(_depth), _format))
+    return RawRGBPtr();
+
+  return result;
+}
+
+/*
+ * \\fn RawRGBPtr RawRGB::to_interleaved
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+RawRGBPtr RawRGB::to_interleaved(PixelType type /*= eRGBA*/) const
+{
+  if (empty() || is_planar(type) || (type == eBayer) || (type == eNone))
+    return RawRGBPtr();
+
+  if (!planar())
+  {
+    if (type == _type)
+      return share();
+
+    RawRGBPtr tmp = to_planar();
+    return tmp ? tmp->to_interleaved(type) : tmp;
+  }
+
+  RawRGBPtr result(new RawRGB(_width, _height, _depth, type, _format));
+  if (result->empty())
+    return RawRGBPtr();
+
+  const uint8_t* planes[4] = { plane(0), plane(1), plane(2), plane(3) };
+  if (!interleave(planes, this->planes(), result->bytes(), type, _width * _height, BYTES_PER_PIXELS(_depth), _format))
+    return RawRGBPtr();
+
+  return result;
+}
+
+/*
+ * \\fn Constructor RawBuffer::RawBuffer
+ *
+ * created on: Mar 2, 2020
+ * author: daniel
+ *
+ */
+RawBuffer::RawBuffer(size_t size)
+: _block(PageAllocator::allocate(size))
+, _pool()
+{
+}
+
+/*
+ * \\fn Constructor RawBuffer::RawBuffer
+ *
+ * created on: Mar 2, 2020
+ * author: daniel
+ *
+ */
+RawBuffer::RawBuffer(const PageAllocator::Block& block, BlockPoolPtr pool /*= BlockPoolPtr()*/)
+: _block(block)
+, _pool(pool)
+{
+}
+
+/*
+ * \\fn Destructor RawBuffer::~RawBuffer
+ *
+ * created on: Mar 2, 2020
+ * author: daniel
+ *
+ */
+RawBuffer::~RawBuffer()
+{
+  if (_pool)
+    _pool->recycle(_block);
+  else
+    PageAllocator::release(_block);
 }
 
 /*
@@ -271,6 +586,34 @@ RawRGBPtr Image::get_bits()
   return _other_source;
 }
 
+/*
+ * \\struct ImageProducer::Registration
+ *
+ * created on: Apr 13, 2020
+ *
+ */
+struct ImageProducer::Registration
+{
+  Registration(ImageConsumer* consumer)
+  : _consumer(consumer), _policy(eDropNewest), _sample(1), _frames(0), _tickets(0), _pushed(0)
+  , _delivered(0), _dropped(0), _skipped(0) {}
+
+  ImageConsumer*                  _consumer;
+  DropPolicy                      _policy;
+  size_t                          _sample;
+  size_t                          _frames;      // seen, under the producer's lock
+  size_t                          _tickets;     // blocking pushes handed out, under the producer's lock
+  size_t                          _pushed;      // blocking pushes done, under _push_mutex
+  std::mutex                      _push_mutex;
+  std::condition_variable         _push_cv;
+  std::unique_ptr<BoundedQueue<ImageBox>>
+                                  _queue;       // async consumers only
+  std::unique_ptr<ThreadPool>     _thread;
+  std::atomic_size_t              _delivered;
+  std::atomic_size_t              _dropped;
+  std::atomic_size_t              _skipped;
+};
+
 /*
  * \\fn Constructor ImageProducer::ImageProducer
  *
@@ -292,7 +635,13 @@ ImageProducer::ImageProducer()
  */
 ImageProducer::~ImageProducer()
 {
+  std::unique_lock<std::mutex> l(_mutex);
+  consumer_map consumers;
+  consumers.swap(_consumers);
+  l.unlock();
 
+  for (auto pair : consumers)
+    release(pair.second);
 }
 
 /*
@@ -304,9 +653,43 @@ ImageProducer::~ImageProducer()
  */
 void ImageProducer::register_consumer(ImageConsumer* consumer,const Metadata& meta /*= Metadata()*/)
 {
+  Metadata image_meta(meta);
+  image_meta.erase("async");
+  image_meta.erase("policy");
+  image_meta.erase("queue_depth");
+  image_meta.erase("sample");
+
   std::unique_lock<std::mutex> l(_mutex);
-  _consumers.insert(consumer);
-  _meta += meta;
+  _meta += image_meta;
+  if (_consumers.find(consumer) != _consumers.end())
+    return;
+
+  RegistrationPtr reg(new Registration(consumer));
+  reg->_policy = drop_policy(meta.get<std::string>("policy",""));
+  reg->_sample = std::max(meta.get<int>("sample",1), 1);
+
+  if (meta.get<bool>("async",meta.exist("policy")))
+  {
+    size_t depth = (reg->_policy == eLatestOnly) ? 1 : std::max(meta.get<int>("queue_depth",DEFAULT_CONSUMER_QUEUE_DEPTH), 1);
+    reg->_queue.reset(new BoundedQueue<ImageBox>(depth));
+    reg->_thread.reset(new ThreadPool(1, "consumer"));
+
+    Registration* worker = reg.get();
+    reg->_thread->post([worker]()
+    {
+      ImageBox box;
+      while (worker->_queue->pop(box))
+      {
+        worker->_consumer->consume(box);
+        worker->_delivered++;
+
+        // Let go of the frames before waiting for the next ones
+        box.clear();
+      }
+    });
+  }
+
+  _consumers[consumer] = reg;
 }
 
 /*
@@ -319,7 +702,15 @@ void ImageProducer::register_consumer(ImageConsumer* consumer,const Metadata& me
 void ImageProducer::unregister_consumer(ImageConsumer* consumer)
 {
   std::unique_lock<std::mutex> l(_mutex);
-  _consumers.erase(consumer);
+  consumer_map::iterator iter = _consumers.find(consumer);
+  if (iter == _consumers.end())
+    return;
+
+  RegistrationPtr reg = iter->second;
+  _consumers.erase(iter);
+  l.unlock();
+
+  release(reg);
 }
 
 /*
@@ -331,6 +722,7 @@ void ImageProducer::unregister_consumer(ImageConsumer* consumer)
  */
 void ImageProducer::consume(ImageBox box)
 {
+  std::vector<std::pair<RegistrationPtr,size_t>> blocking;
   std::unique_lock<std::mutex> l(_mutex);
 
   for (ImagePtr img : box)
@@ -339,10 +731,145 @@ void ImageProducer::consume(ImageBox box)
       *(img.get()) += _meta;
   }
 
-  for (ImageConsumer* consumer : _consumers)
+  for (auto pair : _consumers)
   {
-    consumer->consume(box);
+    Registration& reg = *pair.second;
+    if ((reg._frames++ % reg._sample) != 0)
+    {
+      reg._skipped++;
+      continue;
+    }
+
+    if (!reg._queue)
+    {
+      reg._consumer->consume(box.share());
+      reg._delivered++;
+      continue;
+    }
+
+    size_t evicted = 0;
+    switch (reg._policy)
+    {
+    case eBlock:
+      // The ticket keeps concurrent producers' pushes in the order taken here
+      blocking.push_back(std::make_pair(pair.second, reg._tickets++));
+      break;
+
+    case eDropOldest:
+    case eLatestOnly:
+      reg._queue->push_evict(box.share(), evicted);
+      reg._dropped += evicted;
+      break;
+
+    default:
+      if (!reg._queue->try_push(box.share()))
+        reg._dropped++;
+      break;
+    }
   }
+  l.unlock();
+
+  // A closed queue refuses the push, the consumer is being unregistered
+  for (auto& pair : blocking)
+  {
+    Registration& reg = *pair.first;
+    std::unique_lock<std::mutex> turn(reg._push_mutex);
+    reg._push_cv.wait(turn, [&reg, &pair]() { return reg._pushed == pair.second; });
+    turn.unlock();
+
+    reg._queue->push(box.share());
+
+    turn.lock();
+    reg._pushed++;
+    turn.unlock();
+    reg._push_cv.notify_all();
+  }
+}
+
+/*
+ * \\fn ConsumerStats ImageProducer::consumer_stats
+ *
+ * created on: Apr 13, 2020
+ * author: daniel
+ *
+ */
+ConsumerStats ImageProducer::consumer_stats(ImageConsumer* consumer) const
+{
+  ConsumerStats result;
+  memset(&result, 0, sizeof(result));
+
+  std::lock_guard<std::mutex> l(_mutex);
+  consumer_map::const_iterator iter = _consumers.find(consumer);
+  if (iter == _consumers.end())
+    return result;
+
+  const Registration& reg = *iter->second;
+  result._async = static_cast<bool>(reg._queue);
+  result._policy = reg._policy;
+  result._sample = reg._sample;
+  result._skipped = reg._skipped.load();
+  result._queued = reg._queue ? reg._queue->size() : 0;
+  result._capacity = reg._queue ? reg._queue->capacity() : 0;
+  result._delivered = reg._delivered.load();
+  result._dropped = reg._dropped.load();
+  return result;
+}
+
+/*
+ * \\fn DropPolicy ImageProducer::drop_policy
+ *
+ * created on: Apr 15, 2020
+ * author: daniel
+ *
+ */
+DropPolicy ImageProducer::drop_policy(const std::string& name)
+{
+  for (int policy = 0; policy < eNumDropPolicies; policy++)
+  {
+    if (name == policy_name(static_cast<DropPolicy>(policy)))
+      return static_cast<DropPolicy>(policy);
+  }
+
+  if (!name.empty())
+    std::cerr << "producer: unknown policy \"" << name << "\", using " << policy_name(eDropNewest) << std::endl;
+
+  return eDropNewest;
+}
+
+/*
+ * \\fn const char* ImageProducer::policy_name
+ *
+ * created on: Apr 15, 2020
+ * author: daniel
+ *
+ */
+const char* ImageProducer::policy_name(DropPolicy policy)
+{
+  static const char* names[eNumDropPolicies] = { "drop_newest", "drop_oldest", "latest", "block" };
+  return ((policy >= 0) && (policy < eNumDropPolicies)) ? names[policy] : "unknown";
+}
+
+/*
+ * \\fn void ImageProducer::release
+ *
+ * created on: Apr 13, 2020
+ * author: daniel
+ *
+ * Frames already queued are still delivered before the thread exits, so
+ * are blocking pushes that had their ticket before the registration was
+ * taken out of the map
+ */
+void ImageProducer::release(RegistrationPtr reg)
+{
+  if (!reg->_queue)
+    return;
+
+  std::unique_lock<std::mutex> turn(reg->_push_mutex);
+  reg->_push_cv.wait(turn, [&reg]() { return reg->_pushed == reg->_tickets; });
+  turn.unlock();
+
+  reg->_queue->close();
+  reg->_thread->stop();
 }
 
 
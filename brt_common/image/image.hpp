@@ -10,11 +10,13 @@
 
 #include <memory>
 #include <unordered_set>
+#include <unordered_map>
 #include <mutex>
 #include <vector>
 
 #include "metadata.hpp"
 #include "utils.hpp"
+#include "page_allocator.hpp"
 
 namespace brt
 {
@@ -59,10 +61,128 @@ enum PixelType
   eBGR =   3,
   eRGBA =  4,
   eBGRA =  5,
+  ePlanarRGB =  6,
+  ePlanarRGBA = 7,
 
   eNumTypes
 };
 
+/*
+ * \\enum Channel
+ *
+ * created on: Apr 20, 2020
+ *
+ * Column order of channel_map, the Blue/Green/Red/Alpha order of the
+ * demosaic and Pixel colors
+ */
+enum Channel
+{
+  eBlueChannel = 0,
+  eGreenChannel = 1,
+  eRedChannel = 2,
+  eAlphaChannel = 3,
+
+  eNumChannels
+};
+
+/*
+ * Channel order, the one convention of the whole tree: the name of an
+ * interleaved type is its order in memory, eRGBA holds R,G,B,A and
+ * eBGRA B,G,R,A, same as GL_RGBA/GL_BGRA, the CUDA demosaic and the
+ * image files. Planar types keep R, G, B and A in planes 0 to 3.
+ *
+ * channel_map[type][channel] is the sample index of the channel inside
+ * an interleaved pixel, the plane index for planar types, -1 when the
+ * type has no such channel.
+ */
+constexpr int channel_map[eNumTypes][eNumChannels] =
+{
+  //                  Blue, Green, Red, Alpha
+  /*eNone = 0*/       { -1,   -1,  -1,   -1 },
+  /*eBayer = 1*/      { -1,   -1,  -1,   -1 },
+  /*eRGB = 2*/        {  2,    1,   0,   -1 },
+  /*eBGR = 3*/        {  0,    1,   2,   -1 },
+  /*eRGBA = 4*/       {  2,    1,   0,    3 },
+  /*eBGRA = 5*/       {  0,    1,   2,    3 },
+  /*ePlanarRGB = 6*/  {  2,    1,   0,   -1 },
+  /*ePlanarRGBA = 7*/ {  2,    1,   0,    3 },
+};
+
+#define PLANE_ALIGNMENT                     (64)
+
+/*
+ * \\enum SampleFormat
+ *
+ * created on: Feb 26, 2020
+ *
+ */
+enum SampleFormat
+{
+  eUnsigned = 0,
+  eFloat =    1,
+  eHalf =     2,
+  eMipiRaw10 = 3,     // MIPI CSI-2 RAW10, 4 samples in 5 bytes
+  eMipiRaw12 = 4      // MIPI CSI-2 RAW12, 2 samples in 3 bytes
+};
+
+/*
+ * \\fn bool is_packed
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ */
+inline bool is_packed(SampleFormat format)
+{
+  return (format == eMipiRaw10) || (format == eMipiRaw12);
+}
+
+/*
+ * \\fn size_t format_depth
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ * Depth implied by the sample format, depth itself for plain integers
+ */
+inline size_t format_depth(SampleFormat format, size_t depth)
+{
+  switch (format)
+  {
+  case eFloat:
+    return 32;
+
+  case eHalf:
+    return 16;
+
+  case eMipiRaw10:
+    return 10;
+
+  case eMipiRaw12:
+    return 12;
+
+  default:
+    break;
+  }
+  return depth;
+}
+
+/*
+ * \\fn size_t packed_row_bytes
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ * Packed rows always end on a whole group
+ */
+inline size_t packed_row_bytes(size_t samples, SampleFormat format)
+{
+  if (format == eMipiRaw10)
+    return ((samples + 3) / 4) * 5;
+
+  return ((samples + 1) / 2) * 3;
+}
+
 
 /*
  * \\fn size_t type_size
@@ -86,12 +206,70 @@ inline size_t type_size(PixelType type)
   case eBGRA:
     return 4;
 
+  case ePlanarRGB:
+    return 3;
+
+  case ePlanarRGBA:
+    return 4;
+
   default:
     break;
   }
   return 0;
 }
 
+/*
+ * \\fn bool is_planar
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+inline bool is_planar(PixelType type)
+{
+  return (type == ePlanarRGB) || (type == ePlanarRGBA);
+}
+
+/*
+ * \\fn size_t num_planes
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+inline size_t num_planes(PixelType type)
+{
+  return is_planar(type) ? type_size(type) : 1;
+}
+
+/*
+ * \\class RawBuffer
+ *
+ * created on: Mar 2, 2020
+ *
+ * Pixel storage, shared between RawRGB handles until one of them writes
+ */
+class RawBuffer
+{
+public:
+  RawBuffer(size_t size);
+  RawBuffer(const PageAllocator::Block& block, BlockPoolPtr pool = BlockPoolPtr());
+  virtual ~RawBuffer();
+
+  RawBuffer(const RawBuffer&) = delete;
+  RawBuffer& operator=(const RawBuffer&) = delete;
+
+          uint8_t*                bytes() { return reinterpret_cast<uint8_t*>(_block._ptr); }
+          size_t                  size() const { return _block._size; }
+          MemBacking              backing() const { return _block._backing; }
+
+private:
+  PageAllocator::Block            _block;
+  BlockPoolPtr                    _pool;
+};
+
+typedef std::shared_ptr<RawBuffer> RawBufferPtr;
+
 /*
  * \\class RawRGB
  *
@@ -101,8 +279,9 @@ inline size_t type_size(PixelType type)
 class RawRGB
 {
 public:
-  RawRGB(size_t w, size_t h, size_t depth, PixelType type = eBayer);
-  RawRGB(const uint8_t*, size_t w, size_t h, size_t depth, PixelType type = eBayer);
+  RawRGB(size_t w, size_t h, size_t depth, PixelType type = eBayer, SampleFormat format = eUnsigned);
+  RawRGB(const uint8_t*, size_t w, size_t h, size_t depth, PixelType type = eBayer, SampleFormat format = eUnsigned);
+  RawRGB(RawBufferPtr storage, size_t w, size_t h, size_t depth, PixelType type = eBayer, SampleFormat format = eUnsigned);
   RawRGB(const char *);
   virtual ~RawRGB();
 
@@ -110,26 +289,53 @@ public:
           size_t                  height() const { return _height; }
           size_t                  depth() const { return _depth; }
           PixelType               type() const { return _type; }
-          size_t                  size() const { return _width * _height * BYTES_PER_PIXELS(_depth) * _type;}
-
-          uint8_t*                bytes() { return _buffer; }
+          SampleFormat            format() const { return _format; }
+          bool                    is_float() const { return (_format == eFloat) || (_format == eHalf); }
+          bool                    packed() const { return is_packed(_format); }
+          size_t                  size() const { return plane_stride() * planes(); }
+
+          // Mutable access makes a private copy first if the storage
+          // is shared with another handle, read-only access never copies
+          uint8_t*                bytes() { detach(); return _buffer; }
           const uint8_t*          bytes() const { return _buffer; }
+          const uint8_t*          cbytes() const { return _buffer; }
           bool                    empty() const { return (_buffer == nullptr);}
+          MemBacking              backing() const { return _storage ? _storage->backing() : eNoMemory; }
+          bool                    shared() const { return _storage && (_storage.use_count() > 1); }
+
+          // Planar layouts keep R, G, B (and A) in separate planes in that order,
+          // interleaved layouts are reported as a single plane
+          bool                    planar() const { return is_planar(_type); }
+          size_t                  planes() const { return num_planes(_type); }
+          size_t                  pitch(size_t plane = 0) const;
+          size_t                  plane_stride() const;
+          uint8_t*                plane(size_t index);
+          const uint8_t*          plane(size_t index) const;
 
           //Pixel                   pixel(int x, int y);
 
           void                    set_histogram(HistPtr hist) { _hist = hist; }
           HistPtr                 get_histogram() const { return _hist; }
 
-          RawRGBPtr               clone(size_t depth);
+          RawRGBPtr               share() const;
+          RawRGBPtr               clone(size_t depth) const;
+          bool                    narrow(size_t depth);
+          RawRGBPtr               convert(SampleFormat format, size_t depth = 16) const;
+          RawRGBPtr               to_planar() const;
+          RawRGBPtr               to_interleaved(PixelType type = eRGBA) const;
 
 private:
   size_t                          _width;
   size_t                          _height;
   size_t                          _depth;
   PixelType                       _type;
+  SampleFormat                    _format;
+  RawBufferPtr                    _storage;
   uint8_t*                        _buffer;
   HistPtr                         _hist;
+
+private:
+          void                    detach();
 };
 
 /*
@@ -187,6 +393,63 @@ public:
     for (ImagePtr img : array)
       push_back(img);
   }
+
+  // A box of its own for one consumer, the samples stay shared copy-on-write
+  ImageBox                        share() const
+  {
+    ImageBox result;
+    for (ImagePtr img : *this)
+    {
+      if (!img)
+      {
+        result.push_back(img);
+        continue;
+      }
+
+      RawRGBPtr bits = img->get_bits();
+      ImagePtr copy(bits ? bits->share() : bits);
+      *copy += *img;
+      result.push_back(copy);
+    }
+    return result;
+  }
+};
+
+#define DEFAULT_CONSUMER_QUEUE_DEPTH        (4)
+
+/*
+ * \\enum DropPolicy
+ *
+ * created on: Apr 15, 2020
+ *
+ * What an async consumer's queue does when the consumer can't keep up
+ */
+enum DropPolicy
+{
+  eDropNewest = 0,    // the new frame is refused
+  eDropOldest,        // the oldest queued frame makes room
+  eLatestOnly,        // only the most recent frame waits, depth 1
+  eBlock,             // the producer waits for room, nothing is lost
+
+  eNumDropPolicies
+};
+
+/*
+ * \\struct ConsumerStats
+ *
+ * created on: Apr 13, 2020
+ *
+ */
+struct ConsumerStats
+{
+  bool                            _async;
+  DropPolicy                      _policy;
+  size_t                          _sample;      // every Nth frame is delivered
+  size_t                          _queued;
+  size_t                          _capacity;
+  size_t                          _delivered;
+  size_t                          _dropped;     // lost to the queue policy
+  size_t                          _skipped;     // left out by sampling
 };
 
 class ImageConsumer;
@@ -195,6 +458,27 @@ class ImageConsumer;
  *
  * created on: Jul 2, 2019
  *
+ * Registration options (Metadata, not passed on to the images):
+ *   async            deliver on a thread of the consumer's own, through
+ *                    a bounded queue, consume() only enqueues. Implied
+ *                    by policy.
+ *   policy           block, drop_newest (default), drop_oldest or latest,
+ *                    see DropPolicy
+ *   queue_depth      frames the queue holds, DEFAULT_CONSUMER_QUEUE_DEPTH
+ *   sample           deliver every Nth frame only, sync or async
+ *
+ * Every consumer gets a box of its own through ImageBox::share(), so a
+ * consumer writing to a frame detaches it from the others.
+ *
+ * Synchronous consumers are called in consume() under the producer's
+ * lock. Blocking queues are fed last and outside of the lock, so the
+ * other consumers have their frame before the producer waits. They are
+ * still fed in the order the frames took the lock, whichever producer
+ * thread gets there first.
+ *
+ * Once unregister_consumer() returns the consumer isn't called any
+ * more, an async consumer gets its queued frames first, so it must not
+ * unregister itself from its own consume().
  */
 class ImageProducer
 {
@@ -206,9 +490,20 @@ public:
           void                    unregister_consumer(ImageConsumer*);
           void                    consume(ImageBox);
 
+          ConsumerStats           consumer_stats(ImageConsumer*) const;
+
+  static  DropPolicy              drop_policy(const std::string& name);
+  static  const char*             policy_name(DropPolicy policy);
+
+private:
+  struct Registration;
+  typedef std::shared_ptr<Registration> RegistrationPtr;
+
+  static  void                    release(RegistrationPtr);
+
 private:
-  typedef std::unordered_set<ImageConsumer*> consumer_set;
-  consumer_set                    _consumers;
+  typedef std::unordered_map<ImageConsumer*,RegistrationPtr> consumer_map;
+  consumer_map                    _consumers;
   mutable std::mutex              _mutex;
   Metadata                        _meta;
 };
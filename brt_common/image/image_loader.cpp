@@ -0,0 +1,271 @@
+/*
+ * image_loader.cpp
+ *
+ *  Created on: Mar 11, 2020
+ *      Author: daniel
+ */
+
+#include "image_loader.hpp"
+#include "raw_file.hpp"
+#include "raw_batch_reader.hpp"
+
+#include <iostream>
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\fn Constructor ImageLoader::ImageLoader
+ *
+ * created on: Mar 11, 2020
+ * author: daniel
+ *
+ */
+ImageLoader::ImageLoader(const std::vector<std::string>& files,
+                          size_t prefetch /*= DEFAULT_PREFETCH_DEPTH*/,
+                          size_t io_threads /*= DEFAULT_IO_THREADS*/,
+                          bool batched /*= false*/)
+: _files(files)
+, _prefetch((prefetch > 0) ? prefetch : 1)
+, _batched(batched)
+, _closed(true)
+, _scheduled(0)
+, _consumed(0)
+, _pending()
+, _mutex()
+, _cv()
+, _pool(io_threads, "img_load")
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  schedule();
+}
+
+/*
+ * \\fn Constructor ImageLoader::ImageLoader
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ */
+ImageLoader::ImageLoader(size_t prefetch /*= DEFAULT_PREFETCH_DEPTH*/,
+                          size_t io_threads /*= DEFAULT_IO_THREADS*/,
+                          bool batched /*= false*/)
+: _files()
+, _prefetch((prefetch > 0) ? prefetch : 1)
+, _batched(batched)
+, _closed(false)
+, _scheduled(0)
+, _consumed(0)
+, _pending()
+, _mutex()
+, _cv()
+, _pool(io_threads, "img_load")
+{
+}
+
+/*
+ * \\fn Destructor ImageLoader::~ImageLoader
+ *
+ * created on: Mar 11, 2020
+ * author: daniel
+ *
+ */
+ImageLoader::~ImageLoader()
+{
+  _pool.stop();
+}
+
+/*
+ * \\fn void ImageLoader::add
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ * The file starts loading right away if a prefetch slot is free
+ */
+void ImageLoader::add(const std::string& file)
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  if (_closed)
+    return;
+
+  _files.push_back(file);
+  schedule();
+  l.unlock();
+
+  _cv.notify_all();
+}
+
+/*
+ * \\fn void ImageLoader::close
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ */
+void ImageLoader::close()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  _closed = true;
+  l.unlock();
+
+  _cv.notify_all();
+}
+
+/*
+ * \\fn bool ImageLoader::next
+ *
+ * created on: Mar 11, 2020
+ * author: daniel
+ *
+ * Blocks until the next file in the list has been read, a file whose
+ * load threw is skipped like one that failed
+ */
+bool ImageLoader::next(std::string& filename, RawRGBPtr& image)
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  for (;;)
+  {
+    _cv.wait(l, [this]() { return _closed || !_pending.empty(); });
+    if (_pending.empty())
+      return false;
+
+    Pending pending = std::move(_pending.front());
+    _pending.pop_front();
+    _consumed++;
+
+    // Keep the pipeline full while the consumer works on this one
+    schedule();
+    l.unlock();
+
+    RawRGBPtr result;
+    try
+    {
+      result = pending._image.get();
+    }
+    catch (const std::exception& e)
+    {
+      std::cerr << "loader: " << pending._filename << ": " << e.what() << std::endl;
+    }
+    catch (...)
+    {
+      std::cerr << "loader: " << pending._filename << ": unable to load" << std::endl;
+    }
+
+    if (result)
+    {
+      filename = pending._filename;
+      image = result;
+      return true;
+    }
+
+    l.lock();
+  }
+}
+
+/*
+ * \\fn size_t ImageLoader::remaining
+ *
+ * created on: Mar 11, 2020
+ * author: daniel
+ *
+ * Files known so far, a fed loader may still get more
+ */
+size_t ImageLoader::remaining() const
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  return _files.size() - _consumed;
+}
+
+/*
+ * \\fn void ImageLoader::schedule
+ *
+ * created on: Mar 11, 2020
+ * author: daniel
+ *
+ * Called with _mutex held
+ */
+void ImageLoader::schedule()
+{
+  if (_batched)
+  {
+    schedule_batch();
+    return;
+  }
+
+  while ((_pending.size() < _prefetch) && (_scheduled < _files.size()))
+  {
+    Pending pending;
+    pending._filename = _files[_scheduled++];
+
+    std::string filename = pending._filename;
+    pending._image = _pool.submit([filename]()->RawRGBPtr
+    {
+      // Populate the mapping here, so the consumer never faults on it
+      return RawFile::load(filename.c_str(), true);
+    });
+
+    _pending.push_back(std::move(pending));
+  }
+}
+
+/*
+ * \\fn void ImageLoader::schedule_batch
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ * Hands every free prefetch slot to a single pool job. Waiting for the
+ * pipeline to drain below half way keeps the batches from degenerating
+ * into one file each. A fed loader with nothing in flight starts with
+ * what it has, waiting would hold back the first frame.
+ */
+void ImageLoader::schedule_batch()
+{
+  if ((_pending.size() > _prefetch / 2) || (_scheduled >= _files.size()))
+    return;
+
+  typedef std::vector<std::promise<RawRGBPtr>> Promises;
+  std::shared_ptr<Promises> promises(new Promises());
+  std::vector<std::string> batch;
+
+  while ((_pending.size() < _prefetch) && (_scheduled < _files.size()))
+  {
+    promises->push_back(std::promise<RawRGBPtr>());
+
+    Pending pending;
+    pending._filename = _files[_scheduled++];
+    pending._image = promises->back().get_future();
+
+    batch.push_back(pending._filename);
+    _pending.push_back(std::move(pending));
+  }
+
+  _pool.post([batch, promises]()
+  {
+    // io_uring instances are not shared between threads
+    thread_local RawBatchReader reader;
+
+    // Every promise is kept, a short result or a throw mustn't leave next() with a broken one
+    size_t done = 0;
+    try
+    {
+      std::vector<RawRGBPtr> images = reader.load(batch);
+      for (; done < promises->size(); done++)
+        (*promises)[done].set_value((done < images.size()) ? images[done] : RawRGBPtr());
+    }
+    catch (...)
+    {
+      for (; done < promises->size(); done++)
+        (*promises)[done].set_exception(std::current_exception());
+    }
+  });
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
@@ -0,0 +1,91 @@
+/*
+ * image_loader.hpp
+ *
+ *  Created on: Mar 11, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_IMAGE_LOADER_HPP_
+#define BRT_COMMON_IMAGE_IMAGE_LOADER_HPP_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+
+#include "image.hpp"
+#include "thread_pool.hpp"
+
+#define DEFAULT_PREFETCH_DEPTH              (4)
+#define DEFAULT_IO_THREADS                  (2)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\class ImageLoader
+ *
+ * created on: Mar 11, 2020
+ *
+ * Reads a list of raw files on a background pool, keeping up to
+ * prefetch frames in flight ahead of the consumer. Frames are handed
+ * out in list order; files that fail to load are skipped.
+ *
+ * With batched set, each pool job reads a group of files through a
+ * RawBatchReader (io_uring) instead of one file per job.
+ *
+ * Built without a list, the files are fed with add() while loading runs,
+ * loading starts with the first one. next() waits for more until close().
+ */
+class ImageLoader
+{
+public:
+  ImageLoader(const std::vector<std::string>& files,
+              size_t prefetch = DEFAULT_PREFETCH_DEPTH,
+              size_t io_threads = DEFAULT_IO_THREADS,
+              bool batched = false);
+  ImageLoader(size_t prefetch = DEFAULT_PREFETCH_DEPTH,
+              size_t io_threads = DEFAULT_IO_THREADS,
+              bool batched = false);
+  virtual ~ImageLoader();
+
+          void                    add(const std::string& file);
+          void                    close();
+
+          bool                    next(std::string& filename, RawRGBPtr& image);
+          size_t                  remaining() const;
+
+private:
+          void                    schedule();
+          void                    schedule_batch();
+
+private:
+  struct Pending
+  {
+    std::string                   _filename;
+    std::future<RawRGBPtr>        _image;
+  };
+
+  std::vector<std::string>        _files;
+  size_t                          _prefetch;
+  bool                            _batched;
+  bool                            _closed;      // no more add()
+  size_t                          _scheduled;
+  size_t                          _consumed;
+  std::deque<Pending>             _pending;
+  mutable std::mutex              _mutex;
+  std::condition_variable         _cv;
+  ThreadPool                      _pool;
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_IMAGE_LOADER_HPP_ */
@@ -6,9 +6,12 @@
  */
 
 #include "image_processor.hpp"
+#include "image_view.hpp"
+#include "stencil.hpp"
 
 #include <cmath>
 #include <algorithm>
+#include <limits>
 
 #define BITS_PER_PIXEL                      (1 << 16)
 #define SMALL_HIST_SIZE                     (9)
@@ -20,17 +23,6 @@ namespace jupiter
 namespace image
 {
 
-const size_t color_map[eNumTypes][NumColors] =
-{
-  //            Blue = 0, Green = 1, Red = 2,  Alpha = 3, Bayer = 4
-  /*eNone = 0*/  {  0,       0,          0,        0,          0     },
-  /*eBayer = 1*/ {  0,       0,          0,        0,          0     },
-  /*eRGB = 2*/   {  0,       1,          2,        0,          0     },
-  /*eBGR = 3*/   {  2,       1,          0,        0,          0     },
-  /*eRGBA= 4*/   {  0,       1,          2,        3,          0     },
-  /*eBGRA= 5*/   {  2,       1,          0,        3,          0     },
-};
-
 const size_t _type_size[eNumTypes] =
 {
   /*eNone = 0*/  1,
@@ -39,6 +31,8 @@ const size_t _type_size[eNumTypes] =
   /*eBGR = 3*/   3,
   /*eRGBA= 4*/   4,
   /*eBGRA= 5*/   4,
+  /*ePlanarRGB = 6*/  3,
+  /*ePlanarRGBA = 7*/ 4,
 };
 
 /*
@@ -90,17 +84,17 @@ template<typename T> void LAB::from(T* ptr,int type)
   double X,Y,Z;
 
   // Matrix multiplication
-  X = (0.412453 * static_cast<double>(ptr[color_map[type][Red]])  +
-       0.357580 * static_cast<double>(ptr[color_map[type][Green]])  +
-       0.180423 * static_cast<double>(ptr[color_map[type][Blue]])) / _Xn;
+  X = (0.412453 * static_cast<double>(ptr[channel_map[type][Red]])  +
+       0.357580 * static_cast<double>(ptr[channel_map[type][Green]])  +
+       0.180423 * static_cast<double>(ptr[channel_map[type][Blue]])) / _Xn;
 
-  Y = (0.212671 * static_cast<double>(ptr[color_map[type][Red]]) +
-       0.715160 * static_cast<double>(ptr[color_map[type][Green]]) +
-       0.072169 * static_cast<double>(ptr[color_map[type][Blue]]));
+  Y = (0.212671 * static_cast<double>(ptr[channel_map[type][Red]]) +
+       0.715160 * static_cast<double>(ptr[channel_map[type][Green]]) +
+       0.072169 * static_cast<double>(ptr[channel_map[type][Blue]]));
 
-  Z = (0.019334 * static_cast<double>(ptr[color_map[type][Red]]) +
-       0.119193 * static_cast<double>(ptr[color_map[type][Green]]) +
-       0.950227 * static_cast<double>(ptr[color_map[type][Blue]])) / _Zn;
+  Z = (0.019334 * static_cast<double>(ptr[channel_map[type][Red]]) +
+       0.119193 * static_cast<double>(ptr[channel_map[type][Green]]) +
+       0.950227 * static_cast<double>(ptr[channel_map[type][Blue]])) / _Zn;
 
   auto adjust = [](double value)->double
   {
@@ -160,11 +154,15 @@ Debayer::~Debayer()
  */
 RawRGBPtr Debayer::debayer(RawRGBPtr raw,bool outputBGR)
 {
+  // The GPU takes 16 bit integer samples, float ones come back at full scale
+  if (raw && (raw->packed() || raw->is_float()))
+    raw = raw->convert(eUnsigned, raw->is_float() ? 16 : raw->depth());
+
   if (!raw)
     return RawRGBPtr();
 
   size_t img_size = raw->width() * raw->height();
-  if (!_img_buffer.put((uint16_t*)raw->bytes(), img_size))
+  if (!_img_buffer.put((const uint16_t*)raw->cbytes(), img_size))
   {
     // assert
     return RawRGBPtr();
@@ -268,6 +266,11 @@ bool Debayer::get_histogram(HistPtr& histogram)
  */
 RawRGBPtr Debayer::debayer(RawRGBPtr raw,PixelType type)
 {
+  // The AHD passes read the mosaic several times, unpack it once up front.
+  // Float samples come back as 16 bit integers at full scale.
+  if (raw && (raw->packed() || raw->is_float()))
+    raw = raw->convert(eUnsigned, raw->is_float() ? 16 : raw->depth());
+
   return ahd_rgba<uint16_t>(raw,type);
 }
 
@@ -287,111 +290,90 @@ RawRGBPtr Debayer::biliner_interpolation(RawRGBPtr raw)
   if (raw->type() != eBayer)
     return raw;
 
-  RawRGBPtr result(new RawRGB(raw->width(), raw->height(), raw->depth(), eRGBA));
-  Pixel out(result);
-  Pixel in(raw);
+  if (raw->packed() || raw->is_float())
+    raw = raw->convert(eUnsigned, raw->is_float() ? 16 : raw->depth());
+
+  if (!raw)
+    return RawRGBPtr();
 
-  for (size_t y = 0; y < raw->height(); y++)
+  switch (BYTES_PER_PIXELS(raw->depth()))
   {
-    for (size_t x = 0; x < raw->width(); x++)
-    {
-      number r,g,b;
+  case 1:
+    return biliner_interpolation<uint8_t>(raw);
 
-      switch(position(x,y))
-      {
-      case eClearRed:
-        g = in(x, y).get();
-        if (y < (raw->height() - 1))
-          b += in(x, y + 1).get();
+  case 2:
+    return biliner_interpolation<uint16_t>(raw);
 
-        if (y > 0)
-          b += in(x, y - 1).get();
+  default:
+    break;
+  }
 
-        if (x < (raw->width() - 1))
-          r += in(x + 1, y).get();
+  return RawRGBPtr();
+}
 
-        if (x > 0)
-          r += in(x - 1, y).get();
-        break;
+/*
+ * \\fn template<typename T> RawRGBPtr Debayer::biliner_interpolation
+ *
+ * created on: Mar 4, 2020
+ * author: daniel
+ *
+ */
+template<typename T>
+RawRGBPtr Debayer::biliner_interpolation(RawRGBPtr raw)
+{
+  RawRGBPtr result(new RawRGB(raw->width(), raw->height(), raw->depth(), eRGBA));
+  if (result->empty())
+    return RawRGBPtr();
 
-      case eRed:
-        r = in(x, y).get();
-        if (y < (raw->height() - 1))
-        {
-          g += in(x, y + 1).get();
-          if (x < (raw->width() - 1))
-            b += in(x + 1, y + 1).get();
+  ImageView<const T, eBayer> in(*raw);
+  ImageView<T, eRGBA> out(*result);
 
-          if (x > 0)
-            b += in(x - 1, y + 1).get();
-        }
+  int width = in.width(), height = in.height();
 
-        if (y > 0)
-        {
-          g += in(x, y - 1).get();
-          if (x < (raw->width() - 1))
-            b += in(x + 1, y - 1).get();
+  // Mirroring keeps the Bayer parity, so a missing neighbour at the border
+  // is replaced by the same color on the other side
+  Stencil<T, 1, border::Mirror> bayer(in.row(0), width, height, in.pitch());
 
-          if (x > 0)
-            b += in(x - 1, y - 1).get();
-        }
+  for (int y = 0; y < height; y++)
+  {
+    typename ImageView<T, eRGBA>::iterator px = out.begin(y);
+    for (int x = 0; x < width; x++, ++px)
+    {
+      typename Stencil<T, 1, border::Mirror>::Window p = bayer.window(x,y);
+      uint32_t r,g,b;
 
-        if (x < (raw->width() - 1))
-          g += in(x + 1, y).get();
+      switch(position(x,y))
+      {
+      case eClearRed:
+        g = p(0,0);
+        b = (p(0,-1) + p(0,1)) >> 1;
+        r = (p(-1,0) + p(1,0)) >> 1;
+        break;
 
-        if (x > 0)
-          g += in(x - 1, y).get();
+      case eRed:
+        r = p(0,0);
+        g = (p(0,-1) + p(0,1) + p(-1,0) + p(1,0)) >> 2;
+        b = (p(-1,-1) + p(1,-1) + p(-1,1) + p(1,1)) >> 2;
         break;
 
       case eClearBlue:
-        g = in(x, y).get();
-        if (y < (raw->height() - 1))
-          r += in(x, y + 1).get();
-
-        if (y > 0)
-          r += in(x, y - 1).get();
-
-        if (x < (raw->width() - 1))
-          b += in(x + 1, y).get();
-
-        if (x > 0)
-          b += in(x - 1, y).get();
+        g = p(0,0);
+        r = (p(0,-1) + p(0,1)) >> 1;
+        b = (p(-1,0) + p(1,0)) >> 1;
         break;
 
       case eBlue:
-        b = in(x, y).get();
-        if (y < (raw->height() - 1))
-        {
-          g += in(x, y + 1).get();
-          if (x < (raw->width() - 1))
-            r += in(x + 1, y + 1).get();
-
-          if (x > 0)
-            r += in(x - 1, y + 1).get();
-        }
-
-        if (y > 0)
-        {
-          g += in(x, y - 1).get();
-          if (x < (raw->width() - 1))
-            r += in(x + 1, y - 1).get();
-
-          if (x > 0)
-            r += in(x - 1, y - 1).get();
-        }
-
-        if (x < (raw->width() - 1))
-          g += in(x + 1, y).get();
-
-        if (x > 0)
-          g += in(x - 1, y).get();
+      default:
+        b = p(0,0);
+        g = (p(0,-1) + p(0,1) + p(-1,0) + p(1,0)) >> 2;
+        r = (p(-1,-1) + p(1,-1) + p(-1,1) + p(1,1)) >> 2;
         break;
       }
 
-      out.set(Pixel::Red, r);
-      out.set(Pixel::Green, g);
-      out.set(Pixel::Blue, b);
-      out.set(Pixel::Alpha,(uint32_t)-1);
+      px.red() = static_cast<T>(r);
+      px.green() = static_cast<T>(g);
+      px.blue() = static_cast<T>(b);
+      px.alpha() = static_cast<T>(-1);
     }
   }
 
@@ -408,14 +390,53 @@ RawRGBPtr Debayer::biliner_interpolation(RawRGBPtr raw)
  */
 RawRGBPtr Debayer::ahd(RawRGBPtr raw)
 {
-  size_t width = raw->width(), height = raw->height();
+  if (!raw || (raw->type() != eBayer))
+    return RawRGBPtr();
+
+  switch (BYTES_PER_PIXELS(raw->depth()))
+  {
+  case 1:
+    return ahd<uint8_t>(raw);
+
+  case 2:
+    return ahd<uint16_t>(raw);
+
+  default:
+    break;
+  }
+
+  return RawRGBPtr();
+}
+
+/*
+ * \\fn template<typename T> RawRGBPtr Debayer::ahd
+ *
+ * created on: Mar 4, 2020
+ * author: daniel
+ *
+ */
+template<typename T>
+RawRGBPtr Debayer::ahd(RawRGBPtr raw)
+{
+  int width = static_cast<int>(raw->width()), height = static_cast<int>(raw->height());
+  const int max_value = static_cast<int>(std::numeric_limits<T>::max());
+
   // Interpolate Horizontal and Vertical
-  Pixel hr(RawRGBPtr(new RawRGB(width,height,raw->depth(),eRGBA)));
-  Pixel vr(RawRGBPtr(new RawRGB(width,height,raw->depth(),eRGBA)));
-  Pixel in(raw);
+  RawRGBPtr hr_img(new RawRGB(width,height,raw->depth(),eRGBA));
+  RawRGBPtr vr_img(new RawRGB(width,height,raw->depth(),eRGBA));
+  RawRGBPtr result(new RawRGB(width,height,raw->depth(),eRGBA));
+  if (hr_img->empty() || vr_img->empty() || result->empty())
+    return RawRGBPtr();
+
+  ImageView<const T, eBayer> in(*raw);
+  ImageView<T, eRGBA> hr(*hr_img);
+  ImageView<T, eRGBA> vr(*vr_img);
+  ImageView<T, eRGBA> out(*result);
 
-  LAB* vlab = new LAB[width * height];
-  LAB* hlab = new LAB[width * height];
+  PageArray<LAB> vlab_ws(width * height);
+  PageArray<LAB> hlab_ws(width * height);
+  LAB* vlab = vlab_ws.data();
+  LAB* hlab = hlab_ws.data();
 
   auto limit = [](int x,int a,int b)->int
   {
@@ -425,142 +446,150 @@ RawRGBPtr Debayer::ahd(RawRGBPtr raw)
       return std::max(a, std::min(x,b));
   };
 
+  // Samples outside of the frame read as zero
+  Stencil<T, 2> bayer(in.row(0), width, height, in.pitch());
+  Stencil<T, 1> hg(&hr.green(0,0), width, height, hr.pitch(), hr.step());
+  Stencil<T, 1> vg(&vr.green(0,0), width, height, vr.pitch(), vr.step());
+
   // First Green Colors
-  for (int y = 0;y < static_cast<int>(height); y++)
+  for (int y = 0;y < height; y++)
   {
-    for (int x = 0;x < static_cast<int>(width); x++)
+    for (int x = 0;x < width; x++)
     {
       ColorPos pos = position(x,y);
       if ((pos == eRed) || (pos == eBlue))
       {
-        int value = ((in(x-1,y) + in(x,y) + in(x+1,y)) * 2 - in(x-2,y) - in(x+2,y)) >> 2;
-        hr(x,y).set(Pixel::Green,limit(value,in(x-1,y),in(x+1,y)));
+        typename Stencil<T, 2>::Window p = bayer.window(x,y);
+
+        int value = ((p(-1,0) + p(0,0) + p(1,0)) * 2 - p(-2,0) - p(2,0)) >> 2;
+        hr.green(x,y) = static_cast<T>(limit(value,p(-1,0),p(1,0)));
 
-        value = ((in(x,y-1) + in(x,y) + in(x,y+1)) * 2 - in(x,y-2) - in(x,y+2)) >> 2;
-        vr(x,y).set(Pixel::Green,limit(value,in(x,y-1),in(x,y+1)));
+        value = ((p(0,-1) + p(0,0) + p(0,1)) * 2 - p(0,-2) - p(0,2)) >> 2;
+        vr.green(x,y) = static_cast<T>(limit(value,p(0,-1),p(0,1)));
       }
       else
       {
-        int value = in(x,y);
-        hr(x,y).set(Pixel::Green, value);
-        vr(x,y).set(Pixel::Green, value);
+        hr.green(x,y) = in(x,y);
+        vr.green(x,y) = in(x,y);
       }
 
-      hr(x,y).set(Pixel::Alpha, -1);
-      vr(x,y).set(Pixel::Alpha, -1);
+      hr.alpha(x,y) = static_cast<T>(-1);
+      vr.alpha(x,y) = static_cast<T>(-1);
     }
   }
 
   // Now Blue and Red
-  for (int y = 0;y < static_cast<int>(height); y++)
+  for (int y = 0;y < height; y++)
   {
-    for (int x = 0;x < static_cast<int>(width); x++)
+    for (int x = 0;x < width; x++)
     {
       ColorPos pos = position(x,y);
       int value;
 
+      typename Stencil<T, 2>::Window p = bayer.window(x,y);
+      typename Stencil<T, 1>::Window h = hg.window(x,y);
+      typename Stencil<T, 1>::Window v = vg.window(x,y);
+
       switch (pos)
       {
       case eRed:
-        hr(x,y).set(Pixel::Red,in(x,y));
-        vr(x,y).set(Pixel::Red,in(x,y));
+        hr.red(x,y) = in(x,y);
+        vr.red(x,y) = in(x,y);
 
         // horizontal
-        value = hr(x,y).get(Pixel::Green) +
-                  (((in(x-1,y-1) - hr(x-1,y-1).get(Pixel::Green)) +
-                    (in(x-1,y+1) - hr(x-1,y+1).get(Pixel::Green)) +
-                    (in(x+1,y-1) - hr(x+1,y-1).get(Pixel::Green)) +
-                    (in(x+1,y+1) - hr(x+1,y+1).get(Pixel::Green))) >> 2);
+        value = h(0,0) +
+                  (((p(-1,-1) - h(-1,-1)) +
+                    (p(-1,1) - h(-1,1)) +
+                    (p(1,-1) - h(1,-1)) +
+                    (p(1,1) - h(1,1))) >> 2);
 
-        hr(x,y).set(Pixel::Blue, limit(value,0,((1 << 16) - 1)));
+        hr.blue(x,y) = static_cast<T>(limit(value,0,max_value));
 
         // vertical
-        value = vr(x,y).get(Pixel::Green) +
-                  (((in(x-1,y-1) - vr(x-1,y-1).get(Pixel::Green)) +
-                    (in(x-1,y+1) - vr(x-1,y+1).get(Pixel::Green)) +
-                    (in(x+1,y-1) - vr(x+1,y-1).get(Pixel::Green)) +
-                    (in(x+1,y+1) - vr(x+1,y+1).get(Pixel::Green))) >> 2);
+        value = v(0,0) +
+                  (((p(-1,-1) - v(-1,-1)) +
+                    (p(-1,1) - v(-1,1)) +
+                    (p(1,-1) - v(1,-1)) +
+                    (p(1,1) - v(1,1))) >> 2);
 
-        vr(x,y).set(Pixel::Blue, limit(value,0,((1 << 16) - 1)));
+        vr.blue(x,y) = static_cast<T>(limit(value,0,max_value));
         break;
 
       case eBlue:
-        hr(x,y).set(Pixel::Blue,in(x,y));
-        vr(x,y).set(Pixel::Blue,in(x,y));
+        hr.blue(x,y) = in(x,y);
+        vr.blue(x,y) = in(x,y);
 
         // horizontal
-        value = hr(x,y).get(Pixel::Green) +
-                  (((in(x-1,y-1) - hr(x-1,y-1).get(Pixel::Green)) +
-                    (in(x-1,y+1) - hr(x-1,y+1).get(Pixel::Green)) +
-                    (in(x+1,y-1) - hr(x+1,y-1).get(Pixel::Green)) +
-                    (in(x+1,y+1) - hr(x+1,y+1).get(Pixel::Green))) >> 2);
+        value = h(0,0) +
+                  (((p(-1,-1) - h(-1,-1)) +
+                    (p(-1,1) - h(-1,1)) +
+                    (p(1,-1) - h(1,-1)) +
+                    (p(1,1) - h(1,1))) >> 2);
 
-        hr(x,y).set(Pixel::Red, limit(value,0,((1 << 16) - 1)));
+        hr.red(x,y) = static_cast<T>(limit(value,0,max_value));
 
         // vertical
-        value = vr(x,y).get(Pixel::Green) +
-                  (((in(x-1,y-1) - vr(x-1,y-1).get(Pixel::Green)) +
-                    (in(x-1,y+1) - vr(x-1,y+1).get(Pixel::Green)) +
-                    (in(x+1,y-1) - vr(x+1,y-1).get(Pixel::Green)) +
-                    (in(x+1,y+1) - vr(x+1,y+1).get(Pixel::Green))) >> 2);
+        value = v(0,0) +
+                  (((p(-1,-1) - v(-1,-1)) +
+                    (p(-1,1) - v(-1,1)) +
+                    (p(1,-1) - v(1,-1)) +
+                    (p(1,1) - v(1,1))) >> 2);
 
-        vr(x,y).set(Pixel::Red, limit(value,0,((1 << 16) - 1)));
+        vr.red(x,y) = static_cast<T>(limit(value,0,max_value));
         break;
 
       case eClearRed:
         // horizontal
-        value = hr(x,y).get(Pixel::Green) + ((in(x-1,y) - hr(x-1,y).get(Pixel::Green) + in(x+1,y) - hr(x+1,y).get(Pixel::Green)) >> 1);
-        hr(x,y).set(Pixel::Red, limit(value,0,((1 << 16) - 1)));
+        value = h(0,0) + ((p(-1,0) - h(-1,0) + p(1,0) - h(1,0)) >> 1);
+        hr.red(x,y) = static_cast<T>(limit(value,0,max_value));
 
-        value = hr(x,y).get(Pixel::Green) + ((in(x,y-1) - hr(x,y-1).get(Pixel::Green) + in(x,y+1) - hr(x,y+1).get(Pixel::Green)) >> 1);
-        hr(x,y).set(Pixel::Blue, limit(value,0,((1 << 16) - 1)));
+        value = h(0,0) + ((p(0,-1) - h(0,-1) + p(0,1) - h(0,1)) >> 1);
+        hr.blue(x,y) = static_cast<T>(limit(value,0,max_value));
 
         // vertical
-        value = vr(x,y).get(Pixel::Green) + ((in(x-1,y) - vr(x-1,y).get(Pixel::Green) + in(x+1,y) - vr(x+1,y).get(Pixel::Green)) >> 1);
-        vr(x,y).set(Pixel::Red, limit(value,0,((1 << 16) - 1)));
+        value = v(0,0) + ((p(-1,0) - v(-1,0) + p(1,0) - v(1,0)) >> 1);
+        vr.red(x,y) = static_cast<T>(limit(value,0,max_value));
 
-        value = vr(x,y).get(Pixel::Green) + ((in(x,y-1) - vr(x,y-1).get(Pixel::Green) + in(x,y+1) - vr(x,y+1).get(Pixel::Green)) >> 1);
-        vr(x,y).set(Pixel::Blue, limit(value,0,((1 << 16) - 1)));
+        value = v(0,0) + ((p(0,-1) - v(0,-1) + p(0,1) - v(0,1)) >> 1);
+        vr.blue(x,y) = static_cast<T>(limit(value,0,max_value));
         break;
 
       case eClearBlue:
         // horizontal
-        value = hr(x,y).get(Pixel::Green) + ((in(x-1,y) - hr(x-1,y).get(Pixel::Green) + in(x+1,y) - hr(x+1,y).get(Pixel::Green)) >> 1);
-        hr(x,y).set(Pixel::Blue, limit(value,0,((1 << 16) - 1)));
+        value = h(0,0) + ((p(-1,0) - h(-1,0) + p(1,0) - h(1,0)) >> 1);
+        hr.blue(x,y) = static_cast<T>(limit(value,0,max_value));
 
-        value = hr(x,y).get(Pixel::Green) + ((in(x,y-1) - hr(x,y-1).get(Pixel::Green) + in(x,y+1) - hr(x,y+1).get(Pixel::Green)) >> 1);
-        hr(x,y).set(Pixel::Red, limit(value,0,((1 << 16) - 1)));
+        value = h(0,0) + ((p(0,-1) - h(0,-1) + p(0,1) - h(0,1)) >> 1);
+        hr.red(x,y) = static_cast<T>(limit(value,0,max_value));
 
         // vertical
-        value = vr(x,y).get(Pixel::Green) + ((in(x-1,y) - vr(x-1,y).get(Pixel::Green) + in(x+1,y) - vr(x+1,y).get(Pixel::Green)) >> 1);
-        vr(x,y).set(Pixel::Blue, limit(value,0,((1 << 16) - 1)));
+        value = v(0,0) + ((p(-1,0) - v(-1,0) + p(1,0) - v(1,0)) >> 1);
+        vr.blue(x,y) = static_cast<T>(limit(value,0,max_value));
 
-        value = vr(x,y).get(Pixel::Green) + ((in(x,y-1) - vr(x,y-1).get(Pixel::Green) + in(x,y+1) - vr(x,y+1).get(Pixel::Green)) >> 1);
-        vr(x,y).set(Pixel::Red, limit(value,0,((1 << 16) - 1)));
+        value = v(0,0) + ((p(0,-1) - v(0,-1) + p(0,1) - v(0,1)) >> 1);
+        vr.red(x,y) = static_cast<T>(limit(value,0,max_value));
         break;
       }
 
-      vlab[x + y * width].from_pixel(vr(x,y));
-      hlab[x + y * width].from_pixel(hr(x,y));
+      vlab[x + y * width].from(vr.pixel(x,y),eRGBA);
+      hlab[x + y * width].from(hr.pixel(x,y),eRGBA);
     }
   }
 
   auto get_lab = [width,height](int x,int y, LAB* lab)->LAB
   {
-    int offset = y * width + x;
-    if (offset < 0)
+    if ((x < 0) || (y < 0) || (x >= width) || (y >= height))
       return LAB();
 
-    return lab[offset];
+    return lab[y * width + x];
   };
 
   auto sqr = [](double v)->double { return v*v; };
 
-  Pixel out(RawRGBPtr(new RawRGB(width,height,raw->depth(),eRGBA)));
-
-  for (int y = 0;y < static_cast<int>(raw->height()); y++)
+  for (int y = 0;y < height; y++)
   {
-    for (int x = 0;x < static_cast<int>(raw->width()); x++)
+    typename ImageView<T, eRGBA>::iterator px = out.begin(y);
+    for (int x = 0;x < width; x++, ++px)
     {
       double lv[2],lh[2],cv[2],ch[2];
       int hh = 0,hv = 0;
@@ -591,22 +620,27 @@ RawRGBPtr Debayer::ahd(RawRGBPtr raw)
 
 
       if (hh > hv)
-        out(x,y) = hr(x,y);
+      {
+        px.red() = hr.red(x,y);
+        px.green() = hr.green(x,y);
+        px.blue() = hr.blue(x,y);
+      }
       else if (hv > hh)
-        out(x,y) = vr(x,y);
+      {
+        px.red() = vr.red(x,y);
+        px.green() = vr.green(x,y);
+        px.blue() = vr.blue(x,y);
+      }
       else //if (hv == hh)
       {
-        out.set(Pixel::Red,(hr.get(Pixel::Red) + vr.get(Pixel::Red)) >> 1);
-        out.set(Pixel::Green,(hr.get(Pixel::Green) + vr.get(Pixel::Green)) >> 1);
-        out.set(Pixel::Blue,(hr.get(Pixel::Blue) + vr.get(Pixel::Blue)) >> 1);
-        out.set(Pixel::Alpha,-1);
+        px.red() = static_cast<T>((hr.red(x,y) + vr.red(x,y)) >> 1);
+        px.green() = static_cast<T>((hr.green(x,y) + vr.green(x,y)) >> 1);
+        px.blue() = static_cast<T>((hr.blue(x,y) + vr.blue(x,y)) >> 1);
       }
+      px.alpha() = static_cast<T>(-1);
     }
   }
 
-  delete[] vlab;
-  delete[] hlab;
-
 #if MEDIAN
 #define SWAP(a,b)                           { int temp =(a );( a)=(b );( b)= temp ; }
 #define SORT(a,b)                           { if ((a)>(b)) SWAP((a),(b )); }
@@ -667,7 +701,7 @@ RawRGBPtr Debayer::ahd(RawRGBPtr raw)
   }
 #endif
 
-  return out.image();
+  return result;
 }
 
 /*
@@ -686,16 +720,22 @@ RawRGBPtr Debayer::ahd_rgba(RawRGBPtr raw,PixelType type)
   int width = static_cast<int>(raw->width()),
       height = static_cast<int>(raw->height());
 
+  // Planar output is produced straight from the final pass,
+  // the intermediate planes stay interleaved
+  PixelType work_type = is_planar(type) ? eRGBA : type;
+
   // Interpolate Horizontal and Vertical
-  RawRGBPtr hr(new RawRGB(width,height,raw->depth(),type));
-  RawRGBPtr vr(new RawRGB(width,height,raw->depth(),type));
+  RawRGBPtr hr(new RawRGB(width,height,raw->depth(),work_type));
+  RawRGBPtr vr(new RawRGB(width,height,raw->depth(),work_type));
 
   T*  hrp = reinterpret_cast<T*>(hr->bytes());
   T*  vrp = reinterpret_cast<T*>(vr->bytes());
-  T*  rawp = reinterpret_cast<T*>(raw->bytes());
+  const T*  rawp = reinterpret_cast<const T*>(raw->cbytes());
 
-  LAB* vlab = new LAB[width * height];
-  LAB* hlab = new LAB[width * height];
+  PageArray<LAB> vlab_ws(width * height);
+  PageArray<LAB> hlab_ws(width * height);
+  LAB* vlab = vlab_ws.data();
+  LAB* hlab = hlab_ws.data();
 
   auto limit = [](int x,int a,int b)->int
   {
@@ -705,12 +745,16 @@ RawRGBPtr Debayer::ahd_rgba(RawRGBPtr raw,PixelType type)
       return std::max(a, std::min(x,b));
   };
 
-  const int go = color_map[type][Green]; //green offset
-  const int ro = color_map[type][Red]; //red offset
-  const int bo = color_map[type][Blue]; //blue offset
-  const int ao = color_map[type][Alpha]; //alpha offset
+  const int go = channel_map[work_type][Green]; //green offset
+  const int ro = channel_map[work_type][Red]; //red offset
+  const int bo = channel_map[work_type][Blue]; //blue offset
+  const int ao = channel_map[work_type][Alpha]; //alpha offset
+
+#define _t(x) (x) * _type_size[work_type]
+  Stencil<T, 2> in(rawp, width, height, width);
+  Stencil<T, 1> hg(hrp + go, width, height, _t(width), _t(1));
+  Stencil<T, 1> vg(vrp + go, width, height, _t(width), _t(1));
 
-#define _t(x) (x) * _type_size[type]
   // First Green Colors
   for (int y = 0;y < height; y++)
   {
@@ -722,33 +766,24 @@ RawRGBPtr Debayer::ahd_rgba(RawRGBPtr raw,PixelType type)
       ColorPos pos = position(x,y);
       if ((pos == eRed) || (pos == eBlue))
       {
-        int px[] = { (x > 0) ? rawp[io - 1] : 0,                // x-1,y
-                     (x < (width - 1)) ? rawp[io + 1] : 0,      // x+1,y
-                     (x > 1) ? rawp[io - 2] : 0,                // x-2,y
-                     (x < (width - 2)) ? rawp[io + 2] : 0 };    // x+2,y
+        typename Stencil<T, 2>::Window p = in.window(x,y);
 
-        int value =  ((( px[0] + rawp[io] + px[1]) * 2) - px[2] - px[3]) >> 2;
-        hrp[oo + go] = static_cast<T>(limit(value,px[0],px[1]));
+        int value =  ((( p(-1,0) + p(0,0) + p(1,0)) * 2) - p(-2,0) - p(2,0)) >> 2;
+        hrp[oo + go] = static_cast<T>(limit(value,p(-1,0),p(1,0)));
 
-        int py[] = { (y > 0) ? rawp[io - width] : 0,                    // x,y-1
-                     (y < (height - 1)) ? rawp[io + width] : 0,         // x,y+1
-                     (y > 1) ? rawp[io - (2 * width)] : 0,              // x,y-2
-                     (y < (height - 2))?rawp[io + (2 * width)] : 0 };   // x,y+2
-
-        value =  ((( py[0] + rawp[io] + py[1]) * 2) - py[2] - py[3]) >> 2;
-        vrp[oo + go] = static_cast<T>(limit(value,py[0],py[1]));
+        value =  ((( p(0,-1) + p(0,0) + p(0,1)) * 2) - p(0,-2) - p(0,2)) >> 2;
+        vrp[oo + go] = static_cast<T>(limit(value,p(0,-1),p(0,1)));
       }
       else
       {
         hrp[oo + go] = vrp[oo + go] = rawp[io];
       }
 
-      hrp[oo + ao] = vrp[oo + ao] = static_cast<T>(-1);
+      if (ao >= 0)
+        hrp[oo + ao] = vrp[oo + ao] = static_cast<T>(-1);
     }
   }
 
-  auto sum = [](int arr[4])->int { return arr[0] + arr[1] + arr[2] + arr[3]; };
-
   // Now Blue and Red
   for (int y = 0;y < static_cast<int>(height); y++)
   {
@@ -767,26 +802,17 @@ RawRGBPtr Debayer::ahd_rgba(RawRGBPtr raw,PixelType type)
         {
           hrp[oo + ((pos == eRed) ? ro : bo)] = vrp[oo + ((pos == eRed) ? ro : bo)] = rawp[io];
 
-          int pp[] = { (x > 0 && y > 0) ? rawp[io - width - 1] : 0,                           // x-1,y-1
-                       (x > 0 && y < (height - 1)) ? rawp[io + width - 1] : 0,                // x-1,y+1
-                       (x < (width - 1) && y > 0) ? rawp[io - width + 1] : 0,                 // x+1,y-1
-                       (x < (width - 1) && y < (height - 1)) ? rawp[io + width + 1] : 0};     // x+1,y+1
+          typename Stencil<T, 2>::Window pp = in.window(x,y);
+          typename Stencil<T, 1>::Window ph = hg.window(x,y);
+          typename Stencil<T, 1>::Window pv = vg.window(x,y);
 
-          int ph[] = { (x > 0 && y > 0) ? hrp[oo - _t(width + 1) + go] : 0,                       // x-1,y-1
-                       (x > 0 && y < (height - 1)) ? hrp[oo + _t(width - 1) + go] : 0,            // x-1,y+1
-                       (x < (width - 1) && y > 0) ? hrp[oo - _t(width - 1) + go] : 0,             // x+1,y-1
-                       (x < (width - 1) && y < (height - 1)) ? hrp[oo + _t(width + 1) + go] : 0}; // x+1,y+1
-
-          int pv[] = { (x > 0 && y > 0) ? vrp[oo - _t(width + 1) + go] : 0,                           // x-1,y-1
-                       (x > 0 && y < (height - 1)) ? vrp[oo + _t(width - 1) + go] : 0,                // x-1,y+1
-                       (x < (width - 1) && y > 0) ? vrp[oo - _t(width - 1) + go] : 0,                 // x+1,y-1
-                       (x < (width - 1) && y < (height - 1)) ? vrp[oo + _t(width + 1) + go] : 0};     // x+1,y+1
+          int diagonal = pp(-1,-1) + pp(-1,1) + pp(1,-1) + pp(1,1);
 
           // horizontal
-          value = hrp[oo + go] + ((sum(pp) - sum(ph)) >> 2);
+          value = hrp[oo + go] + ((diagonal - (ph(-1,-1) + ph(-1,1) + ph(1,-1) + ph(1,1))) >> 2);
           hrp[oo + ((pos == eRed) ? bo : ro)] = static_cast<T>(limit(value,0,((1 << 16) - 1)));
 
-          value = vrp[oo + go] + ((sum(pp) - sum(pv)) >> 2);
+          value = vrp[oo + go] + ((diagonal - (pv(-1,-1) + pv(-1,1) + pv(1,-1) + pv(1,1))) >> 2);
           vrp[oo + ((pos == eRed) ? bo : ro)] = static_cast<T>(limit(value,0,((1 << 16) - 1)));
         }
         break;
@@ -794,45 +820,57 @@ RawRGBPtr Debayer::ahd_rgba(RawRGBPtr raw,PixelType type)
       case eClearBlue:
       case eClearRed:
         {
-          int pp[] = { (x > 0) ? rawp[io - 1] : 0,                       // x-1,y
-                       (y > 0) ? rawp[io - width] : 0,                   // x,y-1
-                       (x < (width - 1)) ? rawp[io + 1] : 0,             // x+1,y
-                       (y < (height - 1)) ? rawp[io + width] : 0};       // x,y+1
-
-          int ph[] = { (x > 0) ? hrp[oo - _t(1) + go] : 0,                    // x-1,y
-                       (y > 0) ? hrp[oo - _t(width) + go] : 0,                // x,y-1
-                       (x < (width - 1)) ? hrp[oo + _t(1) + go] : 0,          // x+1,y
-                       (y < (height - 1)) ? hrp[oo + _t(width) + go] : 0};    // x,y+1
-
-          int pv[] = { (x > 0) ? vrp[oo - _t(1) + go] : 0,                    // x-1,y
-                       (y > 0) ? vrp[oo - _t(width) + go] : 0,                // x,y-1
-                       (x < (width - 1)) ? vrp[oo + _t(1) + go] : 0,          // x+1,y
-                       (y < (height - 1)) ? vrp[oo + _t(width) + go] : 0};    // x,y+1
-
-          value = hrp[oo + go] + ((pp[0] - ph[0] + pp[2] - ph[2]) >> 1);
+          typename Stencil<T, 2>::Window pp = in.window(x,y);
+          typename Stencil<T, 1>::Window ph = hg.window(x,y);
+          typename Stencil<T, 1>::Window pv = vg.window(x,y);
+
+          value = hrp[oo + go] + ((pp(-1,0) - ph(-1,0) + pp(1,0) - ph(1,0)) >> 1);
           hrp[oo + ((pos == eClearRed) ? ro : bo)] = static_cast<T>(limit(value,0,((1 << 16) - 1)));
 
-          value = hrp[oo + go] + ((pp[1] - ph[1] + pp[3] - ph[3]) >> 1);
+          value = hrp[oo + go] + ((pp(0,-1) - ph(0,-1) + pp(0,1) - ph(0,1)) >> 1);
           hrp[oo + ((pos == eClearRed) ? bo : ro)] = static_cast<T>(limit(value,0,((1 << 16) - 1)));
 
-          value = vrp[oo + go] + ((pp[0] - pv[0] + pp[2] - pv[2]) >> 1);
+          value = vrp[oo + go] + ((pp(-1,0) - pv(-1,0) + pp(1,0) - pv(1,0)) >> 1);
           vrp[oo + ((pos == eClearRed) ? ro : bo)] = static_cast<T>(limit(value,0,((1 << 16) - 1)));
 
-          value = vrp[oo + go] + ((pp[1] - pv[1] + pp[3] - pv[3]) >> 1);
+          value = vrp[oo + go] + ((pp(0,-1) - pv(0,-1) + pp(0,1) - pv(0,1)) >> 1);
           vrp[oo + ((pos == eClearRed) ? bo : ro)] = static_cast<T>(limit(value,0,((1 << 16) - 1)));
         }
         break;
 
       }
-      vlab[io].from<T>(vrp + oo, type);
-      hlab[io].from<T>(hrp + oo, type);
+      vlab[io].from<T>(vrp + oo, work_type);
+      hlab[io].from<T>(hrp + oo, work_type);
     }
   }
 
   auto sqr = [](double v)->double { return v*v; };
 
+  Stencil<LAB, 1> hl(hlab, width, height, width);
+  Stencil<LAB, 1> vl(vlab, width, height, width);
+
   RawRGBPtr result(new RawRGB(width,height,raw->depth(),type));
-  T*  rsp = reinterpret_cast<T*>(result->bytes());
+
+  // Output channel pointers, either into separate planes or
+  // into one interleaved buffer with a pixel sized step
+  T*  rsp[NumColors] = { nullptr, nullptr, nullptr, nullptr, nullptr };
+  size_t step = 1;
+  if (result->planar())
+  {
+    rsp[Red] = reinterpret_cast<T*>(result->plane(0));
+    rsp[Green] = reinterpret_cast<T*>(result->plane(1));
+    rsp[Blue] = reinterpret_cast<T*>(result->plane(2));
+    rsp[Alpha] = reinterpret_cast<T*>(result->plane(3));
+  }
+  else
+  {
+    step = _type_size[type];
+    for (int color = Blue; color <= Alpha; color++)
+    {
+      if (channel_map[type][color] >= 0)
+        rsp[color] = reinterpret_cast<T*>(result->bytes()) + channel_map[type][color];
+    }
+  }
 
   for (int y = 0;y < height; y++)
   {
@@ -844,23 +882,20 @@ RawRGBPtr Debayer::ahd_rgba(RawRGBPtr raw,PixelType type)
       int io = x + y * width;
       int oo = _t(io);
 
-      lh[0] = local_abs(hlab[io].L(),(x > 0) ? hlab[io - 1].L() : 0);
-      lh[1] = local_abs(hlab[io].L(),(x < (width - 1)) ? hlab[io + 1].L() : 0);
-
-      lv[0] = local_abs(vlab[io].L(),(y > 0) ? vlab[io - width].L() : 0);
-      lv[1] = local_abs(vlab[io].L(),(y < (height - 1)) ? vlab[io + width].L() : 0);
+      typename Stencil<LAB, 1>::Window h = hl.window(x,y);
+      typename Stencil<LAB, 1>::Window v = vl.window(x,y);
 
-      ch[0] = sqr(hlab[io].a() - ((x > 0)?hlab[io - 1].a():0)) +
-              sqr(hlab[io].b() - ((x > 0)?hlab[io - 1].b():0));
+      lh[0] = local_abs(hlab[io].L(),h(-1,0).L());
+      lh[1] = local_abs(hlab[io].L(),h(1,0).L());
 
-      ch[1] = sqr(hlab[io].a() - ((x < (width - 1))?hlab[io + 1].a():0)) +
-              sqr(hlab[io].b() - ((x < (width - 1))?hlab[io + 1].b():0));
+      lv[0] = local_abs(vlab[io].L(),v(0,-1).L());
+      lv[1] = local_abs(vlab[io].L(),v(0,1).L());
 
-      cv[0] = sqr(vlab[io].a() - ((y > 0)?vlab[io - width].a():0)) +
-              sqr(vlab[io].b() - ((y > 0)?vlab[io - width].b():0));
+      ch[0] = sqr(hlab[io].a() - h(-1,0).a()) + sqr(hlab[io].b() - h(-1,0).b());
+      ch[1] = sqr(hlab[io].a() - h(1,0).a()) + sqr(hlab[io].b() - h(1,0).b());
 
-      cv[1] = sqr(vlab[io].a() - ((y < (height - 1))?vlab[io + width].a():0)) +
-              sqr(vlab[io].b() - ((y < (height - 1))?vlab[io + width].b():0));
+      cv[0] = sqr(vlab[io].a() - v(0,-1).a()) + sqr(vlab[io].b() - v(0,-1).b());
+      cv[1] = sqr(vlab[io].a() - v(0,1).a()) + sqr(vlab[io].b() - v(0,1).b());
 
       double eps_l = std::min(std::max(lh[0],lh[1]),std::max(lv[0],lv[1]));
       double eps_c = std::min(std::max(ch[0],ch[1]),std::max(cv[0],cv[1]));
@@ -874,23 +909,27 @@ RawRGBPtr Debayer::ahd_rgba(RawRGBPtr raw,PixelType type)
           hv++;
       }
 
-      if (hh > hv)
-        memcpy(rsp + oo, hrp + oo,sizeof(T) * 4);
-      else if (hv > hh)
-        memcpy(rsp + oo, vrp + oo,sizeof(T) * 4);
+      size_t po = io * step; // result offset
+      const T* src = (hh > hv) ? hrp + oo : (hv > hh) ? vrp + oo : nullptr;
+
+      if (src != nullptr)
+      {
+        rsp[Red][po] = src[ro];
+        rsp[Green][po] = src[go];
+        rsp[Blue][po] = src[bo];
+      }
       else //if (hv == hh)
       {
-        rsp[oo + ro] = (hrp[oo + ro] + vrp[oo + ro]) >> 1;
-        rsp[oo + go] = (hrp[oo + go] + vrp[oo + go]) >> 1;
-        rsp[oo + bo] = (hrp[oo + bo] + vrp[oo + bo]) >> 1;
-        rsp[oo + ao] = static_cast<T>(-1);
+        rsp[Red][po] = (hrp[oo + ro] + vrp[oo + ro]) >> 1;
+        rsp[Green][po] = (hrp[oo + go] + vrp[oo + go]) >> 1;
+        rsp[Blue][po] = (hrp[oo + bo] + vrp[oo + bo]) >> 1;
       }
+
+      if (rsp[Alpha] != nullptr)
+        rsp[Alpha][po] = static_cast<T>(-1);
     }
   }
 
-  delete[] vlab;
-  delete[] hlab;
-
   return result;
 }
 
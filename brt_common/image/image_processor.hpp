@@ -123,6 +123,12 @@ private:
           // Adaptive Homogeneity-Directed
           RawRGBPtr               ahd(RawRGBPtr raw);
 
+          template<typename T>
+          RawRGBPtr               biliner_interpolation(RawRGBPtr raw);
+
+          template<typename T>
+          RawRGBPtr               ahd(RawRGBPtr raw);
+
           template<typename T>
           RawRGBPtr               ahd_rgba(RawRGBPtr raw,PixelType);
 
@@ -138,19 +144,6 @@ private:
     return static_cast<ColorPos>((x & 1) + (y & 1) * 2);
   };
 
-  struct number
-  {
-    number() : _val(0), _div(0) {}
-    number(uint32_t value): _val(value), _div(1) {}
-
-    number& operator+=(uint32_t value) { _val += value; _div++; return *this; }
-    number& operator=(uint32_t value) { _val = value; _div = 1; return *this; }
-    operator uint32_t () const { return _val / _div; }
-
-    uint32_t    _val;
-    uint32_t    _div;
-  };
-
   void                            green_plane(RawRGBPtr src,RawRGBPtr dst);
   void                            red_blue_plane(RawRGBPtr src,RawRGBPtr dst);
 
@@ -0,0 +1,166 @@
+/*
+ * image_view.hpp
+ *
+ *  Created on: Mar 4, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_IMAGE_VIEW_HPP_
+#define BRT_COMMON_IMAGE_IMAGE_VIEW_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+#include "image.hpp"
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\struct Layout
+ *
+ * created on: Mar 4, 2020
+ *
+ * Compile time channel offsets, taken from channel_map so views, the
+ * demosaic and the planar conversions share the one channel order
+ */
+template<PixelType type>
+struct Layout
+{
+  enum
+  {
+    channels = (channel_map[type][eAlphaChannel] < 0) ? 3 : 4,
+    planar = ((type == ePlanarRGB) || (type == ePlanarRGBA)) ? 1 : 0,
+    blue = channel_map[type][eBlueChannel],
+    green = channel_map[type][eGreenChannel],
+    red = channel_map[type][eRedChannel],
+    alpha = channel_map[type][eAlphaChannel]
+  };
+};
+
+// The mosaic sample stands for every color
+template<>
+struct Layout<eBayer>
+{
+  enum { channels = 1, planar = 0, blue = 0, green = 0, red = 0, alpha = -1 };
+};
+
+/*
+ * \\class ImageView
+ *
+ * created on: Mar 4, 2020
+ *
+ * Non owning typed accessor over RawRGB storage. Sample type and layout
+ * are template parameters, so every access is plain pointer arithmetic.
+ * Use a const sample type for read only views, those never detach a
+ * shared buffer.
+ */
+template<typename T, PixelType type>
+class ImageView
+{
+public:
+  typedef Layout<type>            layout;
+  typedef T                       value_type;
+
+  /*
+   * \\class iterator
+   *
+   * created on: Mar 4, 2020
+   *
+   * Walks the pixels of one row
+   */
+  class iterator
+  {
+  public:
+    iterator(T* ptr, size_t channel_stride) : _ptr(ptr), _channel_stride(channel_stride) {}
+
+            iterator&               operator++() { _ptr += ImageView::step(); return *this; }
+            bool                    operator==(const iterator& other) const { return _ptr == other._ptr; }
+            bool                    operator!=(const iterator& other) const { return _ptr != other._ptr; }
+
+            T&                      operator*() const { return *_ptr; }
+            T*                      pixel() const { return _ptr; }
+
+            template<int C>
+            T&                      channel() const { return _ptr[C * _channel_stride]; }
+
+            T&                      red() const { return channel<layout::red>(); }
+            T&                      green() const { return channel<layout::green>(); }
+            T&                      blue() const { return channel<layout::blue>(); }
+            T&                      alpha() const { return channel<layout::alpha>(); }
+
+  private:
+    T*                              _ptr;
+    size_t                          _channel_stride;
+  };
+
+public:
+  ImageView(T* data, int width, int height, size_t pitch, size_t plane_stride = 0)
+  : _data(data), _width(width), _height(height), _pitch(pitch), _plane_stride(plane_stride) {}
+
+  explicit ImageView(RawRGB& image)
+  : _data(data_of(image, std::is_const<T>()))
+  , _width(static_cast<int>(image.width()))
+  , _height(static_cast<int>(image.height()))
+  , _pitch(image.pitch() / sizeof(T))
+  , _plane_stride(image.plane_stride() / sizeof(T)) {}
+
+  // Only read only views can be taken from a const image
+  template<typename U = T, typename = typename std::enable_if<std::is_const<U>::value>::type>
+  explicit ImageView(const RawRGB& image)
+  : _data(reinterpret_cast<T*>(image.cbytes()))
+  , _width(static_cast<int>(image.width()))
+  , _height(static_cast<int>(image.height()))
+  , _pitch(image.pitch() / sizeof(T))
+  , _plane_stride(image.plane_stride() / sizeof(T)) {}
+
+  static  constexpr size_t        step() { return layout::planar ? 1 : layout::channels; }
+
+          int                     width() const { return _width; }
+          int                     height() const { return _height; }
+          size_t                  pitch() const { return _pitch; }
+          size_t                  channel_stride() const { return layout::planar ? _plane_stride : 1; }
+          bool                    empty() const { return (_data == nullptr); }
+          bool                    contains(int x, int y) const { return (x >= 0) && (y >= 0) && (x < _width) && (y < _height); }
+
+          T*                      row(int y) const { return _data + y * _pitch; }
+          T*                      pixel(int x, int y) const { return row(y) + x * step(); }
+          T&                      operator()(int x, int y) const { return *pixel(x, y); }
+
+          template<int C>
+          T&                      channel(int x, int y) const
+          {
+            static_assert((C >= 0) && (C < layout::channels), "channel is not part of this layout");
+            return pixel(x, y)[C * channel_stride()];
+          }
+
+          T&                      red(int x, int y) const { return channel<layout::red>(x, y); }
+          T&                      green(int x, int y) const { return channel<layout::green>(x, y); }
+          T&                      blue(int x, int y) const { return channel<layout::blue>(x, y); }
+          T&                      alpha(int x, int y) const { return channel<layout::alpha>(x, y); }
+
+          iterator                begin(int y) const { return iterator(row(y), channel_stride()); }
+          iterator                end(int y) const { return iterator(row(y) + _width * step(), channel_stride()); }
+
+private:
+  static  T*                      data_of(RawRGB& image, std::true_type) { return reinterpret_cast<T*>(image.cbytes()); }
+  static  T*                      data_of(RawRGB& image, std::false_type) { return reinterpret_cast<T*>(image.bytes()); }
+
+private:
+  T*                              _data;
+  int                             _width;
+  int                             _height;
+  size_t                          _pitch;
+  size_t                          _plane_stride;
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_IMAGE_VIEW_HPP_ */
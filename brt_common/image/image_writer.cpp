@@ -0,0 +1,651 @@
+/*
+ * image_writer.cpp
+ *
+ *  Created on: Mar 18, 2020
+ *      Author: daniel
+ */
+
+#include "image_writer.hpp"
+#include "image_view.hpp"
+#include "sample_convert.hpp"
+#include "png_encoder.hpp"
+#include "raw_codec.hpp"
+#include "raw_file.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+enum TiffTag
+{
+  eTiffImageWidth = 256,
+  eTiffImageLength = 257,
+  eTiffBitsPerSample = 258,
+  eTiffCompression = 259,
+  eTiffPhotometric = 262,
+  eTiffStripOffsets = 273,
+  eTiffSamplesPerPixel = 277,
+  eTiffRowsPerStrip = 278,
+  eTiffStripByteCounts = 279,
+  eTiffPlanarConfig = 284,
+  eTiffExtraSamples = 338,
+  eTiffSampleFormat = 339
+};
+
+enum TiffType
+{
+  eTiffShort = 3,
+  eTiffLong = 4
+};
+
+/*
+ * \\class TiffDirectory
+ *
+ * created on: Mar 18, 2020
+ *
+ * Builds the header and the single IFD in host byte order. Values that
+ * don't fit the 4 byte entry go to a data area right after the IFD.
+ */
+class TiffDirectory
+{
+public:
+  TiffDirectory() {}
+
+  void                            add(uint16_t tag, TiffType type, const std::vector<uint32_t>& values)
+  {
+    _entries.push_back(Entry{tag, type, values});
+  }
+
+  void                            add(uint16_t tag, TiffType type, uint32_t value)
+  {
+    add(tag, type, std::vector<uint32_t>(1, value));
+  }
+
+  void                            set(uint16_t tag, const std::vector<uint32_t>& values)
+  {
+    for (Entry& entry : _entries)
+    {
+      if (entry._tag == tag)
+        entry._values = values;
+    }
+  }
+
+  // Header, IFD and data area, pixel data starts right after
+  size_t                          size() const
+  {
+    size_t result = 8 + 2 + _entries.size() * 12 + 4;
+    for (const Entry& entry : _entries)
+    {
+      size_t bytes = entry.bytes();
+      if (bytes > 4)
+        result += (bytes + 1) & ~1;
+    }
+    return result;
+  }
+
+  void                            write(uint8_t* dst) const
+  {
+    const uint32_t ifd_offset = 8;
+    uint16_t byte_order = (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) ? 0x4D4D : 0x4949;
+    uint16_t magic = 42;
+    uint16_t count = static_cast<uint16_t>(_entries.size());
+    uint32_t next_ifd = 0;
+
+    memcpy(dst + 0, &byte_order, 2);
+    memcpy(dst + 2, &magic, 2);
+    memcpy(dst + 4, &ifd_offset, 4);
+    memcpy(dst + 8, &count, 2);
+
+    uint8_t* entry_ptr = dst + 10;
+    uint32_t data_offset = static_cast<uint32_t>(10 + _entries.size() * 12 + 4);
+    memcpy(dst + data_offset - 4, &next_ifd, 4);
+
+    for (const Entry& entry : _entries)
+    {
+      uint16_t type = static_cast<uint16_t>(entry._type);
+      uint32_t num_values = static_cast<uint32_t>(entry._values.size());
+
+      memcpy(entry_ptr + 0, &entry._tag, 2);
+      memcpy(entry_ptr + 2, &type, 2);
+      memcpy(entry_ptr + 4, &num_values, 4);
+      memset(entry_ptr + 8, 0, 4);
+
+      uint8_t* value_ptr = entry_ptr + 8;
+      if (entry.bytes() > 4)
+      {
+        memcpy(entry_ptr + 8, &data_offset, 4);
+        value_ptr = dst + data_offset;
+        data_offset += static_cast<uint32_t>((entry.bytes() + 1) & ~1);
+      }
+
+      for (uint32_t value : entry._values)
+      {
+        if (entry._type == eTiffShort)
+        {
+          uint16_t short_value = static_cast<uint16_t>(value);
+          memcpy(value_ptr, &short_value, 2);
+          value_ptr += 2;
+        }
+        else
+        {
+          memcpy(value_ptr, &value, 4);
+          value_ptr += 4;
+        }
+      }
+
+      entry_ptr += 12;
+    }
+  }
+
+private:
+  struct Entry
+  {
+    uint16_t                      _tag;
+    TiffType                      _type;
+    std::vector<uint32_t>         _values;
+
+    size_t                        bytes() const { return _values.size() * ((_type == eTiffShort) ? 2 : 4); }
+  };
+
+  std::vector<Entry>              _entries;
+};
+
+/*
+ * \\fn void gather_rows
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ * Copies the pixels out in R, G, B (, A) order
+ */
+template<typename T, PixelType type>
+static void gather_rows(const RawRGB& img, T* dst, size_t channels, int first_row, int rows)
+{
+  typedef ImageView<const T, type> View;
+
+  View view(img);
+  const int offsets[4] = { View::layout::red, View::layout::green, View::layout::blue, View::layout::alpha };
+  const size_t stride = view.channel_stride();
+
+  for (int y = first_row; y < first_row + rows; y++)
+  {
+    const T* src = view.row(y);
+    for (int x = 0; x < view.width(); x++, src += View::step())
+    {
+      for (size_t c = 0; c < channels; c++)
+        *dst++ = src[offsets[c] * stride];
+    }
+  }
+}
+
+/*
+ * \\fn bool gather_rows
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+template<typename T>
+static bool gather_rows(const RawRGB& img, T* dst, size_t channels, int first_row, int rows)
+{
+  switch (img.type())
+  {
+  case eRGB:
+    gather_rows<T, eRGB>(img, dst, std::min<size_t>(channels, 3), first_row, rows);
+    break;
+
+  case eBGR:
+    gather_rows<T, eBGR>(img, dst, std::min<size_t>(channels, 3), first_row, rows);
+    break;
+
+  case eRGBA:
+    gather_rows<T, eRGBA>(img, dst, channels, first_row, rows);
+    break;
+
+  case eBGRA:
+    gather_rows<T, eBGRA>(img, dst, channels, first_row, rows);
+    break;
+
+  case ePlanarRGB:
+    gather_rows<T, ePlanarRGB>(img, dst, std::min<size_t>(channels, 3), first_row, rows);
+    break;
+
+  case ePlanarRGBA:
+    gather_rows<T, ePlanarRGBA>(img, dst, channels, first_row, rows);
+    break;
+
+  default:
+    return false;
+  }
+
+  return true;
+}
+
+
+/*
+ * \\fn uint8_t* EncodedImage::append
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+uint8_t* EncodedImage::append(size_t size)
+{
+  _buffers.push_back(std::vector<uint8_t>(size));
+  uint8_t* result = _buffers.back().data();
+
+  append(result, size);
+  return result;
+}
+
+/*
+ * \\fn void EncodedImage::append
+ *
+ * created on: Mar 20, 2020
+ * author: daniel
+ *
+ */
+void EncodedImage::append(std::vector<uint8_t>&& buffer)
+{
+  _buffers.push_back(std::move(buffer));
+  append(_buffers.back().data(), _buffers.back().size());
+}
+
+/*
+ * \\fn void EncodedImage::append
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+void EncodedImage::append(const void* data, size_t size)
+{
+  if (size == 0)
+    return;
+
+  struct iovec io;
+  io.iov_base = const_cast<void*>(data);
+  io.iov_len = size;
+
+  // Neighbouring ranges collapse, a contiguous image is a single entry
+  if (!_iov.empty() && (reinterpret_cast<uint8_t*>(_iov.back().iov_base) + _iov.back().iov_len == data))
+    _iov.back().iov_len += size;
+  else
+    _iov.push_back(io);
+
+  _size += size;
+}
+
+/*
+ * \\fn FileFormat ImageWriter::format
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+FileFormat ImageWriter::format(const std::string& ext)
+{
+  std::string lower = ext;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+  if ((lower == "ppm") || (lower == "pgm") || (lower == "pnm"))
+    return ePNM;
+
+  if ((lower == "tif") || (lower == "tiff"))
+    return eTIFF;
+
+  if (lower == "png")
+    return ePNG;
+
+  if ((lower == "raw") || (lower == "rgba"))
+    return eRawRGBA;
+
+  if (lower == "rawz")
+    return eRawCFA;
+
+  return eUnknownFormat;
+}
+
+/*
+ * \\fn EncodedImagePtr ImageWriter::encode
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+EncodedImagePtr ImageWriter::encode(RawRGBPtr img, FileFormat format, const ExportOptions& options /*= ExportOptions()*/)
+{
+  if (!img || img->empty())
+    return EncodedImagePtr();
+
+  // Packed sensor frames are stored one sample per uint16, like everything else
+  if (img->packed())
+  {
+    img = img->convert(eUnsigned, img->depth());
+    if (!img)
+      return EncodedImagePtr();
+  }
+
+  switch (format)
+  {
+  case ePNM:
+    return encode_pnm(img);
+
+  case eTIFF:
+    return encode_tiff(img, options);
+
+  case eRawRGBA:
+    return encode_raw(img);
+
+  case ePNG:
+    return PngEncoder::encode(img, options);
+
+  case eRawCFA:
+    return encode_cfa(img, options);
+
+  default:
+    break;
+  }
+
+  return EncodedImagePtr();
+}
+
+/*
+ * \\fn bool ImageWriter::write
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+bool ImageWriter::write(const char* filename, const EncodedImage& encoded)
+{
+  int fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+
+  bool result = write(fd, encoded);
+  if (::close(fd) != 0)
+    result = false;
+
+  return result;
+}
+
+/*
+ * \\fn bool ImageWriter::write
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ * Usually one call, short writes resume where the kernel stopped
+ */
+bool ImageWriter::write(int fd, const EncodedImage& encoded)
+{
+  std::vector<struct iovec> iov = encoded.iov();
+  return Utils::writev_all(fd, iov);
+}
+
+/*
+ * \\fn bool ImageWriter::save
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+bool ImageWriter::save(const char* filename, RawRGBPtr img, FileFormat format,
+                        const ExportOptions& options /*= ExportOptions()*/)
+{
+  EncodedImagePtr encoded = encode(img, format, options);
+  if (!encoded)
+    return false;
+
+  return write(filename, *encoded);
+}
+
+/*
+ * \\fn bool ImageWriter::gather_rgb
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+bool ImageWriter::gather_rgb(const RawRGB& img, uint8_t* dst, size_t channels, size_t first_row, size_t rows)
+{
+  if (first_row + rows > img.height())
+    return false;
+
+  int y = static_cast<int>(first_row), count = static_cast<int>(rows);
+  switch (BYTES_PER_PIXELS(img.depth()))
+  {
+  case 1:
+    return gather_rows<uint8_t>(img, dst, channels, y, count);
+
+  case 2:
+    return gather_rows<uint16_t>(img, reinterpret_cast<uint16_t*>(dst), channels, y, count);
+
+  case 4:
+    return gather_rows<uint32_t>(img, reinterpret_cast<uint32_t*>(dst), channels, y, count);
+
+  default:
+    break;
+  }
+
+  return false;
+}
+
+/*
+ * \\fn EncodedImagePtr ImageWriter::encode_pnm
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+EncodedImagePtr ImageWriter::encode_pnm(RawRGBPtr img)
+{
+  if (img->is_float() || (img->depth() > 16))
+    return EncodedImagePtr();
+
+  const size_t channels = (img->type() == eBayer) ? 1 : 3;
+  const size_t bytes = BYTES_PER_PIXELS(img->depth());
+  const size_t row_bytes = img->width() * channels * bytes;
+
+  std::stringstream header;
+  header << ((channels == 1) ? "P5\n" : "P6\n") << img->width() << " " << img->height() << "\n"
+         << ((1 << img->depth()) - 1) << "\n";
+
+  std::string hdr = header.str();
+  EncodedImagePtr result(new EncodedImage);
+  memcpy(result->append(hdr.size()), hdr.data(), hdr.size());
+
+  if ((channels == 1) && (bytes == 1))
+  {
+    result->hold(img);
+    append_rows(*result, img->cbytes(), img->height(), row_bytes, img->pitch());
+    return result;
+  }
+
+  uint8_t* dst = result->append(row_bytes * img->height());
+  if (channels == 1)
+  {
+    for (size_t y = 0; y < img->height(); y++)
+    {
+      const uint16_t* src = reinterpret_cast<const uint16_t*>(img->cbytes() + y * img->pitch());
+      swap_bytes16(src, reinterpret_cast<uint16_t*>(dst + y * row_bytes), img->width());
+    }
+    return result;
+  }
+
+  if (!gather_rgb(*img, dst, channels, 0, img->height()))
+    return EncodedImagePtr();
+
+  // PNM samples are big-endian
+  if (bytes == 2)
+  {
+    uint16_t* samples = reinterpret_cast<uint16_t*>(dst);
+    swap_bytes16(samples, samples, row_bytes * img->height() / 2);
+  }
+
+  return result;
+}
+
+/*
+ * \\fn EncodedImagePtr ImageWriter::encode_tiff
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ * Bayer, planar and R,G,B ordered interleaved images are referenced as
+ * they are. TIFF has no B,G,R order, those get reordered into a copy.
+ */
+EncodedImagePtr ImageWriter::encode_tiff(RawRGBPtr img, const ExportOptions& options)
+{
+  const size_t width = img->width();
+  const size_t height = img->height();
+  const size_t bytes = BYTES_PER_PIXELS(img->depth());
+  const size_t samples = type_size(img->type());
+  const bool   planar = img->planar();
+
+  if ((samples == 0) || ((bytes != 1) && (bytes != 2) && (bytes != 4)))
+    return EncodedImagePtr();
+
+  const size_t row_bytes = width * bytes * (planar ? 1 : samples);
+  const size_t rows_per_strip = ((options._rows_per_strip == 0) || (options._rows_per_strip > height)) ?
+                                    height : options._rows_per_strip;
+  const size_t strips_per_plane = (height + rows_per_strip - 1) / rows_per_strip;
+  const size_t planes = planar ? samples : 1;
+
+  if (row_bytes * height * planes > UINT32_MAX)
+    return EncodedImagePtr();
+
+  TiffDirectory dir;
+  dir.add(eTiffImageWidth, eTiffLong, static_cast<uint32_t>(width));
+  dir.add(eTiffImageLength, eTiffLong, static_cast<uint32_t>(height));
+  dir.add(eTiffBitsPerSample, eTiffShort, std::vector<uint32_t>(samples, static_cast<uint32_t>(bytes * 8)));
+  dir.add(eTiffCompression, eTiffShort, 1);
+  dir.add(eTiffPhotometric, eTiffShort, (samples == 1) ? 1 : 2);
+
+  // Offsets need the directory size, which doesn't depend on their values
+  std::vector<uint32_t> offsets(strips_per_plane * planes, 0), counts(strips_per_plane * planes, 0);
+  for (size_t plane = 0; plane < planes; plane++)
+  {
+    for (size_t strip = 0; strip < strips_per_plane; strip++)
+    {
+      size_t rows = std::min(rows_per_strip, height - strip * rows_per_strip);
+      counts[plane * strips_per_plane + strip] = static_cast<uint32_t>(rows * row_bytes);
+    }
+  }
+
+  dir.add(eTiffStripOffsets, eTiffLong, offsets);
+  dir.add(eTiffSamplesPerPixel, eTiffShort, static_cast<uint32_t>(samples));
+  dir.add(eTiffRowsPerStrip, eTiffLong, static_cast<uint32_t>(rows_per_strip));
+  dir.add(eTiffStripByteCounts, eTiffLong, counts);
+  dir.add(eTiffPlanarConfig, eTiffShort, planar ? 2 : 1);
+  if (samples == 4)
+    dir.add(eTiffExtraSamples, eTiffShort, 2);
+
+  dir.add(eTiffSampleFormat, eTiffShort, std::vector<uint32_t>(samples, img->is_float() ? 3 : 1));
+
+  uint32_t offset = static_cast<uint32_t>(dir.size());
+  for (size_t index = 0; index < offsets.size(); index++)
+  {
+    offsets[index] = offset;
+    offset += counts[index];
+  }
+  dir.set(eTiffStripOffsets, offsets);
+
+  EncodedImagePtr result(new EncodedImage);
+  dir.write(result->append(dir.size()));
+
+  bool in_place = (samples == 1) || planar ||
+                  (img->type() == eRGB) || (img->type() == eRGBA);
+
+  if (in_place)
+  {
+    const RawRGB& src = *img;
+
+    result->hold(img);
+    for (size_t plane = 0; plane < planes; plane++)
+      append_rows(*result, src.plane(plane), height, row_bytes, src.pitch(plane));
+  }
+  else if (!gather_rgb(*img, result->append(row_bytes * height), samples, 0, height))
+    return EncodedImagePtr();
+
+  return result;
+}
+
+/*
+ * \\fn EncodedImagePtr ImageWriter::encode_raw
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+EncodedImagePtr ImageWriter::encode_raw(RawRGBPtr img)
+{
+  RawRGBPtr src = (img->type() == eBayer) ? img : img->to_interleaved(eRGBA);
+  if (!src)
+    return EncodedImagePtr();
+
+  std::vector<uint8_t> header;
+  if (RawFile::make_header(*src, Metadata(), header) == 0)
+    return EncodedImagePtr();
+
+  EncodedImagePtr result(new EncodedImage);
+  result->append(std::move(header));
+
+  result->hold(src);
+  result->append(src->cbytes(), src->size());
+  return result;
+}
+
+/*
+ * \\fn EncodedImagePtr ImageWriter::encode_cfa
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ * Only the sensor samples compress this way, demosaiced frames fail
+ */
+EncodedImagePtr ImageWriter::encode_cfa(RawRGBPtr img, const ExportOptions& options)
+{
+  std::vector<uint8_t> packed;
+  if (!RawCodec::encode(*img, packed, options._threads))
+    return EncodedImagePtr();
+
+  EncodedImagePtr result(new EncodedImage);
+  result->append(std::move(packed));
+  return result;
+}
+
+/*
+ * \\fn void ImageWriter::append_rows
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+void ImageWriter::append_rows(EncodedImage& encoded, const uint8_t* data,
+                              size_t rows, size_t row_bytes, size_t pitch)
+{
+  if (pitch == row_bytes)
+  {
+    encoded.append(data, rows * row_bytes);
+    return;
+  }
+
+  for (size_t row = 0; row < rows; row++)
+    encoded.append(data + row * pitch, row_bytes);
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
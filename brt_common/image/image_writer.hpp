@@ -0,0 +1,157 @@
+/*
+ * image_writer.hpp
+ *
+ *  Created on: Mar 18, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_IMAGE_WRITER_HPP_
+#define BRT_COMMON_IMAGE_IMAGE_WRITER_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "image.hpp"
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\enum FileFormat
+ *
+ * created on: Mar 18, 2020
+ *
+ */
+enum FileFormat
+{
+  eUnknownFormat = 0,
+  ePNM,               // P5 for Bayer, P6 for colour, 8 or 16 bit
+  eTIFF,              // Uncompressed, single or multiple strips
+  eRawRGBA,           // Version 2 RawFile header, page aligned samples
+  ePNG,               // Strips deflated in parallel, see PngEncoder
+  eRawCFA,            // Bayer samples through RawCodec, lossless
+
+  eNumFormats
+};
+
+/*
+ * \\struct ExportOptions
+ *
+ * created on: Mar 18, 2020
+ *
+ */
+enum PngFilter
+{
+  ePngFilterNone = 0,
+  ePngFilterSub = 1,
+  ePngFilterUp = 2,
+  ePngFilterAverage = 3,
+  ePngFilterPaeth = 4,
+  ePngFilterAdaptive = 5,  // Per row, smallest sum of absolute differences
+
+  eNumPngFilters
+};
+
+struct ExportOptions
+{
+  ExportOptions()
+  : _rows_per_strip(0)
+  , _png_level(6)
+  , _png_filter(ePngFilterAdaptive)
+  , _png_strip_rows(0)
+  , _threads(0)
+  {}
+
+  size_t                          _rows_per_strip;    // TIFF, 0 keeps the whole image in one strip
+  int                             _png_level;         // zlib level, 0..9
+  PngFilter                       _png_filter;
+  size_t                          _png_strip_rows;    // Rows deflated per job, 0 picks ~128K per strip
+  size_t                          _threads;           // 0 uses every core
+};
+
+/*
+ * \\class EncodedImage
+ *
+ * created on: Mar 18, 2020
+ *
+ * Gather list of a file ready to go to disk. Pieces are either owned
+ * buffers (headers, converted samples) or ranges of the source image,
+ * which is kept alive until the list is gone.
+ */
+class EncodedImage
+{
+public:
+  EncodedImage() : _size(0) {}
+  virtual ~EncodedImage() {}
+
+  EncodedImage(const EncodedImage&) = delete;
+  EncodedImage& operator=(const EncodedImage&) = delete;
+
+          size_t                  size() const { return _size; }
+          const std::vector<struct iovec>&
+                                  iov() const { return _iov; }
+
+          uint8_t*                append(size_t size);
+          void                    append(std::vector<uint8_t>&& buffer);
+          void                    append(const void* data, size_t size);
+          void                    hold(RawRGBPtr source) { _sources.push_back(source); }
+
+private:
+  std::vector<struct iovec>       _iov;
+  std::vector<std::vector<uint8_t>>
+                                  _buffers;
+  std::vector<RawRGBPtr>          _sources;
+  size_t                          _size;
+};
+
+typedef std::shared_ptr<EncodedImage> EncodedImagePtr;
+
+/*
+ * \\class ImageWriter
+ *
+ * created on: Mar 18, 2020
+ *
+ * Samples are referenced in place wherever the file layout matches the
+ * image layout, only byte swapping and channel reordering make a copy.
+ * The whole file then goes out with writev.
+ */
+class ImageWriter
+{
+public:
+  static  FileFormat              format(const std::string& ext);
+
+  static  EncodedImagePtr         encode(RawRGBPtr img, FileFormat format, const ExportOptions& options = ExportOptions());
+  static  bool                    write(const char* filename, const EncodedImage& encoded);
+  static  bool                    write(int fd, const EncodedImage& encoded);
+
+  static  bool                    save(const char* filename, RawRGBPtr img, FileFormat format,
+                                        const ExportOptions& options = ExportOptions());
+
+  // Interleaved R, G, B (, A) copy of a range of rows
+  static  bool                    gather_rgb(const RawRGB& img, uint8_t* dst, size_t channels,
+                                        size_t first_row, size_t rows);
+
+private:
+  static  EncodedImagePtr         encode_pnm(RawRGBPtr img);
+  static  EncodedImagePtr         encode_tiff(RawRGBPtr img, const ExportOptions& options);
+  static  EncodedImagePtr         encode_raw(RawRGBPtr img);
+  static  EncodedImagePtr         encode_cfa(RawRGBPtr img, const ExportOptions& options);
+
+  static  void                    append_rows(EncodedImage& encoded, const uint8_t* data,
+                                        size_t rows, size_t row_bytes, size_t pitch);
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_IMAGE_WRITER_HPP_ */
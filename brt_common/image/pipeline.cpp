@@ -0,0 +1,790 @@
+/*
+ * pipeline.cpp
+ *
+ *  Created on: Apr 17, 2020
+ *      Author: daniel
+ */
+
+#include "pipeline.hpp"
+#include "playback.hpp"
+#include "folder_watcher.hpp"
+#include "flight_recorder.hpp"
+#include "image_processor.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include <dir_enumerator.hpp>
+#include <thread_pool.hpp>
+#include <utils.hpp>
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+// Registration options, they belong to the edge and not to the stage
+static const char* edge_keys[] = { "async", "policy", "queue_depth", "sample" };
+
+/*
+ * \\fn std::string trim
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ */
+static std::string trim(const std::string& str)
+{
+  size_t first = str.find_first_not_of(" \t");
+  if (first == std::string::npos)
+    return std::string();
+
+  return str.substr(first, str.find_last_not_of(" \t") - first + 1);
+}
+
+/*
+ * \\fn std::vector<std::string> split
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ */
+static std::vector<std::string> split(const std::string& str, char separator)
+{
+  std::vector<std::string> result;
+  std::stringstream stream(str);
+  std::string item;
+  while (std::getline(stream, item, separator))
+  {
+    item = trim(item);
+    if (!item.empty())
+      result.push_back(item);
+  }
+
+  return result;
+}
+
+/*
+ * \\class PlaybackStage
+ *
+ * created on: Apr 17, 2020
+ *
+ * Sorted input is listed up front. Unsorted input is played in directory
+ * order as the walk hands the matches out, it starts with the constructor.
+ */
+class PlaybackStage : public PipelineStage
+{
+public:
+  PlaybackStage(const std::string& pattern, const Metadata& options)
+  : _player(options), _loop(options.get<bool>("loop",false)), _feeder(1, "enumerate")
+  {
+    SortOrder order = DirEnumerator::sort_order(options.get<std::string>("sort","natural"));
+    if (order != eSortNone)
+    {
+      for (const std::string& file : DirEnumerator::list(pattern, order))
+        _player.add(file);
+
+      _player.close();
+      return;
+    }
+
+    PlaybackProducer* player = &_player;
+    _feeder.post([pattern, player]()
+    {
+      DirEnumerator::enumerate(pattern, [player](const std::string& file) { return player->add(file); });
+      player->close();
+    });
+  }
+
+  virtual ImageProducer*          producer() { return &_player; }
+
+  virtual bool                    start() { return _player.start(); }
+  virtual void                    stop() { _player.stop(); }
+  virtual void                    wait() { _player.wait(); }
+  virtual bool                    endless() const { return _loop; }
+
+  virtual std::string             stats() const
+  {
+    PlaybackStats stats = _player.stats();
+    return Utils::string_format("%zu frames, %zu dropped, %.2f fps, late %.0f us (jitter %.0f us)",
+                  stats._frames, stats._dropped, stats._fps, stats._late_us, stats._jitter_us);
+  }
+
+private:
+  PlaybackProducer                _player;
+  bool                            _loop;
+  ThreadPool                      _feeder;      // goes first, it still feeds _player
+};
+
+/*
+ * \\class WatchStage
+ *
+ * created on: Apr 17, 2020
+ *
+ */
+class WatchStage : public PipelineStage
+{
+public:
+  WatchStage(const std::string& dir, const Metadata& options) : _watcher(dir, options) {}
+
+  virtual ImageProducer*          producer() { return &_watcher; }
+
+  virtual bool                    start() { return _watcher.start(); }
+  virtual void                    stop() { _watcher.stop(); }
+  virtual bool                    endless() const { return true; }
+
+  virtual std::string             stats() const
+  {
+    return Utils::string_format("%zu delivered, %zu dropped, %zu failed",
+                  _watcher.delivered(), _watcher.dropped(), _watcher.failed());
+  }
+
+private:
+  FolderWatcher                   _watcher;
+};
+
+/*
+ * \\class DebayerStage
+ *
+ * created on: Apr 17, 2020
+ *
+ * Runs up to threads debayers at once, every worker with a Debayer of
+ * its own. consume() waits while all of them are busy, the results go
+ * out in the order the frames came in, whichever worker finishes first.
+ */
+class DebayerStage : public PipelineStage
+                   , public ImageConsumer
+                   , public ImageProducer
+{
+public:
+  DebayerStage(size_t threads)
+  : _debayers(threads), _free(), _done(), _next_in(0), _next_out(0), _emitting(false)
+  , _frames(0), _pool(threads, "debayer")
+  {
+    for (size_t slot = 0; slot < threads; slot++)
+      _free.push_back(slot);
+  }
+
+  virtual ~DebayerStage() { stop(); }
+
+  virtual ImageProducer*          producer() { return this; }
+  virtual ImageConsumer*          consumer() { return this; }
+
+  virtual void                    consume(ImageBox box);
+  virtual void                    stop();
+
+  virtual std::string             stats() const
+  {
+    return Utils::string_format("%zu frames, %zu threads", _frames.load(), _debayers.size());
+  }
+
+private:
+          void                    process(ImageBox box, size_t slot, uint64_t sequence);
+
+private:
+  std::vector<Debayer>            _debayers;
+  std::vector<size_t>             _free;        // idle debayers
+  std::map<uint64_t,ImageBox>     _done;        // finished out of order
+  uint64_t                        _next_in;
+  uint64_t                        _next_out;
+  bool                            _emitting;
+  std::mutex                      _mutex;
+  std::condition_variable         _cv;
+
+  std::atomic_size_t              _frames;
+  ThreadPool                      _pool;
+};
+
+/*
+ * \\fn void DebayerStage::consume
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ */
+void DebayerStage::consume(ImageBox box)
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  _cv.wait(l, [this]() { return !_free.empty(); });
+
+  size_t slot = _free.back();
+  _free.pop_back();
+  uint64_t sequence = _next_in++;
+  l.unlock();
+
+  _pool.post([this, box, slot, sequence]() { process(box, slot, sequence); });
+}
+
+/*
+ * \\fn void DebayerStage::stop
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ * Waits for the frames in flight, they still go out
+ */
+void DebayerStage::stop()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  _cv.wait(l, [this]() { return (_free.size() == _debayers.size()) && !_emitting; });
+}
+
+/*
+ * \\fn void DebayerStage::process
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ * One thread hands out the finished frames at a time, the others only
+ * leave theirs in _done
+ */
+void DebayerStage::process(ImageBox box, size_t slot, uint64_t sequence)
+{
+  ImageBox result;
+  for (ImagePtr img : box)
+  {
+    RawRGBPtr rgb = img ? _debayers[slot].debayer(img->get_bits(), eBGRA) : RawRGBPtr();
+    if (rgb)
+      result.append(ImageBox(rgb));
+  }
+
+  std::unique_lock<std::mutex> l(_mutex);
+  _free.push_back(slot);
+  _done[sequence] = result;
+
+  if (!_emitting)
+  {
+    _emitting = true;
+    while (!_done.empty() && (_done.begin()->first == _next_out))
+    {
+      ImageBox next = _done.begin()->second;
+      _done.erase(_done.begin());
+      _next_out++;
+      l.unlock();
+
+      if (!next.empty())
+      {
+        _frames++;
+        ImageProducer::consume(next);
+      }
+
+      l.lock();
+    }
+
+    _emitting = false;
+  }
+
+  l.unlock();
+  _cv.notify_all();
+}
+
+/*
+ * \\class RecorderStage
+ *
+ * created on: Apr 17, 2020
+ *
+ * "dump=true" writes the window out once, when the pipeline stops
+ */
+class RecorderStage : public PipelineStage
+{
+public:
+  RecorderStage(const Metadata& options) : _recorder(options), _dump(options.get<bool>("dump",false)) {}
+
+  virtual ImageConsumer*          consumer() { return &_recorder; }
+
+  virtual void                    stop()
+  {
+    if (_dump && (_recorder.size() > 0))
+      std::cout << "recorder: writing " << _recorder.trigger() << std::endl;
+
+    _dump = false;
+  }
+
+  virtual std::string             stats() const
+  {
+    return Utils::string_format("%zu frames, %.1f MB held", _recorder.size(), _recorder.bytes() / 1048576.0);
+  }
+
+private:
+  FlightRecorder                  _recorder;
+  bool                            _dump;
+};
+
+/*
+ * \\class StatsStage
+ *
+ * created on: Apr 17, 2020
+ *
+ * Counts the frames passing by, a tap to measure a branch of the graph
+ */
+class StatsStage : public PipelineStage
+                 , public ImageConsumer
+{
+public:
+  StatsStage() : _frames(0), _first(), _last() {}
+
+  virtual ImageConsumer*          consumer() { return this; }
+
+  virtual void                    consume(ImageBox)
+  {
+    std::lock_guard<std::mutex> l(_mutex);
+    _last = clock::now();
+    if (_frames++ == 0)
+      _first = _last;
+  }
+
+  virtual std::string             stats() const
+  {
+    std::lock_guard<std::mutex> l(_mutex);
+    double elapsed = std::chrono::duration<double>(_last - _first).count();
+    return Utils::string_format("%zu frames, %.2f fps", _frames,
+                  ((_frames > 1) && (elapsed > 0.0)) ? (_frames - 1) / elapsed : 0.0);
+  }
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  size_t                          _frames;
+  clock::time_point               _first;
+  clock::time_point               _last;
+  mutable std::mutex              _mutex;
+};
+
+/*
+ * \\fn std::map<std::string,StageFactory>& registry
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ * Keyed by "role.type", comes with the stages brt_common knows
+ */
+static std::map<std::string,StageFactory>& registry(std::unique_lock<std::mutex>& l)
+{
+  static std::mutex mutex;
+  static std::map<std::string,StageFactory> factories =
+  {
+    { "source.dir", [](const std::string& arg, const Metadata& options)
+      {
+        std::string dir = arg.empty() ? std::string(".") : arg;
+        if (dir.back() != '/')
+          dir += '/';
+
+        return PipelineStagePtr(new PlaybackStage(dir + options.get<std::string>("pattern","*.raw"), options));
+      }
+    },
+    { "source.files", [](const std::string& arg, const Metadata& options)
+      {
+        return PipelineStagePtr(new PlaybackStage(arg, options));
+      }
+    },
+    { "source.watch", [](const std::string& arg, const Metadata& options)
+      {
+        return PipelineStagePtr(new WatchStage(arg, options));
+      }
+    },
+    { "debayer.ahd", [](const std::string&, const Metadata& options)
+      {
+        return PipelineStagePtr(new DebayerStage(std::max(options.get<int>("threads",1), 1)));
+      }
+    },
+    { "sink.recorder", [](const std::string&, const Metadata& options)
+      {
+        return PipelineStagePtr(new RecorderStage(options));
+      }
+    },
+    { "sink.stats", [](const std::string&, const Metadata&)
+      {
+        return PipelineStagePtr(new StatsStage());
+      }
+    },
+  };
+
+  l = std::unique_lock<std::mutex>(mutex);
+  return factories;
+}
+
+/*
+ * \\fn void PipelineStage::attach
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ */
+void PipelineStage::attach(ImageProducer* upstream, const Metadata& edge)
+{
+  upstream->register_consumer(consumer(), edge);
+}
+
+/*
+ * \\fn void PipelineStage::detach
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ */
+void PipelineStage::detach(ImageProducer* upstream)
+{
+  upstream->unregister_consumer(consumer());
+}
+
+/*
+ * \\fn Constructor Pipeline::Pipeline
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ */
+Pipeline::Pipeline()
+: _nodes()
+, _started(false)
+{
+}
+
+/*
+ * \\fn Destructor Pipeline::~Pipeline
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ */
+Pipeline::~Pipeline()
+{
+  stop();
+}
+
+/*
+ * \\fn bool Pipeline::build
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ * Returns false on the first stage that can't be made or connected,
+ * the stages built until then stay and are torn down by stop()
+ */
+bool Pipeline::build(const std::string& description)
+{
+  for (const std::string& text : split(description, ';'))
+  {
+    std::vector<std::string> items = split(text, ',');
+    // A stage of bare commas splits into nothing
+    size_t assign = items.empty() ? std::string::npos : items[0].find('=');
+    if (assign == std::string::npos)
+    {
+      std::cerr << "pipeline: \"" << text << "\" is not role=type" << std::endl;
+      return false;
+    }
+
+    std::string role = trim(items[0].substr(0, assign));
+    std::string type = trim(items[0].substr(assign + 1));
+    std::string arg;
+    size_t colon = type.find(':');
+    if (colon != std::string::npos)
+    {
+      arg = type.substr(colon + 1);
+      type = type.substr(0, colon);
+    }
+
+    Metadata options;
+    for (size_t index = 1; index < items.size(); index++)
+      options.add(items[index].c_str());
+
+    bool named = options.exist("name");
+    Node node;
+    node._name = options.get<std::string>("name",role);
+    node._from = options.get<std::string>("from","");
+    node._upstream = nullptr;
+    node._attached = false;
+    node._edge = ConsumerStats();
+    options.erase("name");
+    options.erase("from");
+
+    for (size_t suffix = 2; !named && (find(node._name) != nullptr); suffix++)
+      node._name = role + std::to_string(suffix);
+
+    if (find(node._name) != nullptr)
+    {
+      std::cerr << "pipeline: there is a stage \"" << node._name << "\" already" << std::endl;
+      return false;
+    }
+
+    Metadata edge;
+    for (const char* key : edge_keys)
+    {
+      if (options.exist(key))
+        edge.copy_key(key, key, options);
+
+      options.erase(key);
+    }
+
+    StageFactory factory;
+    {
+      std::unique_lock<std::mutex> l;
+      std::map<std::string,StageFactory>& factories = registry(l);
+      auto iter = factories.find(role + "." + type);
+      if (iter != factories.end())
+        factory = iter->second;
+    }
+
+    if (!factory)
+    {
+      std::cerr << "pipeline: unknown stage " << role << "=" << type << std::endl;
+      return false;
+    }
+
+    node._stage = factory(arg, options);
+    if (!node._stage)
+    {
+      std::cerr << "pipeline: unable to create " << node._name << std::endl;
+      return false;
+    }
+
+    // A stage without a consumer is a source, the rest hang off an upstream
+    if (node._stage->consumer() != nullptr)
+    {
+      const Node* upstream = nullptr;
+      if (!node._from.empty())
+        upstream = find(node._from);
+      else
+      {
+        for (auto iter = _nodes.rbegin(); (upstream == nullptr) && (iter != _nodes.rend()); ++iter)
+        {
+          if (iter->_stage->producer() != nullptr)
+            upstream = &(*iter);
+        }
+      }
+
+      if ((upstream == nullptr) || (upstream->_stage->producer() == nullptr))
+      {
+        std::cerr << "pipeline: " << node._name << " has no upstream to consume from" << std::endl;
+        return false;
+      }
+
+      node._from = upstream->_name;
+      node._upstream = upstream->_stage->producer();
+
+      // Keys already in edge stay, the defaults only fill in
+      edge += node._stage->edge_defaults();
+      node._stage->attach(node._upstream, edge);
+      node._attached = true;
+    }
+
+    _nodes.push_back(node);
+  }
+
+  if (_nodes.empty())
+  {
+    std::cerr << "pipeline: nothing to build" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * \\fn bool Pipeline::start
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ * Sinks first, the sources only once everything below them runs
+ */
+bool Pipeline::start()
+{
+  if (_started)
+    return false;
+
+  _started = true;
+  for (auto iter = _nodes.rbegin(); iter != _nodes.rend(); ++iter)
+  {
+    if (!iter->_stage->start())
+    {
+      std::cerr << "pipeline: unable to start " << iter->_name << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * \\fn void Pipeline::stop
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ * Upstream always goes before downstream: a stage's inbound edge is
+ * drained, then the stage finishes what it holds into its own edges
+ */
+void Pipeline::stop()
+{
+  for (Node& node : _nodes)
+  {
+    if (node._upstream == nullptr)
+      node._stage->stop();
+  }
+
+  for (Node& node : _nodes)
+  {
+    if (node._attached)
+    {
+      // Nothing comes in any more, detach() hands the queued frames to the
+      // stage. A frame the edge's thread is busy with isn't counted yet.
+      node._edge = node._upstream->consumer_stats(node._stage->consumer());
+      node._edge._delivered += node._edge._queued;
+      node._edge._queued = 0;
+
+      node._stage->detach(node._upstream);
+      node._attached = false;
+    }
+
+    if (node._upstream != nullptr)
+      node._stage->stop();
+  }
+}
+
+/*
+ * \\fn void Pipeline::wait
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ * Never returns for an endless source that isn't stopped
+ */
+void Pipeline::wait()
+{
+  for (Node& node : _nodes)
+  {
+    if (node._upstream == nullptr)
+      node._stage->wait();
+  }
+}
+
+/*
+ * \\fn bool Pipeline::endless
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ */
+bool Pipeline::endless() const
+{
+  for (const Node& node : _nodes)
+  {
+    if ((node._upstream == nullptr) && node._stage->endless())
+      return true;
+  }
+
+  return false;
+}
+
+/*
+ * \\fn PipelineStagePtr Pipeline::stage
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ */
+PipelineStagePtr Pipeline::stage(const std::string& name) const
+{
+  const Node* node = find(name);
+  return (node != nullptr) ? node->_stage : PipelineStagePtr();
+}
+
+/*
+ * \\fn std::string Pipeline::report
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ * A line per stage, with its inbound edge for all but the sources
+ */
+std::string Pipeline::report() const
+{
+  std::string result;
+  for (const Node& node : _nodes)
+  {
+    result += node._name;
+    if (node._upstream != nullptr)
+    {
+      ConsumerStats edge = node._attached ? node._upstream->consumer_stats(node._stage->consumer()) : node._edge;
+      result += " <- " + node._from;
+      if (edge._async)
+      {
+        result += Utils::string_format(" [%s, %zu/%zu queued]", ImageProducer::policy_name(edge._policy),
+                                          edge._queued, edge._capacity);
+      }
+
+      result += Utils::string_format(": %zu in, %zu dropped, %zu skipped", edge._delivered, edge._dropped, edge._skipped);
+    }
+
+    std::string stats = node._stage->stats();
+    if (!stats.empty())
+      result += (node._upstream != nullptr ? "; " : ": ") + stats;
+
+    result += '\n';
+  }
+
+  return result;
+}
+
+/*
+ * \\fn void Pipeline::register_stage
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ * Replaces a factory registered under the same role and type
+ */
+void Pipeline::register_stage(const std::string& role, const std::string& type, StageFactory factory)
+{
+  std::unique_lock<std::mutex> l;
+  registry(l)[role + "." + type] = factory;
+}
+
+/*
+ * \\fn std::vector<std::string> Pipeline::stage_types
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ */
+std::vector<std::string> Pipeline::stage_types()
+{
+  std::unique_lock<std::mutex> l;
+  std::vector<std::string> result;
+  for (auto& pair : registry(l))
+  {
+    std::string name = pair.first;
+    result.push_back(name.replace(name.find('.'), 1, "="));
+  }
+
+  return result;
+}
+
+/*
+ * \\fn const Pipeline::Node* Pipeline::find
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ */
+const Pipeline::Node* Pipeline::find(const std::string& name) const
+{
+  for (const Node& node : _nodes)
+  {
+    if (node._name == name)
+      return &node;
+  }
+
+  return nullptr;
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
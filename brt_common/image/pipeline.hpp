@@ -0,0 +1,146 @@
+/*
+ * pipeline.hpp
+ *
+ *  Created on: Apr 17, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_PIPELINE_HPP_
+#define BRT_COMMON_IMAGE_PIPELINE_HPP_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "image.hpp"
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\class PipelineStage
+ *
+ * created on: Apr 17, 2020
+ *
+ * One node of a Pipeline. A source only has a producer, a sink only a
+ * consumer, a filter both. attach() connects the stage to its upstream,
+ * stages needing more than a plain registration (a window tile) override
+ * it.
+ */
+class PipelineStage
+{
+public:
+  PipelineStage() {}
+  virtual ~PipelineStage() {}
+
+  PipelineStage(const PipelineStage&) = delete;
+  PipelineStage& operator=(const PipelineStage&) = delete;
+
+  virtual ImageProducer*          producer() { return nullptr; }
+  virtual ImageConsumer*          consumer() { return nullptr; }
+
+  virtual void                    attach(ImageProducer* upstream, const Metadata& edge);
+  virtual void                    detach(ImageProducer* upstream);
+
+  // Edge options the stage's inbound edge falls back to
+  virtual Metadata                edge_defaults() const { return Metadata("policy=block"); }
+
+  virtual bool                    start() { return true; }
+  // Sources stop producing, the others finish the frames they hold
+  virtual void                    stop() {}
+  // Sources only, returns once the last frame went out
+  virtual void                    wait() {}
+  virtual bool                    endless() const { return false; }
+
+  virtual std::string             stats() const { return std::string(); }
+};
+
+typedef std::shared_ptr<PipelineStage> PipelineStagePtr;
+
+// arg is what follows the type's colon, options the stage's own list
+typedef std::function<PipelineStagePtr(const std::string& arg, const Metadata& options)> StageFactory;
+
+/*
+ * \\class Pipeline
+ *
+ * created on: Apr 17, 2020
+ *
+ * Builds and runs a graph of stages from a description, stages are
+ * separated by semicolons:
+ *
+ *   source=dir:/data,fps=60;debayer=ahd,threads=8;sink=window,policy=latest
+ *
+ * Every stage reads role=type[:arg][,key=value...]. The role and type
+ * pick the factory in the registry, the key=value list goes to the
+ * factory except for the keys the builder takes itself:
+ *   name             the stage's name, the role by default ("sink2" for a
+ *                    second sink)
+ *   from             upstream stage, the closest stage before it that
+ *                    produces by default
+ *   async, policy, queue_depth, sample
+ *                    registration options of the inbound edge, see
+ *                    ImageProducer. Edges are async, every one with its
+ *                    own thread and queue, "async=false" calls the stage
+ *                    on the upstream's thread.
+ *
+ * Built in: source=dir:<dir>, source=files:<pattern>, source=watch:<dir>,
+ * debayer=ahd, sink=recorder, sink=stats. Stages living outside of
+ * brt_common, like windows, are added with register_stage().
+ *
+ * stop() tears down in description order: the sources stop first, then
+ * every edge is drained before its stage finishes, so frames already in
+ * the graph reach the sinks.
+ */
+class Pipeline
+{
+public:
+  Pipeline();
+  virtual ~Pipeline();
+
+  Pipeline(const Pipeline&) = delete;
+  Pipeline& operator=(const Pipeline&) = delete;
+
+          bool                    build(const std::string& description);
+          bool                    start();
+          void                    stop();
+          void                    wait();
+
+          bool                    endless() const;
+          PipelineStagePtr        stage(const std::string& name) const;
+          std::string             report() const;
+
+  static  void                    register_stage(const std::string& role, const std::string& type,
+                                                  StageFactory factory);
+  static  std::vector<std::string>
+                                  stage_types();
+
+private:
+  struct Node
+  {
+    std::string                   _name;
+    std::string                   _from;
+    PipelineStagePtr              _stage;
+    ImageProducer*                _upstream;
+    bool                          _attached;
+    ConsumerStats                 _edge;        // as it was when detached
+  };
+
+          const Node*             find(const std::string& name) const;
+
+private:
+  std::vector<Node>               _nodes;       // description order, upstream first
+  bool                            _started;
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_PIPELINE_HPP_ */
@@ -15,18 +15,6 @@ namespace jupiter
 namespace image
 {
 
-//const size_t Pixel::color_map[eNumTypes][Pixel::NumColors] =
-//{
-//  //            Blue = 0, Green = 1, Red = 2,  Alpha = 3, Bayer = 4
-//  /*eNone = 0*/  {  0,       0,          0,        0,          0     },
-//  /*eBayer = 1*/ {  0,       0,          0,        0,          0     },
-//  /*eRGB = 2*/   {  0,       1,          2,        0,          0     },
-//  /*eBGR = 3*/   {  2,       1,          0,        0,          0     },
-//  /*eRGBA= 4*/   {  0,       1,          2,        3,          0     },
-//  /*eBGRA= 5*/   {  3,       2,          1,        0,          0     },
-//};
-//
-
 /*
  * \\fn Constructor Pixel::Pixel
  *
@@ -41,16 +29,41 @@ Pixel::Pixel(RawRGBPtr image, size_t offset /*= 0*/)
 , _width(0)
 , _height(0)
 , _bytes_per_pixel(0)
+, _plane_stride(0)
 {
   if (_image)
   {
     _width = _image->width();
     _height = _image->height();
-    _bytes_per_pixel = BYTES_PER_PIXELS(_image->depth()) * type_size(_image->type());
+    _bytes_per_pixel = BYTES_PER_PIXELS(_image->depth()) * (_image->planar() ? 1 : type_size(_image->type()));
     _total_size = _width * _height * _bytes_per_pixel;
+    _plane_stride = _image->plane_stride();
   }
 }
 
+/*
+ * \\fn int Pixel::channel_offset
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ * Offset of the color sample relative to the pixel. Planar images keep
+ * every color in its own plane, so the offset jumps by whole planes.
+ * -1 when the image has no such color.
+ */
+int Pixel::channel_offset(Color color) const
+{
+  // A mosaic has the one sample for every color
+  int channel = ((color == Bayer) || (_image->type() == eBayer)) ? 0 : channel_map[_image->type()][color];
+  if (channel < 0)
+    return -1;
+
+  if (_image->planar())
+    return static_cast<int>(channel * _plane_stride);
+
+  return static_cast<int>(channel * BYTES_PER_PIXELS(_image->depth()));
+}
+
 /*
  * \\fn Destructor Pixel::~Pixel
  *
@@ -109,23 +122,24 @@ int Pixel::get(Color color) const
   if (!_image)
     return 0;
 
-  int full_offset = _offset + color_map[_image->type()][color] * BYTES_PER_PIXELS(_image->depth());
-  if ((full_offset < 0) || (full_offset > static_cast<int>(_total_size - BYTES_PER_PIXELS(_image->depth()))))
+  int channel = channel_offset(color);
+  int full_offset = _offset + channel;
+  if ((channel < 0) || (full_offset < 0) || (full_offset > static_cast<int>(_image->size() - BYTES_PER_PIXELS(_image->depth()))))
     return 0;
 
   switch (BYTES_PER_PIXELS(_image->depth()))
   {
   case 1:
-    return _image->bytes()[full_offset];
+    return _image->cbytes()[full_offset];
 
   case 2:
-    return *(reinterpret_cast<uint16_t*>(_image->bytes() + full_offset));
+    return *(reinterpret_cast<const uint16_t*>(_image->cbytes() + full_offset));
 
   case 3:
-    return *(reinterpret_cast<uint32_t*>(_image->bytes() + full_offset)) & 0xFFFFFF;
+    return *(reinterpret_cast<const uint32_t*>(_image->cbytes() + full_offset)) & 0xFFFFFF;
 
   case 4:
-    return *(reinterpret_cast<uint32_t*>(_image->bytes() + full_offset));
+    return *(reinterpret_cast<const uint32_t*>(_image->cbytes() + full_offset));
 
   default:
     break;
@@ -146,8 +160,9 @@ void Pixel::set(Color color,int value)
   if (!_image)
     return;
 
-  int full_offset = _offset + color_map[_image->type()][color] * BYTES_PER_PIXELS(_image->depth());
-  if ((full_offset < 0) || (full_offset > static_cast<int>(_total_size - BYTES_PER_PIXELS(_image->depth()))))
+  int channel = channel_offset(color);
+  int full_offset = _offset + channel;
+  if ((channel < 0) || (full_offset < 0) || (full_offset > static_cast<int>(_image->size() - BYTES_PER_PIXELS(_image->depth()))))
     return;
 
   memcpy(_image->bytes() + full_offset, &value, std::min(BYTES_PER_PIXELS(_image->depth()),sizeof(int)));
@@ -172,7 +187,7 @@ Pixel& Pixel::operator=(const Pixel& px)
     return *this;
 
   if (_image->depth() == px._image->depth())
-    memcpy(_image->bytes() + _offset, px._image->bytes() + px._offset,BYTES_PER_PIXELS(_image->depth())) ;
+    memcpy(_image->bytes() + _offset, px._image->cbytes() + px._offset,BYTES_PER_PIXELS(_image->depth())) ;
   else
   {
     set(Red,px.get(Red));
@@ -195,8 +210,7 @@ Pixel& Pixel::operator=(const Point& pt)
 {
   if (_image)
   {
-    int new_offset = (pt._x + static_cast<int>(_image->width()) * pt._y) *
-        BYTES_PER_PIXELS(_image->depth()) * type_size(_image->type());
+    int new_offset = (pt._x + static_cast<int>(_image->width()) * pt._y) * _bytes_per_pixel;
 
     _offset = static_cast<size_t>(new_offset);
   }
@@ -214,8 +228,7 @@ Pixel& Pixel::operator+=(const Point& pt)
 {
   if (_image)
   {
-    int new_offset = static_cast<int>(_offset) + (pt._x + static_cast<int>(_image->width()) * pt._y) *
-        BYTES_PER_PIXELS(_image->depth()) * type_size(_image->type());
+    int new_offset = static_cast<int>(_offset) + (pt._x + static_cast<int>(_image->width()) * pt._y) * _bytes_per_pixel;
 
     _offset = static_cast<size_t>(new_offset);
   }
@@ -234,8 +247,7 @@ Pixel Pixel::operator+(const Point& pt)
   if (!_image)
     return Pixel();
 
-  int new_offset = static_cast<int>(_offset) + (pt._x + static_cast<int>(_image->width()) * pt._y) *
-      BYTES_PER_PIXELS(_image->depth()) * type_size(_image->type());
+  int new_offset = static_cast<int>(_offset) + (pt._x + static_cast<int>(_image->width()) * pt._y) * _bytes_per_pixel;
 
   return Pixel(_image,static_cast<size_t>(new_offset));
 }
@@ -251,8 +263,7 @@ Pixel& Pixel::operator-=(const Point& pt)
 {
   if (_image)
   {
-    int new_offset = static_cast<int>(_offset) - (pt._x + static_cast<int>(_image->width()) * pt._y) *
-        BYTES_PER_PIXELS(_image->depth()) * type_size(_image->type());
+    int new_offset = static_cast<int>(_offset) - (pt._x + static_cast<int>(_image->width()) * pt._y) * _bytes_per_pixel;
 
     _offset = static_cast<size_t>(new_offset);
   }
@@ -271,8 +282,7 @@ Pixel Pixel::operator-(const Point& pt)
   if (!_image)
     return Pixel();
 
-  int new_offset = static_cast<int>(_offset) - (pt._x + static_cast<int>(_image->width()) * pt._y) *
-      BYTES_PER_PIXELS(_image->depth()) * type_size(_image->type());
+  int new_offset = static_cast<int>(_offset) - (pt._x + static_cast<int>(_image->width()) * pt._y) * _bytes_per_pixel;
 
   return Pixel(_image,static_cast<size_t>(new_offset));
 }
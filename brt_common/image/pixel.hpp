@@ -39,7 +39,7 @@ struct Point
 class Pixel
 {
 public:
-  Pixel() : _image(), _offset(0) , _total_size(0), _width(0), _height(0), _bytes_per_pixel(0) {}
+  Pixel() : _image(), _offset(0) , _total_size(0), _width(0), _height(0), _bytes_per_pixel(0), _plane_stride(0) {}
   Pixel(RawRGBPtr image, size_t offset = 0);
   virtual ~Pixel();
 
@@ -62,18 +62,8 @@ public:
           RawRGBPtr               image() const { return _image; }
           Point                   point() const;
 
-public:
-  const  size_t                  color_map[eNumTypes][Pixel::NumColors] =
-  {
-    //            Blue = 0, Green = 1, Red = 2,  Alpha = 3, Bayer = 4
-    /*eNone = 0*/  {  0,       0,          0,        0,          0     },
-    /*eBayer = 1*/ {  0,       0,          0,        0,          0     },
-    /*eRGB = 2*/   {  0,       1,          2,        0,          0     },
-    /*eBGR = 3*/   {  2,       1,          0,        0,          0     },
-    /*eRGBA= 4*/   {  0,       1,          2,        3,          0     },
-    /*eBGRA= 5*/   {  3,       2,          1,        0,          0     },
-  };
-
+private:
+          int                     channel_offset(Color color) const;
 
 private:
   RawRGBPtr                       _image;
@@ -83,6 +73,7 @@ private:
   uint32_t                        _width;
   uint32_t                        _height;
   uint32_t                        _bytes_per_pixel;
+  uint32_t                        _plane_stride;
 };
 
 } /* namespace image */
@@ -0,0 +1,227 @@
+/*
+ * planar.cpp
+ *
+ *  Created on: Feb 24, 2020
+ *      Author: daniel
+ */
+
+#include "planar.hpp"
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\fn bool plane_offsets
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ * Sample offset inside an interleaved pixel for every plane, both taken
+ * from channel_map. -1 for a plane the type has no channel for, false
+ * if the type isn't interleaved color.
+ */
+static bool plane_offsets(PixelType type, int (&offset)[4])
+{
+  if ((type <= eBayer) || (type >= eNumTypes) || is_planar(type))
+    return false;
+
+  for (int channel = 0; channel < eNumChannels; channel++)
+    offset[channel_map[ePlanarRGBA][channel]] = channel_map[type][channel];
+
+  return true;
+}
+/*
+ * \\fn T opaque
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ * Full scale alpha, 1.0 for float formats
+ */
+template<typename T>
+static T opaque(SampleFormat format)
+{
+  if ((format == eFloat) && (sizeof(T) == 4))
+    return static_cast<T>(0x3F800000);
+
+  if ((format == eHalf) && (sizeof(T) == 2))
+    return static_cast<T>(0x3C00);
+
+  return static_cast<T>(-1);
+}
+
+/*
+ * \\fn void split
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ * C is a compile time constant so the inner loop is a plain strided copy
+ * which gcc turns into shuffles
+ */
+template<typename T, size_t C>
+static void split(const T* __restrict__ src, const int (&offset)[4],
+                  T* const* planes, size_t num_planes, size_t count, T alpha)
+{
+  for (size_t channel = 0; channel < num_planes; channel++)
+  {
+    T* __restrict__ dst = reinterpret_cast<T*>(planes[channel]);
+
+    if (offset[channel] < 0)
+    {
+      for (size_t index = 0; index < count; index++)
+        dst[index] = alpha;
+
+      continue;
+    }
+
+    const T* __restrict__ ch = src + offset[channel];
+    for (size_t index = 0; index < count; index++)
+      dst[index] = ch[index * C];
+  }
+}
+
+/*
+ * \\fn void merge
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+template<typename T, size_t C>
+static void merge(const T* const* planes, size_t num_planes, const int (&offset)[4],
+                  T* __restrict__ dst, size_t count, T alpha)
+{
+  for (size_t channel = 0; channel < C; channel++)
+  {
+    int channel_id = -1;
+    for (size_t ch = 0; ch < 4; ch++)
+    {
+      if (offset[ch] == static_cast<int>(channel))
+        channel_id = ch;
+    }
+
+    T* __restrict__ out = dst + channel;
+    if ((channel_id < 0) || (channel_id >= static_cast<int>(num_planes)))
+    {
+      for (size_t index = 0; index < count; index++)
+        out[index * C] = alpha;
+
+      continue;
+    }
+
+    const T* __restrict__ src = planes[channel_id];
+    for (size_t index = 0; index < count; index++)
+      out[index * C] = src[index];
+  }
+}
+
+/*
+ * \\fn bool deinterleave
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+bool deinterleave(const uint8_t* src, PixelType src_type,
+                  uint8_t* const* planes, size_t num_planes,
+                  size_t count, size_t bytes_per_sample, SampleFormat format /*= eUnsigned*/)
+{
+  int offset[4];
+  if ((src == nullptr) || (num_planes < 3) || (num_planes > 4) || !plane_offsets(src_type, offset))
+    return false;
+
+  bool four = (type_size(src_type) == 4);
+
+  switch (bytes_per_sample)
+  {
+  case 1:
+    if (four)
+      split<uint8_t, 4>(src, offset, planes, num_planes, count, opaque<uint8_t>(format));
+    else
+      split<uint8_t, 3>(src, offset, planes, num_planes, count, opaque<uint8_t>(format));
+    break;
+
+  case 2:
+    if (four)
+      split<uint16_t, 4>(reinterpret_cast<const uint16_t*>(src), offset,
+                         reinterpret_cast<uint16_t* const*>(planes), num_planes, count, opaque<uint16_t>(format));
+    else
+      split<uint16_t, 3>(reinterpret_cast<const uint16_t*>(src), offset,
+                         reinterpret_cast<uint16_t* const*>(planes), num_planes, count, opaque<uint16_t>(format));
+    break;
+
+  case 4:
+    if (four)
+      split<uint32_t, 4>(reinterpret_cast<const uint32_t*>(src), offset,
+                         reinterpret_cast<uint32_t* const*>(planes), num_planes, count, opaque<uint32_t>(format));
+    else
+      split<uint32_t, 3>(reinterpret_cast<const uint32_t*>(src), offset,
+                         reinterpret_cast<uint32_t* const*>(planes), num_planes, count, opaque<uint32_t>(format));
+    break;
+
+  default:
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * \\fn bool interleave
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+bool interleave(const uint8_t* const* planes, size_t num_planes,
+                uint8_t* dst, PixelType dst_type,
+                size_t count, size_t bytes_per_sample, SampleFormat format /*= eUnsigned*/)
+{
+  int offset[4];
+  if ((dst == nullptr) || (num_planes < 3) || (num_planes > 4) || !plane_offsets(dst_type, offset))
+    return false;
+
+  bool four = (type_size(dst_type) == 4);
+
+  switch (bytes_per_sample)
+  {
+  case 1:
+    if (four)
+      merge<uint8_t, 4>(planes, num_planes, offset, dst, count, opaque<uint8_t>(format));
+    else
+      merge<uint8_t, 3>(planes, num_planes, offset, dst, count, opaque<uint8_t>(format));
+    break;
+
+  case 2:
+    if (four)
+      merge<uint16_t, 4>(reinterpret_cast<const uint16_t* const*>(planes), num_planes, offset,
+                         reinterpret_cast<uint16_t*>(dst), count, opaque<uint16_t>(format));
+    else
+      merge<uint16_t, 3>(reinterpret_cast<const uint16_t* const*>(planes), num_planes, offset,
+                         reinterpret_cast<uint16_t*>(dst), count, opaque<uint16_t>(format));
+    break;
+
+  case 4:
+    if (four)
+      merge<uint32_t, 4>(reinterpret_cast<const uint32_t* const*>(planes), num_planes, offset,
+                         reinterpret_cast<uint32_t*>(dst), count, opaque<uint32_t>(format));
+    else
+      merge<uint32_t, 3>(reinterpret_cast<const uint32_t* const*>(planes), num_planes, offset,
+                         reinterpret_cast<uint32_t*>(dst), count, opaque<uint32_t>(format));
+    break;
+
+  default:
+    return false;
+  }
+
+  return true;
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
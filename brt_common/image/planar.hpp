@@ -0,0 +1,43 @@
+/*
+ * planar.hpp
+ *
+ *  Created on: Feb 24, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_PLANAR_HPP_
+#define BRT_COMMON_IMAGE_PLANAR_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "image.hpp"
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * Plane order is always R, G, B, A regardless of the interleaved source order.
+ * A missing alpha channel on the source side is filled with full scale
+ * (1.0 for float formats),
+ * an extra one on the source side is dropped.
+ */
+bool                              deinterleave(const uint8_t* src, PixelType src_type,
+                                                uint8_t* const* planes, size_t num_planes,
+                                                size_t count, size_t bytes_per_sample,
+                                                SampleFormat format = eUnsigned);
+
+bool                              interleave(const uint8_t* const* planes, size_t num_planes,
+                                                uint8_t* dst, PixelType dst_type,
+                                                size_t count, size_t bytes_per_sample,
+                                                SampleFormat format = eUnsigned);
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_PLANAR_HPP_ */
@@ -0,0 +1,378 @@
+/*
+ * playback.cpp
+ *
+ *  Created on: Apr 8, 2020
+ *      Author: daniel
+ */
+
+#include "playback.hpp"
+#include "raw_file.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <iostream>
+
+#include <utils.hpp>
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\fn Constructor PlaybackProducer::PlaybackProducer
+ *
+ * created on: Apr 8, 2020
+ * author: daniel
+ *
+ */
+PlaybackProducer::PlaybackProducer(const std::vector<std::string>& files, const Metadata& meta /*= Metadata()*/)
+: PlaybackProducer(meta)
+{
+  for (const std::string& file : files)
+    add(file);
+
+  close();
+}
+
+/*
+ * \\fn Constructor PlaybackProducer::PlaybackProducer
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ */
+PlaybackProducer::PlaybackProducer(const Metadata& meta)
+: _sources()
+, _period(Utils::frame_rate(meta.get<std::string>("fps",DEFAULT_PLAYBACK_RATE).c_str()))
+, _prefetch(std::max(meta.get<int>("prefetch",DEFAULT_PREFETCH_DEPTH), 1))
+, _loop(meta.get<bool>("loop",false))
+, _drop(meta.get<bool>("drop",true))
+, _running(false)
+, _terminate(false)
+, _closed(false)
+, _frames(0)
+, _dropped(0)
+, _late_sum(0.0)
+, _late_sq_sum(0.0)
+, _max_late(0.0)
+, _first()
+, _last()
+, _player(1, "playback")
+, _io(std::max(meta.get<int>("io_threads",DEFAULT_IO_THREADS), 1), "playback_io")
+{
+  if (!std::isfinite(_period) || (_period <= 0.0))
+  {
+    std::cerr << "playback: invalid rate \"" << meta.get<std::string>("fps","") << "\", using " DEFAULT_PLAYBACK_RATE << std::endl;
+    _period = Utils::frame_rate(DEFAULT_PLAYBACK_RATE);
+  }
+
+}
+
+/*
+ * \\fn Destructor PlaybackProducer::~PlaybackProducer
+ *
+ * created on: Apr 8, 2020
+ * author: daniel
+ *
+ */
+PlaybackProducer::~PlaybackProducer()
+{
+  stop();
+}
+
+/*
+ * \\fn bool PlaybackProducer::start
+ *
+ * created on: Apr 8, 2020
+ * author: daniel
+ *
+ */
+bool PlaybackProducer::start()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  if (_running || _terminate || (_closed && _sources.empty()))
+    return false;
+
+  _running = true;
+  l.unlock();
+
+  _player.post([this]() { play_loop(); });
+  return true;
+}
+
+/*
+ * \\fn void PlaybackProducer::stop
+ *
+ * created on: Apr 8, 2020
+ * author: daniel
+ *
+ * The io pool goes last, the player may still wait for a load in flight
+ */
+void PlaybackProducer::stop()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  _terminate = true;
+  l.unlock();
+
+  _cv.notify_all();
+  _player.stop();
+  _io.stop();
+}
+
+/*
+ * \\fn void PlaybackProducer::wait
+ *
+ * created on: Apr 8, 2020
+ * author: daniel
+ *
+ * Returns once the last frame went out, never for a looping playback
+ * that isn't stopped
+ */
+void PlaybackProducer::wait()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  _cv.wait(l, [this]() { return !_running; });
+}
+
+/*
+ * \\fn bool PlaybackProducer::add
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ * Sequence files expand into one source per frame
+ */
+bool PlaybackProducer::add(const std::string& file)
+{
+  SequenceReaderPtr sequence;
+  if (SequenceReader::is_sequence(file.c_str()))
+    sequence = SequenceReader::open_file(file.c_str());
+
+  size_t frames = sequence ? sequence->size() : 1;
+
+  std::unique_lock<std::mutex> l(_mutex);
+  if (_terminate || _closed)
+    return false;
+
+  for (size_t frame = 0; frame < frames; frame++)
+  {
+    Source source;
+    source._filename = file;
+    source._sequence = sequence;
+    source._frame = frame;
+    _sources.push_back(source);
+  }
+  l.unlock();
+
+  _cv.notify_all();
+  return true;
+}
+
+/*
+ * \\fn void PlaybackProducer::close
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ */
+void PlaybackProducer::close()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  _closed = true;
+  l.unlock();
+
+  _cv.notify_all();
+}
+
+/*
+ * \\fn size_t PlaybackProducer::size
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ */
+size_t PlaybackProducer::size() const
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  return _sources.size();
+}
+
+/*
+ * \\fn PlaybackStats PlaybackProducer::stats
+ *
+ * created on: Apr 8, 2020
+ * author: daniel
+ *
+ */
+PlaybackStats PlaybackProducer::stats() const
+{
+  std::lock_guard<std::mutex> l(_mutex);
+
+  PlaybackStats result;
+  result._frames = _frames;
+  result._dropped = _dropped;
+  result._fps = 0.0;
+  result._late_us = 0.0;
+  result._jitter_us = 0.0;
+  result._max_late_us = _max_late;
+
+  if (_frames > 0)
+  {
+    double mean = _late_sum / _frames;
+    result._late_us = mean;
+    result._jitter_us = sqrt(std::max(_late_sq_sum / _frames - mean * mean, 0.0));
+  }
+
+  double elapsed = std::chrono::duration<double>(_last - _first).count();
+  if ((_frames > 1) && (elapsed > 0.0))
+    result._fps = (_frames - 1) / elapsed;
+
+  return result;
+}
+
+/*
+ * \\fn ImagePtr PlaybackProducer::load
+ *
+ * created on: Apr 8, 2020
+ * author: daniel
+ *
+ */
+ImagePtr PlaybackProducer::load(const Source& source) const
+{
+  RawRGBPtr raw = source._sequence ? source._sequence->frame(source._frame)
+                                   : RawFile::load(source._filename.c_str());
+  if (!raw)
+    return ImagePtr();
+
+  ImagePtr img(raw);
+  img->set("filename", source._filename.c_str());
+  img->set<int>("frame", static_cast<int>(source._frame));
+  if (source._sequence)
+    img->set<unsigned long>("timestamp", source._sequence->entry(source._frame)._timestamp);
+
+  return img;
+}
+
+/*
+ * \\fn void PlaybackProducer::play_loop
+ *
+ * created on: Apr 8, 2020
+ * author: daniel
+ *
+ */
+void PlaybackProducer::play_loop()
+{
+  struct Pending
+  {
+    Source                        _source;
+    std::future<ImagePtr>         _image;
+  };
+
+  std::deque<Pending> loading;
+  size_t next = 0;  // next source to load, keeps counting while looping
+
+  auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(_period));
+  clock::time_point start = clock::now();
+
+  for (size_t slot = 0; ; slot++)
+  {
+    std::unique_lock<std::mutex> l(_mutex);
+    if (loading.empty() && !_closed && (next >= _sources.size()))
+    {
+      _cv.wait(l, [this, next]() { return _terminate || _closed || (next < _sources.size()); });
+      if (_terminate)
+        break;
+
+      // Waiting for the next file isn't lateness, the schedule resumes from here
+      start = clock::now() - period * slot;
+    }
+
+    // Sources are only appended, a copy stays valid while the list grows
+    size_t count = _sources.size();
+    while ((loading.size() < _prefetch) && ((next < count) || (_loop && _closed && (count > 0))))
+    {
+      Source source = _sources[next % count];
+
+      Pending pending;
+      pending._source = source;
+      pending._image = _io.submit([this, source]() { return load(source); });
+      loading.push_back(std::move(pending));
+      next++;
+    }
+    l.unlock();
+
+    if (loading.empty())
+      break;
+
+    Pending pending = std::move(loading.front());
+    loading.pop_front();
+
+    clock::time_point due = start + period * slot;
+
+    // More than a period late: this slot is lost, the next frame takes the next one
+    if (_drop && (clock::now() > due + period))
+    {
+      l.lock();
+      _dropped++;
+      if (_terminate)
+        break;
+
+      continue;
+    }
+
+    ImagePtr img = pending._image.get();
+
+    l.lock();
+    if (_cv.wait_until(l, due, [this]() { return _terminate; }))
+      break;
+    l.unlock();
+
+    if (!img)
+    {
+      std::cerr << "playback: unable to load " << pending._source._filename << std::endl;
+      continue;
+    }
+
+    // Lateness is taken when the frame goes out, the consumers' time is theirs
+    record(std::chrono::duration<double, std::micro>(clock::now() - due).count());
+
+    ImageBox box;
+    box.push_back(img);
+    ImageProducer::consume(box);
+  }
+
+  std::lock_guard<std::mutex> l(_mutex);
+  _running = false;
+  _cv.notify_all();
+}
+
+/*
+ * \\fn void PlaybackProducer::record
+ *
+ * created on: Apr 8, 2020
+ * author: daniel
+ *
+ */
+void PlaybackProducer::record(double late_us)
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  clock::time_point now = clock::now();
+  if (_frames == 0)
+    _first = now;
+
+  _last = now;
+  _frames++;
+  _late_sum += late_us;
+  _late_sq_sum += late_us * late_us;
+  _max_late = std::max(_max_late, late_us);
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
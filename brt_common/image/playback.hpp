@@ -0,0 +1,146 @@
+/*
+ * playback.hpp
+ *
+ *  Created on: Apr 8, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_PLAYBACK_HPP_
+#define BRT_COMMON_IMAGE_PLAYBACK_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "image.hpp"
+#include "image_loader.hpp"
+#include "raw_sequence.hpp"
+#include "thread_pool.hpp"
+
+#define DEFAULT_PLAYBACK_RATE               "30fps"
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\struct PlaybackStats
+ *
+ * created on: Apr 8, 2020
+ *
+ * _late_us and _jitter_us are the mean and standard deviation of the
+ * delay between the frame's slot and the moment it went out
+ */
+struct PlaybackStats
+{
+  size_t                          _frames;      // delivered
+  size_t                          _dropped;     // skipped because playback fell behind
+  double                          _fps;         // achieved, delivered frames only
+  double                          _late_us;
+  double                          _jitter_us;
+  double                          _max_late_us;
+};
+
+/*
+ * \\class PlaybackProducer
+ *
+ * created on: Apr 8, 2020
+ *
+ * Plays a list of raw files and sequence files to the consumers at a
+ * fixed rate. Frame N is due N periods after start on the steady clock,
+ * so slow frames don't push the rest of the schedule back. Frames are
+ * loaded ahead on an io pool; a frame more than one period late is
+ * skipped unless dropping is turned off, in which case every frame goes
+ * out as soon as it can.
+ *
+ * Images carry "filename" and "frame", sequence frames also their
+ * "timestamp".
+ *
+ * Built without a list, the files are fed with add() and playback can
+ * start with the first one. When it runs out it waits for more until
+ * close(), the schedule picks up from the next file. Looping only starts
+ * over once the list is closed.
+ *
+ * Options (Metadata):
+ *   fps              rate as understood by Utils::frame_rate(), DEFAULT_PLAYBACK_RATE
+ *   prefetch         frames loading ahead, DEFAULT_PREFETCH_DEPTH
+ *   io_threads       loader threads, DEFAULT_IO_THREADS
+ *   loop             start over after the last frame
+ *   drop             skip late frames, true by default
+ */
+class PlaybackProducer : public ImageProducer
+{
+public:
+  PlaybackProducer(const std::vector<std::string>& files, const Metadata& meta = Metadata());
+  PlaybackProducer(const Metadata& meta);
+  virtual ~PlaybackProducer();
+
+  PlaybackProducer(const PlaybackProducer&) = delete;
+  PlaybackProducer& operator=(const PlaybackProducer&) = delete;
+
+          // A stopped producer can't be started again
+          bool                    start();
+          void                    stop();
+          void                    wait();
+
+          // false once the producer is stopped, enumerations feeding it can stop too
+          bool                    add(const std::string& file);
+          void                    close();
+
+          size_t                  size() const;
+          double                  period() const { return _period; }
+          PlaybackStats           stats() const;
+
+private:
+  struct Source
+  {
+    std::string                   _filename;
+    SequenceReaderPtr             _sequence;
+    size_t                        _frame;
+  };
+
+  typedef std::chrono::steady_clock clock;
+
+          ImagePtr                load(const Source& source) const;
+          void                    play_loop();
+          void                    record(double late_us);
+
+private:
+  std::vector<Source>             _sources;
+  double                          _period;      // seconds
+  size_t                          _prefetch;
+  bool                            _loop;
+  bool                            _drop;
+
+  bool                            _running;
+  bool                            _terminate;
+  bool                            _closed;      // no more add()
+  mutable std::mutex              _mutex;
+  std::condition_variable         _cv;
+
+  // Statistics, under _mutex
+  size_t                          _frames;
+  size_t                          _dropped;
+  double                          _late_sum;
+  double                          _late_sq_sum;
+  double                          _max_late;
+  clock::time_point               _first;
+  clock::time_point               _last;
+
+  ThreadPool                      _player;
+  ThreadPool                      _io;
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_PLAYBACK_HPP_ */
@@ -0,0 +1,426 @@
+/*
+ * png_encoder.cpp
+ *
+ *  Created on: Mar 20, 2020
+ *      Author: daniel
+ */
+
+#include "png_encoder.hpp"
+#include "sample_convert.hpp"
+#include "page_allocator.hpp"
+#include "thread_pool.hpp"
+
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <thread>
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\struct PngEncoder::Frame
+ *
+ * created on: Mar 20, 2020
+ *
+ */
+struct PngEncoder::Frame
+{
+  const RawRGB*                   _img;
+  size_t                          _channels;
+  size_t                          _bytes;          // per sample
+  size_t                          _bpp;            // per pixel, the filter distance
+  size_t                          _row_bytes;
+  size_t                          _stride;         // filtered row, with the filter type byte
+  size_t                          _strip_rows;
+  size_t                          _strips;
+  int                             _level;
+  PngFilter                       _filter;
+  uint8_t*                        _filtered;
+};
+
+/*
+ * \\fn void put_be32
+ *
+ * created on: Mar 20, 2020
+ * author: daniel
+ *
+ */
+static inline void put_be32(uint8_t* dst, uint32_t value)
+{
+  dst[0] = static_cast<uint8_t>(value >> 24);
+  dst[1] = static_cast<uint8_t>(value >> 16);
+  dst[2] = static_cast<uint8_t>(value >> 8);
+  dst[3] = static_cast<uint8_t>(value);
+}
+
+/*
+ * \\fn void append_chunk
+ *
+ * created on: Mar 20, 2020
+ * author: daniel
+ *
+ */
+static void append_chunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size)
+{
+  size_t pos = out.size();
+  out.resize(pos + 12 + size);
+
+  put_be32(&out[pos], static_cast<uint32_t>(size));
+  memcpy(&out[pos + 4], type, 4);
+  if (size > 0)
+    memcpy(&out[pos + 8], data, size);
+
+  uLong crc = crc32(0, &out[pos + 4], static_cast<uInt>(size + 4));
+  put_be32(&out[pos + 8 + size], static_cast<uint32_t>(crc));
+}
+
+/*
+ * \\fn uint8_t paeth
+ *
+ * created on: Mar 20, 2020
+ * author: daniel
+ *
+ */
+static inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+  int p = static_cast<int>(a) + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+  if ((pa <= pb) && (pa <= pc))
+    return a;
+
+  return (pb <= pc) ? b : c;
+}
+
+/*
+ * \\fn void filter_row
+ *
+ * created on: Mar 20, 2020
+ * author: daniel
+ *
+ * prev is all zeros for the first row of the image
+ */
+static void filter_row(PngFilter filter, const uint8_t* row, const uint8_t* prev, uint8_t* dst, size_t size, size_t bpp)
+{
+  switch (filter)
+  {
+  case ePngFilterSub:
+    for (size_t i = 0; i < size; i++)
+      dst[i] = row[i] - ((i >= bpp) ? row[i - bpp] : 0);
+    break;
+
+  case ePngFilterUp:
+    for (size_t i = 0; i < size; i++)
+      dst[i] = row[i] - prev[i];
+    break;
+
+  case ePngFilterAverage:
+    for (size_t i = 0; i < size; i++)
+      dst[i] = row[i] - static_cast<uint8_t>((((i >= bpp) ? row[i - bpp] : 0) + prev[i]) >> 1);
+    break;
+
+  case ePngFilterPaeth:
+    for (size_t i = 0; i < size; i++)
+      dst[i] = row[i] - ((i >= bpp) ? paeth(row[i - bpp], prev[i], prev[i - bpp]) : prev[i]);
+    break;
+
+  default:
+    memcpy(dst, row, size);
+    break;
+  }
+}
+
+/*
+ * \\fn size_t row_cost
+ *
+ * created on: Mar 20, 2020
+ * author: daniel
+ *
+ * Minimum sum of absolute differences, the libpng heuristic
+ */
+static size_t row_cost(const uint8_t* row, size_t size)
+{
+  size_t result = 0;
+  for (size_t i = 0; i < size; i++)
+    result += abs(static_cast<int8_t>(row[i]));
+
+  return result;
+}
+
+/*
+ * \\fn void scale_samples
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ * Scales depth bit samples to the full bits of the PNG sample by left
+ * bit replication, as the PNG spec recommends. Full scale stays full
+ * scale, a 12 bit 4095 becomes 65535.
+ */
+template<typename T>
+static void scale_samples(T* samples, size_t count, int depth, int bits)
+{
+  const uint32_t mask = (1u << depth) - 1;
+  for (size_t index = 0; index < count; index++)
+  {
+    uint32_t value = samples[index] & mask, result = 0;
+    for (int shift = bits - depth; shift > -depth; shift -= depth)
+      result |= (shift >= 0) ? (value << shift) : (value >> -shift);
+
+    samples[index] = static_cast<T>(result);
+  }
+}
+
+/*
+ * \\fn EncodedImagePtr PngEncoder::encode
+ *
+ * created on: Mar 20, 2020
+ * author: daniel
+ *
+ */
+EncodedImagePtr PngEncoder::encode(RawRGBPtr img, const ExportOptions& options /*= ExportOptions()*/)
+{
+  if (!img || img->empty() || img->is_float() || img->packed() || (img->depth() > 16) || (img->type() == eNone))
+    return EncodedImagePtr();
+
+  Frame frame;
+  frame._img = img.get();
+  frame._channels = (img->type() == eBayer) ? 1 : type_size(img->type());
+  frame._bytes = (img->depth() > 8) ? 2 : 1;
+  frame._bpp = frame._channels * frame._bytes;
+  frame._row_bytes = img->width() * frame._bpp;
+  frame._stride = frame._row_bytes + 1;
+  frame._strip_rows = (options._png_strip_rows != 0) ? options._png_strip_rows :
+                                    std::max<size_t>(PNG_STRIP_BYTES / frame._stride, 1);
+  frame._strip_rows = std::min(frame._strip_rows, img->height());
+  frame._strips = (img->height() + frame._strip_rows - 1) / frame._strip_rows;
+  frame._level = std::min(std::max(options._png_level, 0), 9);
+  frame._filter = options._png_filter;
+
+  PageArray<uint8_t> filtered(frame._stride * img->height());
+  if (filtered.size() == 0)
+    return EncodedImagePtr();
+
+  frame._filtered = filtered.data();
+
+  size_t threads = (options._threads != 0) ? options._threads :
+                                    std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+  // Filtering first, every strip needs the filtered tail of the one before as dictionary
+  ThreadPool::shared().parallel_for(frame._strips, threads, [&frame](size_t strip) { filter_strip(frame, strip); });
+
+  std::vector<std::vector<uint8_t>> chunks(frame._strips);
+  std::vector<uint32_t> adlers(frame._strips);
+  ThreadPool::shared().parallel_for(frame._strips, threads, [&frame, &chunks, &adlers](size_t strip)
+  {
+    deflate_strip(frame, strip, chunks[strip], adlers[strip]);
+  });
+
+  static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  std::vector<uint8_t> header(signature, signature + sizeof(signature));
+
+  static const uint8_t color_types[5] = { 0, 0, 0, 2, 6 };
+  uint8_t ihdr[13];
+  put_be32(ihdr, static_cast<uint32_t>(img->width()));
+  put_be32(ihdr + 4, static_cast<uint32_t>(img->height()));
+  ihdr[8] = static_cast<uint8_t>(frame._bytes * 8);
+  ihdr[9] = color_types[frame._channels];
+  ihdr[10] = 0;
+  ihdr[11] = 0;
+  ihdr[12] = 0;
+  append_chunk(header, "IHDR", ihdr, sizeof(ihdr));
+
+  if (img->depth() != frame._bytes * 8)
+  {
+    uint8_t sbit[4];
+    memset(sbit, static_cast<uint8_t>(img->depth()), sizeof(sbit));
+    append_chunk(header, "sBIT", sbit, frame._channels);
+  }
+
+  uLong adler = adler32(0, Z_NULL, 0);
+  for (size_t strip = 0; strip < frame._strips; strip++)
+  {
+    size_t rows = std::min(frame._strip_rows, img->height() - strip * frame._strip_rows);
+    adler = adler32_combine(adler, adlers[strip], static_cast<z_off_t>(rows * frame._stride));
+  }
+
+  std::vector<uint8_t> trailer;
+  uint8_t check[4];
+  put_be32(check, static_cast<uint32_t>(adler));
+  append_chunk(trailer, "IDAT", check, sizeof(check));
+  append_chunk(trailer, "IEND", nullptr, 0);
+
+  EncodedImagePtr result(new EncodedImage);
+  result->append(std::move(header));
+  for (std::vector<uint8_t>& chunk : chunks)
+    result->append(std::move(chunk));
+
+  result->append(std::move(trailer));
+  return result;
+}
+
+/*
+ * \\fn bool PngEncoder::load_row
+ *
+ * created on: Mar 20, 2020
+ * author: daniel
+ *
+ * One row in PNG sample order, scaled to the full sample depth, 16 bit
+ * samples big-endian
+ */
+bool PngEncoder::load_row(const Frame& frame, size_t y, uint8_t* dst)
+{
+  const RawRGB& img = *frame._img;
+  if (frame._channels == 1)
+    memcpy(dst, img.cbytes() + y * img.pitch(), frame._row_bytes);
+  else if (!ImageWriter::gather_rgb(img, dst, frame._channels, y, 1))
+    return false;
+
+  int depth = static_cast<int>(img.depth()), bits = static_cast<int>(frame._bytes * 8);
+  if (frame._bytes == 2)
+  {
+    uint16_t* samples = reinterpret_cast<uint16_t*>(dst);
+    if (depth < bits)
+      scale_samples(samples, frame._row_bytes / 2, depth, bits);
+
+    swap_bytes16(samples, samples, frame._row_bytes / 2);
+  }
+  else if (depth < bits)
+    scale_samples(dst, frame._row_bytes, depth, bits);
+
+  return true;
+}
+
+/*
+ * \\fn void PngEncoder::filter_strip
+ *
+ * created on: Mar 20, 2020
+ * author: daniel
+ *
+ */
+void PngEncoder::filter_strip(const Frame& frame, size_t strip)
+{
+  size_t first = strip * frame._strip_rows;
+  size_t last = std::min(first + frame._strip_rows, frame._img->height());
+
+  std::vector<uint8_t> rows(frame._row_bytes * 2, 0);
+  std::vector<uint8_t> trial((frame._filter == ePngFilterAdaptive) ? frame._row_bytes : 0);
+  uint8_t* prev = rows.data();
+  uint8_t* cur = rows.data() + frame._row_bytes;
+
+  if (first > 0)
+    load_row(frame, first - 1, prev);
+
+  for (size_t y = first; y < last; y++)
+  {
+    load_row(frame, y, cur);
+
+    uint8_t* dst = frame._filtered + y * frame._stride;
+    if (frame._filter != ePngFilterAdaptive)
+    {
+      dst[0] = static_cast<uint8_t>(frame._filter);
+      filter_row(frame._filter, cur, prev, dst + 1, frame._row_bytes, frame._bpp);
+    }
+    else
+    {
+      size_t best = SIZE_MAX;
+      for (int filter = ePngFilterNone; filter < ePngFilterAdaptive; filter++)
+      {
+        filter_row(static_cast<PngFilter>(filter), cur, prev, trial.data(), frame._row_bytes, frame._bpp);
+
+        size_t cost = row_cost(trial.data(), frame._row_bytes);
+        if (cost < best)
+        {
+          best = cost;
+          dst[0] = static_cast<uint8_t>(filter);
+          memcpy(dst + 1, trial.data(), frame._row_bytes);
+        }
+      }
+    }
+
+    std::swap(prev, cur);
+  }
+}
+
+/*
+ * \\fn void PngEncoder::deflate_strip
+ *
+ * created on: Mar 20, 2020
+ * author: daniel
+ *
+ * Builds the complete IDAT chunk of one strip. The first one carries
+ * the zlib header, the last one ends the deflate stream.
+ */
+void PngEncoder::deflate_strip(const Frame& frame, size_t strip, std::vector<uint8_t>& chunk, uint32_t& adler)
+{
+  size_t first = strip * frame._strip_rows;
+  size_t last = std::min(first + frame._strip_rows, frame._img->height());
+  bool   final = (last == frame._img->height());
+
+  uint8_t* input = frame._filtered + first * frame._stride;
+  size_t input_size = (last - first) * frame._stride;
+  adler = static_cast<uint32_t>(adler32(adler32(0, Z_NULL, 0), input, static_cast<uInt>(input_size)));
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, frame._level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+
+  if (first > 0)
+  {
+    size_t dict = std::min<size_t>(first * frame._stride, PNG_WINDOW_SIZE);
+    deflateSetDictionary(&stream, input - dict, static_cast<uInt>(dict));
+  }
+
+  // Length and type up front, zlib header on the first strip
+  size_t header = 8 + ((strip == 0) ? 2 : 0);
+  chunk.resize(header + deflateBound(&stream, input_size) + 16);
+
+  if (strip == 0)
+  {
+    static const uint8_t levels[10] = { 0, 0, 1, 1, 1, 1, 2, 3, 3, 3 };
+    uint8_t cmf = 0x78, flg = static_cast<uint8_t>(levels[frame._level] << 6);
+    flg += 31 - ((cmf * 256 + flg) % 31);
+
+    chunk[8] = cmf;
+    chunk[9] = flg;
+  }
+
+  stream.next_in = input;
+  stream.avail_in = static_cast<uInt>(input_size);
+  stream.next_out = chunk.data() + header;
+  stream.avail_out = static_cast<uInt>(chunk.size() - header);
+
+  int flush = final ? Z_FINISH : Z_SYNC_FLUSH;
+  while (true)
+  {
+    int res = deflate(&stream, flush);
+    if (final ? (res == Z_STREAM_END) : ((res == Z_OK) && (stream.avail_in == 0) && (stream.avail_out > 0)))
+      break;
+
+    size_t used = chunk.size() - stream.avail_out;
+    chunk.resize(chunk.size() * 2);
+    stream.next_out = chunk.data() + used;
+    stream.avail_out = static_cast<uInt>(chunk.size() - used);
+  }
+
+  size_t data_size = chunk.size() - stream.avail_out - 8;
+  deflateEnd(&stream);
+
+  chunk.resize(8 + data_size + 4);
+  put_be32(chunk.data(), static_cast<uint32_t>(data_size));
+  memcpy(chunk.data() + 4, "IDAT", 4);
+
+  uLong crc = crc32(0, chunk.data() + 4, static_cast<uInt>(data_size + 4));
+  put_be32(chunk.data() + 8 + data_size, static_cast<uint32_t>(crc));
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
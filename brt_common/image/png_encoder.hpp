@@ -0,0 +1,60 @@
+/*
+ * png_encoder.hpp
+ *
+ *  Created on: Mar 20, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_PNG_ENCODER_HPP_
+#define BRT_COMMON_IMAGE_PNG_ENCODER_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "image.hpp"
+#include "image_writer.hpp"
+
+#define PNG_STRIP_BYTES                     (128 * 1024)
+#define PNG_WINDOW_SIZE                     (32 * 1024)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\class PngEncoder
+ *
+ * created on: Mar 20, 2020
+ *
+ * pigz style parallel deflate. The image is cut into horizontal strips,
+ * each strip is filtered and deflated on its own, primed with the last
+ * 32K of the strip before it, and ends on a sync flush so the pieces
+ * concatenate into a single zlib stream. Every strip goes out as its
+ * own IDAT chunk, followed by one with the combined adler32.
+ *
+ * Bayer frames are written as grayscale. Depths other than 8 and 16 are
+ * scaled up to the full sample depth, an sBIT chunk keeps the original
+ * precision.
+ */
+class PngEncoder
+{
+public:
+  static  EncodedImagePtr         encode(RawRGBPtr img, const ExportOptions& options = ExportOptions());
+
+private:
+  struct Frame;
+
+  static  void                    filter_strip(const Frame& frame, size_t strip);
+  static  void                    deflate_strip(const Frame& frame, size_t strip,
+                                        std::vector<uint8_t>& chunk, uint32_t& adler);
+  static  bool                    load_row(const Frame& frame, size_t y, uint8_t* dst);
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_PNG_ENCODER_HPP_ */
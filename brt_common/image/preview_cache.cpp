@@ -0,0 +1,513 @@
+/*
+ * preview_cache.cpp
+ *
+ *  Created on: Apr 1, 2020
+ *      Author: daniel
+ */
+
+#include "preview_cache.hpp"
+#include "image_view.hpp"
+#include "raw_file.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include <utils.hpp>
+
+#define PREVIEW_MAX_LEVELS                  (16)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+// Version 2: levels are R,G,B,A in memory, version 1 files had blue first
+static const char preview_magic[8] = { 'B', 'R', 'T', 'P', 'Y', 'R', 0, 2 };
+
+/*
+ * \\fn bool source_stat
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ */
+static bool source_stat(const std::string& filename, uint64_t& size, uint64_t& mtime)
+{
+  struct stat st;
+  if ((::stat(filename.c_str(), &st) != 0) || !S_ISREG(st.st_mode))
+    return false;
+
+  size = static_cast<uint64_t>(st.st_size);
+  mtime = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ull + static_cast<uint64_t>(st.st_mtim.tv_nsec);
+  return true;
+}
+
+/*
+ * \\fn bool make_dirs
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ */
+static bool make_dirs(const std::string& path)
+{
+  for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+  {
+    std::string dir = path.substr(0, pos);
+    if (!dir.empty() && (::mkdir(dir.c_str(), 0755) != 0) && (errno != EEXIST))
+      return false;
+
+    if (pos == std::string::npos)
+      break;
+  }
+  return true;
+}
+
+/*
+ * \\fn size_t pick_level
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ * Smallest level that still covers min_size, level 0 if none does
+ */
+template<typename L>
+static size_t pick_level(const L* levels, size_t count, size_t min_size)
+{
+  for (size_t index = count; index-- > 0; )
+  {
+    if (std::max<size_t>(levels[index]._width, levels[index]._height) >= min_size)
+      return index;
+  }
+  return 0;
+}
+
+/*
+ * \\fn RawRGBPtr box_half
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ * 2x2 average of an interleaved eRGBA image into 8 bit eRGBA
+ */
+template<typename T>
+static RawRGBPtr box_half(const RawRGB& img, int shift)
+{
+  int width = static_cast<int>(img.width() / 2), height = static_cast<int>(img.height() / 2);
+  RawRGBPtr result(new RawRGB(width, height, 8, eRGBA));
+  if (result->empty())
+    return RawRGBPtr();
+
+  ImageView<const T, eRGBA> in(img);
+  ImageView<uint8_t, eRGBA> out(*result);
+
+  auto average = [shift](int a, int b, int c, int d)->uint8_t
+  {
+    return static_cast<uint8_t>(std::min(((a + b + c + d + 2) >> 2) >> shift, 255));
+  };
+
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      int sx = x * 2, sy = y * 2;
+      out.red(x, y) = average(in.red(sx, sy), in.red(sx + 1, sy), in.red(sx, sy + 1), in.red(sx + 1, sy + 1));
+      out.green(x, y) = average(in.green(sx, sy), in.green(sx + 1, sy), in.green(sx, sy + 1), in.green(sx + 1, sy + 1));
+      out.blue(x, y) = average(in.blue(sx, sy), in.blue(sx + 1, sy), in.blue(sx, sy + 1), in.blue(sx + 1, sy + 1));
+      out.alpha(x, y) = 0xFF;
+    }
+  }
+
+  return result;
+}
+
+/*
+ * \\fn RawRGBPtr superpixel
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ * Every Bayer quad becomes one pixel, in the same quad layout as the
+ * demosaic: green at (0,0) and (1,1), red at (1,0), blue at (0,1)
+ */
+template<typename T>
+static RawRGBPtr superpixel(const RawRGB& img, int shift)
+{
+  int width = static_cast<int>(img.width() / 2), height = static_cast<int>(img.height() / 2);
+  RawRGBPtr result(new RawRGB(width, height, 8, eRGBA));
+  if (result->empty())
+    return RawRGBPtr();
+
+  ImageView<const T, eBayer> in(img);
+  ImageView<uint8_t, eRGBA> out(*result);
+
+  for (int y = 0; y < height; y++)
+  {
+    const T* top = in.row(y * 2);
+    const T* bottom = in.row(y * 2 + 1);
+
+    for (int x = 0; x < width; x++)
+    {
+      int green = (top[x * 2] + bottom[x * 2 + 1] + 1) >> 1;
+      out.red(x, y) = static_cast<uint8_t>(std::min(top[x * 2 + 1] >> shift, 255));
+      out.green(x, y) = static_cast<uint8_t>(std::min(green >> shift, 255));
+      out.blue(x, y) = static_cast<uint8_t>(std::min(bottom[x * 2] >> shift, 255));
+      out.alpha(x, y) = 0xFF;
+    }
+  }
+
+  return result;
+}
+
+/*
+ * \\fn Constructor PreviewCache::PreviewCache
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ */
+PreviewCache::PreviewCache(const Metadata& meta /*= Metadata()*/)
+: _dir(meta.get<std::string>("cache_dir",""))
+, _building()
+, _terminate(false)
+, _pool(std::max(meta.get<int>("preview_threads",DEFAULT_PREVIEW_THREADS), 1), "preview")
+{
+  if (_dir.empty())
+  {
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if ((xdg != nullptr) && (*xdg != '\0'))
+      _dir = std::string(xdg) + "/cuda_image_view";
+    else
+      _dir = std::string((home != nullptr) ? home : "/tmp") + "/.cache/cuda_image_view";
+  }
+
+  if (_dir.back() != '/')
+    _dir += '/';
+
+  make_dirs(_dir.substr(0, _dir.size() - 1));
+}
+
+/*
+ * \\fn Destructor PreviewCache::~PreviewCache
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ * Builds already running finish, the queued ones are skipped
+ */
+PreviewCache::~PreviewCache()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  _terminate = true;
+  l.unlock();
+
+  _pool.stop();
+}
+
+/*
+ * \\fn std::string PreviewCache::cache_file
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ * FNV-1a of the absolute path, so every spelling of a path shares the entry
+ */
+std::string PreviewCache::cache_file(const std::string& filename) const
+{
+  char* real = ::realpath(filename.c_str(), nullptr);
+  std::string path = (real != nullptr) ? real : filename;
+  free(real);
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (char c : path)
+  {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ull;
+  }
+
+  return _dir + Utils::string_format("%016llx.pyr", static_cast<unsigned long long>(hash));
+}
+
+/*
+ * \\fn RawRGBPtr PreviewCache::preview
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ * Cached level only, empty when the file has no valid entry
+ */
+RawRGBPtr PreviewCache::preview(const std::string& filename, size_t min_size /*= 0*/)
+{
+  uint64_t size, mtime;
+  if (!source_stat(filename, size, mtime))
+    return RawRGBPtr();
+
+  return open_level(filename, size, mtime, min_size);
+}
+
+/*
+ * \\fn RawRGBPtr PreviewCache::build
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ * Loads the source, builds and stores the pyramid. The source is
+ * checked before it is read, so a file changed meanwhile is rebuilt
+ * the next time instead of being cached with the wrong contents.
+ */
+RawRGBPtr PreviewCache::build(const std::string& filename, size_t min_size /*= 0*/)
+{
+  uint64_t size, mtime;
+  if (!source_stat(filename, size, mtime))
+    return RawRGBPtr();
+
+  RawRGBPtr raw = RawFile::load(filename.c_str());
+  if (!raw)
+    return RawRGBPtr();
+
+  std::vector<RawRGBPtr> levels;
+  for (RawRGBPtr level = half_size(*raw); level; level = downscale(*level))
+  {
+    levels.push_back(level);
+    if ((std::max(level->width(), level->height()) <= PREVIEW_MIN_SIZE) || (levels.size() == PREVIEW_MAX_LEVELS))
+      break;
+  }
+
+  if (levels.empty())
+    return RawRGBPtr();
+
+  if (!store(filename, size, mtime, levels))
+    std::cerr << filename << ": unable to cache preview in " << _dir << std::endl;
+
+  size_t index = levels.size();
+  while ((index > 1) && (std::max(levels[index - 1]->width(), levels[index - 1]->height()) < min_size))
+    index--;
+
+  return levels[index - 1];
+}
+
+/*
+ * \\fn void PreviewCache::prefetch
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ */
+void PreviewCache::prefetch(const std::vector<std::string>& files)
+{
+  for (const std::string& filename : files)
+  {
+    std::unique_lock<std::mutex> l(_mutex);
+    if (!_building.insert(filename).second)
+      continue;
+    l.unlock();
+
+    _pool.post([this, filename]()
+    {
+      std::unique_lock<std::mutex> l(_mutex);
+      bool skip = _terminate;
+      l.unlock();
+
+      if (!skip && !preview(filename, 0))
+        build(filename);
+
+      l.lock();
+      _building.erase(filename);
+      l.unlock();
+      _cv.notify_all();
+    });
+  }
+}
+
+/*
+ * \\fn size_t PreviewCache::pending
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ */
+size_t PreviewCache::pending() const
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  return _building.size();
+}
+
+/*
+ * \\fn void PreviewCache::wait
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ */
+void PreviewCache::wait()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  _cv.wait(l, [this]() { return _building.empty(); });
+}
+
+/*
+ * \\fn RawRGBPtr PreviewCache::half_size
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ * 8 bit eRGBA at half the size of img. Bayer frames skip the demosaic,
+ * each quad already holds one sample of every colour.
+ */
+RawRGBPtr PreviewCache::half_size(const RawRGB& img)
+{
+  if (img.empty() || (img.width() < 2) || (img.height() < 2) || (img.type() == eNone))
+    return RawRGBPtr();
+
+  RawRGBPtr src;
+  if (img.packed())
+    src = img.convert(eUnsigned, img.depth());
+  else if (img.is_float())
+    src = img.convert(eUnsigned, 16);
+  else
+    src = img.share();
+
+  if (src && (src->type() != eBayer))
+    src = src->to_interleaved(eRGBA);
+
+  if (!src || (src->depth() > 16))
+    return RawRGBPtr();
+
+  int shift = (src->depth() > 8) ? static_cast<int>(src->depth()) - 8 : 0;
+  bool wide = (BYTES_PER_PIXELS(src->depth()) == 2);
+
+  if (src->type() == eBayer)
+    return wide ? superpixel<uint16_t>(*src, shift) : superpixel<uint8_t>(*src, shift);
+
+  return wide ? box_half<uint16_t>(*src, shift) : box_half<uint8_t>(*src, shift);
+}
+
+/*
+ * \\fn RawRGBPtr PreviewCache::downscale
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ * Next pyramid level of an 8 bit eRGBA level
+ */
+RawRGBPtr PreviewCache::downscale(const RawRGB& img)
+{
+  if (img.empty() || (img.type() != eRGBA) || (img.depth() != 8) || (img.width() < 2) || (img.height() < 2))
+    return RawRGBPtr();
+
+  return box_half<uint8_t>(img, 0);
+}
+
+/*
+ * \\fn RawRGBPtr PreviewCache::open_level
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ */
+RawRGBPtr PreviewCache::open_level(const std::string& filename, uint64_t size, uint64_t mtime, size_t min_size)
+{
+  int fd = ::open(cache_file(filename).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return RawRGBPtr();
+
+  RawRGBPtr result;
+  PreviewHeader header;
+  PreviewLevel levels[PREVIEW_MAX_LEVELS];
+  struct stat st;
+
+  if ((::fstat(fd, &st) == 0) &&
+      (::pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header))) &&
+      (memcmp(header._magic, preview_magic, sizeof(header._magic)) == 0) &&
+      (header._source_size == size) && (header._source_mtime == mtime) &&
+      (header._levels > 0) && (header._levels <= PREVIEW_MAX_LEVELS))
+  {
+    size_t table = header._levels * sizeof(PreviewLevel);
+    if (::pread(fd, levels, table, sizeof(header)) == static_cast<ssize_t>(table))
+    {
+      const PreviewLevel& level = levels[pick_level(levels, header._levels, min_size)];
+      size_t bytes = static_cast<size_t>(level._width) * level._height * type_size(eRGBA);
+
+      if ((bytes > 0) && (level._offset + bytes <= static_cast<uint64_t>(st.st_size)))
+      {
+        PageAllocator::Block block = PageAllocator::map_file(fd, level._offset, bytes, true);
+        if (block._ptr != nullptr)
+          result.reset(new RawRGB(RawBufferPtr(new RawBuffer(block)), level._width, level._height, 8, eRGBA));
+      }
+    }
+  }
+
+  ::close(fd);
+  return result;
+}
+
+/*
+ * \\fn bool PreviewCache::store
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ * Written to a temporary file and renamed over the entry, readers see
+ * either the old pyramid or the complete new one
+ */
+bool PreviewCache::store(const std::string& filename, uint64_t size, uint64_t mtime,
+                         const std::vector<RawRGBPtr>& levels)
+{
+  PreviewHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header._magic, preview_magic, sizeof(header._magic));
+  header._source_size = size;
+  header._source_mtime = mtime;
+  header._levels = static_cast<uint32_t>(levels.size());
+
+  std::vector<PreviewLevel> table(levels.size());
+  std::vector<struct iovec> iov;
+  iov.push_back({ &header, sizeof(header) });
+  iov.push_back({ table.data(), table.size() * sizeof(PreviewLevel) });
+
+  uint64_t offset = sizeof(header) + table.size() * sizeof(PreviewLevel);
+  for (size_t index = 0; index < levels.size(); index++)
+  {
+    table[index]._width = static_cast<uint32_t>(levels[index]->width());
+    table[index]._height = static_cast<uint32_t>(levels[index]->height());
+    table[index]._offset = offset;
+
+    iov.push_back({ const_cast<uint8_t*>(levels[index]->cbytes()), levels[index]->size() });
+    offset += levels[index]->size();
+  }
+
+  std::string entry = cache_file(filename);
+  std::string temp = entry + ".XXXXXX";
+  int fd = ::mkstemp(&temp[0]);
+  if (fd < 0)
+    return false;
+
+  bool result = Utils::writev_all(fd, iov);
+
+  ::fchmod(fd, 0644);
+  if (::close(fd) != 0)
+    result = false;
+
+  if (result && (::rename(temp.c_str(), entry.c_str()) != 0))
+    result = false;
+
+  if (!result)
+    ::unlink(temp.c_str());
+
+  return result;
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
@@ -0,0 +1,122 @@
+/*
+ * preview_cache.hpp
+ *
+ *  Created on: Apr 1, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_PREVIEW_CACHE_HPP_
+#define BRT_COMMON_IMAGE_PREVIEW_CACHE_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+
+#include "image.hpp"
+#include "thread_pool.hpp"
+
+#define PREVIEW_MIN_SIZE                    (128)
+#define DEFAULT_PREVIEW_THREADS             (2)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\struct PreviewHeader
+ *
+ * created on: Apr 1, 2020
+ *
+ * First bytes of a cache file, followed by one PreviewLevel per level.
+ * The source size and modification time are repeated here, a file
+ * that doesn't match them any more is rebuilt.
+ */
+struct PreviewHeader
+{
+  char                            _magic[8];
+  uint64_t                        _source_size;
+  uint64_t                        _source_mtime; // nanoseconds
+  uint32_t                        _levels;
+  uint32_t                        _reserved;
+};
+
+/*
+ * \\struct PreviewLevel
+ *
+ * created on: Apr 1, 2020
+ *
+ */
+struct PreviewLevel
+{
+  uint32_t                        _width;
+  uint32_t                        _height;
+  uint64_t                        _offset;      // 8 bit eRGBA samples
+};
+
+/*
+ * \\class PreviewCache
+ *
+ * created on: Apr 1, 2020
+ *
+ * Persistent pyramid of small demosaiced previews per raw file, keyed
+ * by path, size and modification time. Level 0 is half the source size,
+ * straight from the Bayer quads, every further level halves again down
+ * to PREVIEW_MIN_SIZE. Levels are 8 bit eRGBA and are mapped from the
+ * cache file when read.
+ *
+ * prefetch() builds missing entries on a worker pool, so a dataset
+ * that was opened before shows its previews right away.
+ *
+ * Options (Metadata):
+ *   cache_dir        defaults to $XDG_CACHE_HOME (or ~/.cache)/cuda_image_view
+ *   preview_threads  background workers, DEFAULT_PREVIEW_THREADS
+ */
+class PreviewCache
+{
+public:
+  PreviewCache(const Metadata& meta = Metadata());
+  virtual ~PreviewCache();
+
+  PreviewCache(const PreviewCache&) = delete;
+  PreviewCache& operator=(const PreviewCache&) = delete;
+
+          RawRGBPtr               preview(const std::string& filename, size_t min_size = 0);
+          RawRGBPtr               build(const std::string& filename, size_t min_size = 0);
+
+          void                    prefetch(const std::vector<std::string>& files);
+          size_t                  pending() const;
+          void                    wait();
+
+          const std::string&      directory() const { return _dir; }
+          std::string             cache_file(const std::string& filename) const;
+
+  static  RawRGBPtr               half_size(const RawRGB& img);
+  static  RawRGBPtr               downscale(const RawRGB& img);
+
+private:
+          RawRGBPtr               open_level(const std::string& filename, uint64_t size, uint64_t mtime, size_t min_size);
+          bool                    store(const std::string& filename, uint64_t size, uint64_t mtime,
+                                        const std::vector<RawRGBPtr>& levels);
+
+private:
+  std::string                     _dir;
+  std::unordered_set<std::string> _building;
+  bool                            _terminate;
+  mutable std::mutex              _mutex;
+  std::condition_variable         _cv;
+  ThreadPool                      _pool;
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_PREVIEW_CACHE_HPP_ */
@@ -0,0 +1,223 @@
+/*
+ * raw_batch_reader.cpp
+ *
+ *  Created on: Mar 13, 2020
+ *      Author: daniel
+ */
+
+#include "raw_batch_reader.hpp"
+#include "raw_file.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/stat.h>
+
+#include <algorithm>
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+enum BatchOp
+{
+  eOpen = 0,
+  eStat = 1,
+  eRead = 2,
+  eClose = 3,
+
+  eNumOps
+};
+
+#define BATCH_TAG(index, op)                ((static_cast<uint64_t>(index) << 2) | (op))
+#define BATCH_INDEX(tag)                    static_cast<size_t>((tag) >> 2)
+#define BATCH_OP(tag)                       static_cast<BatchOp>((tag) & 3)
+
+/*
+ * \\fn Constructor RawBatchReader::RawBatchReader
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+RawBatchReader::RawBatchReader(unsigned entries /*= DEFAULT_URING_ENTRIES*/, BlockPoolPtr pool /*= BlockPoolPtr()*/)
+: _ring(entries)
+, _pool(pool ? pool : BlockPoolPtr(new BlockPool()))
+{
+}
+
+/*
+ * \\fn Destructor RawBatchReader::~RawBatchReader
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+RawBatchReader::~RawBatchReader()
+{
+}
+
+/*
+ * \\fn std::vector<RawRGBPtr> RawBatchReader::load
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+std::vector<RawRGBPtr> RawBatchReader::load(const std::vector<std::string>& files)
+{
+  std::vector<RawRGBPtr> result(files.size());
+  if (!_ring.valid())
+  {
+    for (size_t index = 0; index < files.size(); index++)
+      result[index] = RawFile::load(files[index].c_str());
+
+    return result;
+  }
+
+  // openat and statx go in together, so a batch takes two entries per file
+  size_t batch = std::max<size_t>(_ring.entries() / 2, 1);
+  for (size_t index = 0; index < files.size(); index += batch)
+    load_batch(&files[index], std::min(batch, files.size() - index), &result[index]);
+
+  return result;
+}
+
+/*
+ * \\fn void RawBatchReader::load_batch
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+void RawBatchReader::load_batch(const std::string* files, size_t count, RawRGBPtr* results)
+{
+  std::vector<int> res(count * eNumOps, -1);
+  std::vector<struct statx> stx(count);
+  std::vector<PageAllocator::Block> blocks(count);
+
+  memset(stx.data(), 0, sizeof(struct statx) * count);
+
+  // Open and size every file of the batch
+  size_t submitted = 0;
+  for (size_t index = 0; index < count; index++)
+  {
+    io_uring_sqe* sqe = _ring.get_sqe();
+    if (sqe == nullptr)
+      break;
+
+    _ring.prep_openat(sqe, AT_FDCWD, files[index].c_str(), O_RDONLY | O_CLOEXEC, BATCH_TAG(index, eOpen));
+    submitted++;
+
+    sqe = _ring.get_sqe();
+    if (sqe == nullptr)
+      break;
+
+    _ring.prep_statx(sqe, AT_FDCWD, files[index].c_str(), STATX_SIZE, &stx[index], BATCH_TAG(index, eStat));
+    submitted++;
+  }
+
+  _ring.submit();
+  reap(submitted, res);
+
+  // One read of the whole file, header included
+  submitted = 0;
+  for (size_t index = 0; index < count; index++)
+  {
+    size_t file_size = static_cast<size_t>(stx[index].stx_size);
+    if ((res[index * eNumOps + eOpen] < 0) || (res[index * eNumOps + eStat] < 0) ||
+        (file_size < sizeof(uint32_t) * 3) || (file_size > UINT32_MAX))
+      continue;
+
+    blocks[index] = _pool->acquire(file_size);
+    if (blocks[index]._ptr == nullptr)
+      continue;
+
+    io_uring_sqe* sqe = _ring.get_sqe();
+    if (sqe == nullptr)
+      break;
+
+    _ring.prep_read(sqe, res[index * eNumOps + eOpen], blocks[index]._ptr,
+                    static_cast<unsigned>(file_size), 0, BATCH_TAG(index, eRead));
+    submitted++;
+  }
+
+  _ring.submit();
+  reap(submitted, res);
+
+  submitted = 0;
+  for (size_t index = 0; index < count; index++)
+  {
+    if (res[index * eNumOps + eOpen] < 0)
+      continue;
+
+    io_uring_sqe* sqe = _ring.get_sqe();
+    if (sqe == nullptr)
+    {
+      ::close(res[index * eNumOps + eOpen]);
+      continue;
+    }
+
+    _ring.prep_close(sqe, res[index * eNumOps + eOpen], BATCH_TAG(index, eClose));
+    submitted++;
+  }
+
+  _ring.submit();
+  reap(submitted, res);
+
+  for (size_t index = 0; index < count; index++)
+  {
+    PageAllocator::Block& block = blocks[index];
+    size_t file_size = static_cast<size_t>(stx[index].stx_size);
+
+    RawHeader header;
+    if ((block._ptr != nullptr) && (res[index * eNumOps + eRead] == static_cast<int>(file_size)) &&
+        RawFile::parse_header(reinterpret_cast<uint8_t*>(block._ptr), file_size, file_size, header) &&
+        (header._pitch == RawFile::row_bytes(header)))
+    {
+      // Skip the header, the pool rewinds _ptr when the buffer comes back
+      block._ptr = reinterpret_cast<uint8_t*>(block._ptr) + header._offset;
+      block._offset = header._offset;
+      block._size = header._size;
+
+      RawBufferPtr storage(new RawBuffer(block, _pool));
+      results[index].reset(new RawRGB(storage, header._width, header._height, header._depth, header._type, header._format));
+      continue;
+    }
+
+    _pool->recycle(block);
+
+    // Anything the ring couldn't do (old kernel, short read) goes the slow way
+    results[index] = RawFile::load(files[index].c_str());
+  }
+}
+
+/*
+ * \\fn size_t RawBatchReader::reap
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+size_t RawBatchReader::reap(size_t count, std::vector<int>& results)
+{
+  size_t done = 0;
+  io_uring_cqe cqe;
+  while ((done < count) && _ring.wait(cqe))
+  {
+    size_t index = BATCH_INDEX(cqe.user_data) * eNumOps + BATCH_OP(cqe.user_data);
+    if (index < results.size())
+      results[index] = cqe.res;
+
+    done++;
+  }
+
+  return done;
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
@@ -0,0 +1,61 @@
+/*
+ * raw_batch_reader.hpp
+ *
+ *  Created on: Mar 13, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_RAW_BATCH_READER_HPP_
+#define BRT_COMMON_IMAGE_RAW_BATCH_READER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "image.hpp"
+#include "io_uring.hpp"
+#include "page_allocator.hpp"
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\class RawBatchReader
+ *
+ * created on: Mar 13, 2020
+ *
+ * Loads many small raw files with a handful of io_uring submissions:
+ * openat and statx for the whole batch, then one read per file into
+ * pooled buffers, then close. Without io_uring, or for any file the
+ * ring could not read, it falls back to RawFile::load.
+ *
+ * Not thread safe, use one reader per thread.
+ */
+class RawBatchReader
+{
+public:
+  RawBatchReader(unsigned entries = DEFAULT_URING_ENTRIES, BlockPoolPtr pool = BlockPoolPtr());
+  virtual ~RawBatchReader();
+
+          bool                    uring() const { return _ring.valid(); }
+
+          // Results are in the order of files, empty for files that failed
+          std::vector<RawRGBPtr>  load(const std::vector<std::string>& files);
+
+private:
+          void                    load_batch(const std::string* files, size_t count, RawRGBPtr* results);
+          size_t                  reap(size_t count, std::vector<int>& results);
+
+private:
+  IoUring                         _ring;
+  BlockPoolPtr                    _pool;
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_RAW_BATCH_READER_HPP_ */
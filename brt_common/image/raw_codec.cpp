@@ -0,0 +1,414 @@
+/*
+ * raw_codec.cpp
+ *
+ *  Created on: Mar 25, 2020
+ *      Author: daniel
+ */
+
+#include "raw_codec.hpp"
+#include "thread_pool.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+#define RICE_BLOCK                          (32)
+#define RICE_LIMIT                          (24)      // longer quotients escape to raw
+#define RICE_RAW_BITS                       (17)      // a zigzagged 16 bit residual
+#define RICE_K_BITS                         (5)
+#define STRIP_PADDING                       (8)       // lets the reader load past the end
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+static const char codec_magic[4] = { 'B', 'R', 'C', '1' };
+
+/*
+ * \\class BitWriter
+ *
+ * created on: Mar 25, 2020
+ *
+ * MSB first into a buffer sized for the worst case, 32 bits at a time
+ */
+class BitWriter
+{
+public:
+  BitWriter(uint8_t* data) : _start(data), _ptr(data), _acc(0), _bits(0) {}
+
+  // count <= 32
+  inline void                     put(uint32_t value, int count)
+  {
+    _acc = (_acc << count) | value;
+    _bits += count;
+    if (_bits >= 32)
+    {
+      _bits -= 32;
+      uint32_t word = __builtin_bswap32(static_cast<uint32_t>(_acc >> _bits));
+      memcpy(_ptr, &word, sizeof(word));
+      _ptr += sizeof(word);
+    }
+  }
+
+  // Bytes used, including the padding
+  size_t                          flush()
+  {
+    if (_bits > 0)
+      put(0, 32 - _bits);
+
+    memset(_ptr, 0, STRIP_PADDING);
+    return static_cast<size_t>(_ptr - _start) + STRIP_PADDING;
+  }
+
+private:
+  uint8_t*                        _start;
+  uint8_t*                        _ptr;
+  uint64_t                        _acc;
+  int                             _bits;
+};
+
+/*
+ * \\class BitReader
+ *
+ * created on: Mar 25, 2020
+ *
+ * Left aligned accumulator, refilled with one unaligned 64 bit load so
+ * it always holds at least 56 bits: enough for a whole sample, quotient
+ * and remainder. A damaged stream reads zeros past the end instead of
+ * leaving the buffer.
+ */
+class BitReader
+{
+public:
+  BitReader(const uint8_t* data, const uint8_t* end) : _ptr(data), _end(end), _acc(0), _bits(0) { refill(); }
+
+  inline void                     refill()
+  {
+    uint64_t word = 0;
+    if (__builtin_expect(_ptr + sizeof(word) <= _end, 1))
+      memcpy(&word, _ptr, sizeof(word));
+    else if (_ptr < _end)
+      memcpy(&word, _ptr, _end - _ptr);
+
+    _acc |= __builtin_bswap64(word) >> _bits;
+    _ptr += (63 - _bits) >> 3;
+    _bits |= 56;
+  }
+
+  // Number of zeros before the next one bit, the one is consumed
+  inline int                      unary()
+  {
+    int zeros = (_acc == 0) ? 64 : __builtin_clzll(_acc);
+    if (zeros > RICE_LIMIT)
+      zeros = RICE_LIMIT;
+
+    skip(zeros + 1);
+    return zeros;
+  }
+
+  // count <= 32, the caller refills
+  inline uint32_t                 get(int count)
+  {
+    uint32_t result = static_cast<uint32_t>((_acc >> 1) >> (63 - count));
+    skip(count);
+    return result;
+  }
+
+private:
+  inline void                     skip(int count) { _acc <<= count; _bits -= count; }
+
+private:
+  const uint8_t*                  _ptr;
+  const uint8_t*                  _end;
+  uint64_t                        _acc;
+  int                             _bits;
+};
+
+/*
+ * \\fn uint32_t zigzag
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ */
+static inline uint32_t zigzag(int32_t value)
+{
+  return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+/*
+ * \\fn int32_t unzigzag
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ */
+static inline int32_t unzigzag(uint32_t value)
+{
+  return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+/*
+ * \\fn int32_t predict
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ * Same colour neighbour: two to the left, or two rows up for the first
+ * two columns. The first two rows of a strip start from mid scale.
+ */
+template<typename T>
+static inline int32_t predict(const T* row, const T* row_up2, size_t x, int32_t mid)
+{
+  if (x >= 2)
+    return row[x - 2];
+
+  return (row_up2 != nullptr) ? row_up2[x] : mid;
+}
+
+/*
+ * \\fn void encode_strip
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ */
+template<typename T>
+static void encode_strip(const RawRGB& img, size_t first, size_t last, std::vector<uint8_t>& out)
+{
+  const size_t width = img.width();
+  const int32_t mid = 1 << (img.depth() - 1);
+
+  // Every sample fits in an escape, every run adds its k
+  size_t blocks = (width + RICE_BLOCK - 1) / RICE_BLOCK;
+  size_t bits = (last - first) * (width * (RICE_LIMIT + 1 + RICE_RAW_BITS) + blocks * RICE_K_BITS);
+  out.resize(bits / 8 + 8 + STRIP_PADDING);
+
+  BitWriter writer(out.data());
+  uint32_t residuals[RICE_BLOCK];
+
+  for (size_t y = first; y < last; y++)
+  {
+    const T* row = reinterpret_cast<const T*>(img.cbytes() + y * img.pitch());
+    const T* row_up2 = (y >= first + 2) ? reinterpret_cast<const T*>(img.cbytes() + (y - 2) * img.pitch()) : nullptr;
+
+    for (size_t x = 0; x < width; x += RICE_BLOCK)
+    {
+      size_t count = std::min<size_t>(RICE_BLOCK, width - x);
+      uint64_t sum = 0;
+      for (size_t i = 0; i < count; i++)
+      {
+        residuals[i] = zigzag(static_cast<int32_t>(row[x + i]) - predict(row, row_up2, x + i, mid));
+        sum += residuals[i];
+      }
+
+      // Smallest k with count * 2^k covering the sum, the usual Rice estimate
+      int k = 0;
+      while ((k < RICE_RAW_BITS) && ((static_cast<uint64_t>(count) << k) < sum))
+        k++;
+
+      writer.put(static_cast<uint32_t>(k), RICE_K_BITS);
+      for (size_t i = 0; i < count; i++)
+      {
+        uint32_t q = residuals[i] >> k;
+        if (q < RICE_LIMIT)
+        {
+          writer.put(1, static_cast<int>(q) + 1);
+          if (k > 0)
+            writer.put(residuals[i] & ((1u << k) - 1), k);
+        }
+        else
+        {
+          writer.put(1, RICE_LIMIT + 1);
+          writer.put(residuals[i], RICE_RAW_BITS);
+        }
+      }
+    }
+  }
+
+  out.resize(writer.flush());
+}
+
+/*
+ * \\fn void decode_strip
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ */
+template<typename T>
+static void decode_strip(RawRGB& img, uint8_t* bytes, size_t first, size_t last, const uint8_t* data, const uint8_t* end)
+{
+  const size_t width = img.width();
+  const int32_t mid = 1 << (img.depth() - 1);
+
+  BitReader reader(data, end);
+  for (size_t y = first; y < last; y++)
+  {
+    T* row = reinterpret_cast<T*>(bytes + y * img.pitch());
+    const T* row_up2 = (y >= first + 2) ? reinterpret_cast<const T*>(bytes + (y - 2) * img.pitch()) : nullptr;
+
+    for (size_t x = 0; x < width; x += RICE_BLOCK)
+    {
+      size_t count = std::min<size_t>(RICE_BLOCK, width - x);
+
+      reader.refill();
+      int k = static_cast<int>(reader.get(RICE_K_BITS));
+
+      for (size_t i = 0; i < count; i++)
+      {
+        reader.refill();
+
+        int q = reader.unary();
+        uint32_t residual = (q < RICE_LIMIT) ? ((static_cast<uint32_t>(q) << k) | reader.get(k)) :
+                                                reader.get(RICE_RAW_BITS);
+
+        row[x + i] = static_cast<T>(predict(row, row_up2, x + i, mid) + unzigzag(residual));
+      }
+    }
+  }
+}
+
+/*
+ * \\fn bool RawCodec::supported
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ */
+bool RawCodec::supported(const RawRGB& img)
+{
+  return !img.empty() && (img.type() == eBayer) && (img.format() == eUnsigned) &&
+         (img.depth() > 0) && (img.depth() <= 16) && (img.width() >= 2);
+}
+
+/*
+ * \\fn bool RawCodec::is_compressed
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ */
+bool RawCodec::is_compressed(const uint8_t* data, size_t size)
+{
+  return (data != nullptr) && (size >= sizeof(RawCodecHeader)) && (memcmp(data, codec_magic, sizeof(codec_magic)) == 0);
+}
+
+/*
+ * \\fn bool RawCodec::encode
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ */
+bool RawCodec::encode(const RawRGB& img, std::vector<uint8_t>& out, size_t threads /*= 0*/)
+{
+  if (!supported(img))
+    return false;
+
+  RawCodecHeader header;
+  memcpy(header._magic, codec_magic, sizeof(header._magic));
+  header._width = static_cast<uint32_t>(img.width());
+  header._height = static_cast<uint32_t>(img.height());
+  header._depth = static_cast<uint16_t>(img.depth());
+  header._strip_rows = RAW_CODEC_STRIP_ROWS;
+  header._strips = static_cast<uint32_t>((img.height() + RAW_CODEC_STRIP_ROWS - 1) / RAW_CODEC_STRIP_ROWS);
+
+  std::vector<std::vector<uint8_t>> strips(header._strips);
+  if (threads == 0)
+    threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+  bool wide = (BYTES_PER_PIXELS(img.depth()) == 2);
+  ThreadPool::shared().parallel_for(strips.size(), threads, [&img, &strips, wide](size_t strip)
+  {
+    size_t first = strip * RAW_CODEC_STRIP_ROWS;
+    size_t last = std::min<size_t>(first + RAW_CODEC_STRIP_ROWS, img.height());
+
+    if (wide)
+      encode_strip<uint16_t>(img, first, last, strips[strip]);
+    else
+      encode_strip<uint8_t>(img, first, last, strips[strip]);
+  });
+
+  std::vector<uint32_t> offsets(strips.size() + 1);
+  size_t offset = sizeof(header) + offsets.size() * sizeof(uint32_t);
+  for (size_t strip = 0; strip < strips.size(); strip++)
+  {
+    offsets[strip] = static_cast<uint32_t>(offset);
+    offset += strips[strip].size();
+  }
+  offsets.back() = static_cast<uint32_t>(offset);
+
+  out.resize(offset);
+  memcpy(out.data(), &header, sizeof(header));
+  memcpy(out.data() + sizeof(header), offsets.data(), offsets.size() * sizeof(uint32_t));
+  for (size_t strip = 0; strip < strips.size(); strip++)
+    memcpy(out.data() + offsets[strip], strips[strip].data(), strips[strip].size());
+
+  return true;
+}
+
+/*
+ * \\fn RawRGBPtr RawCodec::decode
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ */
+RawRGBPtr RawCodec::decode(const uint8_t* data, size_t size, size_t threads /*= 0*/)
+{
+  if (!is_compressed(data, size))
+    return RawRGBPtr();
+
+  RawCodecHeader header;
+  memcpy(&header, data, sizeof(header));
+  if ((header._width < 2) || (header._height == 0) || (header._depth == 0) || (header._depth > 16) ||
+      (header._strip_rows == 0) || (header._strips != (header._height + header._strip_rows - 1) / header._strip_rows))
+    return RawRGBPtr();
+
+  size_t table = sizeof(header) + (header._strips + 1) * sizeof(uint32_t);
+  if (table > size)
+    return RawRGBPtr();
+
+  std::vector<uint32_t> offsets(header._strips + 1);
+  memcpy(offsets.data(), data + sizeof(header), offsets.size() * sizeof(uint32_t));
+
+  // Every strip has to hold at least its padding, so the reader never leaves the buffer
+  for (size_t strip = 0; strip < header._strips; strip++)
+  {
+    if ((offsets[strip] < table) || (offsets[strip] + STRIP_PADDING > offsets[strip + 1]) || (offsets[strip + 1] > size))
+      return RawRGBPtr();
+  }
+
+  RawRGBPtr result(new RawRGB(header._width, header._height, header._depth, eBayer));
+  if (result->empty())
+    return RawRGBPtr();
+
+  if (threads == 0)
+    threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+  RawRGB& img = *result;
+  uint8_t* bytes = img.bytes();
+  bool wide = (BYTES_PER_PIXELS(header._depth) == 2);
+
+  ThreadPool::shared().parallel_for(header._strips, threads, [&](size_t strip)
+  {
+    size_t first = strip * header._strip_rows;
+    size_t last = std::min<size_t>(first + header._strip_rows, header._height);
+
+    if (wide)
+      decode_strip<uint16_t>(img, bytes, first, last, data + offsets[strip], data + offsets[strip + 1]);
+    else
+      decode_strip<uint8_t>(img, bytes, first, last, data + offsets[strip], data + offsets[strip + 1]);
+  });
+
+  return result;
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
@@ -0,0 +1,73 @@
+/*
+ * raw_codec.hpp
+ *
+ *  Created on: Mar 25, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_RAW_CODEC_HPP_
+#define BRT_COMMON_IMAGE_RAW_CODEC_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "image.hpp"
+
+#define RAW_CODEC_NONE                      (0)
+#define RAW_CODEC_CFA_RICE                  (1)
+
+#define RAW_CODEC_STRIP_ROWS                (16)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\struct RawCodecHeader
+ *
+ * created on: Mar 25, 2020
+ *
+ * Start of every compressed frame, followed by strips + 1 uint32 strip
+ * offsets (from the start of the frame) and the strips themselves
+ */
+struct RawCodecHeader
+{
+  char                            _magic[4];
+  uint32_t                        _width;
+  uint32_t                        _height;
+  uint16_t                        _depth;
+  uint16_t                        _strip_rows;
+  uint32_t                        _strips;
+};
+
+/*
+ * \\class RawCodec
+ *
+ * created on: Mar 25, 2020
+ *
+ * Lossless codec for Bayer frames. Every sample is predicted from the
+ * previous sample of the same CFA colour on its row (two to the left),
+ * the zigzagged residuals are Rice coded with one k per run of 32.
+ * Strips of rows are coded independently, encode and decode run the
+ * strips in parallel.
+ */
+class RawCodec
+{
+public:
+  static  bool                    supported(const RawRGB& img);
+  static  bool                    is_compressed(const uint8_t* data, size_t size);
+
+  static  bool                    encode(const RawRGB& img, std::vector<uint8_t>& out, size_t threads = 0);
+  static  RawRGBPtr               decode(const uint8_t* data, size_t size, size_t threads = 0);
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_RAW_CODEC_HPP_ */
@@ -0,0 +1,516 @@
+/*
+ * raw_file.cpp
+ *
+ *  Created on: Mar 9, 2020
+ *      Author: daniel
+ */
+
+#include "raw_file.hpp"
+#include "raw_codec.hpp"
+#include "image_writer.hpp"
+#include "page_allocator.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <utils.hpp>
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+static const char raw_file_magic[4] = { 'B', 'R', 'A', 'W' };
+
+/*
+ * \\fn void read_metadata
+ *
+ * created on: Apr 3, 2020
+ * author: daniel
+ *
+ * The block is the semicolon separated list of Metadata::to_string()
+ */
+static void read_metadata(const uint8_t* data, size_t size, Metadata& meta)
+{
+  std::string text(reinterpret_cast<const char*>(data), strnlen(reinterpret_cast<const char*>(data), size));
+  if (!text.empty())
+    meta.add(text.c_str());
+}
+
+/*
+ * \\fn RawRGBPtr RawFile::load
+ *
+ * created on: Mar 9, 2020
+ * author: daniel
+ *
+ */
+RawRGBPtr RawFile::load(const char* filename, bool populate /*= true*/)
+{
+  RawHeader header;
+  RawBufferPtr storage = load(filename, header, populate);
+  if (!storage)
+    return load_compressed(filename);
+
+  return RawRGBPtr(new RawRGB(storage, header._width, header._height, header._depth, header._type, header._format));
+}
+
+/*
+ * \\fn RawBufferPtr RawFile::load
+ *
+ * created on: Mar 9, 2020
+ * author: daniel
+ *
+ */
+RawBufferPtr RawFile::load(const char* filename, RawHeader& header, bool populate /*= true*/)
+{
+  return load_payload(filename, header, true, populate);
+}
+
+/*
+ * \\fn RawRGBPtr RawFile::read
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ * Like load(), but the samples are always copied into storage of their
+ * own. A mapped file rewritten or truncated while the frame is still in
+ * use raises SIGBUS on the next access.
+ */
+RawRGBPtr RawFile::read(const char* filename)
+{
+  RawHeader header;
+  RawBufferPtr storage = read(filename, header);
+  if (!storage)
+    return load_compressed(filename, false);
+
+  return RawRGBPtr(new RawRGB(storage, header._width, header._height, header._depth, header._type, header._format));
+}
+
+/*
+ * \\fn RawBufferPtr RawFile::read
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ */
+RawBufferPtr RawFile::read(const char* filename, RawHeader& header)
+{
+  return load_payload(filename, header, false, false);
+}
+
+/*
+ * \\fn RawBufferPtr RawFile::load_payload
+ *
+ * created on: Mar 9, 2020
+ * author: daniel
+ *
+ */
+RawBufferPtr RawFile::load_payload(const char* filename, RawHeader& header, bool map, bool populate)
+{
+  if (filename == nullptr)
+    return RawBufferPtr();
+
+  int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return RawBufferPtr();
+
+  RawBufferPtr result;
+  struct stat st;
+  if ((::fstat(fd, &st) == 0) && read_header(fd, static_cast<size_t>(st.st_size), header))
+  {
+    // Zero copy only works if every sample stays naturally aligned and rows aren't padded
+    bool contiguous = (header._pitch == row_bytes(header));
+    if (map && contiguous && (is_packed(header._format) || ((header._offset % BYTES_PER_PIXELS(header._depth)) == 0)))
+      result = map_payload(fd, header, populate);
+
+    if (!result)
+    {
+      result = read_payload(fd, header);
+      if (result && !contiguous)
+        compact_rows(*result, header);
+    }
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  ::close(fd);
+  return result;
+}
+
+/*
+ * \\fn RawRGBPtr RawFile::load_compressed
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ */
+RawRGBPtr RawFile::load_compressed(const char* filename, bool map /*= true*/)
+{
+  if (filename == nullptr)
+    return RawRGBPtr();
+
+  int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return RawRGBPtr();
+
+  RawRGBPtr result;
+  struct stat st;
+  if ((::fstat(fd, &st) == 0) && (static_cast<size_t>(st.st_size) >= sizeof(RawCodecHeader)))
+  {
+    size_t size = static_cast<size_t>(st.st_size);
+    if (map)
+    {
+      PageAllocator::Block block = PageAllocator::map_file(fd, 0, size, true);
+      if (block._ptr != nullptr)
+      {
+        result = RawCodec::decode(reinterpret_cast<const uint8_t*>(block._ptr), size);
+        PageAllocator::release(block);
+      }
+    }
+    else
+    {
+      RawHeader whole;
+      whole._offset = 0;
+      whole._size = size;
+
+      RawBufferPtr stream = read_payload(fd, whole);
+      if (stream)
+        result = RawCodec::decode(stream->bytes(), size);
+    }
+  }
+
+  ::close(fd);
+  return result;
+}
+
+/*
+ * \\fn bool RawFile::read_header
+ *
+ * created on: Mar 9, 2020
+ * author: daniel
+ *
+ * One page covers the old header, the new one and most metadata
+ * blocks, only a larger block takes a second read
+ */
+bool RawFile::read_header(int fd, size_t file_size, RawHeader& header)
+{
+  uint8_t page[RAW_PAYLOAD_ALIGNMENT];
+  size_t length = std::min<size_t>(file_size, sizeof(page));
+  if (length < 3 * sizeof(uint32_t))
+    return false;
+
+  if (::pread(fd, page, length, 0) != static_cast<ssize_t>(length))
+    return false;
+
+  if (!parse_header(page, length, file_size, header))
+    return false;
+
+  if (header._version >= 2)
+  {
+    RawFileHeader v2;
+    memcpy(&v2, page, sizeof(v2));
+
+    if ((v2._metadata_size > 0) && (v2._metadata_size <= RAW_MAX_METADATA) &&
+        (static_cast<size_t>(v2._header_size) + v2._metadata_size > length))
+    {
+      std::vector<uint8_t> block(v2._metadata_size);
+      if (::pread(fd, block.data(), block.size(), v2._header_size) == static_cast<ssize_t>(block.size()))
+        read_metadata(block.data(), block.size(), header._metadata);
+    }
+  }
+
+  return true;
+}
+
+/*
+ * \\fn bool RawFile::parse_header
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ * data holds the first length bytes of a file of file_size bytes
+ */
+bool RawFile::parse_header(const uint8_t* data, size_t length, size_t file_size, RawHeader& header)
+{
+  uint32_t words[3];
+  if ((data == nullptr) || (length < sizeof(words)) || (file_size < sizeof(words)))
+    return false;
+
+  if (memcmp(data, raw_file_magic, sizeof(raw_file_magic)) == 0)
+    return parse_v2(data, length, file_size, header);
+
+  memcpy(words, data, sizeof(words));
+
+  header._version = 1;
+  header._width = words[0];
+  header._height = words[1];
+  header._depth = words[2];
+
+  /// Backward compatibility
+  if (header._depth == 2)
+    header._depth = 16;
+
+  if ((header._width == 0) || (header._height == 0) || (header._depth == 0) || (header._depth > 32))
+    return false;
+
+  header._offset = sizeof(words);
+
+  size_t available = file_size - header._offset;
+  size_t bayer_size = static_cast<size_t>(header._width) * header._height * BYTES_PER_PIXELS(header._depth);
+
+  header._format = eUnsigned;
+
+  // Debayered frames are stored with the same header, only the size tells them apart
+  if (available >= bayer_size * type_size(eRGBA))
+    header._type = eRGBA;
+  else if (available >= bayer_size)
+    header._type = eBayer;
+  else
+  {
+    // Too short for one sample per uint16, MIPI packed sensor frames still fit
+    SampleFormat format = (header._depth == 10) ? eMipiRaw10 : (header._depth == 12) ? eMipiRaw12 : eUnsigned;
+    if (format == eUnsigned)
+      return false;
+
+    size_t packed_size = packed_row_bytes(header._width, format) * header._height;
+    if (available < packed_size)
+      return false;
+
+    header._type = eBayer;
+    header._format = format;
+    header._size = packed_size;
+    header._pitch = row_bytes(header);
+    header._cfa = eCfaGRBG;
+    return true;
+  }
+
+  header._size = bayer_size * type_size(header._type);
+  header._pitch = row_bytes(header);
+  header._cfa = (header._type == eBayer) ? eCfaGRBG : eCfaNone;
+  return true;
+}
+
+/*
+ * \\fn bool RawFile::parse_v2
+ *
+ * created on: Apr 3, 2020
+ * author: daniel
+ *
+ * Later versions only append to RawFileHeader, _header_size skips
+ * what this reader doesn't know
+ */
+bool RawFile::parse_v2(const uint8_t* data, size_t length, size_t file_size, RawHeader& header)
+{
+  RawFileHeader v2;
+  if (length < sizeof(v2))
+    return false;
+
+  memcpy(&v2, data, sizeof(v2));
+  if ((v2._version < RAW_FILE_VERSION) || (v2._header_size < sizeof(v2)))
+    return false;
+
+  if ((v2._type == eNone) || (v2._type >= eNumTypes) || (v2._format > eMipiRaw12) || (v2._cfa >= eNumCfaPatterns))
+    return false;
+
+  header._version = v2._version;
+  header._width = v2._width;
+  header._height = v2._height;
+  header._type = static_cast<PixelType>(v2._type);
+  header._format = static_cast<SampleFormat>(v2._format);
+  header._depth = static_cast<uint32_t>(format_depth(header._format, v2._depth));
+  header._cfa = static_cast<CfaPattern>(v2._cfa);
+  header._timestamp = v2._timestamp;
+  header._exposure = v2._exposure;
+
+  if ((header._width == 0) || (header._height == 0) || (header._depth == 0) || (header._depth > 32))
+    return false;
+
+  // Padded rows are compacted on load, planes have nowhere to put the padding
+  size_t natural = row_bytes(header);
+  header._pitch = (v2._pitch != 0) ? v2._pitch : natural;
+  if ((header._pitch < natural) || (is_planar(header._type) && (header._pitch != natural)))
+    return false;
+
+  header._offset = static_cast<size_t>(v2._payload_offset);
+  header._size = (header._pitch == natural) ? payload_size(header) : header._pitch * header._height;
+
+  if ((v2._payload_size < header._size) || (header._offset > file_size) || (file_size - header._offset < header._size))
+    return false;
+
+  if ((v2._metadata_size > 0) && (static_cast<size_t>(v2._header_size) + v2._metadata_size <= length))
+    read_metadata(data + v2._header_size, v2._metadata_size, header._metadata);
+
+  return true;
+}
+
+/*
+ * \\fn size_t RawFile::row_bytes
+ *
+ * created on: Apr 3, 2020
+ * author: daniel
+ *
+ * Same as RawRGB::pitch()
+ */
+size_t RawFile::row_bytes(const RawHeader& header)
+{
+  size_t samples = static_cast<size_t>(header._width) * (is_planar(header._type) ? 1 : type_size(header._type));
+  if (is_packed(header._format))
+    return packed_row_bytes(samples, header._format);
+
+  return samples * BYTES_PER_PIXELS(header._depth);
+}
+
+/*
+ * \\fn size_t RawFile::payload_size
+ *
+ * created on: Apr 3, 2020
+ * author: daniel
+ *
+ * Same as RawRGB::size(), planes included
+ */
+size_t RawFile::payload_size(const RawHeader& header)
+{
+  size_t plane_size = row_bytes(header) * header._height;
+  if (!is_planar(header._type))
+    return plane_size;
+
+  plane_size = (plane_size + PLANE_ALIGNMENT - 1) & ~static_cast<size_t>(PLANE_ALIGNMENT - 1);
+  return plane_size * num_planes(header._type);
+}
+
+/*
+ * \\fn size_t RawFile::make_header
+ *
+ * created on: Apr 3, 2020
+ * author: daniel
+ *
+ * Fills header with everything in front of the payload and returns the
+ * payload offset, 0 on failure. "cfa" (CfaPattern), "timestamp"
+ * (microseconds) and "exposure" (microseconds) are taken from meta, the
+ * whole of meta also goes into the metadata block.
+ */
+size_t RawFile::make_header(const RawRGB& img, const Metadata& meta, std::vector<uint8_t>& header)
+{
+  if (img.empty() || (img.type() == eNone))
+    return 0;
+
+  std::string text = meta.to_string();
+  size_t metadata_size = text.empty() ? 0 : text.size() + 1;
+  if (metadata_size > RAW_MAX_METADATA)
+    return 0;
+
+  size_t offset = (sizeof(RawFileHeader) + metadata_size + RAW_PAYLOAD_ALIGNMENT - 1) &
+                                          ~static_cast<size_t>(RAW_PAYLOAD_ALIGNMENT - 1);
+
+  RawFileHeader v2;
+  memset(&v2, 0, sizeof(v2));
+  memcpy(v2._magic, raw_file_magic, sizeof(v2._magic));
+  v2._version = RAW_FILE_VERSION;
+  v2._header_size = sizeof(v2);
+  v2._width = static_cast<uint32_t>(img.width());
+  v2._height = static_cast<uint32_t>(img.height());
+  v2._depth = static_cast<uint16_t>(img.depth());
+  v2._type = static_cast<uint8_t>(img.type());
+  v2._format = static_cast<uint8_t>(img.format());
+  v2._cfa = static_cast<uint8_t>(meta.get<int>("cfa",(img.type() == eBayer) ? eCfaGRBG : eCfaNone));
+  v2._pitch = static_cast<uint32_t>(img.pitch());
+  v2._metadata_size = static_cast<uint32_t>(metadata_size);
+  v2._timestamp = meta.get<unsigned long>("timestamp",0);
+  v2._exposure = static_cast<uint32_t>(meta.get<int>("exposure",0));
+  v2._payload_offset = offset;
+  v2._payload_size = img.size();
+
+  header.assign(offset, 0);
+  memcpy(header.data(), &v2, sizeof(v2));
+  if (metadata_size > 0)
+    memcpy(header.data() + sizeof(v2), text.c_str(), metadata_size);
+
+  return offset;
+}
+
+/*
+ * \\fn bool RawFile::save
+ *
+ * created on: Apr 3, 2020
+ * author: daniel
+ *
+ */
+bool RawFile::save(const char* filename, const RawRGB& img, const Metadata& meta /*= Metadata()*/)
+{
+  std::vector<uint8_t> header;
+  if ((filename == nullptr) || (make_header(img, meta, header) == 0))
+    return false;
+
+  EncodedImage encoded;
+  encoded.append(std::move(header));
+  encoded.append(img.cbytes(), img.size());
+  return ImageWriter::write(filename, encoded);
+}
+
+/*
+ * \\fn RawBufferPtr RawFile::map_payload
+ *
+ * created on: Mar 9, 2020
+ * author: daniel
+ *
+ */
+RawBufferPtr RawFile::map_payload(int fd, const RawHeader& header, bool populate)
+{
+  PageAllocator::Block block = PageAllocator::map_file(fd, header._offset, header._size, populate);
+  if (block._ptr == nullptr)
+    return RawBufferPtr();
+
+  return RawBufferPtr(new RawBuffer(block));
+}
+
+/*
+ * \\fn RawBufferPtr RawFile::read_payload
+ *
+ * created on: Mar 9, 2020
+ * author: daniel
+ *
+ */
+RawBufferPtr RawFile::read_payload(int fd, const RawHeader& header)
+{
+  RawBufferPtr result(new RawBuffer(header._size));
+  if (result->bytes() == nullptr)
+    return RawBufferPtr();
+
+  size_t done = 0;
+  while (done < header._size)
+  {
+    ssize_t ret = ::pread(fd, result->bytes() + done, header._size - done, static_cast<off_t>(header._offset + done));
+    if (ret <= 0)
+      return RawBufferPtr();
+
+    done += static_cast<size_t>(ret);
+  }
+
+  return result;
+}
+
+/*
+ * \\fn void RawFile::compact_rows
+ *
+ * created on: Apr 3, 2020
+ * author: daniel
+ *
+ * Rows only move towards the start, so they are moved in place
+ */
+void RawFile::compact_rows(RawBuffer& buffer, const RawHeader& header)
+{
+  size_t row = row_bytes(header);
+  uint8_t* data = buffer.bytes();
+
+  for (size_t y = 1; y < header._height; y++)
+    memmove(data + y * row, data + y * header._pitch, row);
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
@@ -0,0 +1,156 @@
+/*
+ * raw_file.hpp
+ *
+ *  Created on: Mar 9, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_RAW_FILE_HPP_
+#define BRT_COMMON_IMAGE_RAW_FILE_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "image.hpp"
+
+#define RAW_FILE_VERSION                    (2)
+#define RAW_PAYLOAD_ALIGNMENT               (4096)
+#define RAW_MAX_METADATA                    (1024 * 1024)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\enum CfaPattern
+ *
+ * created on: Apr 3, 2020
+ *
+ * Colours of the top left quad, in row order. The debayers here all
+ * expect eCfaGRBG.
+ */
+enum CfaPattern
+{
+  eCfaNone = 0,
+  eCfaGRBG = 1,
+  eCfaRGGB = 2,
+  eCfaBGGR = 3,
+  eCfaGBRG = 4,
+
+  eNumCfaPatterns
+};
+
+/*
+ * \\struct RawFileHeader
+ *
+ * created on: Apr 3, 2020
+ *
+ * Version 2 header as stored on disk, little endian. The metadata block
+ * follows at _header_size, the payload starts at _payload_offset which
+ * is a multiple of RAW_PAYLOAD_ALIGNMENT, so it maps page aligned.
+ * Version 1 files are the bare three words width, height, depth.
+ */
+struct RawFileHeader
+{
+  char                            _magic[4];
+  uint16_t                        _version;
+  uint16_t                        _header_size;
+  uint32_t                        _width;
+  uint32_t                        _height;
+  uint16_t                        _depth;       // significant bits per sample
+  uint8_t                         _type;        // PixelType
+  uint8_t                         _format;      // SampleFormat
+  uint8_t                         _cfa;         // CfaPattern
+  uint8_t                         _reserved[3];
+  uint32_t                        _pitch;       // payload bytes per row (per plane)
+  uint32_t                        _metadata_size;
+  uint64_t                        _timestamp;   // microseconds, 0 if unknown
+  uint32_t                        _exposure;    // microseconds, 0 if unknown
+  uint32_t                        _reserved2;
+  uint64_t                        _payload_offset;
+  uint64_t                        _payload_size;
+};
+
+/*
+ * \\struct RawHeader
+ *
+ * created on: Mar 9, 2020
+ *
+ */
+struct RawHeader
+{
+  RawHeader()
+  : _width(0), _height(0), _depth(0), _type(eBayer), _format(eUnsigned), _offset(0), _size(0)
+  , _version(1), _cfa(eCfaNone), _pitch(0), _timestamp(0), _exposure(0), _metadata() {}
+
+  uint32_t                        _width;
+  uint32_t                        _height;
+  uint32_t                        _depth;
+  PixelType                       _type;
+  SampleFormat                    _format;
+  size_t                          _offset;      // payload offset in the file
+  size_t                          _size;        // payload size
+
+  uint32_t                        _version;
+  CfaPattern                      _cfa;
+  size_t                          _pitch;       // payload bytes per row
+  uint64_t                        _timestamp;
+  uint32_t                        _exposure;
+  Metadata                        _metadata;    // version 2 only
+};
+
+/*
+ * \\class RawFile
+ *
+ * created on: Mar 9, 2020
+ *
+ * Loader for the .raw files written by the cameras: three uint32 words
+ * (width, height, depth) followed by the samples. The payload is mapped
+ * straight into the RawRGB storage when it is aligned to the sample
+ * size, otherwise it is read with a single pread. 10 and 12 bit files
+ * sized for MIPI packed rows load packed, files written by RawCodec are
+ * recognized by their magic and decoded.
+ *
+ * Version 2 files start with a RawFileHeader instead and carry the
+ * layout explicitly, together with a Metadata block. save() always
+ * writes version 2.
+ */
+class RawFile
+{
+public:
+  static  RawRGBPtr               load(const char* filename, bool populate = true);
+  static  RawBufferPtr            load(const char* filename, RawHeader& header, bool populate = true);
+
+  // Never keeps the file mapped, for files another process may rewrite or truncate
+  static  RawRGBPtr               read(const char* filename);
+  static  RawBufferPtr            read(const char* filename, RawHeader& header);
+
+  static  bool                    read_header(int fd, size_t file_size, RawHeader& header);
+  static  bool                    parse_header(const uint8_t* data, size_t length, size_t file_size, RawHeader& header);
+
+  static  size_t                  make_header(const RawRGB& img, const Metadata& meta, std::vector<uint8_t>& header);
+  static  bool                    save(const char* filename, const RawRGB& img, const Metadata& meta = Metadata());
+
+  // Row size of the samples in memory, payloads with a larger pitch are compacted on load
+  static  size_t                  row_bytes(const RawHeader& header);
+
+private:
+  static  bool                    parse_v2(const uint8_t* data, size_t length, size_t file_size, RawHeader& header);
+  static  size_t                  payload_size(const RawHeader& header);
+  static  RawBufferPtr            load_payload(const char* filename, RawHeader& header, bool map, bool populate);
+  static  RawBufferPtr            map_payload(int fd, const RawHeader& header, bool populate);
+  static  RawBufferPtr            read_payload(int fd, const RawHeader& header);
+  static  void                    compact_rows(RawBuffer& buffer, const RawHeader& header);
+  static  RawRGBPtr               load_compressed(const char* filename, bool map = true);
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_RAW_FILE_HPP_ */
@@ -0,0 +1,626 @@
+/*
+ * raw_sequence.cpp
+ *
+ *  Created on: Mar 23, 2020
+ *      Author: daniel
+ */
+
+#include "raw_sequence.hpp"
+#include "raw_codec.hpp"
+#include "page_allocator.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+static const char sequence_magic[8] = { 'B', 'R', 'T', 'S', 'E', 'Q', 0, 1 };
+static const char frame_magic[8] = { 'B', 'R', 'T', 'F', 'R', 'A', 'M', 'E' };
+static const char index_magic[8] = { 'B', 'R', 'T', 'I', 'N', 'D', 'E', 'X' };
+
+/*
+ * \\struct FrameRecord
+ *
+ * created on: Mar 23, 2020
+ *
+ */
+struct FrameRecord
+{
+  char                            _magic[8];
+  SequenceEntry                   _entry;
+};
+
+/*
+ * \\struct IndexFooter
+ *
+ * created on: Mar 23, 2020
+ *
+ */
+struct IndexFooter
+{
+  char                            _magic[8];
+  uint64_t                        _frames;
+  uint64_t                        _index_offset;
+};
+
+static_assert(sizeof(SequenceEntry) == 48, "SequenceEntry is part of the file format");
+static_assert(sizeof(SequenceHeader) == 64, "SequenceHeader is part of the file format");
+
+/*
+ * \\fn uint64_t align_up
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+static inline uint64_t align_up(uint64_t value)
+{
+  return (value + SEQUENCE_ALIGNMENT - 1) & ~static_cast<uint64_t>(SEQUENCE_ALIGNMENT - 1);
+}
+
+/*
+ * \\fn bool write_all
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+static bool write_all(int fd, struct iovec* iov, int count, uint64_t offset)
+{
+  while (count > 0)
+  {
+    ssize_t res = ::pwritev(fd, iov, count, static_cast<off_t>(offset));
+    if (res < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return false;
+    }
+
+    offset += static_cast<uint64_t>(res);
+    size_t written = static_cast<size_t>(res);
+    while ((count > 0) && (written >= iov->iov_len))
+    {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+
+    if (count > 0)
+    {
+      iov->iov_base = reinterpret_cast<uint8_t*>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * \\fn bool read_all
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+static bool read_all(int fd, void* data, size_t size, uint64_t offset)
+{
+  uint8_t* dst = reinterpret_cast<uint8_t*>(data);
+  while (size > 0)
+  {
+    ssize_t res = ::pread(fd, dst, size, static_cast<off_t>(offset));
+    if (res < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return false;
+    }
+
+    if (res == 0)
+      return false;
+
+    dst += res;
+    size -= static_cast<size_t>(res);
+    offset += static_cast<uint64_t>(res);
+  }
+
+  return true;
+}
+
+/*
+ * \\fn bool valid_entry
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+static bool valid_entry(const SequenceEntry& entry, uint64_t file_size)
+{
+  return ((entry._offset % SEQUENCE_ALIGNMENT) == 0) &&
+         (entry._offset + entry._size <= file_size) &&
+         (entry._width != 0) && (entry._height != 0) &&
+         (entry._type > eNone) && (entry._type < eNumTypes);
+}
+
+/*
+ * \\fn Constructor SequenceWriter::SequenceWriter
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+SequenceWriter::SequenceWriter()
+: _fd(-1)
+, _end(0)
+, _codec(RAW_CODEC_NONE)
+, _index()
+, _writing(0)
+, _closing(false)
+{
+}
+
+/*
+ * \\fn Destructor SequenceWriter::~SequenceWriter
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+SequenceWriter::~SequenceWriter()
+{
+  close();
+}
+
+/*
+ * \\fn bool SequenceWriter::open
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+bool SequenceWriter::open(const char* filename)
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  if ((_fd >= 0) || (filename == nullptr))
+    return false;
+
+  _fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (_fd < 0)
+    return false;
+
+  // The header keeps a whole page, so the first frame record starts aligned
+  std::vector<uint8_t> page(SEQUENCE_ALIGNMENT, 0);
+  SequenceHeader* header = reinterpret_cast<SequenceHeader*>(page.data());
+  memcpy(header->_magic, sequence_magic, sizeof(header->_magic));
+  header->_version = SEQUENCE_VERSION;
+  header->_alignment = SEQUENCE_ALIGNMENT;
+
+  struct iovec iov = { page.data(), page.size() };
+  if (!write_all(_fd, &iov, 1, 0))
+  {
+    ::close(_fd);
+    _fd = -1;
+    return false;
+  }
+
+  _end = SEQUENCE_ALIGNMENT;
+  _index.clear();
+  return true;
+}
+
+/*
+ * \\fn bool SequenceWriter::close
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+bool SequenceWriter::close()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  if ((_fd < 0) || _closing)
+    return false;
+
+  // Appends already past the lock still write to _fd, new ones are refused
+  _closing = true;
+  _cv.wait(l, [this]() { return (_writing == 0); });
+
+  IndexFooter footer;
+  memcpy(footer._magic, index_magic, sizeof(footer._magic));
+  footer._frames = _index.size();
+  footer._index_offset = _end;
+
+  struct iovec iov[2] =
+  {
+    { _index.data(), _index.size() * sizeof(SequenceEntry) },
+    { &footer, sizeof(footer) }
+  };
+
+  bool result = write_all(_fd, iov, 2, _end);
+  if (result)
+  {
+    // Only now is the file complete, until then readers scan the records
+    SequenceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header._magic, sequence_magic, sizeof(header._magic));
+    header._version = SEQUENCE_VERSION;
+    header._alignment = SEQUENCE_ALIGNMENT;
+    header._index_offset = _end;
+    header._frames = _index.size();
+
+    struct iovec hdr = { &header, sizeof(header) };
+    result = write_all(_fd, &hdr, 1, 0);
+  }
+
+  if (::close(_fd) != 0)
+    result = false;
+
+  _fd = -1;
+  _closing = false;
+  return result;
+}
+
+/*
+ * \\fn bool SequenceWriter::append
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+bool SequenceWriter::append(const RawRGB& img, uint64_t timestamp, uint32_t camera_id)
+{
+  if (img.empty())
+    return false;
+
+  SequenceEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry._size = img.size();
+  entry._timestamp = timestamp;
+  entry._camera_id = camera_id;
+  entry._width = static_cast<uint32_t>(img.width());
+  entry._height = static_cast<uint32_t>(img.height());
+  entry._depth = static_cast<uint16_t>(img.depth());
+  entry._type = static_cast<uint8_t>(img.type());
+  entry._format = static_cast<uint8_t>(img.format());
+
+  // Frames the codec can't take are stored as is, the record tells them apart
+  if ((_codec.load() == RAW_CODEC_CFA_RICE) && RawCodec::supported(img))
+  {
+    std::vector<uint8_t> packed;
+    if (RawCodec::encode(img, packed))
+    {
+      entry._size = packed.size();
+      entry._codec = RAW_CODEC_CFA_RICE;
+      return append(entry, packed.data());
+    }
+  }
+
+  return append(entry, img.cbytes());
+}
+
+/*
+ * \\fn bool SequenceWriter::append
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ * Record page, payload and padding in one pwritev. The space is claimed
+ * under the lock, the write itself runs outside of it and is counted in
+ * _writing, so close() never takes the fd from under it.
+ */
+bool SequenceWriter::append(const SequenceEntry& entry, const uint8_t* payload)
+{
+  static const uint8_t zeros[SEQUENCE_ALIGNMENT] = { 0 };
+
+  std::vector<uint8_t> page(SEQUENCE_ALIGNMENT, 0);
+  FrameRecord* record = reinterpret_cast<FrameRecord*>(page.data());
+  memcpy(record->_magic, frame_magic, sizeof(record->_magic));
+  record->_entry = entry;
+
+  int fd;
+  uint64_t offset;
+  {
+    std::lock_guard<std::mutex> l(_mutex);
+    if ((_fd < 0) || _closing)
+      return false;
+
+    fd = _fd;
+    offset = _end;
+    record->_entry._offset = offset + SEQUENCE_ALIGNMENT;
+    _end = record->_entry._offset + align_up(entry._size);
+    _writing++;
+  }
+
+  struct iovec iov[3] =
+  {
+    { page.data(), page.size() },
+    { const_cast<uint8_t*>(payload), entry._size },
+    { const_cast<uint8_t*>(zeros), align_up(entry._size) - entry._size }
+  };
+
+  bool result = write_all(fd, iov, (iov[2].iov_len > 0) ? 3 : 2, offset);
+
+  std::unique_lock<std::mutex> l(_mutex);
+  if (result)
+  {
+    // Index order is file order, even if appends finish out of order
+    std::vector<SequenceEntry>::iterator pos = _index.end();
+    while ((pos != _index.begin()) && ((pos - 1)->_offset > record->_entry._offset))
+      --pos;
+
+    _index.insert(pos, record->_entry);
+  }
+
+  // close() waits for the last append in flight
+  if (--_writing == 0)
+  {
+    l.unlock();
+    _cv.notify_all();
+  }
+
+  return result;
+}
+
+/*
+ * \\fn size_t SequenceWriter::frames
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+size_t SequenceWriter::frames() const
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  return _index.size();
+}
+
+/*
+ * \\fn uint64_t SequenceWriter::bytes
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+uint64_t SequenceWriter::bytes() const
+{
+  std::lock_guard<std::mutex> l(_mutex);
+  return _end;
+}
+
+/*
+ * \\fn Constructor SequenceReader::SequenceReader
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+SequenceReader::SequenceReader()
+: _fd(-1)
+, _index()
+{
+}
+
+/*
+ * \\fn Destructor SequenceReader::~SequenceReader
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+SequenceReader::~SequenceReader()
+{
+  close();
+}
+
+/*
+ * \\fn bool SequenceReader::is_sequence
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+bool SequenceReader::is_sequence(const char* filename)
+{
+  if (filename == nullptr)
+    return false;
+
+  int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  char magic[8];
+  bool result = read_all(fd, magic, sizeof(magic), 0) && (memcmp(magic, sequence_magic, sizeof(magic)) == 0);
+
+  ::close(fd);
+  return result;
+}
+
+/*
+ * \\fn SequenceReaderPtr SequenceReader::open_file
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+SequenceReaderPtr SequenceReader::open_file(const char* filename)
+{
+  SequenceReaderPtr result(new SequenceReader);
+  if (!result->open(filename))
+    return SequenceReaderPtr();
+
+  return result;
+}
+
+/*
+ * \\fn bool SequenceReader::open
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+bool SequenceReader::open(const char* filename)
+{
+  close();
+  if (filename == nullptr)
+    return false;
+
+  _fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+  if (_fd < 0)
+    return false;
+
+  struct stat st;
+  SequenceHeader header;
+  if ((::fstat(_fd, &st) != 0) || !read_all(_fd, &header, sizeof(header), 0) ||
+      (memcmp(header._magic, sequence_magic, sizeof(header._magic)) != 0) ||
+      (header._alignment != SEQUENCE_ALIGNMENT))
+  {
+    close();
+    return false;
+  }
+
+  uint64_t file_size = static_cast<uint64_t>(st.st_size);
+  if (!read_index(header, file_size) && !scan_frames(file_size))
+  {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * \\fn void SequenceReader::close
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+void SequenceReader::close()
+{
+  if (_fd >= 0)
+    ::close(_fd);
+
+  _fd = -1;
+  _index.clear();
+}
+
+/*
+ * \\fn RawRGBPtr SequenceReader::frame
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+RawRGBPtr SequenceReader::frame(size_t frame, bool populate /*= true*/) const
+{
+  if ((_fd < 0) || (frame >= _index.size()))
+    return RawRGBPtr();
+
+  const SequenceEntry& entry = _index[frame];
+  if ((entry._codec != RAW_CODEC_NONE) && (entry._codec != RAW_CODEC_CFA_RICE))
+    return RawRGBPtr();
+
+  PageAllocator::Block block = PageAllocator::map_file(_fd, entry._offset, entry._size, populate);
+  if (block._ptr == nullptr)
+    return RawRGBPtr();
+
+  if (entry._codec == RAW_CODEC_CFA_RICE)
+  {
+    // Decoded frames own their samples, the compressed mapping goes right away
+    RawRGBPtr result = RawCodec::decode(reinterpret_cast<const uint8_t*>(block._ptr), entry._size);
+    PageAllocator::release(block);
+
+    if (!result || result->empty() || (result->width() != entry._width) || (result->height() != entry._height))
+      return RawRGBPtr();
+
+    return result;
+  }
+
+  // An entry too small for its own dimensions leaves the image without samples
+  RawBufferPtr storage(new RawBuffer(block));
+  RawRGBPtr result(new RawRGB(storage, entry._width, entry._height, entry._depth,
+                              static_cast<PixelType>(entry._type), static_cast<SampleFormat>(entry._format)));
+  return result->empty() ? RawRGBPtr() : result;
+}
+
+/*
+ * \\fn bool SequenceReader::read_index
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ */
+bool SequenceReader::read_index(const SequenceHeader& header, uint64_t file_size)
+{
+  uint64_t index_size = header._frames * sizeof(SequenceEntry);
+  if ((header._index_offset == 0) || (header._index_offset + index_size + sizeof(IndexFooter) > file_size))
+    return false;
+
+  IndexFooter footer;
+  if (!read_all(_fd, &footer, sizeof(footer), header._index_offset + index_size) ||
+      (memcmp(footer._magic, index_magic, sizeof(footer._magic)) != 0) ||
+      (footer._frames != header._frames) || (footer._index_offset != header._index_offset))
+    return false;
+
+  _index.resize(header._frames);
+  if ((index_size > 0) && !read_all(_fd, _index.data(), index_size, header._index_offset))
+  {
+    _index.clear();
+    return false;
+  }
+
+  for (const SequenceEntry& entry : _index)
+  {
+    if (!valid_entry(entry, file_size))
+    {
+      _index.clear();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * \\fn bool SequenceReader::scan_frames
+ *
+ * created on: Mar 23, 2020
+ * author: daniel
+ *
+ * Recovery for files whose writer never got to close(), walks the
+ * frame records up to the first incomplete one
+ */
+bool SequenceReader::scan_frames(uint64_t file_size)
+{
+  _index.clear();
+
+  uint64_t offset = SEQUENCE_ALIGNMENT;
+  FrameRecord record;
+  while ((offset + SEQUENCE_ALIGNMENT <= file_size) && read_all(_fd, &record, sizeof(record), offset))
+  {
+    if ((memcmp(record._magic, frame_magic, sizeof(record._magic)) != 0) ||
+        (record._entry._offset != offset + SEQUENCE_ALIGNMENT) ||
+        !valid_entry(record._entry, file_size))
+      break;
+
+    _index.push_back(record._entry);
+    offset = record._entry._offset + align_up(record._entry._size);
+  }
+
+  return true;
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
@@ -0,0 +1,163 @@
+/*
+ * raw_sequence.hpp
+ *
+ *  Created on: Mar 23, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_RAW_SEQUENCE_HPP_
+#define BRT_COMMON_IMAGE_RAW_SEQUENCE_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "image.hpp"
+
+#define SEQUENCE_ALIGNMENT                  (4096)
+#define SEQUENCE_VERSION                    (1)
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\struct SequenceEntry
+ *
+ * created on: Mar 23, 2020
+ *
+ * On disk record of one frame. The same record precedes every payload
+ * and is repeated in the trailing index.
+ */
+struct SequenceEntry
+{
+  uint64_t                        _offset;      // payload, multiple of SEQUENCE_ALIGNMENT
+  uint64_t                        _size;        // payload bytes as stored
+  uint64_t                        _timestamp;   // capture time, microseconds
+  uint32_t                        _camera_id;
+  uint32_t                        _width;
+  uint32_t                        _height;
+  uint16_t                        _depth;
+  uint8_t                         _type;        // PixelType
+  uint8_t                         _format;      // SampleFormat
+  uint32_t                        _codec;       // RAW_CODEC_*, 0 when the payload is stored as is
+  uint32_t                        _reserved;
+};
+
+/*
+ * \\struct SequenceHeader
+ *
+ * created on: Mar 23, 2020
+ *
+ * First page of the file. _index_offset stays zero until the writer is
+ * closed, a reader then rebuilds the index by walking the frame records.
+ */
+struct SequenceHeader
+{
+  char                            _magic[8];
+  uint32_t                        _version;
+  uint32_t                        _alignment;
+  uint64_t                        _index_offset;
+  uint64_t                        _frames;
+  uint8_t                         _reserved[32];
+};
+
+/*
+ * \\class SequenceWriter
+ *
+ * created on: Mar 23, 2020
+ *
+ * Appends frames to a sequence file. Every frame is a page with its
+ * record followed by the page aligned payload, written with a single
+ * pwritev. close() appends the index and patches the header. Safe to
+ * call from several capture threads. With a codec set, Bayer frames
+ * are stored compressed and the reader decodes them transparently.
+ */
+class SequenceWriter
+{
+public:
+  SequenceWriter();
+  virtual ~SequenceWriter();
+
+  SequenceWriter(const SequenceWriter&) = delete;
+  SequenceWriter& operator=(const SequenceWriter&) = delete;
+
+          bool                    open(const char* filename);
+          bool                    is_open() const { return (_fd >= 0); }
+          bool                    close();
+
+          // RAW_CODEC_CFA_RICE compresses Bayer frames on append
+          void                    set_codec(uint32_t codec) { _codec.store(codec); }
+          uint32_t                codec() const { return _codec.load(); }
+
+          bool                    append(const RawRGB& img, uint64_t timestamp, uint32_t camera_id);
+          bool                    append(const SequenceEntry& entry, const uint8_t* payload);
+
+          size_t                  frames() const;
+          uint64_t                bytes() const;
+
+private:
+  int                             _fd;
+  uint64_t                        _end;
+  std::atomic<uint32_t>           _codec;
+  std::vector<SequenceEntry>      _index;
+  size_t                          _writing;     // appends past the lock, not done yet
+  bool                            _closing;
+  mutable std::mutex              _mutex;
+  std::condition_variable         _cv;
+};
+
+class SequenceReader;
+typedef std::shared_ptr<SequenceReader> SequenceReaderPtr;
+
+/*
+ * \\class SequenceReader
+ *
+ * created on: Mar 23, 2020
+ *
+ * Random access to the frames of a sequence file. A frame is a private
+ * mapping of its payload, so reading frame N costs one mmap regardless
+ * of N or of the size of the file.
+ */
+class SequenceReader
+{
+public:
+  SequenceReader();
+  virtual ~SequenceReader();
+
+  SequenceReader(const SequenceReader&) = delete;
+  SequenceReader& operator=(const SequenceReader&) = delete;
+
+  static  bool                    is_sequence(const char* filename);
+  static  SequenceReaderPtr       open_file(const char* filename);
+
+          bool                    open(const char* filename);
+          void                    close();
+
+          size_t                  size() const { return _index.size(); }
+          const SequenceEntry&    entry(size_t frame) const { return _index[frame]; }
+          RawRGBPtr               frame(size_t frame, bool populate = true) const;
+
+private:
+          bool                    read_index(const SequenceHeader& header, uint64_t file_size);
+          bool                    scan_frames(uint64_t file_size);
+
+private:
+  int                             _fd;
+  std::vector<SequenceEntry>      _index;
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_RAW_SEQUENCE_HPP_ */
@@ -0,0 +1,735 @@
+/*
+ * sample_convert.cpp
+ *
+ *  Created on: Feb 26, 2020
+ *      Author: daniel
+ */
+
+#include "sample_convert.hpp"
+
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define F16C_AVAILABLE                      (1)
+#define F16C_TARGET                         __attribute__((target("avx2,f16c")))
+#define AVX2_TARGET                         __attribute__((target("avx2")))
+#endif
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * \\fn float full_scale
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+static inline float full_scale(size_t depth)
+{
+  if ((depth == 0) || (depth > 32))
+    depth = 16;
+
+  return static_cast<float>((1ull << depth) - 1);
+}
+
+/*
+ * \\fn uint16_t float_to_half
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ * Round to nearest even, overflow goes to infinity
+ */
+uint16_t float_to_half(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  uint32_t sign = (bits >> 16) & 0x8000;
+  int32_t  exp = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+  uint32_t mant = bits & 0x7FFFFF;
+
+  if (((bits >> 23) & 0xFF) == 0xFF)
+    return static_cast<uint16_t>(sign | 0x7C00 | ((mant != 0) ? 0x200 : 0));
+
+  if (exp >= 0x1F)
+    return static_cast<uint16_t>(sign | 0x7C00);
+
+  if (exp <= 0)
+  {
+    if (exp < -10)
+      return static_cast<uint16_t>(sign);
+
+    mant |= 0x800000;
+    uint32_t shift = static_cast<uint32_t>(14 - exp);
+    uint32_t half_mant = mant >> shift;
+    uint32_t rest = mant & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+
+    if ((rest > halfway) || ((rest == halfway) && (half_mant & 1)))
+      half_mant++;
+
+    return static_cast<uint16_t>(sign | half_mant);
+  }
+
+  uint32_t half = sign | (static_cast<uint32_t>(exp) << 10) | (mant >> 13);
+  uint32_t rest = mant & 0x1FFF;
+
+  if ((rest > 0x1000) || ((rest == 0x1000) && (half & 1)))
+    half++;
+
+  return static_cast<uint16_t>(half);
+}
+
+/*
+ * \\fn float half_to_float
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+float half_to_float(uint16_t value)
+{
+  uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+  uint32_t exp = (value >> 10) & 0x1F;
+  uint32_t mant = value & 0x3FF;
+  uint32_t bits;
+
+  if (exp == 0)
+  {
+    if (mant == 0)
+      bits = sign;
+    else
+    {
+      // Denormal, normalize it
+      exp = 127 - 15 + 1;
+      while ((mant & 0x400) == 0)
+      {
+        mant <<= 1;
+        exp--;
+      }
+      bits = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+    }
+  }
+  else if (exp == 0x1F)
+    bits = sign | 0x7F800000 | (mant << 13);
+  else
+    bits = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+#ifdef F16C_AVAILABLE
+/*
+ * \\fn bool has_f16c
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+static bool has_f16c()
+{
+  static const bool result = __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx2");
+  return result;
+}
+
+/*
+ * \\fn size_t u16_to_half_f16c
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+F16C_TARGET static size_t u16_to_half_f16c(const uint16_t* src, uint16_t* dst, size_t count, float scale)
+{
+  __m256 mul = _mm256_set1_ps(scale);
+  size_t index = 0;
+  for (; index + 8 <= count; index += 8)
+  {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + index));
+    __m256 fl = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(in)), mul);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + index), _mm256_cvtps_ph(fl, _MM_FROUND_TO_NEAREST_INT));
+  }
+  return index;
+}
+
+/*
+ * \\fn size_t half_to_u16_f16c
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+F16C_TARGET static size_t half_to_u16_f16c(const uint16_t* src, uint16_t* dst, size_t count, float scale)
+{
+  __m256 mul = _mm256_set1_ps(scale);
+  __m256 zero = _mm256_setzero_ps();
+  __m256 max = _mm256_set1_ps(scale);
+  size_t index = 0;
+  for (; index + 8 <= count; index += 8)
+  {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + index));
+    __m256 fl = _mm256_mul_ps(_mm256_cvtph_ps(in), mul);
+    fl = _mm256_min_ps(_mm256_max_ps(fl, zero), max);
+
+    __m256i i32 = _mm256_cvtps_epi32(fl);
+    __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(i32), _mm256_extracti128_si256(i32, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + index), packed);
+  }
+  return index;
+}
+
+/*
+ * \\fn size_t half_to_float_f16c
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+F16C_TARGET static size_t half_to_float_f16c(const uint16_t* src, float* dst, size_t count)
+{
+  size_t index = 0;
+  for (; index + 8 <= count; index += 8)
+  {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + index));
+    _mm256_storeu_ps(dst + index, _mm256_cvtph_ps(in));
+  }
+  return index;
+}
+
+/*
+ * \\fn size_t float_to_half_f16c
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+F16C_TARGET static size_t float_to_half_f16c(const float* src, uint16_t* dst, size_t count)
+{
+  size_t index = 0;
+  for (; index + 8 <= count; index += 8)
+  {
+    __m256 in = _mm256_loadu_ps(src + index);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + index), _mm256_cvtps_ph(in, _MM_FROUND_TO_NEAREST_INT));
+  }
+  return index;
+}
+#endif
+
+/*
+ * \\fn void u16_to_half
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+void u16_to_half(const uint16_t* src, uint16_t* dst, size_t count, size_t depth)
+{
+  float scale = 1.0f / full_scale(depth);
+  size_t index = 0;
+
+#ifdef F16C_AVAILABLE
+  if (has_f16c())
+    index = u16_to_half_f16c(src, dst, count, scale);
+#endif
+
+  for (; index < count; index++)
+    dst[index] = float_to_half(static_cast<float>(src[index]) * scale);
+}
+
+/*
+ * \\fn void half_to_u16
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+void half_to_u16(const uint16_t* src, uint16_t* dst, size_t count, size_t depth)
+{
+  float scale = full_scale(depth);
+  size_t index = 0;
+
+#ifdef F16C_AVAILABLE
+  if (has_f16c())
+    index = half_to_u16_f16c(src, dst, count, scale);
+#endif
+
+  for (; index < count; index++)
+  {
+    float value = std::min(std::max(half_to_float(src[index]) * scale, 0.0f), scale);
+    dst[index] = static_cast<uint16_t>(std::lrint(value));
+  }
+}
+
+/*
+ * \\fn void u16_to_float
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+void u16_to_float(const uint16_t* __restrict__ src, float* __restrict__ dst, size_t count, size_t depth)
+{
+  float scale = 1.0f / full_scale(depth);
+  for (size_t index = 0; index < count; index++)
+    dst[index] = static_cast<float>(src[index]) * scale;
+}
+
+/*
+ * \\fn void float_to_u16
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+void float_to_u16(const float* __restrict__ src, uint16_t* __restrict__ dst, size_t count, size_t depth)
+{
+  float scale = full_scale(depth);
+  for (size_t index = 0; index < count; index++)
+  {
+    float value = std::min(std::max(src[index] * scale, 0.0f), scale);
+    dst[index] = static_cast<uint16_t>(value + 0.5f);
+  }
+}
+
+/*
+ * \\fn void half_to_float
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+void half_to_float(const uint16_t* src, float* dst, size_t count)
+{
+  size_t index = 0;
+
+#ifdef F16C_AVAILABLE
+  if (has_f16c())
+    index = half_to_float_f16c(src, dst, count);
+#endif
+
+  for (; index < count; index++)
+    dst[index] = half_to_float(src[index]);
+}
+
+/*
+ * \\fn void float_to_half
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+void float_to_half(const float* src, uint16_t* dst, size_t count)
+{
+  size_t index = 0;
+
+#ifdef F16C_AVAILABLE
+  if (has_f16c())
+    index = float_to_half_f16c(src, dst, count);
+#endif
+
+  for (; index < count; index++)
+    dst[index] = float_to_half(src[index]);
+}
+
+/*
+ * \\fn uint32_t read_sample
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+static inline uint32_t read_sample(const uint8_t* src, size_t bytes)
+{
+  uint32_t value = 0;
+  memcpy(&value, src, bytes);
+  return value;
+}
+
+/*
+ * \\fn bool convert_samples
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ * Fast paths cover everything touching uint16, the rest
+ * goes through a scalar float loop
+ */
+bool convert_samples(const uint8_t* src, SampleFormat src_format, size_t src_depth,
+                     uint8_t* dst, SampleFormat dst_format, size_t dst_depth,
+                     size_t count)
+{
+  if ((src == nullptr) || (dst == nullptr))
+    return false;
+
+  // Packed samples go through uint16 at their own depth, the rest of
+  // the conversion then takes one of the paths below
+  if (is_packed(src_format))
+  {
+    std::vector<uint16_t> samples;
+    bool direct = (dst_format == eUnsigned) && (dst_depth == src_depth);
+    uint16_t* unpacked = direct ? reinterpret_cast<uint16_t*>(dst) : (samples.resize(count), samples.data());
+
+    if (src_format == eMipiRaw10)
+      unpack_raw10(src, unpacked, count);
+    else
+      unpack_raw12(src, unpacked, count);
+
+    return direct || convert_samples(reinterpret_cast<const uint8_t*>(unpacked), eUnsigned, src_depth,
+                                     dst, dst_format, dst_depth, count);
+  }
+
+  if (is_packed(dst_format))
+  {
+    std::vector<uint16_t> samples;
+    const uint16_t* unpacked = reinterpret_cast<const uint16_t*>(src);
+    if ((src_format != eUnsigned) || (src_depth != dst_depth))
+    {
+      samples.resize(count);
+      if (!convert_samples(src, src_format, src_depth, reinterpret_cast<uint8_t*>(samples.data()), eUnsigned, dst_depth, count))
+        return false;
+
+      unpacked = samples.data();
+    }
+
+    if (dst_format == eMipiRaw10)
+      pack_raw10(unpacked, dst, count);
+    else
+      pack_raw12(unpacked, dst, count);
+
+    return true;
+  }
+
+  const uint16_t* src16 = reinterpret_cast<const uint16_t*>(src);
+  uint16_t* dst16 = reinterpret_cast<uint16_t*>(dst);
+  const float* srcf = reinterpret_cast<const float*>(src);
+  float* dstf = reinterpret_cast<float*>(dst);
+
+  bool src_u16 = (src_format == eUnsigned) && (BYTES_PER_PIXELS(src_depth) == 2);
+  bool dst_u16 = (dst_format == eUnsigned) && (BYTES_PER_PIXELS(dst_depth) == 2);
+
+  if (src_format == dst_format)
+  {
+    if ((src_format != eUnsigned) || (src_depth == dst_depth))
+    {
+      memcpy(dst, src, count * BYTES_PER_PIXELS(src_depth));
+      return true;
+    }
+  }
+  else if (src_u16 && (dst_format == eHalf))
+  {
+    u16_to_half(src16, dst16, count, src_depth);
+    return true;
+  }
+  else if ((src_format == eHalf) && dst_u16)
+  {
+    half_to_u16(src16, dst16, count, dst_depth);
+    return true;
+  }
+  else if (src_u16 && (dst_format == eFloat))
+  {
+    u16_to_float(src16, dstf, count, src_depth);
+    return true;
+  }
+  else if ((src_format == eFloat) && dst_u16)
+  {
+    float_to_u16(srcf, dst16, count, dst_depth);
+    return true;
+  }
+  else if ((src_format == eHalf) && (dst_format == eFloat))
+  {
+    half_to_float(src16, dstf, count);
+    return true;
+  }
+  else if ((src_format == eFloat) && (dst_format == eHalf))
+  {
+    float_to_half(srcf, dst16, count);
+    return true;
+  }
+
+  // Generic path, everything else involves at least one
+  // integer side of a depth other than 16 bits
+  size_t src_bytes = BYTES_PER_PIXELS(src_depth);
+  size_t dst_bytes = BYTES_PER_PIXELS(dst_depth);
+  float  src_scale = 1.0f / full_scale(src_depth);
+  float  dst_scale = full_scale(dst_depth);
+
+  for (size_t index = 0; index < count; index++)
+  {
+    float value;
+    switch (src_format)
+    {
+    case eFloat:
+      value = srcf[index];
+      break;
+
+    case eHalf:
+      value = half_to_float(src16[index]);
+      break;
+
+    default:
+      value = static_cast<float>(read_sample(src + index * src_bytes, src_bytes)) * src_scale;
+      break;
+    }
+
+    switch (dst_format)
+    {
+    case eFloat:
+      dstf[index] = value;
+      break;
+
+    case eHalf:
+      dst16[index] = float_to_half(value);
+      break;
+
+    default:
+      {
+        float scaled = std::min(std::max(value * dst_scale, 0.0f), dst_scale);
+        uint32_t sample = static_cast<uint32_t>(scaled + 0.5f);
+        memcpy(dst + index * dst_bytes, &sample, dst_bytes);
+      }
+      break;
+    }
+  }
+
+  return true;
+}
+
+#ifdef F16C_AVAILABLE
+/*
+ * \\fn bool has_avx2
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+static bool has_avx2()
+{
+  static const bool result = __builtin_cpu_supports("avx2");
+  return result;
+}
+
+/*
+ * \\fn size_t swap_bytes16_avx2
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+AVX2_TARGET static size_t swap_bytes16_avx2(const uint16_t* src, uint16_t* dst, size_t count)
+{
+  const __m256i shuffle = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                           1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  size_t index = 0;
+  for (; index + 16 <= count; index += 16)
+  {
+    __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + index));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + index), _mm256_shuffle_epi8(in, shuffle));
+  }
+  return index;
+}
+#endif
+
+/*
+ * \\fn void swap_bytes16
+ *
+ * created on: Mar 18, 2020
+ * author: daniel
+ *
+ */
+void swap_bytes16(const uint16_t* src, uint16_t* dst, size_t count)
+{
+  size_t index = 0;
+
+#ifdef F16C_AVAILABLE
+  if (has_avx2())
+    index = swap_bytes16_avx2(src, dst, count);
+#endif
+
+  for (; index < count; index++)
+    dst[index] = __builtin_bswap16(src[index]);
+}
+
+#ifdef F16C_AVAILABLE
+/*
+ * \\fn size_t unpack_raw10_avx2
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ * Every 128 bit lane expands two 5 byte groups. Each sample word is
+ * built as (high byte << 8 | shared low byte), the shared byte is then
+ * shifted per word with a multiply since AVX2 has no 16 bit variable
+ * shift.
+ */
+AVX2_TARGET static size_t unpack_raw10_avx2(const uint8_t* src, uint16_t* dst, size_t count)
+{
+  const __m256i shuffle = _mm256_setr_epi8(4, 0, 4, 1, 4, 2, 4, 3, 9, 5, 9, 6, 9, 7, 9, 8,
+                                           4, 0, 4, 1, 4, 2, 4, 3, 9, 5, 9, 6, 9, 7, 9, 8);
+  const __m256i shift = _mm256_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1);
+  const __m256i high_mask = _mm256_set1_epi16(0x3FC);
+  const __m256i low_mask = _mm256_set1_epi16(0x3);
+
+  // Each lane loads 16 bytes for the 10 it uses
+  size_t bytes = packed_row_bytes(count, eMipiRaw10);
+  size_t index = 0;
+  for (; (index + 16 <= count) && ((index / 4) * 5 + 26 <= bytes); index += 16)
+  {
+    const uint8_t* group = src + (index / 4) * 5;
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group))),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(group + 10)), 1);
+
+    __m256i words = _mm256_shuffle_epi8(in, shuffle);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(words, 6), high_mask);
+    __m256i low = _mm256_and_si256(_mm256_srli_epi16(_mm256_mullo_epi16(words, shift), 6), low_mask);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + index), _mm256_or_si256(high, low));
+  }
+  return index;
+}
+
+/*
+ * \\fn size_t unpack_raw12_avx2
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ * Every 128 bit lane expands four 3 byte groups. Even samples keep the
+ * low nibble of the shared byte, odd samples its high nibble.
+ */
+AVX2_TARGET static size_t unpack_raw12_avx2(const uint8_t* src, uint16_t* dst, size_t count)
+{
+  const __m256i shuffle = _mm256_setr_epi8(2, 0, 2, 1, 5, 3, 5, 4, 8, 6, 8, 7, 11, 9, 11, 10,
+                                           2, 0, 2, 1, 5, 3, 5, 4, 8, 6, 8, 7, 11, 9, 11, 10);
+  const __m256i high_mask = _mm256_setr_epi16(0xFF0, 0xFFF, 0xFF0, 0xFFF, 0xFF0, 0xFFF, 0xFF0, 0xFFF,
+                                              0xFF0, 0xFFF, 0xFF0, 0xFFF, 0xFF0, 0xFFF, 0xFF0, 0xFFF);
+  const __m256i low_mask = _mm256_setr_epi16(0xF, 0, 0xF, 0, 0xF, 0, 0xF, 0, 0xF, 0, 0xF, 0, 0xF, 0, 0xF, 0);
+
+  // Each lane loads 16 bytes for the 12 it uses
+  size_t bytes = packed_row_bytes(count, eMipiRaw12);
+  size_t index = 0;
+  for (; (index + 16 <= count) && ((index / 2) * 3 + 28 <= bytes); index += 16)
+  {
+    const uint8_t* group = src + (index / 2) * 3;
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group))),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(group + 12)), 1);
+
+    __m256i words = _mm256_shuffle_epi8(in, shuffle);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(words, 4), high_mask);
+    __m256i low = _mm256_and_si256(words, low_mask);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + index), _mm256_or_si256(high, low));
+  }
+  return index;
+}
+#endif
+
+/*
+ * \\fn void unpack_raw10
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ * Four high bytes, then one byte with the two low bits of each sample
+ */
+void unpack_raw10(const uint8_t* src, uint16_t* dst, size_t count)
+{
+  size_t index = 0;
+
+#ifdef F16C_AVAILABLE
+  if (has_avx2())
+    index = unpack_raw10_avx2(src, dst, count);
+#endif
+
+  for (; index < count; index += 4)
+  {
+    const uint8_t* group = src + (index / 4) * 5;
+    for (size_t sample = 0; (sample < 4) && (index + sample < count); sample++)
+      dst[index + sample] = static_cast<uint16_t>((group[sample] << 2) | ((group[4] >> (2 * sample)) & 0x3));
+  }
+}
+
+/*
+ * \\fn void unpack_raw12
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ * Two high bytes, then one byte with both low nibbles
+ */
+void unpack_raw12(const uint8_t* src, uint16_t* dst, size_t count)
+{
+  size_t index = 0;
+
+#ifdef F16C_AVAILABLE
+  if (has_avx2())
+    index = unpack_raw12_avx2(src, dst, count);
+#endif
+
+  for (; index < count; index += 2)
+  {
+    const uint8_t* group = src + (index / 2) * 3;
+    dst[index] = static_cast<uint16_t>((group[0] << 4) | (group[2] & 0xF));
+    if (index + 1 < count)
+      dst[index + 1] = static_cast<uint16_t>((group[1] << 4) | (group[2] >> 4));
+  }
+}
+
+/*
+ * \\fn void pack_raw10
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ * Samples above 10 bits are truncated, a partial last group is zero filled
+ */
+void pack_raw10(const uint16_t* src, uint8_t* dst, size_t count)
+{
+  for (size_t index = 0; index < count; index += 4)
+  {
+    uint8_t* group = dst + (index / 4) * 5;
+    group[4] = 0;
+    for (size_t sample = 0; sample < 4; sample++)
+    {
+      uint16_t value = (index + sample < count) ? (src[index + sample] & 0x3FF) : 0;
+      group[sample] = static_cast<uint8_t>(value >> 2);
+      group[4] |= static_cast<uint8_t>((value & 0x3) << (2 * sample));
+    }
+  }
+}
+
+/*
+ * \\fn void pack_raw12
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ */
+void pack_raw12(const uint16_t* src, uint8_t* dst, size_t count)
+{
+  for (size_t index = 0; index < count; index += 2)
+  {
+    uint8_t* group = dst + (index / 2) * 3;
+    uint16_t first = src[index] & 0xFFF;
+    uint16_t second = (index + 1 < count) ? (src[index + 1] & 0xFFF) : 0;
+
+    group[0] = static_cast<uint8_t>(first >> 4);
+    group[1] = static_cast<uint8_t>(second >> 4);
+    group[2] = static_cast<uint8_t>((first & 0xF) | ((second & 0xF) << 4));
+  }
+}
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
@@ -0,0 +1,56 @@
+/*
+ * sample_convert.hpp
+ *
+ *  Created on: Feb 26, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_SAMPLE_CONVERT_HPP_
+#define BRT_COMMON_IMAGE_SAMPLE_CONVERT_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "image.hpp"
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+
+/*
+ * Float and half float samples are normalized, 1.0 is the full scale
+ * of the integer depth they were converted from (or will be converted to).
+ * Conversion to integer clamps to [0, full scale] and rounds to nearest.
+ */
+uint16_t                          float_to_half(float value);
+float                             half_to_float(uint16_t value);
+
+void                              u16_to_half(const uint16_t* src, uint16_t* dst, size_t count, size_t depth);
+void                              half_to_u16(const uint16_t* src, uint16_t* dst, size_t count, size_t depth);
+void                              u16_to_float(const uint16_t* src, float* dst, size_t count, size_t depth);
+void                              float_to_u16(const float* src, uint16_t* dst, size_t count, size_t depth);
+void                              half_to_float(const uint16_t* src, float* dst, size_t count);
+void                              float_to_half(const float* src, uint16_t* dst, size_t count);
+
+// Big-endian <-> little-endian 16 bit samples, src and dst may be the same buffer
+void                              swap_bytes16(const uint16_t* src, uint16_t* dst, size_t count);
+
+// MIPI CSI-2 packed rows <-> one uint16 per sample, count in samples. The
+// packed side always holds whole groups, so a partial last group is fine
+void                              unpack_raw10(const uint8_t* src, uint16_t* dst, size_t count);
+void                              unpack_raw12(const uint8_t* src, uint16_t* dst, size_t count);
+void                              pack_raw10(const uint16_t* src, uint8_t* dst, size_t count);
+void                              pack_raw12(const uint16_t* src, uint8_t* dst, size_t count);
+
+bool                              convert_samples(const uint8_t* src, SampleFormat src_format, size_t src_depth,
+                                                  uint8_t* dst, SampleFormat dst_format, size_t dst_depth,
+                                                  size_t count);
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_SAMPLE_CONVERT_HPP_ */
@@ -0,0 +1,186 @@
+/*
+ * stencil.hpp
+ *
+ *  Created on: Mar 6, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IMAGE_STENCIL_HPP_
+#define BRT_COMMON_IMAGE_STENCIL_HPP_
+
+#include <stddef.h>
+
+#ifdef __CUDACC__
+#define STENCIL_CALL                        __host__ __device__ inline
+#else
+#define STENCIL_CALL                        inline
+#endif
+
+namespace brt
+{
+namespace jupiter
+{
+namespace image
+{
+namespace border
+{
+
+/*
+ * \\struct Zero
+ *
+ * created on: Mar 6, 2020
+ *
+ * Samples outside of the frame read as zero
+ */
+struct Zero
+{
+  static STENCIL_CALL bool remap(int& index, int size)
+  {
+    return (index >= 0) && (index < size);
+  }
+};
+
+/*
+ * \\struct Clamp
+ *
+ * created on: Mar 6, 2020
+ *
+ * Samples outside of the frame repeat the edge sample
+ */
+struct Clamp
+{
+  static STENCIL_CALL bool remap(int& index, int size)
+  {
+    index = (index < 0) ? 0 : (index >= size) ? size - 1 : index;
+    return true;
+  }
+};
+
+/*
+ * \\struct Mirror
+ *
+ * created on: Mar 6, 2020
+ *
+ * Samples outside of the frame reflect around the edge sample without
+ * repeating it, so the Bayer parity of the coordinate is preserved
+ */
+struct Mirror
+{
+  static STENCIL_CALL bool remap(int& index, int size)
+  {
+    if (index < 0)
+      index = -index;
+
+    if (index >= size)
+      index = 2 * (size - 1) - index;
+
+    index = (index < 0) ? 0 : (index >= size) ? size - 1 : index;
+    return true;
+  }
+};
+
+} /* namespace border */
+
+/*
+ * \\class Stencil
+ *
+ * created on: Mar 6, 2020
+ *
+ * Neighbourhood access of radius R over a strided 2D buffer. Windows
+ * fully inside the frame read through row pointers, only windows that
+ * touch the border go through the Border policy.
+ *
+ * pitch is the distance between rows and step the distance between
+ * pixels, both in elements of T, so one channel of an interleaved
+ * buffer can be read directly.
+ */
+template<typename T, int R, typename Border = border::Zero>
+class Stencil
+{
+public:
+  /*
+   * \\class Window
+   *
+   * created on: Mar 6, 2020
+   *
+   */
+  class Window
+  {
+  public:
+    STENCIL_CALL Window(const Stencil& stencil, int x, int y)
+    : _stencil(stencil), _x(x), _y(y), _interior(stencil.interior(x, y))
+    {
+      if (_interior)
+      {
+        const T* centre = stencil.pixel(x, y);
+        for (int dy = -R; dy <= R; dy++)
+          _rows[dy + R] = centre + dy * static_cast<ptrdiff_t>(stencil._pitch);
+      }
+    }
+
+    STENCIL_CALL bool               interior() const { return _interior; }
+
+    // Row pointer relative to the centre column, valid for interior windows only
+    STENCIL_CALL const T*           row(int dy) const { return _rows[dy + R]; }
+
+    STENCIL_CALL T                  operator()(int dx, int dy) const
+    {
+      if (_interior)
+        return _rows[dy + R][dx * static_cast<ptrdiff_t>(_stencil._step)];
+
+      return _stencil.at(_x + dx, _y + dy);
+    }
+
+  private:
+    const Stencil&                  _stencil;
+    int                             _x;
+    int                             _y;
+    bool                            _interior;
+    const T*                        _rows[2 * R + 1];
+  };
+
+public:
+  STENCIL_CALL Stencil(const T* data, int width, int height, size_t pitch, size_t step = 1)
+  : _data(data), _width(width), _height(height), _pitch(pitch), _step(step) {}
+
+  static  STENCIL_CALL int        radius() { return R; }
+
+  STENCIL_CALL int                width() const { return _width; }
+  STENCIL_CALL int                height() const { return _height; }
+
+  STENCIL_CALL bool               interior(int x, int y) const
+  {
+    return (x >= R) && (y >= R) && (x < (_width - R)) && (y < (_height - R));
+  }
+
+  STENCIL_CALL const T*           pixel(int x, int y) const
+  {
+    return _data + y * static_cast<ptrdiff_t>(_pitch) + x * static_cast<ptrdiff_t>(_step);
+  }
+
+  // Policy driven access, safe anywhere
+  STENCIL_CALL T                  at(int x, int y) const
+  {
+    bool inside_x = Border::remap(x, _width);
+    bool inside_y = Border::remap(y, _height);
+    if (!inside_x || !inside_y)
+      return T();
+
+    return *pixel(x, y);
+  }
+
+  STENCIL_CALL Window             window(int x, int y) const { return Window(*this, x, y); }
+
+private:
+  const T*                        _data;
+  int                             _width;
+  int                             _height;
+  size_t                          _pitch;
+  size_t                          _step;
+};
+
+} /* namespace image */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IMAGE_STENCIL_HPP_ */
@@ -0,0 +1,305 @@
+/*
+ * io_uring.cpp
+ *
+ *  Created on: Mar 13, 2020
+ *      Author: daniel
+ */
+
+#include "io_uring.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+
+namespace brt
+{
+namespace jupiter
+{
+
+/*
+ * \\fn Constructor IoUring::IoUring
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+IoUring::IoUring(unsigned entries /*= DEFAULT_URING_ENTRIES*/)
+: _fd(-1)
+, _sq_ring(MAP_FAILED)
+, _sq_ring_size(0)
+, _cq_ring(MAP_FAILED)
+, _cq_ring_size(0)
+, _sqes(reinterpret_cast<io_uring_sqe*>(MAP_FAILED))
+, _sqes_size(0)
+, _sq_head(nullptr)
+, _sq_tail(nullptr)
+, _sq_mask(nullptr)
+, _sq_array(nullptr)
+, _sq_entries(0)
+, _sqe_tail(0)
+, _cq_head(nullptr)
+, _cq_tail(nullptr)
+, _cq_mask(nullptr)
+, _cqes(nullptr)
+{
+#ifdef __NR_io_uring_setup
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+  if (fd < 0)
+    return;
+
+  _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap)
+    _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+
+  _sq_ring = ::mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (_sq_ring == MAP_FAILED)
+  {
+    ::close(fd);
+    return;
+  }
+
+  if (single_mmap)
+    _cq_ring = _sq_ring;
+  else
+    _cq_ring = ::mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+  _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  _sqes = reinterpret_cast<io_uring_sqe*>(::mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+
+  _fd = fd;
+  if ((_cq_ring == MAP_FAILED) || (_sqes == MAP_FAILED))
+  {
+    release();
+    return;
+  }
+
+  uint8_t* sq = reinterpret_cast<uint8_t*>(_sq_ring);
+  _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  _sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  _sq_entries = params.sq_entries;
+  _sqe_tail = *_sq_tail;
+
+  uint8_t* cq = reinterpret_cast<uint8_t*>(_cq_ring);
+  _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  _cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+#endif
+}
+
+/*
+ * \\fn Destructor IoUring::~IoUring
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+IoUring::~IoUring()
+{
+  release();
+}
+
+/*
+ * \\fn void IoUring::release
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+void IoUring::release()
+{
+  if (_sqes != MAP_FAILED)
+    ::munmap(_sqes, _sqes_size);
+
+  if ((_cq_ring != MAP_FAILED) && (_cq_ring != _sq_ring))
+    ::munmap(_cq_ring, _cq_ring_size);
+
+  if (_sq_ring != MAP_FAILED)
+    ::munmap(_sq_ring, _sq_ring_size);
+
+  _sqes = reinterpret_cast<io_uring_sqe*>(MAP_FAILED);
+  _cq_ring = _sq_ring = MAP_FAILED;
+
+  if (_fd >= 0)
+    ::close(_fd);
+
+  _fd = -1;
+}
+
+/*
+ * \\fn io_uring_sqe* IoUring::get_sqe
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+io_uring_sqe* IoUring::get_sqe()
+{
+  if (!valid())
+    return nullptr;
+
+  unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+  if ((_sqe_tail - head) >= _sq_entries)
+    return nullptr;
+
+  io_uring_sqe* sqe = &_sqes[_sqe_tail & *_sq_mask];
+  _sqe_tail++;
+
+  memset(sqe, 0, sizeof(io_uring_sqe));
+  return sqe;
+}
+
+/*
+ * \\fn void IoUring::prep_openat
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+void IoUring::prep_openat(io_uring_sqe* sqe, int dfd, const char* path, int flags, uint64_t user_data)
+{
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = dfd;
+  sqe->addr = reinterpret_cast<uint64_t>(path);
+  sqe->open_flags = static_cast<uint32_t>(flags);
+  sqe->user_data = user_data;
+}
+
+/*
+ * \\fn void IoUring::prep_statx
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+void IoUring::prep_statx(io_uring_sqe* sqe, int dfd, const char* path, unsigned mask, void* statxbuf, uint64_t user_data)
+{
+  sqe->opcode = IORING_OP_STATX;
+  sqe->fd = dfd;
+  sqe->addr = reinterpret_cast<uint64_t>(path);
+  sqe->len = mask;
+  sqe->off = reinterpret_cast<uint64_t>(statxbuf);
+  sqe->user_data = user_data;
+}
+
+/*
+ * \\fn void IoUring::prep_read
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+void IoUring::prep_read(io_uring_sqe* sqe, int fd, void* buf, unsigned len, uint64_t offset, uint64_t user_data)
+{
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+}
+
+/*
+ * \\fn void IoUring::prep_close
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+void IoUring::prep_close(io_uring_sqe* sqe, int fd, uint64_t user_data)
+{
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = fd;
+  sqe->user_data = user_data;
+}
+
+/*
+ * \\fn int IoUring::submit
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ * Publishes every sqe handed out since the last call and optionally
+ * waits for wait_nr completions
+ */
+int IoUring::submit(unsigned wait_nr /*= 0*/)
+{
+  if (!valid())
+    return -ENOSYS;
+
+  unsigned tail = *_sq_tail;
+  unsigned to_submit = _sqe_tail - tail;
+  for (unsigned index = tail; index != _sqe_tail; index++)
+    _sq_array[index & *_sq_mask] = index & *_sq_mask;
+
+  __atomic_store_n(_sq_tail, _sqe_tail, __ATOMIC_RELEASE);
+
+  int ret;
+  do
+  {
+    ret = static_cast<int>(::syscall(__NR_io_uring_enter, _fd, to_submit, wait_nr,
+                                      (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+  }
+  while ((ret < 0) && (errno == EINTR));
+
+  return (ret < 0) ? -errno : ret;
+}
+
+/*
+ * \\fn bool IoUring::peek
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+bool IoUring::peek(io_uring_cqe& cqe)
+{
+  if (!valid())
+    return false;
+
+  unsigned head = *_cq_head;
+  if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+    return false;
+
+  cqe = _cqes[head & *_cq_mask];
+  __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/*
+ * \\fn bool IoUring::wait
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+bool IoUring::wait(io_uring_cqe& cqe)
+{
+  while (valid())
+  {
+    if (peek(cqe))
+      return true;
+
+    int ret = static_cast<int>(::syscall(__NR_io_uring_enter, _fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+    if ((ret < 0) && (errno != EINTR))
+      return false;
+  }
+
+  return false;
+}
+
+} /* namespace jupiter */
+} /* namespace brt */
@@ -0,0 +1,85 @@
+/*
+ * io_uring.hpp
+ *
+ *  Created on: Mar 13, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_IO_URING_HPP_
+#define BRT_COMMON_IO_URING_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+
+#define DEFAULT_URING_ENTRIES               (256)
+
+namespace brt
+{
+namespace jupiter
+{
+
+/*
+ * \\class IoUring
+ *
+ * created on: Mar 13, 2020
+ *
+ * Minimal io_uring ring on top of the raw system calls. valid() is false
+ * on kernels (or sandboxes) without io_uring, callers fall back to the
+ * synchronous path then.
+ */
+class IoUring
+{
+public:
+  IoUring(unsigned entries = DEFAULT_URING_ENTRIES);
+  virtual ~IoUring();
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+          bool                    valid() const { return (_fd >= 0); }
+          unsigned                entries() const { return _sq_entries; }
+
+          // nullptr when the submission queue is full
+          io_uring_sqe*           get_sqe();
+
+          void                    prep_openat(io_uring_sqe* sqe, int dfd, const char* path, int flags, uint64_t user_data);
+          void                    prep_statx(io_uring_sqe* sqe, int dfd, const char* path, unsigned mask, void* statxbuf, uint64_t user_data);
+          void                    prep_read(io_uring_sqe* sqe, int fd, void* buf, unsigned len, uint64_t offset, uint64_t user_data);
+          void                    prep_close(io_uring_sqe* sqe, int fd, uint64_t user_data);
+
+          int                     submit(unsigned wait_nr = 0);
+          bool                    peek(io_uring_cqe& cqe);
+          bool                    wait(io_uring_cqe& cqe);
+
+private:
+          void                    release();
+
+private:
+  int                             _fd;
+
+  void*                           _sq_ring;
+  size_t                          _sq_ring_size;
+  void*                           _cq_ring;
+  size_t                          _cq_ring_size;
+  io_uring_sqe*                   _sqes;
+  size_t                          _sqes_size;
+
+  unsigned*                       _sq_head;
+  unsigned*                       _sq_tail;
+  unsigned*                       _sq_mask;
+  unsigned*                       _sq_array;
+  unsigned                        _sq_entries;
+  unsigned                        _sqe_tail;      // local tail, published by submit()
+
+  unsigned*                       _cq_head;
+  unsigned*                       _cq_tail;
+  unsigned*                       _cq_mask;
+  io_uring_cqe*                   _cqes;
+};
+
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_IO_URING_HPP_ */
@@ -0,0 +1,348 @@
+/*
+ * page_allocator.cpp
+ *
+ *  Created on: Feb 28, 2020
+ *      Author: daniel
+ */
+
+#include "page_allocator.hpp"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace brt
+{
+namespace jupiter
+{
+
+std::atomic_bool    PageAllocator::_huge_pages(false);
+std::atomic_size_t  PageAllocator::_threshold(DEFAULT_HUGE_PAGE_THRESHOLD);
+std::atomic_size_t  PageAllocator::_in_use[eNumBackings];
+
+/*
+ * \\fn PageAllocator::Block PageAllocator::allocate
+ *
+ * created on: Feb 28, 2020
+ * author: daniel
+ *
+ */
+PageAllocator::Block PageAllocator::allocate(size_t size)
+{
+  Block result;
+  if (size == 0)
+    return result;
+
+  if (_huge_pages.load() && (size >= _threshold.load()))
+  {
+    if (!map_huge_tlb(size, result))
+      map_transparent(size, result);
+  }
+
+  if (result._ptr == nullptr)
+  {
+    result._ptr = ::malloc(size);
+    if (result._ptr == nullptr)
+      return result;
+
+    result._mapped = size;
+    result._backing = eHeapMemory;
+  }
+
+  result._size = size;
+  _in_use[result._backing] += result._mapped;
+
+  return result;
+}
+
+/*
+ * \\fn void PageAllocator::release
+ *
+ * created on: Feb 28, 2020
+ * author: daniel
+ *
+ */
+void PageAllocator::release(Block& block)
+{
+  if (block._ptr == nullptr)
+    return;
+
+  switch (block._backing)
+  {
+  case eHeapMemory:
+    ::free(reinterpret_cast<uint8_t*>(block._ptr) - block._offset);
+    break;
+
+  case eAnonymousMap:
+  case eTransparentHugePages:
+  case eHugeTLB:
+  case eFileMap:
+    ::munmap(reinterpret_cast<uint8_t*>(block._ptr) - block._offset, block._mapped);
+    break;
+
+  default:
+    break;
+  }
+
+  _in_use[block._backing] -= block._mapped;
+  block = Block();
+}
+
+/*
+ * \\fn PageAllocator::Block PageAllocator::map_file
+ *
+ * created on: Mar 9, 2020
+ * author: daniel
+ *
+ * Private writable mapping of [offset, offset + size) of the file. Pages
+ * are copied only if the image is modified, the file is never written.
+ */
+PageAllocator::Block PageAllocator::map_file(int fd, size_t offset, size_t size, bool populate /*= true*/)
+{
+  Block result;
+  if ((fd < 0) || (size == 0))
+    return result;
+
+  // mmap offsets must be page aligned, so the mapping starts at the page
+  // holding the first byte and _ptr is moved forward to it
+  size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  size_t map_offset = offset & ~(page - 1);
+  size_t mapped = size + (offset - map_offset);
+
+  int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+  if (populate)
+    flags |= MAP_POPULATE;
+#endif
+
+  uint8_t* ptr = reinterpret_cast<uint8_t*>(::mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                                                    flags, fd, static_cast<off_t>(map_offset)));
+  if (ptr == MAP_FAILED)
+    return result;
+
+  ::madvise(ptr, mapped, MADV_SEQUENTIAL);
+  if (!populate)
+    ::madvise(ptr, mapped, MADV_WILLNEED);
+
+  result._ptr = ptr + (offset - map_offset);
+  result._size = size;
+  result._mapped = mapped;
+  result._offset = offset - map_offset;
+  result._backing = eFileMap;
+
+  _in_use[result._backing] += result._mapped;
+  return result;
+}
+
+/*
+ * \\fn bool PageAllocator::map_huge_tlb
+ *
+ * created on: Feb 28, 2020
+ * author: daniel
+ *
+ */
+bool PageAllocator::map_huge_tlb(size_t size, Block& block)
+{
+#ifdef MAP_HUGETLB
+  size_t mapped = (size + HUGE_PAGE_SIZE - 1) & ~static_cast<size_t>(HUGE_PAGE_SIZE - 1);
+
+  void* ptr = ::mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (ptr == MAP_FAILED)
+    return false;
+
+  block._ptr = ptr;
+  block._mapped = mapped;
+  block._backing = eHugeTLB;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/*
+ * \\fn bool PageAllocator::map_transparent
+ *
+ * created on: Feb 28, 2020
+ * author: daniel
+ *
+ * Over-allocate by one huge page, then trim both ends so the
+ * mapping starts on a 2MB boundary the kernel can back with huge pages
+ */
+bool PageAllocator::map_transparent(size_t size, Block& block)
+{
+  size_t mapped = (size + HUGE_PAGE_SIZE - 1) & ~static_cast<size_t>(HUGE_PAGE_SIZE - 1);
+  size_t total = mapped + HUGE_PAGE_SIZE;
+
+  uint8_t* ptr = reinterpret_cast<uint8_t*>(::mmap(nullptr, total, PROT_READ | PROT_WRITE,
+                                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (ptr == MAP_FAILED)
+    return false;
+
+  uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+  uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~static_cast<uintptr_t>(HUGE_PAGE_SIZE - 1);
+
+  size_t head = aligned - start;
+  size_t tail = total - head - mapped;
+
+  if (head != 0)
+    ::munmap(ptr, head);
+
+  if (tail != 0)
+    ::munmap(reinterpret_cast<uint8_t*>(aligned) + mapped, tail);
+
+  block._ptr = reinterpret_cast<void*>(aligned);
+  block._mapped = mapped;
+  block._backing = eAnonymousMap;
+
+#ifdef MADV_HUGEPAGE
+  if (::madvise(block._ptr, mapped, MADV_HUGEPAGE) == 0)
+    block._backing = eTransparentHugePages;
+#endif
+
+  return true;
+}
+
+/*
+ * \\fn size_t PageAllocator::in_use
+ *
+ * created on: Feb 28, 2020
+ * author: daniel
+ *
+ */
+size_t PageAllocator::in_use(MemBacking backing)
+{
+  if (backing >= eNumBackings)
+    return 0;
+
+  return _in_use[backing].load();
+}
+
+/*
+ * \\fn const char* PageAllocator::backing_name
+ *
+ * created on: Feb 28, 2020
+ * author: daniel
+ *
+ */
+const char* PageAllocator::backing_name(MemBacking backing)
+{
+  switch (backing)
+  {
+  case eHeapMemory:
+    return "heap";
+
+  case eAnonymousMap:
+    return "anonymous map";
+
+  case eTransparentHugePages:
+    return "transparent huge pages";
+
+  case eHugeTLB:
+    return "hugetlbfs";
+
+  case eFileMap:
+    return "file map";
+
+  case eExternalMemory:
+    return "external";
+
+  default:
+    break;
+  }
+
+  return "none";
+}
+
+/*
+ * \\fn Constructor BlockPool::BlockPool
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+BlockPool::BlockPool(size_t max_cached /*= DEFAULT_POOL_CACHE_SIZE*/)
+: _free()
+, _cached(0)
+, _max_cached(max_cached)
+{
+}
+
+/*
+ * \\fn Destructor BlockPool::~BlockPool
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+BlockPool::~BlockPool()
+{
+  for (auto& entry : _free)
+    PageAllocator::release(entry.second);
+}
+
+/*
+ * \\fn PageAllocator::Block BlockPool::acquire
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+PageAllocator::Block BlockPool::acquire(size_t size)
+{
+  std::unique_lock<std::mutex> l(_mutex);
+
+  // Smallest cached block that fits, as long as it doesn't waste
+  // more than the requested size
+  auto iter = _free.lower_bound(size);
+  if ((iter != _free.end()) && (iter->first <= size * 2))
+  {
+    PageAllocator::Block result = iter->second;
+    _free.erase(iter);
+    _cached -= result._mapped;
+
+    result._size = size;
+    return result;
+  }
+  l.unlock();
+
+  return PageAllocator::allocate(size);
+}
+
+/*
+ * \\fn void BlockPool::recycle
+ *
+ * created on: Mar 13, 2020
+ * author: daniel
+ *
+ */
+void BlockPool::recycle(PageAllocator::Block& block)
+{
+  if (block._ptr == nullptr)
+    return;
+
+  // File maps can't be reused for anything else
+  if (block._backing == eFileMap)
+  {
+    PageAllocator::release(block);
+    return;
+  }
+
+  block._ptr = reinterpret_cast<uint8_t*>(block._ptr) - block._offset;
+  block._offset = 0;
+
+  std::unique_lock<std::mutex> l(_mutex);
+  if ((_cached + block._mapped) > _max_cached)
+  {
+    l.unlock();
+    PageAllocator::release(block);
+    return;
+  }
+
+  _cached += block._mapped;
+  _free.insert(std::make_pair(block._mapped, block));
+  block = PageAllocator::Block();
+}
+
+} /* namespace jupiter */
+} /* namespace brt */
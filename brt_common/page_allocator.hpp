@@ -0,0 +1,176 @@
+/*
+ * page_allocator.hpp
+ *
+ *  Created on: Feb 28, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_PAGE_ALLOCATOR_HPP_
+#define BRT_COMMON_PAGE_ALLOCATOR_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <map>
+
+#define HUGE_PAGE_SIZE                      (2 * 1024 * 1024)
+#define DEFAULT_HUGE_PAGE_THRESHOLD         (HUGE_PAGE_SIZE)
+#define DEFAULT_POOL_CACHE_SIZE             (256 * 1024 * 1024)
+
+namespace brt
+{
+namespace jupiter
+{
+
+/*
+ * \\enum MemBacking
+ *
+ * created on: Feb 28, 2020
+ *
+ */
+enum MemBacking
+{
+  eNoMemory = 0,
+  eHeapMemory,
+  eAnonymousMap,
+  eTransparentHugePages,
+  eHugeTLB,
+  eFileMap,
+  eExternalMemory,
+
+  eNumBackings
+};
+
+/*
+ * \\class PageAllocator
+ *
+ * created on: Feb 28, 2020
+ *
+ * Large frame buffers go to 2MB pages when it is enabled: hugetlbfs first
+ * (MAP_HUGETLB, needs reserved pages), then an aligned anonymous mapping
+ * with MADV_HUGEPAGE. Anything failing falls back to malloc.
+ */
+class PageAllocator
+{
+public:
+  /*
+   * \\struct Block
+   *
+   * created on: Feb 28, 2020
+   *
+   */
+  struct Block
+  {
+    Block() : _ptr(nullptr), _size(0), _mapped(0), _offset(0), _backing(eNoMemory) {}
+
+    void*                         _ptr;
+    size_t                        _size;
+    size_t                        _mapped;
+    size_t                        _offset;      // _ptr distance from the start of the mapping
+    MemBacking                    _backing;
+  };
+
+  static  Block                   allocate(size_t size);
+  static  Block                   map_file(int fd, size_t offset, size_t size, bool populate = true);
+  static  void                    release(Block& block);
+
+  static  void                    set_huge_pages(bool enable) { _huge_pages.store(enable); }
+  static  bool                    huge_pages() { return _huge_pages.load(); }
+  static  void                    set_threshold(size_t threshold) { _threshold.store(threshold); }
+
+  static  size_t                  in_use(MemBacking backing);
+  static  const char*             backing_name(MemBacking backing);
+
+private:
+  static  bool                    map_huge_tlb(size_t size, Block& block);
+  static  bool                    map_transparent(size_t size, Block& block);
+
+private:
+  static  std::atomic_bool        _huge_pages;
+  static  std::atomic_size_t      _threshold;
+  static  std::atomic_size_t      _in_use[eNumBackings];
+};
+
+/*
+ * \\class BlockPool
+ *
+ * created on: Mar 13, 2020
+ *
+ * Keeps released blocks for reuse, so streams of same sized frames
+ * stop going back to the allocator for every file
+ */
+class BlockPool
+{
+public:
+  BlockPool(size_t max_cached = DEFAULT_POOL_CACHE_SIZE);
+  virtual ~BlockPool();
+
+  BlockPool(const BlockPool&) = delete;
+  BlockPool& operator=(const BlockPool&) = delete;
+
+          PageAllocator::Block    acquire(size_t size);
+          void                    recycle(PageAllocator::Block& block);
+
+          size_t                  cached() const { return _cached; }
+
+private:
+  std::multimap<size_t, PageAllocator::Block>
+                                  _free;
+  size_t                          _cached;
+  size_t                          _max_cached;
+  std::mutex                      _mutex;
+};
+
+typedef std::shared_ptr<BlockPool> BlockPoolPtr;
+
+/*
+ * \\class PageArray
+ *
+ * created on: Feb 28, 2020
+ *
+ * Workspace array allocated through PageAllocator
+ */
+template<typename T>
+class PageArray
+{
+public:
+  PageArray(size_t count) : _block(PageAllocator::allocate(count * sizeof(T))), _count(0)
+  {
+    if (_block._ptr == nullptr)
+      return;
+
+    _count = count;
+    for (size_t index = 0; index < _count; index++)
+      new (data() + index) T();
+  }
+
+  ~PageArray()
+  {
+    for (size_t index = 0; index < _count; index++)
+      data()[index].~T();
+
+    PageAllocator::release(_block);
+  }
+
+  PageArray(const PageArray&) = delete;
+  PageArray& operator=(const PageArray&) = delete;
+
+          T*                      data() { return reinterpret_cast<T*>(_block._ptr); }
+          size_t                  size() const { return _count; }
+          MemBacking              backing() const { return _block._backing; }
+
+          T&                      operator[](size_t index) { return data()[index]; }
+
+private:
+  PageAllocator::Block            _block;
+  size_t                          _count;
+};
+
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_PAGE_ALLOCATOR_HPP_ */
@@ -0,0 +1,120 @@
+/*
+ * image_fanout_test.cpp
+ *
+ *  Created on: Apr 20, 2020
+ *      Author: daniel
+ *
+ * Two consumers receive one frame, one of them writes to it. Neither the
+ * other consumer nor the producer may see the write.
+ *
+ *   g++ -std=c++14 -I.. -I../image -I../private image_fanout_test.cpp \
+ *       ../image/[a-z]*.cpp ../[a-z]*.cpp ../private/[a-z]*.cpp -lpthread -lz
+ */
+
+#include <string.h>
+#include <iostream>
+#include <mutex>
+
+#include <image.hpp>
+
+using namespace brt::jupiter;
+using namespace brt::jupiter::image;
+
+#define FRAME_VALUE           (0x11)
+#define WRITTEN_VALUE         (0x77)
+
+/*
+ * \\class Writer
+ *
+ * created on: Apr 20, 2020
+ *
+ */
+class Writer : public ImageConsumer
+{
+public:
+  virtual void                    consume(ImageBox box)
+  {
+    RawRGBPtr bits = box[0]->get_bits();
+    memset(bits->bytes(), WRITTEN_VALUE, bits->size());
+    box[0]->set("written", true);
+  }
+};
+
+/*
+ * \\class Reader
+ *
+ * created on: Apr 20, 2020
+ *
+ */
+class Reader : public ImageConsumer
+{
+public:
+  Reader() : _frames(0), _corrupted(0) {}
+
+  virtual void                    consume(ImageBox box)
+  {
+    RawRGBPtr bits = box[0]->get_bits();
+    bool corrupted = box[0]->get<bool>("written", false);
+    for (size_t index = 0; index < bits->size(); index++)
+      corrupted |= (bits->cbytes()[index] != FRAME_VALUE);
+
+    std::lock_guard<std::mutex> l(_mutex);
+    _frames++;
+    if (corrupted)
+      _corrupted++;
+  }
+
+  std::mutex                      _mutex;
+  size_t                          _frames;
+  size_t                          _corrupted;
+};
+
+/*
+ * \\fn static bool run
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ */
+static bool run(const char* name, const Metadata& writer_options, const Metadata& reader_options)
+{
+  ImageProducer producer;
+  Writer writer, second_writer;
+  Reader reader;
+
+  producer.register_consumer(&writer, writer_options);
+  producer.register_consumer(&second_writer, writer_options);
+  producer.register_consumer(&reader, reader_options);
+
+  bool producer_intact = true;
+  for (int frame = 0; frame < 64; frame++)
+  {
+    RawRGBPtr bits(new RawRGB(64, 48, 8, eRGBA));
+    memset(bits->bytes(), FRAME_VALUE, bits->size());
+    producer.consume(ImageBox(bits));
+
+    // The producer's own handle is never written through
+    for (size_t index = 0; index < bits->size(); index++)
+      producer_intact &= (bits->cbytes()[index] == FRAME_VALUE);
+  }
+
+  producer.unregister_consumer(&writer);
+  producer.unregister_consumer(&second_writer);
+  producer.unregister_consumer(&reader);
+
+  bool ok = producer_intact && (reader._frames == 64) && (reader._corrupted == 0);
+  std::cout << name << ": " << (ok ? "ok" : "FAILED") << " (" << reader._frames << " frames, "
+      << reader._corrupted << " corrupted" << (producer_intact ? "" : ", producer written") << ")" << std::endl;
+
+  return ok;
+}
+
+int main()
+{
+  bool ok = true;
+  ok &= run("sync", Metadata(), Metadata());
+  ok &= run("async", Metadata("policy=block"), Metadata("policy=block"));
+  ok &= run("mixed", Metadata("policy=block"), Metadata());
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+/*
+ * thread_pool.cpp
+ *
+ *  Created on: Mar 11, 2020
+ *      Author: daniel
+ */
+
+#include "thread_pool.hpp"
+
+#include <pthread.h>
+
+namespace brt
+{
+namespace jupiter
+{
+
+/*
+ * \\fn Constructor ThreadPool::ThreadPool
+ *
+ * created on: Mar 11, 2020
+ * author: daniel
+ *
+ */
+ThreadPool::ThreadPool(size_t num_threads, const char* name /*= "pool"*/)
+: _threads()
+, _jobs()
+, _name(name != nullptr ? name : "pool")
+, _terminate(false)
+{
+  if (num_threads == 0)
+    num_threads = 1;
+
+  // Thread names are limited to 15 characters
+  if (_name.size() > 12)
+    _name.resize(12);
+
+  for (size_t index = 0; index < num_threads; index++)
+  {
+    _threads.push_back(std::thread([this, index]()
+    {
+      std::string thread_name = _name + "_" + std::to_string(index);
+      pthread_setname_np(pthread_self(), thread_name.c_str());
+
+      loop();
+    }));
+  }
+}
+
+/*
+ * \\fn Destructor ThreadPool::~ThreadPool
+ *
+ * created on: Mar 11, 2020
+ * author: daniel
+ *
+ */
+ThreadPool::~ThreadPool()
+{
+  stop();
+}
+
+/*
+ * \\fn ThreadPool& ThreadPool::shared
+ *
+ * created on: Mar 25, 2020
+ * author: daniel
+ *
+ * One thread per core, for data parallel work inside a single call
+ */
+ThreadPool& ThreadPool::shared()
+{
+  static ThreadPool pool(std::max<size_t>(std::thread::hardware_concurrency(), 1), "shared");
+  return pool;
+}
+
+/*
+ * \\fn void ThreadPool::post
+ *
+ * created on: Mar 11, 2020
+ * author: daniel
+ *
+ */
+void ThreadPool::post(std::function<void()> job)
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  if (_terminate)
+    return;
+
+  _jobs.push_back(job);
+  l.unlock();
+
+  _cv.notify_one();
+}
+
+/*
+ * \\fn void ThreadPool::stop
+ *
+ * created on: Mar 11, 2020
+ * author: daniel
+ *
+ * Jobs already queued are still executed before the threads exit
+ */
+void ThreadPool::stop()
+{
+  std::unique_lock<std::mutex> l(_mutex);
+  _terminate = true;
+  l.unlock();
+
+  _cv.notify_all();
+  for (std::thread& thread : _threads)
+  {
+    if (thread.joinable())
+      thread.join();
+  }
+  _threads.clear();
+}
+
+/*
+ * \\fn void ThreadPool::loop
+ *
+ * created on: Mar 11, 2020
+ * author: daniel
+ *
+ */
+void ThreadPool::loop()
+{
+  while (true)
+  {
+    std::unique_lock<std::mutex> l(_mutex);
+    _cv.wait(l, [this]() { return _terminate || !_jobs.empty(); });
+
+    if (_jobs.empty())
+      break;
+
+    std::function<void()> job = _jobs.front();
+    _jobs.pop_front();
+    l.unlock();
+
+    job();
+  }
+}
+
+} /* namespace jupiter */
+} /* namespace brt */
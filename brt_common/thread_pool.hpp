@@ -0,0 +1,137 @@
+/*
+ * thread_pool.hpp
+ *
+ *  Created on: Mar 11, 2020
+ *      Author: daniel
+ */
+
+#ifndef BRT_COMMON_THREAD_POOL_HPP_
+#define BRT_COMMON_THREAD_POOL_HPP_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <deque>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+namespace brt
+{
+namespace jupiter
+{
+
+/*
+ * \\class ThreadPool
+ *
+ * created on: Mar 11, 2020
+ *
+ */
+class ThreadPool
+{
+public:
+  ThreadPool(size_t num_threads, const char* name = "pool");
+  virtual ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  static  ThreadPool&             shared();
+
+          size_t                  size() const { return _threads.size(); }
+
+          void                    post(std::function<void()> job);
+          void                    stop();
+
+  /*
+   * \\fn std::future<R> submit
+   *
+   * created on: Mar 11, 2020
+   * author: daniel
+   *
+   */
+  template<typename F>
+  auto                            submit(F func) -> std::future<decltype(func())>
+  {
+    typedef decltype(func()) R;
+    std::shared_ptr<std::packaged_task<R()>> task(new std::packaged_task<R()>(func));
+
+    std::future<R> result = task->get_future();
+    post([task]() { (*task)(); });
+    return result;
+  }
+
+  /*
+   * \\fn void parallel_for
+   *
+   * created on: Mar 25, 2020
+   * author: daniel
+   *
+   * Calls func(index) for every index in [0, count) on the calling thread
+   * and up to jobs - 1 pool threads, returns when all calls are done.
+   * Indices are claimed one at a time and the caller only waits for
+   * completed calls, never for a queued job to start, so it is safe to
+   * nest inside jobs of the same pool.
+   */
+  template<typename F>
+  void                            parallel_for(size_t count, size_t jobs, F func)
+  {
+    struct State
+    {
+      std::atomic_size_t          _next;
+      size_t                      _done;
+      std::mutex                  _mutex;
+      std::condition_variable     _cv;
+    };
+
+    std::shared_ptr<State> state(new State);
+    state->_next = 0;
+    state->_done = 0;
+
+    std::function<void()> work = [state, count, func]()
+    {
+      size_t done = 0;
+      for (size_t index = state->_next++; index < count; index = state->_next++, done++)
+        func(index);
+
+      if (done == 0)
+        return;
+
+      std::lock_guard<std::mutex> l(state->_mutex);
+      state->_done += done;
+      if (state->_done == count)
+        state->_cv.notify_all();
+    };
+
+    jobs = std::min(jobs, count);
+    for (size_t index = 1; index < jobs; index++)
+      post(work);
+
+    work();
+
+    std::unique_lock<std::mutex> l(state->_mutex);
+    state->_cv.wait(l, [state, count]() { return state->_done >= count; });
+  }
+
+private:
+          void                    loop();
+
+private:
+  std::vector<std::thread>        _threads;
+  std::deque<std::function<void()>>
+                                  _jobs;
+  std::string                     _name;
+  bool                            _terminate;
+
+  std::mutex                      _mutex;
+  std::condition_variable         _cv;
+};
+
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* BRT_COMMON_THREAD_POOL_HPP_ */
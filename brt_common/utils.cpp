@@ -6,6 +6,8 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <iostream>
 
 #include "utils.hpp"
@@ -19,6 +21,10 @@
 #define X11_PORT_MIN                        (6000)
 #define X11_PORT_MAX                        (6100)
 
+#ifndef IOV_MAX
+#define IOV_MAX                             (1024)
+#endif
+
 
 namespace brt {
 
@@ -95,6 +101,42 @@ double Utils::frame_rate(const char* fr_string)
   return frame_rate = 1.0 / (frame_rate * multiplier);
 }
 
+/*
+ * \\fn bool Utils::writev_all
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ */
+bool Utils::writev_all(int fd, std::vector<struct iovec>& iov)
+{
+  size_t first = 0;
+  while (first < iov.size())
+  {
+    int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+    ssize_t res = ::writev(fd, &iov[first], count);
+    if (res < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return false;
+    }
+
+    size_t written = static_cast<size_t>(res);
+    while ((first < iov.size()) && (written >= iov[first].iov_len))
+      written -= iov[first++].iov_len;
+
+    if (written > 0)
+    {
+      iov[first].iov_base = reinterpret_cast<uint8_t*>(iov[first].iov_base) + written;
+      iov[first].iov_len -= written;
+    }
+  }
+
+  return true;
+}
+
 /*
  * \\fn std::vector<std::string> FLTKManager::enumerate_displays
  *
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #define DEFAULT_FIFO_SIZE                   (32)
 #define BYTES_PER_PIXELS(x)                 (((x - 1) >> 3) + 1)
@@ -437,6 +438,8 @@ public:
   static const char*              stristr(const char* src,const char* dst,size_t len = (size_t)-1);
   static size_t                   stristr(const std::string& src,const char* dst,size_t len = (size_t)-1);
   static double                   frame_rate(const char* fr_string);
+  // Short writes resume where the kernel stopped, iov is consumed on the way
+  static bool                     writev_all(int fd, std::vector<struct iovec>& iov);
 
   static  std::set<X11Display>    enumerate_displays(DisplayType = eAllDisplays);
   static  X11Display              aquire_display(const char* extra_string);
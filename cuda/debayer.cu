@@ -8,6 +8,7 @@
 #include "debayer.hpp"
 #include "cuda_2d_mem.hpp"
 #include "cuda_mem.hpp"
+#include "stencil.hpp"
 
 #include <cuda_profiler_api.h>
 
@@ -65,10 +66,11 @@ Debayer_impl()
   virtual ~Debayer_impl() {}
 
           void                    init(size_t width,size_t height,size_t small_hits_size);
-          image::RawRGBPtr        ahd(image::RawRGBPtr img);
+          image::RawRGBPtr        ahd(image::RawRGBPtr img, image::PixelType type);
 private:
 
   Cuda2DMem<uint16_t>             _raw;
+  CudaPtr<uint8_t>                _packed;
   Cuda2DMem<RGBA>                 _horiz;
   Cuda2DMem<RGBA>                 _vert;
   Cuda2DMem<RGBA>                 _result;
@@ -76,6 +78,8 @@ private:
   Cuda2DMem<LAB>                  _hlab;
   Cuda2DMem<LAB>                  _vlab;
 
+  Cuda2DMem<uint16_t>             _planes[4];   // planar output only
+
   CudaPtr<uint32_t>               _histogram;
   CudaPtr<uint32_t>               _histogram_max;
   CudaPtr<uint32_t>               _small_histogram;
@@ -85,6 +89,43 @@ private:
 };
 
 
+/*
+ * \\fn void unpack_mipi
+ *
+ * created on: Mar 27, 2020
+ * author: daniel
+ *
+ * One thread per packed group, one block row per image row. Packed
+ * frames cross the bus as they came from the sensor and only exist
+ * unpacked in device memory.
+ */
+__global__ void unpack_mipi(size_t width, size_t height, size_t pitch, bool raw10,
+                                          const uint8_t* packed, uint16_t* raw)
+{
+  const size_t samples = raw10 ? 4 : 2;
+  const size_t group = (blockIdx.x * blockDim.x) + threadIdx.x;
+  const size_t y = blockIdx.y;
+
+  size_t x = group * samples;
+  if ((x >= width) || (y >= height))
+    return;
+
+  const uint8_t* src = packed + y * pitch + group * (raw10 ? 5 : 3);
+  uint16_t* dst = raw + x + y * width;
+
+  if (raw10)
+  {
+    for (size_t sample = 0; (sample < 4) && (x + sample < width); sample++)
+      dst[sample] = (src[sample] << 2) | ((src[4] >> (2 * sample)) & 0x3);
+  }
+  else
+  {
+    dst[0] = (src[0] << 4) | (src[2] & 0xF);
+    if (x + 1 < width)
+      dst[1] = (src[1] << 4) | (src[2] >> 4);
+  }
+}
+
 /*
  * \\fn void green_interpolate
  *
@@ -107,6 +148,9 @@ __global__ void green_interpolate(size_t width, size_t height,
     return (x<a)?a:(x>b)?b:x;
   };
 
+  // Samples outside of the frame read as zero
+  image::Stencil<uint16_t, 2> bayer(raw, static_cast<int>(width), static_cast<int>(height), width);
+
   // C R
   // B C
   // (0,0) -> Clear
@@ -122,21 +166,13 @@ __global__ void green_interpolate(size_t width, size_t height,
   y = origy;
   io = x + y * width; // input offset
   {
-    int px[] = { (x > 0) ? raw[io - 1] : 0,                // x-1,y
-                 (x < (width - 1)) ? raw[io + 1] : 0,      // x+1,y
-                 (x > 1) ? raw[io - 2] : 0,                // x-2,y
-                 (x < (width - 2)) ? raw[io + 2] : 0 };    // x+2,y
-
-    int value =  ((( px[0] + raw[io] + px[1]) * 2) - px[2] - px[3]) >> 2;
-    hr[io]._g = limit(value, px[0], px[1]);
+    image::Stencil<uint16_t, 2>::Window p = bayer.window(x, y);
 
-    int py[] = { (y > 0) ? raw[io - width] : 0,                    // x,y-1
-                 (y < (height - 1)) ? raw[io + width] : 0,         // x,y+1
-                 (y > 1) ? raw[io - (2 * width)] : 0,              // x,y-2
-                 (y < (height - 2))?raw[io + (2 * width)] : 0 };   // x,y+2
+    int value =  ((( p(-1,0) + p(0,0) + p(1,0)) * 2) - p(-2,0) - p(2,0)) >> 2;
+    hr[io]._g = limit(value, p(-1,0), p(1,0));
 
-    value =  ((( py[0] + raw[io] + py[1]) * 2) - py[2] - py[3]) >> 2;
-    vr[io]._g = limit(value, py[0], py[1]);
+    value =  ((( p(0,-1) + p(0,0) + p(0,1)) * 2) - p(0,-2) - p(0,2)) >> 2;
+    vr[io]._g = limit(value, p(0,-1), p(0,1));
   }
 
   ////////////////////////////////////////////////
@@ -145,21 +181,13 @@ __global__ void green_interpolate(size_t width, size_t height,
   y = origy + 1;
   io = x + y * width; // input offset
   {
-    int px[] = { (x > 0) ? raw[io - 1] : 0,                // x-1,y
-                 (x < (width - 1)) ? raw[io + 1] : 0,      // x+1,y
-                 (x > 1) ? raw[io - 2] : 0,                // x-2,y
-                 (x < (width - 2)) ? raw[io + 2] : 0 };    // x+2,y
+    image::Stencil<uint16_t, 2>::Window p = bayer.window(x, y);
 
-    int value =  ((( px[0] + raw[io] + px[1]) * 2) - px[2] - px[3]) >> 2;
-    hr[io]._g = limit(value, px[0], px[1]);
+    int value =  ((( p(-1,0) + p(0,0) + p(1,0)) * 2) - p(-2,0) - p(2,0)) >> 2;
+    hr[io]._g = limit(value, p(-1,0), p(1,0));
 
-    int py[] = { (y > 0) ? raw[io - width] : 0,                    // x,y-1
-                 (y < (height - 1)) ? raw[io + width] : 0,         // x,y+1
-                 (y > 1) ? raw[io - (2 * width)] : 0,              // x,y-2
-                 (y < (height - 2))?raw[io + (2 * width)] : 0 };   // x,y+2
-
-    value =  ((( py[0] + raw[io] + py[1]) * 2) - py[2] - py[3]) >> 2;
-    vr[io]._g = limit(value, py[0], py[1]);
+    value =  ((( p(0,-1) + p(0,0) + p(0,1)) * 2) - p(0,-2) - p(0,2)) >> 2;
+    vr[io]._g = limit(value, p(0,-1), p(0,1));
   }
   ////////////////////////////////////////////////
   // (1,1) -> Clear
@@ -197,51 +225,24 @@ __global__ void blue_red_interpolate( size_t width, size_t height,
     return (x<a)?a:(x>b)?b:x;
   };
 
-  int sub[4][4] = { {0,0,0,0}, {0,0,0,0}, {0,0,0,0}, {0,0,0,0} };
-
-  int io = origx + origy * width;
-
-
-  if (origx > 0)
-  {
-    if (origy > 0)
-      sub[0][0] = raw[io-width-1] - ip[z][io-width-1]._g;
-
-    sub[1][0] = raw[io-1] - ip[z][io-1]._g;
-    sub[2][0] = raw[io+width-1] - ip[z][io+width-1]._g;
+  // Green is read straight out of the interleaved RGBA buffer
+  image::Stencil<uint16_t, 2> bayer(raw, static_cast<int>(width), static_cast<int>(height), width);
+  image::Stencil<uint16_t, 2> green(&ip[z][0]._g, static_cast<int>(width), static_cast<int>(height),
+                                    width * (sizeof(RGBA) / sizeof(uint16_t)), sizeof(RGBA) / sizeof(uint16_t));
 
-    if (origy < (height - 2))
-      sub[3][0] = raw[io+2*width-1] - ip[z][io+2*width-1]._g;
-  }
+  image::Stencil<uint16_t, 2>::Window pr = bayer.window(origx, origy);
+  image::Stencil<uint16_t, 2>::Window pg = green.window(origx, origy);
 
-  if (origx < (width - 2))
+  // Color differences of the 4x4 block around the 2x2 quad,
+  // zero outside of the frame
+  int sub[4][4];
+  for (int row = 0; row < 4; row++)
   {
-    if (origy > 0)
-      sub[0][3] = raw[io-width+2] - ip[z][io-width+2]._g;
-
-    sub[1][3] = raw[io+2] - ip[z][io+2]._g;
-    sub[2][3] = raw[io+width+2] - ip[z][io+width+2]._g;
-
-    if (origy < (height - 2))
-      sub[3][3] = raw[io+2*width+2] - ip[z][io+2*width+2]._g;
+    for (int col = 0; col < 4; col++)
+      sub[row][col] = pr(col - 1, row - 1) - pg(col - 1, row - 1);
   }
 
-  if (origy > 0)
-  {
-    sub[0][1] = raw[io-width] - ip[z][io-width]._g;
-    sub[0][2] = raw[io-width+1] - ip[z][io-width+1]._g;
-  }
-
-  if (origy < (height - 2))
-  {
-    sub[3][1] = raw[io+2*width] - ip[z][io+2*width]._g;
-    sub[3][2] = raw[io+2*width+1] - ip[z][io+2*width+1]._g;
-  }
-
-  sub[1][1] = raw[io] - ip[z][io]._g;
-  sub[1][2] = raw[io+1] - ip[z][io+1]._g;
-  sub[2][1] = raw[io+width] - ip[z][io+width]._g;
-  sub[2][2] = raw[io+width+1] - ip[z][io+width+1]._g;
+  int io = origx + origy * width;
 
   // C R
   // B C
@@ -499,6 +500,28 @@ __global__ void misguidance_color_artifacts(size_t width, size_t height, RGBA* r
 }
 
 
+/*
+ * \\fn void split_planes
+ *
+ * created on: Feb 24, 2020
+ * author: daniel
+ *
+ */
+__global__ void split_planes(size_t width, size_t height, RGBA* rst,
+                             uint16_t* r, uint16_t* g, uint16_t* b, uint16_t* a)
+{
+  int x = ((blockIdx.x * blockDim.x) + threadIdx.x);
+  int y = ((blockIdx.y * blockDim.y) + threadIdx.y);
+  int io = x + y * width;
+
+  r[io] = rst[io]._r;
+  g[io] = rst[io]._g;
+  b[io] = rst[io]._b;
+
+  if (a != nullptr)
+    a[io] = rst[io]._a;
+}
+
 /*
  * \\fn void cudaMax
  *
@@ -542,6 +565,7 @@ __global__ void cudaMax(uint32_t* org,uint32_t* max)
 Debayer::Debayer()
 : _width(0)
 , _height(0)
+, _output_type(image::eRGBA)
 {
   _impl = new Debayer_impl();
 }
@@ -581,6 +605,10 @@ void Debayer_impl::init(size_t width,size_t height,size_t small_hits_size)
   _histogram_max = CudaPtr<uint32_t>(1 << 16); _histogram_max.fill(0);
   _small_histogram = CudaPtr<uint32_t>(small_hits_size); _small_histogram.fill(0);
 
+  // Planar output allocates its planes on first use
+  for (size_t index = 0; index < 4; index++)
+    _planes[index] = Cuda2DMem<uint16_t>();
+
   _thx = std::min(DEFAULT_NUMBER_OF_THREADS, (1 << __builtin_ctz(width)));
   if (_thx == 0)
     _thx = 1;
@@ -620,14 +648,29 @@ bool Debayer::init(size_t width,size_t height,size_t small_hits_size)
  * author: daniel
  *
  */
-image::RawRGBPtr Debayer_impl::ahd(image::RawRGBPtr img)
+image::RawRGBPtr Debayer_impl::ahd(image::RawRGBPtr img, image::PixelType type)
 {
+  // The kernels take 16 bit integer samples, float frames are quantised
+  // on the host first, the way the CPU path does
+  if (img && img->is_float())
+    img = img->convert(image::eUnsigned, 16);
+
   if (!img)
     return image::RawRGBPtr();
 
   _histogram_max.fill(0);
   _small_histogram.fill(0);
-  _raw.put((uint16_t*)img->bytes(),img->width() * img->height());
+  if (img->packed())
+  {
+    bool raw10 = (img->format() == image::eMipiRaw10);
+    size_t groups = (img->width() + (raw10 ? 3 : 1)) / (raw10 ? 4 : 2);
+
+    _packed.put(img->cbytes(), img->size());
+    unpack_mipi<<<dim3((groups + 127) / 128, img->height()), dim3(128)>>>(img->width(), img->height(), img->pitch(),
+                                                                          raw10, _packed.ptr(), _raw.ptr());
+  }
+  else
+    _raw.put((uint16_t*)img->cbytes(),img->width() * img->height());
 
   cudaProfilerStart();
 
@@ -649,10 +692,34 @@ image::RawRGBPtr Debayer_impl::ahd(image::RawRGBPtr img)
 
   cudaMax<<<_histogram.size() / thx, thx>>>(_histogram.ptr(), _histogram_max.ptr());
 
+  if (image::is_planar(type))
+  {
+    // The alpha plane only exists once ePlanarRGBA was asked for
+    for (size_t index = 0; index < image::num_planes(type); index++)
+    {
+      if (_planes[index].size() != img->width() * img->height())
+        _planes[index] = Cuda2DMem<uint16_t>(img->width(), img->height());
+    }
+
+    split_planes<<<blocks,threads2>>>(img->width(), img->height(), _result.ptr(),
+                      _planes[0].ptr(), _planes[1].ptr(), _planes[2].ptr(),
+                      (type == image::ePlanarRGBA) ? _planes[3].ptr() : nullptr);
+  }
+
   cudaProfilerStop();
 
-  image::RawRGBPtr result(new image::RawRGB(img->width(), img->height(), img->depth(), image::eRGBA));
-  _result.get((RGBA*)result->bytes(), result->width() * result->height());
+  image::RawRGBPtr result;
+  if (image::is_planar(type))
+  {
+    result.reset(new image::RawRGB(img->width(), img->height(), img->depth(), type));
+    for (size_t index = 0; index < result->planes(); index++)
+      _planes[index].get((uint16_t*)result->plane(index), result->width() * result->height());
+  }
+  else
+  {
+    result.reset(new image::RawRGB(img->width(), img->height(), img->depth(), image::eRGBA));
+    _result.get((RGBA*)result->bytes(), result->width() * result->height());
+  }
 
   image::HistPtr  full_hist(new image::Histogram);
   full_hist->_histogram.resize(_histogram.size());
@@ -675,9 +742,9 @@ image::RawRGBPtr Debayer_impl::ahd(image::RawRGBPtr img)
  * author: daniel
  *
  */
-image::RawRGBPtr Debayer::ahd(image::RawRGBPtr img)
+image::RawRGBPtr Debayer::ahd(image::RawRGBPtr img, image::PixelType type /*= image::eRGBA*/)
 {
-  return _impl->ahd(img);
+  return _impl->ahd(img, type);
 }
 
 /*
@@ -691,7 +758,7 @@ void Debayer::consume(image::ImageBox box)
 {
   for (image::ImagePtr img : box)
   {
-    image::RawRGBPtr result = _impl->ahd(img->get_bits());
+    image::RawRGBPtr result = _impl->ahd(img->get_bits(), _output_type);
     if (result)
       ImageProducer::consume(image::ImageBox(result));
   }
@@ -35,14 +35,18 @@ public:
   virtual ~Debayer();
 
           bool                    init(size_t width,size_t height,size_t small_hits_size);
-          image::RawRGBPtr        ahd(image::RawRGBPtr img);
+          image::RawRGBPtr        ahd(image::RawRGBPtr img, image::PixelType type = image::eRGBA);
 
   virtual void                    consume(image::ImageBox box);
 
+          void                    set_output_type(image::PixelType type) { _output_type = type; }
+          image::PixelType        output_type() const { return _output_type; }
+
 private:
   Debayer_impl*                   _impl;
   size_t                          _width;
   size_t                          _height;
+  image::PixelType                _output_type;
 };
 
 } /* namespace jupiter */
@@ -409,11 +409,15 @@ void Debayer_Bilinear::consume(image::ImageBox box)
  */
 image::RawRGBPtr Debayer_Bilinear_Impl::ahd(image::RawRGBPtr raw)
 {
+  // Only 16 bit integer samples go up, packed and float frames are converted first
+  if (raw && (raw->packed() || raw->is_float()))
+    raw = raw->convert(image::eUnsigned, raw->is_float() ? 16 : raw->depth());
+
   if (!raw)
     return image::RawRGBPtr();
 
   size_t img_size = raw->width() * raw->height();
-  if (!_img_buffer.put((uint16_t*)raw->bytes(), img_size))
+  if (!_img_buffer.put((const uint16_t*)raw->cbytes(), img_size))
     return image::RawRGBPtr();
 
   size_t debayer_img_size = img_size * 4; /* RGBA*/
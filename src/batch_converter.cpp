@@ -0,0 +1,369 @@
+/*
+ * batch_converter.cpp
+ *
+ *  Created on: Mar 16, 2020
+ *      Author: daniel
+ */
+
+#include "batch_converter.hpp"
+#include "raw_file.hpp"
+#include "utils.hpp"
+#include "image_processor.hpp"
+#include "debayer.hpp"
+
+#include <iostream>
+#include <chrono>
+
+namespace brt
+{
+namespace jupiter
+{
+
+/*
+ * \\fn static std::string strip_extension
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ * Drops the extension of the file name, dots in the directory are kept
+ */
+static std::string strip_extension(const std::string& filename)
+{
+  size_t slash = filename.find_last_of('/');
+  size_t dot = filename.find_last_of('.');
+  if ((dot == std::string::npos) || ((slash != std::string::npos) && (dot < slash)))
+    return filename;
+
+  return filename.substr(0, dot);
+}
+
+/*
+ * \\fn Constructor BatchConverter::BatchConverter
+ *
+ * created on: Mar 16, 2020
+ * author: daniel
+ *
+ */
+BatchConverter::BatchConverter(const Metadata& args)
+: _out_dir(args.get<std::string>("out_dir",""))
+, _ext(args.get<std::string>("ext","png"))
+, _prefix(args.get<std::string>("prefix",""))
+, _format(image::ImageWriter::format(_ext))
+, _options()
+, _cpu(args.get<bool>("cpu",false))
+, _queue_depth(args.get<int>("queue_depth",DEFAULT_BATCH_QUEUE_DEPTH))
+, _files(0)
+, _failed(0)
+, _bytes_in(0)
+, _bytes_out(0)
+{
+  _options._rows_per_strip = args.get<int>("rows_per_strip",0);
+  _options._png_level = args.get<int>("png_level",_options._png_level);
+  _options._png_filter = static_cast<image::PngFilter>(args.get<int>("png_filter",_options._png_filter));
+  _options._png_strip_rows = args.get<int>("png_strip_rows",0);
+
+  // Frames are already encoded in parallel, strips only help with few workers
+  _options._threads = args.get<int>("png_threads",1);
+
+  size_t cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+  _threads[eLoadStage] = args.get<int>("load_threads",DEFAULT_BATCH_LOAD_THREADS);
+  _threads[eDebayerStage] = args.get<int>("debayer_threads",_cpu ? cores : DEFAULT_BATCH_DEBAYER_THREADS);
+  _threads[eEncodeStage] = args.get<int>("encode_threads",cores);
+  _threads[eWriteStage] = args.get<int>("write_threads",DEFAULT_BATCH_WRITE_THREADS);
+
+  for (size_t index = 0; index < eNumStages; index++)
+  {
+    if (_threads[index] == 0)
+      _threads[index] = 1;
+  }
+}
+
+/*
+ * \\fn Destructor BatchConverter::~BatchConverter
+ *
+ * created on: Mar 16, 2020
+ * author: daniel
+ *
+ */
+BatchConverter::~BatchConverter()
+{
+}
+
+/*
+ * \\fn bool BatchConverter::run
+ *
+ * created on: Mar 16, 2020
+ * author: daniel
+ *
+ * Blocks until every file went through the pipeline
+ */
+bool BatchConverter::run(const std::vector<std::string>& files)
+{
+  if (_format == image::eUnknownFormat)
+  {
+    std::cerr << "batch: unsupported output format \"" << _ext << "\"" << std::endl;
+    return false;
+  }
+
+  _files = 0;
+  _failed = 0;
+  _bytes_in = 0;
+  _bytes_out = 0;
+
+  // Sequence files expand into one job per frame
+  std::vector<JobPtr> jobs;
+  for (const std::string& file : files)
+  {
+    image::SequenceReaderPtr sequence;
+    if (image::SequenceReader::is_sequence(file.c_str()))
+      sequence = image::SequenceReader::open_file(file.c_str());
+
+    if (!sequence)
+    {
+      JobPtr job(new Job);
+      job->_filename = file;
+      job->_frame = 0;
+      jobs.push_back(job);
+      continue;
+    }
+
+    std::string base = strip_extension(file);
+    for (size_t frame = 0; frame < sequence->size(); frame++)
+    {
+      JobPtr job(new Job);
+      job->_filename = Utils::string_format("%s_%06zu", base.c_str(), frame);
+      job->_sequence = sequence;
+      job->_frame = frame;
+      jobs.push_back(job);
+    }
+  }
+
+  // The source queue holds the whole list, everything after it is bounded
+  JobQueue sources(jobs.size());
+  JobQueue decoded(_queue_depth), debayered(_queue_depth), encoded(_queue_depth);
+
+  for (JobPtr job : jobs)
+    sources.push(job);
+
+  sources.close();
+  jobs.clear();
+
+  Stage stages[eNumStages] =
+  {
+    { "load",    _threads[eLoadStage],    &sources,   &decoded,   {0} },
+    { "debayer", _threads[eDebayerStage], &decoded,   &debayered, {0} },
+    { "encode",  _threads[eEncodeStage],  &debayered, &encoded,   {0} },
+    { "write",   _threads[eWriteStage],   &encoded,   nullptr,    {0} },
+  };
+
+  auto start_time = std::chrono::steady_clock::now();
+  {
+    ThreadPool load(stages[eLoadStage]._workers, "batch_load");
+    ThreadPool debayer(stages[eDebayerStage]._workers, "batch_dbr");
+    ThreadPool encode(stages[eEncodeStage]._workers, "batch_enc");
+    ThreadPool write(stages[eWriteStage]._workers, "batch_wr");
+
+    start(load, stages[eLoadStage], &BatchConverter::load_worker);
+    start(debayer, stages[eDebayerStage], &BatchConverter::debayer_worker);
+    start(encode, stages[eEncodeStage], &BatchConverter::encode_worker);
+    start(write, stages[eWriteStage], &BatchConverter::write_worker);
+
+    // Pools join on destruction, the last stage finishes last
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+  if (seconds <= 0.0)
+    seconds = 1e-9;
+
+  std::cout << "batch: " << _files << " files (" << _failed << " failed) in " << seconds << " s, "
+            << (_files / seconds) << " files/s, "
+            << (_bytes_in / seconds / (1024.0 * 1024.0)) << " MB/s in, "
+            << (_bytes_out / seconds / (1024.0 * 1024.0)) << " MB/s out" << std::endl;
+
+  return (_failed == 0);
+}
+
+/*
+ * \\fn void BatchConverter::start
+ *
+ * created on: Mar 16, 2020
+ * author: daniel
+ *
+ * The last worker of a stage to finish closes the queue it feeds, which
+ * in turn lets the next stage drain and finish
+ */
+void BatchConverter::start(ThreadPool& pool, Stage& stage, void (BatchConverter::*worker)(Stage&))
+{
+  stage._active = stage._workers;
+  for (size_t index = 0; index < stage._workers; index++)
+  {
+    pool.post([this, &stage, worker]()
+    {
+      (this->*worker)(stage);
+
+      if ((--stage._active == 0) && (stage._out != nullptr))
+        stage._out->close();
+    });
+  }
+}
+
+/*
+ * \\fn void BatchConverter::load_worker
+ *
+ * created on: Mar 16, 2020
+ * author: daniel
+ *
+ */
+void BatchConverter::load_worker(Stage& stage)
+{
+  JobPtr job;
+  while (stage._in->pop(job))
+  {
+    if (job->_sequence)
+      job->_image = job->_sequence->frame(job->_frame);
+    else
+      job->_image = image::RawFile::load(job->_filename.c_str(), true);
+
+    if (!job->_image || (job->_image->width() == 0))
+    {
+      std::cerr << job->_filename << ": unable to load" << std::endl;
+      _failed++;
+      continue;
+    }
+
+    _bytes_in += job->_image->size();
+    stage._out->push(job);
+  }
+}
+
+/*
+ * \\fn void BatchConverter::debayer_worker
+ *
+ * created on: Mar 16, 2020
+ * author: daniel
+ *
+ */
+void BatchConverter::debayer_worker(Stage& stage)
+{
+  // One demosaic context per worker, rebuilt when the frame size changes
+  std::unique_ptr<Debayer> gpu;
+  image::Debayer cpu;
+  size_t width = 0, height = 0;
+
+  JobPtr job;
+  while (stage._in->pop(job))
+  {
+    // Compressed raw keeps the sensor samples, nothing to demosaic
+    if ((job->_image->type() == image::eBayer) && (_format != image::eRawCFA))
+    {
+      image::RawRGBPtr raw = job->_image;
+      if (_cpu)
+        job->_image = cpu.debayer(raw, image::eRGBA);
+      else
+      {
+        if (!gpu || (width != raw->width()) || (height != raw->height()))
+        {
+          width = raw->width();
+          height = raw->height();
+
+          gpu.reset(new Debayer());
+          gpu->init(width, height, 9);
+        }
+        job->_image = gpu->ahd(raw);
+      }
+    }
+
+    if (!job->_image)
+    {
+      std::cerr << job->_filename << ": demosaic failed" << std::endl;
+      _failed++;
+      continue;
+    }
+
+    stage._out->push(job);
+  }
+}
+
+/*
+ * \\fn void BatchConverter::encode_worker
+ *
+ * created on: Mar 16, 2020
+ * author: daniel
+ *
+ */
+void BatchConverter::encode_worker(Stage& stage)
+{
+  JobPtr job;
+  while (stage._in->pop(job))
+  {
+    job->_encoded = image::ImageWriter::encode(job->_image, _format, _options);
+
+    // The encoded image holds on to whatever it still references
+    job->_image.reset();
+    if (!job->_encoded)
+    {
+      std::cerr << job->_filename << ": unable to encode as " << _ext << std::endl;
+      _failed++;
+      continue;
+    }
+
+    stage._out->push(job);
+  }
+}
+
+/*
+ * \\fn void BatchConverter::write_worker
+ *
+ * created on: Mar 16, 2020
+ * author: daniel
+ *
+ */
+void BatchConverter::write_worker(Stage& stage)
+{
+  JobPtr job;
+  while (stage._in->pop(job))
+  {
+    std::string filename = output_name(job->_filename);
+    if (!image::ImageWriter::write(filename.c_str(), *job->_encoded))
+    {
+      std::cerr << filename << ": unable to write" << std::endl;
+      _failed++;
+      continue;
+    }
+
+    _bytes_out += job->_encoded->size();
+    _files++;
+  }
+}
+
+/*
+ * \\fn std::string BatchConverter::output_name
+ *
+ * created on: Mar 16, 2020
+ * author: daniel
+ *
+ */
+std::string BatchConverter::output_name(const std::string& filename) const
+{
+  std::string dir, name = strip_extension(filename);
+
+  size_t slash = name.find_last_of('/');
+  if (slash != std::string::npos)
+  {
+    dir = name.substr(0, slash + 1);
+    name = name.substr(slash + 1);
+  }
+
+  if (!_out_dir.empty())
+  {
+    dir = _out_dir;
+    if (dir.back() != '/')
+      dir += '/';
+  }
+
+  return dir + _prefix + name + "." + _ext;
+}
+
+} /* namespace jupiter */
+} /* namespace brt */
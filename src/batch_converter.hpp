@@ -0,0 +1,122 @@
+/*
+ * batch_converter.hpp
+ *
+ *  Created on: Mar 16, 2020
+ *      Author: daniel
+ */
+
+#ifndef SRC_BATCH_CONVERTER_HPP_
+#define SRC_BATCH_CONVERTER_HPP_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+#include "image.hpp"
+#include "image_writer.hpp"
+#include "raw_sequence.hpp"
+#include "metadata.hpp"
+#include "bounded_queue.hpp"
+#include "thread_pool.hpp"
+
+#define DEFAULT_BATCH_QUEUE_DEPTH           (8)
+#define DEFAULT_BATCH_LOAD_THREADS          (2)
+#define DEFAULT_BATCH_DEBAYER_THREADS       (1)
+#define DEFAULT_BATCH_WRITE_THREADS         (2)
+
+namespace brt
+{
+namespace jupiter
+{
+
+/*
+ * \\class BatchConverter
+ *
+ * created on: Mar 16, 2020
+ *
+ * Headless load -> debayer -> encode -> write pipeline. Every stage
+ * runs its own workers and hands frames to the next one through a
+ * bounded queue, so a slow stage throttles the ones before it instead
+ * of piling frames up in memory. Output order is not preserved.
+ * Sequence files are expanded, every frame is converted on its own.
+ *
+ * Options (from the command line):
+ *   out_dir          output directory, next to the input when empty
+ *   ext              output format, see ImageWriter::format
+ *   rows_per_strip   TIFF strip height, 0 for a single strip
+ *   png_level, png_filter, png_strip_rows, png_threads
+ *                    PNG encoder settings, see ExportOptions
+ *   prefix           prepended to every output file name
+ *   cpu              use the CPU demosaic instead of CUDA
+ *   queue_depth      frames between two stages
+ *   load_threads, debayer_threads, encode_threads, write_threads
+ */
+class BatchConverter
+{
+public:
+  BatchConverter(const Metadata& args);
+  virtual ~BatchConverter();
+
+          bool                    run(const std::vector<std::string>& files);
+
+private:
+  struct Job
+  {
+    std::string                   _filename;
+    image::SequenceReaderPtr      _sequence;
+    size_t                        _frame;
+    image::RawRGBPtr              _image;
+    image::EncodedImagePtr        _encoded;
+  };
+  typedef std::shared_ptr<Job>    JobPtr;
+  typedef BoundedQueue<JobPtr>    JobQueue;
+
+  enum StageId
+  {
+    eLoadStage = 0,
+    eDebayerStage,
+    eEncodeStage,
+    eWriteStage,
+
+    eNumStages
+  };
+
+  struct Stage
+  {
+    const char*                   _name;
+    size_t                        _workers;
+    JobQueue*                     _in;
+    JobQueue*                     _out;
+    std::atomic_size_t            _active;
+  };
+
+          void                    start(ThreadPool& pool, Stage& stage, void (BatchConverter::*worker)(Stage&));
+
+          void                    load_worker(Stage&);
+          void                    debayer_worker(Stage&);
+          void                    encode_worker(Stage&);
+          void                    write_worker(Stage&);
+
+          std::string             output_name(const std::string& filename) const;
+
+private:
+  std::string                     _out_dir;
+  std::string                     _ext;
+  std::string                     _prefix;
+  image::FileFormat               _format;
+  image::ExportOptions            _options;
+  bool                            _cpu;
+  size_t                          _queue_depth;
+  size_t                          _threads[eNumStages];
+
+  std::atomic_size_t              _files;
+  std::atomic_size_t              _failed;
+  std::atomic_size_t              _bytes_in;
+  std::atomic_size_t              _bytes_out;
+};
+
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* SRC_BATCH_CONVERTER_HPP_ */
@@ -9,12 +9,23 @@
 #include <iostream>
 #include <sstream>
 
-#include <glob.h>
-
 #include "utils.hpp"
+#include "dir_enumerator.hpp"
+#include "thread_pool.hpp"
 #include "metadata.hpp"
+#include "page_allocator.hpp"
+#include "image_loader.hpp"
+#include "batch_converter.hpp"
+#include "image_writer.hpp"
+#include "preview_cache.hpp"
+#include "folder_watcher.hpp"
+#include "playback.hpp"
+#include "pipeline.hpp"
+#include "image_processor.hpp"
+#include "raw_file.hpp"
 #include "image_window.hpp"
 #include "window_manager.hpp"
+#include "camera_window.hpp"
 
 #include "debayer.hpp"
 #include "debayer_bilin.hpp"
@@ -22,45 +33,6 @@
 
 using namespace brt::jupiter;
 
-/*
- * \\fn std::vector<std::string> glob
- *
- * created on: Feb 12, 2020, 4:12:48 PM
- * author daniel
- *
- */
-std::vector<std::string> glob(const std::string& pattern)
-{
-  // glob struct resides on the stack
-  glob_t glob_result;
-  memset(&glob_result, 0, sizeof(glob_result));
-
-  // do the glob operation
-  int return_value = glob(pattern.c_str(), GLOB_TILDE, NULL, &glob_result);
-  if (return_value != 0)
-  {
-    globfree(&glob_result);
-    std::stringstream ss;
-    ss << "glob() failed with return_value " << return_value << std::endl;
-    throw std::runtime_error(ss.str());
-  }
-
-  // collect all the filenames into a std::list<std::string>
-  std::vector<std::string> filenames;
-  for (size_t i = 0; i < glob_result.gl_pathc; ++i)
-  {
-    filenames.push_back(std::string(glob_result.gl_pathv[i]));
-  }
-
-  // cleanup
-  globfree(&glob_result);
-
-  // done
-  return filenames;
-}
-
-
-
 // static std::string fn;
 /*
  * \\fn void show_window
@@ -70,13 +42,16 @@ std::vector<std::string> glob(const std::string& pattern)
  *
  */
 void show_window(const std::string& filename,
+                  image::RawRGBPtr raw_image,
                   std::string output_dir,
                   const std::string& ext = "png",
                   bool show = true,
                   const std::string& prefix = "")
 {
   image::RawRGBPtr image;
-  image::RawRGBPtr raw_image(new image::RawRGB(filename.c_str()));
+  if (PageAllocator::huge_pages())
+    std::cout << filename << ": " << PageAllocator::backing_name(raw_image->backing()) << std::endl;
+
   if (raw_image->type() == image::eBayer)
   {
     Debayer db;
@@ -96,6 +71,20 @@ void show_window(const std::string& filename,
   if (!image)
     return;
 
+  if (!output_dir.empty())
+  {
+    size_t slash = filename.find_last_of('/');
+    std::string name = (slash != std::string::npos) ? filename.substr(slash + 1) : filename;
+    name = name.substr(0, name.find_last_of('.'));
+
+    if (output_dir.back() != '/')
+      output_dir += '/';
+
+    std::string out_file = output_dir + prefix + name + "." + ext;
+    if (!image::ImageWriter::save(out_file.c_str(), image, image::ImageWriter::format(ext)))
+      std::cerr << out_file << ": unable to save" << std::endl;
+  }
+
 
   window::ImageWindow* wnd = window::ImageWindow::create(filename.c_str(), nullptr, image);
   if (wnd != nullptr)
@@ -112,6 +101,289 @@ void show_window(const std::string& filename,
 
 }
 
+/*
+ * \\fn void show_previews
+ *
+ * created on: Apr 1, 2020
+ * author: daniel
+ *
+ * Browses the files through the preview cache, misses are built by the
+ * cache's workers ahead of time. Only "f" loads and demosaics the full
+ * resolution image.
+ */
+void show_previews(const std::vector<std::string>& files, const Metadata& meta_args)
+{
+  image::PreviewCache cache(meta_args);
+  cache.prefetch(files);
+
+  size_t min_size = meta_args.get<int>("preview_size",0);
+  for (const std::string& filename : files)
+  {
+    image::RawRGBPtr preview = cache.preview(filename, min_size);
+    if (!preview)
+      preview = cache.build(filename, min_size);
+
+    if (!preview)
+    {
+      std::cerr << filename << ": unable to load" << std::endl;
+      continue;
+    }
+
+    window::ImageWindow* wnd = window::ImageWindow::create(filename.c_str(), nullptr, preview);
+    if (wnd == nullptr)
+      continue;
+
+    wnd->show();
+    std::cout << '\n' << filename << ": Enter for the next file, f for full resolution...";
+
+    std::string line;
+    std::getline(std::cin, line);
+    wnd->close();
+
+    if (line == "f")
+    {
+      image::RawRGBPtr raw_image = image::RawFile::load(filename.c_str());
+      if (raw_image)
+        show_window(filename, raw_image, "");
+    }
+  }
+}
+
+/*
+ * \\fn Metadata debayer_options
+ *
+ * created on: Apr 15, 2020
+ * author: daniel
+ *
+ * A display only cares for the newest frame, --policy=block keeps them all
+ */
+Metadata debayer_options(const Metadata& meta_args)
+{
+  Metadata options;
+  options.set("policy", meta_args.get<std::string>("policy","latest").c_str());
+  options.set<int>("queue_depth", meta_args.get<int>("queue_depth",DEFAULT_CONSUMER_QUEUE_DEPTH));
+  options.set<int>("sample", meta_args.get<int>("sample",1));
+
+  return options;
+}
+
+/*
+ * \\fn void watch_folder
+ *
+ * created on: Apr 6, 2020
+ * author: daniel
+ *
+ * Shows every raw file landing in dir until Enter is pressed
+ */
+void watch_folder(const std::string& dir, const Metadata& meta_args)
+{
+  image::FolderWatcher watcher(dir, meta_args);
+  image::ImageProcessor processor;
+  // The debayer runs on its own thread, a slow frame doesn't hold up the watch
+  watcher.register_consumer(&processor, debayer_options(meta_args));
+
+  window::CameraWindow* wnd = window::CameraWindow::create(dir.c_str(), nullptr,
+                                    meta_args.get<int>("width",1280), meta_args.get<int>("height",720));
+  if (wnd == nullptr)
+    return;
+
+  wnd->show();
+  wnd->add_subwnd(&processor);
+
+  if (watcher.start())
+  {
+    std::cout << '\n' << "Watching " << dir << ", press Enter to stop...";
+    std::cin.get();
+  }
+
+  watcher.stop();
+  image::ConsumerStats debayer = watcher.consumer_stats(&processor);
+  std::cout << dir << ": " << watcher.delivered() << " shown, " << watcher.dropped() << " dropped, "
+            << watcher.failed() << " failed, " << debayer._dropped << " dropped by the debayer ("
+            << image::ImageProducer::policy_name(debayer._policy) << ")" << std::endl;
+
+  // Drains the debayer queue while the processor is still around
+  watcher.unregister_consumer(&processor);
+
+  wnd->close();
+}
+
+/*
+ * \\fn void play_files
+ *
+ * created on: Apr 8, 2020
+ * author: daniel
+ *
+ * Plays the files at --fps through the debayer into a CameraWindow
+ */
+void play_files(const std::vector<std::string>& files, const Metadata& meta_args)
+{
+  image::PlaybackProducer player(files, meta_args);
+  image::ImageProcessor processor;
+  player.register_consumer(&processor, debayer_options(meta_args));
+
+  window::CameraWindow* wnd = window::CameraWindow::create("playback", nullptr,
+                                    meta_args.get<int>("width",1280), meta_args.get<int>("height",720));
+  if (wnd == nullptr)
+    return;
+
+  wnd->show();
+  wnd->add_subwnd(&processor);
+
+  if (player.start())
+  {
+    std::cout << '\n' << "Playing " << player.size() << " frames at " << 1.0 / player.period() << " fps..." << std::endl;
+    player.wait();
+  }
+
+  image::PlaybackStats stats = player.stats();
+  image::ConsumerStats debayer = player.consumer_stats(&processor);
+  std::cout << "playback: " << stats._frames << " frames, " << stats._dropped << " dropped, "
+            << debayer._delivered << " debayered (" << debayer._dropped << " dropped), "
+            << Utils::string_format("%.2f fps, late %.0f us (jitter %.0f us, max %.0f us)",
+                  stats._fps, stats._late_us, stats._jitter_us, stats._max_late_us) << std::endl;
+
+  player.unregister_consumer(&processor);
+
+  wnd->close();
+}
+
+/*
+ * \\class WindowStage
+ *
+ * created on: Apr 17, 2020
+ *
+ * Pipeline sink showing its upstream in a tile of a CameraWindow
+ */
+class WindowStage : public image::PipelineStage
+{
+public:
+  WindowStage(window::CameraWindow* wnd) : _wnd(wnd), _closed(false) {}
+  virtual ~WindowStage() { stop(); }
+
+  virtual image::ImageConsumer*   consumer() { return _wnd; }
+
+  virtual void                    attach(image::ImageProducer* upstream, const Metadata& edge)
+  {
+    Metadata tile(edge);
+    upstream->register_consumer(_wnd, tile.set("id",_wnd->add_subwnd(nullptr)));
+  }
+
+  // A display only cares for the newest frame
+  virtual Metadata                edge_defaults() const { return Metadata("policy=latest"); }
+
+  virtual void                    stop()
+  {
+    if (!_closed)
+      _wnd->close();
+
+    _closed = true;
+  }
+
+private:
+  window::CameraWindow*           _wnd;
+  bool                            _closed;
+};
+
+/*
+ * \\fn void run_pipeline
+ *
+ * created on: Apr 17, 2020
+ * author: daniel
+ *
+ * Builds the --pipeline description, sink=window[:title] adds a window
+ * to the stages brt_common knows
+ */
+void run_pipeline(const std::string& description, const Metadata& meta_args)
+{
+  int width = meta_args.get<int>("width",1280);
+  int height = meta_args.get<int>("height",720);
+  image::Pipeline::register_stage("sink", "window", [width, height](const std::string& arg, const Metadata& options)
+  {
+    window::CameraWindow* wnd = window::CameraWindow::create(arg.empty() ? "pipeline" : arg.c_str(), nullptr,
+                                    options.get<int>("width",width), options.get<int>("height",height));
+    if (wnd == nullptr)
+      return image::PipelineStagePtr();
+
+    wnd->show();
+    return image::PipelineStagePtr(new WindowStage(wnd));
+  });
+
+  image::Pipeline pipeline;
+  if (pipeline.build(description) && pipeline.start())
+  {
+    if (pipeline.endless())
+    {
+      std::cout << '\n' << "Running, press Enter to stop...";
+      std::cin.get();
+    }
+    else
+      pipeline.wait();
+  }
+  else
+  {
+    std::string types;
+    for (const std::string& type : image::Pipeline::stage_types())
+      types += " " + type;
+
+    std::cerr << "pipeline: stages are" << types << std::endl;
+  }
+
+  pipeline.stop();
+  std::cout << pipeline.report();
+}
+
+/*
+ * \\fn std::vector<std::string> list_files
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ * Every pattern is sorted on its own, the patterns keep their order
+ */
+std::vector<std::string> list_files(const std::vector<std::string>& patterns, SortOrder order)
+{
+  std::vector<std::string> files;
+  for (const std::string& pattern : patterns)
+  {
+    std::vector<std::string> matches = DirEnumerator::list(pattern, order);
+    if (matches.empty())
+      std::cerr << pattern << ": no match" << std::endl;
+
+    files.insert(files.end(), matches.begin(), matches.end());
+  }
+
+  return files;
+}
+
+/*
+ * \\fn void feed_files
+ *
+ * created on: Apr 20, 2020
+ * author: daniel
+ *
+ * Unsorted input goes to the loader match by match, the first file is
+ * loading while the directory walk is still running
+ */
+void feed_files(const std::vector<std::string>& patterns, image::ImageLoader& loader)
+{
+  for (const std::string& pattern : patterns)
+  {
+    size_t matches = 0;
+    DirEnumerator::enumerate(pattern, [&loader, &matches](const std::string& file)
+    {
+      loader.add(file);
+      matches++;
+      return true;
+    });
+
+    if (matches == 0)
+      std::cerr << pattern << ": no match" << std::endl;
+  }
+
+  loader.close();
+}
+
 /*
  * \\fn int main
  *
@@ -121,29 +393,81 @@ void show_window(const std::string& filename,
  */
 int main(int argc,char** argv)
 {
-  wm::get()->init();
-
   Metadata meta_args;
   meta_args.parse(argc,argv);
+  PageAllocator::set_huge_pages(meta_args.get<bool>("huge_pages",false));
 
   size_t num_images = meta_args.size("<default>");
 
+  SortOrder order = DirEnumerator::sort_order(meta_args.get<std::string>("sort","natural"));
+  std::vector<std::string> patterns;
+  for (size_t index = 0; index < num_images; index++)
+    patterns.push_back(meta_args.get_at<std::string>("<default>", index));
+
+  // Headless conversion never touches X or stdin
+  if (meta_args.get<bool>("batch",false))
+  {
+    BatchConverter converter(meta_args);
+    return converter.run(list_files(patterns, order)) ? 0 : 1;
+  }
+
+  wm::get()->init();
   std::cin.get();
 
-  for (size_t index = 0; index < num_images; index++)
+  if (meta_args.exist("pipeline"))
   {
-    std::string path = meta_args.get_at<std::string>("<default>", index);
-    std::vector<std::string> files = glob(path);
+    run_pipeline(meta_args.get<std::string>("pipeline",""), meta_args);
+    wm::get()->release();
+    return 0;
+  }
 
-    for (auto filename : files)
-    {
-      show_window(filename,
-              meta_args.get<std::string>("out_dir",""),
-              meta_args.get<std::string>("ext","png"),
-              meta_args.get<bool>("show",false),
-              meta_args.get<std::string>("prefix",""));
-      //break;
-    }
+  if (meta_args.exist("watch"))
+  {
+    watch_folder(meta_args.get<std::string>("watch",""), meta_args);
+    wm::get()->release();
+    return 0;
+  }
+
+  if (meta_args.get<bool>("play",false))
+  {
+    play_files(list_files(patterns, order), meta_args);
+    wm::get()->release();
+    return 0;
+  }
+
+  if (meta_args.get<bool>("preview",false))
+  {
+    show_previews(list_files(patterns, order), meta_args);
+    wm::get()->release();
+    return 0;
+  }
+
+  // Files are read ahead on a background pool while the current one is processed
+  size_t prefetch = meta_args.get<int>("prefetch",DEFAULT_PREFETCH_DEPTH);
+  size_t io_threads = meta_args.get<int>("io_threads",DEFAULT_IO_THREADS);
+  bool uring = meta_args.get<bool>("uring",false);
+
+  // Sorting needs the whole listing, without it the loader is fed as matches come in
+  std::unique_ptr<image::ImageLoader> loader;
+  ThreadPool feeder(1, "enumerate");
+  if (order == eSortNone)
+  {
+    loader.reset(new image::ImageLoader(prefetch, io_threads, uring));
+    image::ImageLoader* fed = loader.get();
+    feeder.post([patterns, fed]() { feed_files(patterns, *fed); });
+  }
+  else
+    loader.reset(new image::ImageLoader(list_files(patterns, order), prefetch, io_threads, uring));
+
+  std::string filename;
+  image::RawRGBPtr raw_image;
+  while (loader->next(filename, raw_image))
+  {
+    show_window(filename, raw_image,
+            meta_args.get<std::string>("out_dir",""),
+            meta_args.get<std::string>("ext","png"),
+            meta_args.get<bool>("show",false),
+            meta_args.get<std::string>("prefix",""));
   }
 
   wm::get()->release();
@@ -7,13 +7,13 @@
 
 #include "camera_window.hpp"
 #include "window_manager.hpp"
+#include "gl_format.hpp"
 // #include "cuda_debayering.h"
 
 #include <iostream>
 #include <algorithm>
 #include <chrono>
 #include <cmath>
-#include <fstream>
 
 #include <utils.hpp>
 #include <cuda_utils.hpp>
@@ -398,16 +398,11 @@ void CameraWindow::show_video(Context context,LShowImageEvent* evt)
   if (!wnd._image)
     return;
 
+  // The frame is only queued here, the writer thread does the disk I/O
   if (_click.load() == static_cast<int>(evt->_id))
   {
     std::string file_name = Utils::string_format("image_%04d_%04d.raw", evt->_id, _global_number++);
-    uint32_t w = wnd._image->width(), h = wnd._image->height(), bytes = 2 /* RAW12*/;
-    std::ofstream raw_file (file_name, std::ios::out | std::ios::binary);
-    raw_file.write(reinterpret_cast<const char*>(&w), sizeof(w));
-    raw_file.write(reinterpret_cast<const char*>(&h), sizeof(h));
-    raw_file.write(reinterpret_cast<const char*>(&bytes), sizeof(bytes));
-
-    raw_file.write(reinterpret_cast<const char*>(wnd._image->bytes()),w * h * bytes);
+    _capture.submit(file_name, wnd._image);
 
     _click.store(-1);
   }
@@ -417,7 +412,8 @@ void CameraWindow::show_video(Context context,LShowImageEvent* evt)
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB,  wnd._image->width(), wnd._image->height(), 0, GL_RGB, GL_UNSIGNED_SHORT, wnd._image->bytes());
+  glTexImage2D(GL_TEXTURE_2D, 0, wnd._image->is_float() ? GL_RGB16F : GL_RGB,  wnd._image->width(), wnd._image->height(), 0,
+                gl_pixel_format(*wnd._image), gl_data_type(*wnd._image), wnd._image->cbytes());
 
   glEnable(GL_TEXTURE_2D);
   glBindTexture(GL_TEXTURE_2D, _texture);
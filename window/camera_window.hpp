@@ -19,6 +19,7 @@
 
 #include "image.hpp"
 #include "image_processor.hpp"
+#include "capture_writer.hpp"
 
 namespace brt
 {
@@ -87,6 +88,7 @@ private:
   std::vector<GLWindow>           _gl_map;
   std::atomic_int_fast32_t        _click;
   uint32_t                        _global_number;
+  image::CaptureWriter            _capture;
 
   XVisualInfo*                    _vi;
   XFontStruct*                    _font;
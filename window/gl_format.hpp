@@ -0,0 +1,112 @@
+/*
+ * gl_format.hpp
+ *
+ *  Created on: Feb 26, 2020
+ *      Author: daniel
+ */
+
+#ifndef WINDOW_GL_FORMAT_HPP_
+#define WINDOW_GL_FORMAT_HPP_
+
+#include <GL/gl.h>
+
+#include "image.hpp"
+
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT                       (0x140B)
+#endif
+
+#ifndef GL_RGBA16F
+#define GL_RGBA16F                          (0x881A)
+#endif
+
+#ifndef GL_RGB16F
+#define GL_RGB16F                           (0x881B)
+#endif
+
+#ifndef GL_BGR
+#define GL_BGR                              (0x80E0)
+#endif
+
+#ifndef GL_BGRA
+#define GL_BGRA                             (0x80E1)
+#endif
+
+namespace brt
+{
+namespace jupiter
+{
+namespace window
+{
+
+/*
+ * \\fn GLenum gl_data_type
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+inline GLenum gl_data_type(const image::RawRGB& img)
+{
+  switch (img.format())
+  {
+  case image::eFloat:
+    return GL_FLOAT;
+
+  case image::eHalf:
+    return GL_HALF_FLOAT;
+
+  default:
+    break;
+  }
+
+  switch (BYTES_PER_PIXELS(img.depth()))
+  {
+  case 1:
+    return GL_UNSIGNED_BYTE;
+
+  case 4:
+    return GL_UNSIGNED_INT;
+
+  default:
+    break;
+  }
+
+  return GL_UNSIGNED_SHORT;
+}
+
+/*
+ * \\fn GLenum gl_pixel_format
+ *
+ * created on: Feb 26, 2020
+ * author: daniel
+ *
+ */
+inline GLenum gl_pixel_format(const image::RawRGB& img)
+{
+  switch (img.type())
+  {
+  case image::eRGB:
+    return GL_RGB;
+
+  case image::eBGR:
+    return GL_BGR;
+
+  case image::eBGRA:
+    return GL_BGRA;
+
+  case image::eBayer:
+    return GL_LUMINANCE;
+
+  default:
+    break;
+  }
+
+  return GL_RGBA;
+}
+
+} /* namespace window */
+} /* namespace jupiter */
+} /* namespace brt */
+
+#endif /* WINDOW_GL_FORMAT_HPP_ */
@@ -7,9 +7,8 @@
 
 #include "image_list_window.hpp"
 
-#include <fstream>
-
 #include <image_processor.hpp>
+#include <raw_file.hpp>
 
 namespace brt
 {
@@ -81,42 +80,12 @@ bool ImageListWindow::next_image()
   image::RawRGBPtr image;
   while(!image && (_index < _files.size()))
   {
-    try
+    image = image::RawFile::load(_files[_index].c_str());
+    if (image && (image->type() == image::eBayer))
     {
-      std::ifstream raw_file (_files[_index], std::ios::binary);
-      if (!raw_file.is_open())
-        throw 1;
-
-      raw_file.seekg(0, std::ios::end);
-      size_t file_size = raw_file.tellg();
-      raw_file.seekg(0, std::ios::beg);
-
-      if (file_size < sizeof(uint32_t) * 3)
-        throw 1;
-
-      bool rgb = false;
-
-      uint32_t width,height,numbytes;
-      raw_file.read(reinterpret_cast<char*>(&width), sizeof(uint32_t));
-      raw_file.read(reinterpret_cast<char*>(&height), sizeof(uint32_t));
-      raw_file.read(reinterpret_cast<char*>(&numbytes), sizeof(uint32_t));
-
-      if (file_size >= (width * height * numbytes * image::eRGBA))
-        rgb = true;
-      else if (file_size < (width * height * numbytes))
-        throw 1;
-
-      image.reset(new image::RawRGB(width,height,16, rgb ? image::eRGBA : image::eBayer));
-      raw_file.read(reinterpret_cast<char*>(image->bytes()),image->size());
-
-      if (image->type() == image::eBayer)
-      {
-        image::Debayer db;
-        image = db.debayer(image);
-      }
+      image::Debayer db;
+      image = db.debayer(image, image::eRGBA);
     }
-    catch(...)
-    {   }
 
     _index++;
   }
@@ -7,6 +7,7 @@
 
 #include "image_window.hpp"
 #include "window_manager.hpp"
+#include "gl_format.hpp"
 
 namespace brt
 {
@@ -25,7 +26,7 @@ namespace window
 ImageWindow::ImageWindow(const char* title, int x, int y,
     image::RawRGBPtr bits, Window* parent)
 : Window(title, x, y, bits->width(), bits->height(), parent)
-, _bits(bits)
+, _bits(bits->share())
 , _actual_width(bits->width())
 , _actual_height(bits->height())
 , _vi(nullptr)
@@ -135,13 +136,18 @@ void ImageWindow::show_img(Context ctx)
 
   if (display(ctx)._dt == eLocalDisplay)
   {
+    // Planar images can't be uploaded as one texture
+    if (_bits->planar())
+      _bits = _bits->to_interleaved(_bits->planes() == 4 ? image::eRGBA : image::eRGB);
+
     glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_DECAL);
     glBindTexture(GL_TEXTURE_2D, _texture);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,  _bits->width(), _bits->height(), 0, GL_RGBA, GL_UNSIGNED_SHORT, _bits->bytes());
+    glTexImage2D(GL_TEXTURE_2D, 0, _bits->is_float() ? GL_RGBA16F : GL_RGBA,  _bits->width(), _bits->height(), 0,
+                  gl_pixel_format(*_bits), gl_data_type(*_bits), _bits->cbytes());
 
     glEnable(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, _texture);
@@ -224,7 +230,7 @@ void ImageWindow::show_img(Context ctx)
     Display* dsp = x11_display(ctx);
     if (_vi != nullptr)
     {
-      XImage *ximage = XCreateImage(dsp, _vi->visual, 24, ZPixmap, 0,reinterpret_cast<char*>(_bits->bytes()), _bits->width(), _bits->height(), 8, 0);
+      XImage *ximage = XCreateImage(dsp, _vi->visual, 24, ZPixmap, 0,reinterpret_cast<char*>(const_cast<uint8_t*>(_bits->cbytes())), _bits->width(), _bits->height(), 8, 0);
       XPutImage(dsp, handle(), _gc, ximage, 0, 0, 0, 0, _actual_width, _actual_height);
     }
   }
@@ -318,8 +324,9 @@ void ImageWindow::pre_create_window(Context context)
   }
   else
   {
+    // The window's own handle, converted in place unless the caller still shares it
     if (_bits->depth() > 8)
-      _bits = _bits->clone(8);
+      _bits->narrow(8);
 
     XVisualInfo visual_template;
     int nxvisuals = 0;